@@ -0,0 +1,246 @@
+#include <getopt.h>
+#include <sched.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "alloc-guard.h"
+#include "block-pool.h"
+#include "capture-clock.h"
+#include "capture-log.h"
+#include "mock-capture.h"
+#include "pcm-pipe-sink.h"
+
+// Fails when the capture -> process -> sink path allocates once warmed up.
+//
+// The path is the one the examples run, on a mock device (mock-capture.h)
+// so it needs no hardware: a capture thread fills blocks from a
+// block-pool.h pool, a process thread measures them and dates them
+// (capture-clock.h), and a sink thread writes them to a pipe
+// (pcm-pipe-sink.h), to a capture log (capture-log.h) and prints a status
+// line with fprintf, then returns them to the pool. alloc-guard.h replaces
+// malloc: after the warm-up, when every stage has run at least once and
+// stdio has its buffers, the guard is armed and any allocation in any
+// thread makes the check fail. Page faults in the same window are
+// reported too.
+//
+//   --allocate   the process stage copies each block into a std::vector,
+//                to see the check fail
+//
+// g++ -O2 alloc-free-check.cc -o alloc-free-check -lm -std=c++11 -lpthread
+// ./alloc-free-check && echo allocation free
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define POOL_BLOCKS 32
+#define WARMUP_BLOCKS 64
+#define STATUS_EVERY 100
+
+static block_pool pool;
+static block_queue to_process, to_sink;
+static std::atomic<uint64_t> sunk(0);
+static uint32_t block_frames = 256;
+static bool allocate = false, paced = false;
+
+struct level_stats {
+  double peak, sum_squares;
+  uint64_t samples;
+};
+
+static void capture(mock_capture *m, uint64_t blocks) {
+  uint64_t pushed = 0;
+  for (uint64_t i = 0; i < blocks; i++) {
+    if (i == WARMUP_BLOCKS) {
+      /* Everything downstream has handled its blocks: arm. */
+      while (sunk.load() < pushed) {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+      }
+      alloc_guard_arm();
+    }
+    uint8_t *b = block_pool_get(&pool);
+    if (!b && !paced) {
+      /* No device to overrun: wait for the pipeline. */
+      sched_yield();
+      i--;
+      continue;
+    }
+    if (!b) {
+      /* Everyone is behind: drop what the device has for us. */
+      int16_t discard[256 * CHANNELS];
+      int64_t ns;
+      mock_capture_read(m, discard, block_frames < 256 ? block_frames : 256, &ns);
+      continue;
+    }
+    int64_t capture_ns;
+    if (mock_capture_read(m, b, block_frames, &capture_ns) != (long) block_frames ||
+        !block_queue_push(&to_process, b, block_frames, capture_ns))
+      block_pool_put(&pool, b);
+    else
+      pushed++;
+  }
+  block_queue_close(&to_process);
+}
+
+static void process(level_stats *stats) {
+  capture_clock clock;
+  capture_clock_init(&clock, SAMPLE_RATE, CAPTURE_CLOCK_TAU_SEC);
+  uint64_t position = 0;
+  block_ref r;
+  while (block_queue_pop(&to_process, &r, -1)) {
+    const int16_t *s = (const int16_t*) r.data;
+    uint32_t n = r.frames * CHANNELS;
+    if (allocate) {
+      std::vector<int16_t> copy(s, s + n);
+      stats->samples += copy.size() - n;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      double x = s[i] / 32768.0;
+      stats->sum_squares += x * x;
+      if (fabs(x) > stats->peak)
+        stats->peak = fabs(x);
+    }
+    stats->samples += n;
+    r.capture_ns = capture_clock_update(&clock, position, r.capture_ns);
+    position += r.frames;
+    if (!block_queue_push(&to_sink, r.data, r.frames, r.capture_ns)) {
+      block_pool_put(&pool, r.data);
+      sunk.fetch_add(1);  /* accounted for, if not written */
+    }
+  }
+  block_queue_close(&to_sink);
+}
+
+static void sink(pcm_pipe_sink *pipe_sink, capture_log *log, FILE *status) {
+  block_ref r;
+  uint64_t blocks = 0;
+  while (block_queue_pop(&to_sink, &r, -1)) {
+    size_t bytes = (size_t) r.frames * CHANNELS * sizeof(int16_t);
+    pcm_pipe_sink_push(pipe_sink, r.data, bytes);
+    pcm_pipe_sink_flush(pipe_sink);  /* never waits: a slow reader costs frames */
+    int64_t now = capture_log_monotonic_ns();
+    capture_log_block(log, r.data, r.frames, now, now, r.capture_ns);
+    if (blocks++ % STATUS_EVERY == 0)
+      fprintf(status, "block %lu captured at %ld.%06ld, %.1f ms ago\n", (unsigned long) blocks,
+              (long) (r.capture_ns / 1000000000LL), (long) (r.capture_ns % 1000000000LL / 1000),
+              (now - r.capture_ns) / 1e6);
+    block_pool_put(&pool, r.data);
+    sunk.fetch_add(1);
+  }
+}
+
+static void drain(int fd) {
+  static uint8_t buffer[65536];
+  while (read(fd, buffer, sizeof(buffer)) > 0) {
+  }
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  -b, --blocks=N    blocks to capture after the warm-up (default 20000)\n"
+          "  -f, --frames=N    frames per block (default 256)\n"
+          "  -p, --paced       capture in real time instead of as fast as possible\n"
+          "  -l, --lock        mlock() the pool\n"
+          "      --allocate    allocate in the process stage (the check must fail)\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t blocks = 20000;
+  bool lock = false;
+  int c;
+  static const struct option long_options[] = {
+      {"blocks",   1, NULL, 'b'},
+      {"frames",   1, NULL, 'f'},
+      {"paced",    0, NULL, 'p'},
+      {"lock",     0, NULL, 'l'},
+      {"allocate", 0, NULL, 'a'},
+      {"help",     0, NULL, 'h'},
+      {NULL,       0, NULL, 0}
+  };
+  while ((c = getopt_long(argc, argv, "b:f:plh", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'b': blocks = strtoull(optarg, NULL, 10); break;
+      case 'f': block_frames = (uint32_t) atoi(optarg); break;
+      case 'p': paced = true; break;
+      case 'l': lock = true; break;
+      case 'a': allocate = true; break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (!block_frames || !blocks) {
+    help(argv[0]);
+    return 1;
+  }
+
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, SAMPLE_RATE, CHANNELS, MOCK_S16);
+  cfg.noise_amp = 0.01f;
+  cfg.speed = paced ? 1 : 0;
+  cfg.buffer_frames = block_frames * POOL_BLOCKS * 2;
+  static mock_capture m;
+  mock_capture_open(&m, &cfg);
+
+  int fds[2];
+  static pcm_pipe_sink pipe_sink;
+  static capture_log log;
+  FILE *status = fopen("/dev/null", "w");
+  if (pipe(fds) < 0 || !status ||
+      block_pool_init(&pool, POOL_BLOCKS, block_frames * CHANNELS * sizeof(int16_t), lock) < 0 ||
+      !block_queue_init(&to_process, POOL_BLOCKS) || !block_queue_init(&to_sink, POOL_BLOCKS) ||
+      pcm_pipe_sink_open(&pipe_sink, fds[1], 1 << 20, CHANNELS * sizeof(int16_t)) < 0 ||
+      capture_log_open(&log, "/dev/null", CAPTURE_LOG_S16LE, SAMPLE_RATE, CHANNELS, "mock") < 0) {
+    perror("setup");
+    return 1;
+  }
+
+  level_stats stats;
+  memset(&stats, 0, sizeof(stats));
+  std::thread reader(drain, fds[0]);
+  std::thread sink_thread(sink, &pipe_sink, &log, status);
+  std::thread process_thread(process, &stats);
+  int64_t start = mock_monotonic_ns();
+  capture(&m, blocks + WARMUP_BLOCKS);
+  process_thread.join();
+  sink_thread.join();
+  alloc_guard_disarm();
+  double seconds = (mock_monotonic_ns() - start) / 1e9;
+
+  pcm_pipe_sink_close(&pipe_sink);
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+  capture_log_close(&log);
+  fclose(status);
+
+  fprintf(stdout, "%lu blocks of %u frames in %.2f s (%.0fx real time), peak %.3f, rms %.4f\n",
+          (unsigned long) sunk.load(), block_frames, seconds,
+          (double) sunk.load() * block_frames / SAMPLE_RATE / seconds, stats.peak,
+          stats.samples ? sqrt(stats.sum_squares / stats.samples) : 0.0);
+  block_pool_print_stats(&pool, stdout);
+  fprintf(stdout, "queues: process %lu deep at most, sink %lu, %lu + %lu full\n",
+          (unsigned long) to_process.max_depth, (unsigned long) to_sink.max_depth,
+          (unsigned long) to_process.full, (unsigned long) to_sink.full);
+  pcm_pipe_sink_print_stats(&pipe_sink, stdout);
+  fprintf(stdout, "steady state: ");
+  uint64_t allocations = alloc_guard_report(stdout);
+  block_queue_free(&to_process);
+  block_queue_free(&to_sink);
+  block_pool_free(&pool);
+  if (allocations) {
+    fprintf(stdout, "FAIL: the hot path allocated\n");
+    return 1;
+  }
+  fprintf(stdout, "OK\n");
+  return 0;
+}
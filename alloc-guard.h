@@ -0,0 +1,138 @@
+/*
+  Counts heap allocations while armed, to prove a hot path allocates
+  nothing.
+
+  Including this header replaces malloc, calloc, realloc, free and the
+  aligned allocators of the whole program (operator new goes through
+  malloc in libstdc++), forwarding to glibc's __libc_* entry points. While
+  armed, every allocation in any thread is counted, and the first one's
+  caller is remembered so it can be looked up:
+
+    addr2line -f -C -e ./program <address>
+
+  Page faults in the same window come from getrusage(): a steady state
+  that allocates nothing but still faults is touching memory for the
+  first time.
+
+    alloc_guard_arm();
+    ...steady state...
+    alloc_guard_disarm();
+    alloc_guard_report(stdout);   // 0 when nothing was allocated
+
+  Include it in exactly one translation unit of a test program, never in
+  a library. glibc only, C++11.
+*/
+#ifndef ALLOC_GUARD_H_
+#define ALLOC_GUARD_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <atomic>
+
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void*, size_t);
+void *__libc_memalign(size_t, size_t);
+void __libc_free(void*);
+}
+
+struct alloc_guard_state {
+  std::atomic<bool> armed;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uintptr_t> first_caller;
+  long minor_faults, major_faults;   /* at arm, then the difference at disarm */
+};
+
+static alloc_guard_state alloc_guard;
+
+static inline void alloc_guard_note(size_t size, void *caller) {
+  if (!alloc_guard.armed.load(std::memory_order_relaxed))
+    return;
+  if (alloc_guard.allocations.fetch_add(1, std::memory_order_relaxed) == 0)
+    alloc_guard.first_caller.store((uintptr_t) caller, std::memory_order_relaxed);
+  alloc_guard.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+  alloc_guard_note(size, __builtin_return_address(0));
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  alloc_guard_note(n * size, __builtin_return_address(0));
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+  alloc_guard_note(size, __builtin_return_address(0));
+  return __libc_realloc(p, size);
+}
+
+void free(void *p) {
+  __libc_free(p);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  alloc_guard_note(size, __builtin_return_address(0));
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  alloc_guard_note(size, __builtin_return_address(0));
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+  alloc_guard_note(size, __builtin_return_address(0));
+  void *p = __libc_memalign(alignment, size);
+  if (!p)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+}  // extern "C"
+
+static inline void alloc_guard_faults(long *minor, long *major) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  *minor = ru.ru_minflt;
+  *major = ru.ru_majflt;
+}
+
+static inline void alloc_guard_arm() {
+  alloc_guard.allocations.store(0);
+  alloc_guard.bytes.store(0);
+  alloc_guard.first_caller.store(0);
+  alloc_guard_faults(&alloc_guard.minor_faults, &alloc_guard.major_faults);
+  alloc_guard.armed.store(true, std::memory_order_release);
+}
+
+static inline void alloc_guard_disarm() {
+  alloc_guard.armed.store(false, std::memory_order_release);
+  long minor, major;
+  alloc_guard_faults(&minor, &major);
+  alloc_guard.minor_faults = minor - alloc_guard.minor_faults;
+  alloc_guard.major_faults = major - alloc_guard.major_faults;
+}
+
+/* Returns the number of allocations while armed. */
+static inline uint64_t alloc_guard_report(FILE *out) {
+  uint64_t n = alloc_guard.allocations.load();
+  fprintf(out, "%lu allocations (%lu bytes), %ld minor / %ld major page faults",
+          (unsigned long) n, (unsigned long) alloc_guard.bytes.load(), alloc_guard.minor_faults,
+          alloc_guard.major_faults);
+  if (n)
+    fprintf(out, ", first from %p", (void*) alloc_guard.first_caller.load());
+  fprintf(out, "\n");
+  return n;
+}
+
+#endif  // ALLOC_GUARD_H_
@@ -0,0 +1,332 @@
+/*
+  A Hotplug-aware Capture Program
+
+  Same capture loop as alsa-record-example.cc, but a device that
+  disappears (USB mic brown-out, cable pulled) does not end the program.
+  The capture handle is closed, and the program waits on udev netlink
+  events for the capture node of the same card to come back. There is
+  no rescan polling: the only wake-ups while detached are udev events
+  and the signal check timeout.
+
+  A read error while the card is still there (a stalled driver, an
+  -EIO that is not an unplug) sends no udev event, so that case is a
+  bounded reopen of the same device instead; only when the card has gone
+  does the program wait on udev.
+
+  The card identity is taken from the control interface when the device
+  is first opened (id, longname and components). The longname of a USB
+  card contains its port path, so a returning mic is matched even when
+  it comes back with a different card index, and a second mic of the
+  same model on another port is not mistaken for it.
+
+  The time spent detached is recorded as a gap in frames.
+
+  sudo apt-get install libasound2-dev libudev-dev
+  g++ alsa-hotplug-record-example.cc -I/usr/include/  -o alsa-hotplug-record-example -lm -ldl -lasound -ludev
+  ./alsa-hotplug-record-example plughw:1,0
+*/
+
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <alsa/asoundlib.h>
+#include <libudev.h>
+
+/* Upper bound on how long a returning device may keep failing to open
+   (busy, permissions not applied yet) after its udev event. */
+#define REATTACH_TIMEOUT_MS 800
+#define REATTACH_RETRY_MS 20
+#define SIGNAL_CHECK_MS 500
+/* Reopens of a card that is still present before giving up. */
+#define REOPEN_ATTEMPTS 5
+#define REOPEN_RETRY_MS 200
+
+static bool running = true;
+static snd_pcm_t* capture_handle = NULL;
+/* The rate the device granted, which set_rate_near may move. */
+static unsigned int capture_rate = 0;
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+/* What makes a card "the same card" across unplug/replug. */
+struct card_identity {
+  std::string id;
+  std::string longname;
+  std::string components;
+  int card;
+  int device;
+  bool plug;
+};
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool card_info_by_index(int card, card_identity *out) {
+  char name[32];
+  snd_ctl_t *ctl;
+  snd_ctl_card_info_t *info;
+
+  snd_ctl_card_info_alloca(&info);
+  snprintf(name, sizeof(name), "hw:%d", card);
+  if (snd_ctl_open(&ctl, name, 0) < 0)
+    return false;
+  if (snd_ctl_card_info(ctl, info) < 0) {
+    snd_ctl_close(ctl);
+    return false;
+  }
+  out->id = snd_ctl_card_info_get_id(info);
+  out->longname = snd_ctl_card_info_get_longname(info);
+  out->components = snd_ctl_card_info_get_components(info);
+  snd_ctl_close(ctl);
+  return true;
+}
+
+static bool same_card(const card_identity &a, const card_identity &b) {
+  return a.longname == b.longname && a.components == b.components;
+}
+
+/* Like snd_param_init in alsa-record-example.cc, but failures are
+   returned instead of exiting, since a device can vanish between the
+   udev event and any of these calls. */
+int snd_param_open(snd_pcm_t **capture_handle,
+                   const char* name,
+                   unsigned int rate,
+                   snd_pcm_format_t format) {
+  int err;
+  snd_pcm_hw_params_t *hw_params;
+
+  if ((err = snd_pcm_open (capture_handle, name, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+    fprintf (stderr, "cannot open audio device %s (%s)\n",
+             name,
+             snd_strerror (err));
+    return err;
+  }
+
+  snd_pcm_hw_params_alloca(&hw_params);
+
+  if ((err = snd_pcm_hw_params_any (*capture_handle, hw_params)) < 0 ||
+      (err = snd_pcm_hw_params_set_access (*capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+      (err = snd_pcm_hw_params_set_format (*capture_handle, hw_params, format)) < 0 ||
+      (err = snd_pcm_hw_params_set_rate_near (*capture_handle, hw_params, &rate, 0)) < 0 ||
+      (err = snd_pcm_hw_params_set_channels (*capture_handle, hw_params, 1)) < 0 ||
+      (err = snd_pcm_hw_params (*capture_handle, hw_params)) < 0) {
+    fprintf (stderr, "cannot set parameters (%s)\n",
+             snd_strerror (err));
+    snd_pcm_close (*capture_handle);
+    *capture_handle = NULL;
+    return err;
+  }
+
+  if ((err = snd_pcm_prepare (*capture_handle)) < 0) {
+    fprintf (stderr, "cannot prepare audio interface for use (%s)\n",
+             snd_strerror (err));
+    snd_pcm_close (*capture_handle);
+    *capture_handle = NULL;
+    return err;
+  }
+  capture_rate = rate;
+  return 0;
+}
+
+/* Resolve the identity of an opened handle through its card index. */
+static bool identify(snd_pcm_t *handle, const char *name, card_identity *out) {
+  snd_pcm_info_t *info;
+
+  snd_pcm_info_alloca(&info);
+  if (snd_pcm_info(handle, info) < 0)
+    return false;
+  out->card = snd_pcm_info_get_card(info);
+  if (!card_info_by_index(out->card, out))
+    return false;
+  out->device = snd_pcm_info_get_device(info);
+  out->plug = strncmp(name, "plug", 4) == 0;
+  return true;
+}
+
+/* Open the capture device of `card` if it is the card we lost. */
+static int reopen_on_card(int card, card_identity *identity,
+                          unsigned int rate, snd_pcm_format_t format) {
+  card_identity candidate;
+  char name[64];
+
+  if (!card_info_by_index(card, &candidate) || !same_card(candidate, *identity))
+    return -ENODEV;
+
+  snprintf(name, sizeof(name), "%shw:%d,%d", identity->plug ? "plug" : "", card, identity->device);
+  int64_t deadline = monotonic_ns() + (int64_t) REATTACH_TIMEOUT_MS * 1000000;
+  int err;
+  /* The node exists once udev reports it, but it may still be held by
+     the previous (dead) handle of another client or lack permissions
+     for a few ms; retry only within the bound. */
+  while ((err = snd_param_open(&capture_handle, name, rate, format)) < 0 &&
+         (err == -EBUSY || err == -EACCES || err == -EAGAIN) &&
+         monotonic_ns() < deadline)
+    usleep(REATTACH_RETRY_MS * 1000);
+  if (err == 0) {
+    identity->card = card;
+    fprintf(stdout, "re-attached %s (%s)\n", name, identity->longname.c_str());
+  }
+  return err;
+}
+
+/* Block on udev until the capture node of our card shows up again. */
+static bool wait_for_device(struct udev_monitor *monitor,
+                            card_identity *identity,
+                            unsigned int rate, snd_pcm_format_t format) {
+  struct pollfd pfd;
+  pfd.fd = udev_monitor_get_fd(monitor);
+  pfd.events = POLLIN;
+
+  while (running) {
+    if (poll(&pfd, 1, SIGNAL_CHECK_MS) <= 0)
+      continue;
+
+    struct udev_device *dev = udev_monitor_receive_device(monitor);
+    if (!dev)
+      continue;
+
+    const char *action = udev_device_get_action(dev);
+    const char *sysname = udev_device_get_sysname(dev);
+    int card, device;
+    char dir;
+    bool candidate = action && sysname && strcmp(action, "add") == 0 &&
+        sscanf(sysname, "pcmC%dD%d%c", &card, &device, &dir) == 3 &&
+        dir == 'c' && device == identity->device;
+    udev_device_unref(dev);
+
+    if (candidate && reopen_on_card(card, identity, rate, format) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Get a working handle back after a read error: reopen in place while
+   the card is still present, wait on udev once it is gone. False when
+   stopped, or when a present card keeps failing to open. */
+static bool reattach(struct udev_monitor *monitor, card_identity *identity,
+                     unsigned int rate, snd_pcm_format_t format) {
+  for (int attempt = 0; running && attempt < REOPEN_ATTEMPTS; attempt++) {
+    card_identity present;
+    if (!card_info_by_index(identity->card, &present) || !same_card(present, *identity)) {
+      fprintf(stderr, "card gone, waiting for it to return\n");
+      return wait_for_device(monitor, identity, rate, format);
+    }
+    if (attempt)
+      usleep(REOPEN_RETRY_MS * 1000);
+    if (reopen_on_card(identity->card, identity, rate, format) == 0)
+      return true;
+  }
+  if (running)
+    fprintf(stderr, "card still present but cannot be reopened, giving up\n");
+  return false;
+}
+
+int main (int argc, char *argv[])
+{
+  int err;
+  char *buffer;
+  int buffer_frames = 22050;
+  unsigned int rate = 44100;
+  snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+  card_identity identity;
+  long xruns = 0, detaches = 0;
+  int64_t gap_frames = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <pcm name, e.g. plughw:1,0>\n", argv[0]);
+    return 1;
+  }
+
+  init_signal();
+
+  /* Subscribe before opening, so an unplug/replug racing the first
+     open is not missed. */
+  struct udev *udev = udev_new();
+  struct udev_monitor *monitor = udev ? udev_monitor_new_from_netlink(udev, "udev") : NULL;
+  if (!monitor ||
+      udev_monitor_filter_add_match_subsystem_devtype(monitor, "sound", NULL) < 0 ||
+      udev_monitor_enable_receiving(monitor) < 0) {
+    fprintf(stderr, "cannot listen to udev events\n");
+    return 1;
+  }
+
+  if (snd_param_open(&capture_handle, argv[1], rate, format) < 0)
+    return 1;
+  if (!identify(capture_handle, argv[1], &identity)) {
+    fprintf(stderr, "cannot identify card of %s\n", argv[1]);
+    return 1;
+  }
+
+  fprintf(stdout, "audio interface prepared: %s device %d (%s) at %u Hz\n",
+          identity.id.c_str(), identity.device, identity.longname.c_str(), capture_rate);
+
+  buffer = (char*) malloc(buffer_frames * snd_pcm_format_width(format) / 8);
+
+  while(running){
+    auto start = std::chrono::high_resolution_clock::now();
+    if ((err = snd_pcm_readi (capture_handle, buffer, buffer_frames)) == -EPIPE) {
+      xruns++;
+      fprintf (stderr, "overrun #%ld\n", xruns);
+      snd_pcm_prepare (capture_handle);
+      continue;
+    } else if (err == -ESTRPIPE) {
+      while ((err = snd_pcm_resume (capture_handle)) == -EAGAIN)
+        usleep(10000);
+      if (err < 0)
+        snd_pcm_prepare (capture_handle);
+      continue;
+    } else if (err < 0) {
+      /* -ENODEV/-EBADFD/-EIO: the device is gone or wedged. */
+      fprintf (stderr, "device lost (%s)\n", snd_strerror (err));
+      int64_t lost_at = monotonic_ns();
+      unsigned int lost_rate = capture_rate;
+      snd_pcm_close (capture_handle);
+      capture_handle = NULL;
+      detaches++;
+
+      if (!reattach(monitor, &identity, rate, format))
+        break;
+
+      int64_t gap_ns = monotonic_ns() - lost_at;
+      int64_t gap = gap_ns * lost_rate / 1000000000LL;
+      gap_frames += gap;
+      fprintf(stdout, "gap %ld frames (%ld ms), total gap %ld frames over %ld detaches\n",
+              (long) gap, (long) (gap_ns / 1000000), (long) gap_frames, detaches);
+      continue;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    fprintf(stdout, "read %d done %ld ms \n", buffer[0], duration);
+  }
+
+  free(buffer);
+  fprintf(stdout, "buffer freed\n");
+
+  if (capture_handle)
+    snd_pcm_close (capture_handle);
+  fprintf(stdout, "audio interface closed (%ld xruns, %ld detaches, %ld gap frames)\n",
+          xruns, detaches, (long) gap_frames);
+
+  udev_monitor_unref(monitor);
+  udev_unref(udev);
+  return 0;
+}
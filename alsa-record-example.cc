@@ -18,6 +18,23 @@
   g++ alsa-record-example.cc -I/usr/include/  -o alsa-record-example -lm -ldl -lasound 
   gcc alsa-record-example.c -I/usr/include/  -o alsa-record-example -lm -ldl -lasound   
   ./alsa-record-example hw:2,0
+  ./alsa-record-example hw:2,0 udp://10.0.0.2:5004   (also tcp://host:port, unix:/path)
+
+  Every block is dated from the driver's timestamps (see capture-clock.h):
+  "captured at" is the CLOCK_REALTIME of its first frame.
+
+  Record what was read, and run it again later without the card (capture-log.h):
+  CAPTURE_LOG=field.caplog ./alsa-record-example hw:2,0
+  CAPTURE_REPLAY=field.caplog CAPTURE_REPLAY_SPEED=asap ./alsa-record-example -
+
+  Or without any card, from a mock device (mock-capture.h):
+  CAPTURE_MOCK=sine=440,impulse=0.5,jitter=2,xrun=0.01 ./alsa-record-example -
+
+  CAPTURE_RATE, CAPTURE_CHANNELS and CAPTURE_BLOCK_FRAMES override the
+  workload (see capture-backend-bench.cc).
+
+  Condition what is sent, not what is logged (biquad-bank.h):
+  CAPTURE_FILTER=dc=10,hp=80,order=4 ./alsa-record-example hw:2,0 udp://10.0.0.2:5004
 
   - More information: https://vovkos.github.io/doxyrest/samples/alsa/page_pcm.html#doxid-pcm
 */
@@ -30,8 +47,21 @@
 #include <stdbool.h>
 #include <alsa/asoundlib.h>
 
+#include "biquad-bank.h"
+#include "capture-clock.h"
+#include "capture-log.h"
+#include "mock-capture.h"
+#include "net-audio-sink.h"
+
+#define SINK_BATCH_PACKETS 8
+#define SINK_MAX_DELAY_MS 20
+
 static bool running = true;
 static snd_pcm_t* capture_handle = NULL;
+static net_audio_sink sink;
+static capture_log recording;
+static capture_replay replay;
+static mock_capture mock;
 /* Signals handling */
 static void handle_sigterm(int signo) { running = false; }
 
@@ -49,6 +79,7 @@ void snd_param_init(snd_pcm_t **capture_handle,
                     const char* name, 
                     int buffer_frames, 
                     unsigned int rate, 
+                    unsigned int channels,
                     snd_pcm_hw_params_t *hw_params, 
                     snd_pcm_format_t format) {
   int err;
@@ -102,7 +133,7 @@ void snd_param_init(snd_pcm_t **capture_handle,
 	
   fprintf(stdout, "hw_params rate setted\n");
 
-  if ((err = snd_pcm_hw_params_set_channels (*capture_handle, hw_params, 1)) < 0) {
+  if ((err = snd_pcm_hw_params_set_channels (*capture_handle, hw_params, channels)) < 0) {
     fprintf (stderr, "cannot set channel count (%s)\n",
              snd_strerror (err));
     exit (1);
@@ -121,6 +152,21 @@ void snd_param_init(snd_pcm_t **capture_handle,
   snd_pcm_hw_params_free (hw_params);
 
   fprintf(stdout, "hw_params freed\n");
+
+  // Have the driver timestamp pointer updates on CLOCK_MONOTONIC, so each
+  // block can be dated from snd_pcm_status(). Optional: without it the
+  // blocks are dated from the time the read returned.
+  snd_pcm_sw_params_t *sw_params;
+  if (snd_pcm_sw_params_malloc (&sw_params) == 0) {
+    if (snd_pcm_sw_params_current (*capture_handle, sw_params) < 0 ||
+        snd_pcm_sw_params_set_tstamp_mode (*capture_handle, sw_params, SND_PCM_TSTAMP_ENABLE) < 0 ||
+        snd_pcm_sw_params_set_tstamp_type (*capture_handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0 ||
+        snd_pcm_sw_params (*capture_handle, sw_params) < 0)
+      fprintf (stderr, "no hardware timestamps, using read completion time\n");
+    else
+      fprintf(stdout, "sw_params timestamps enabled\n");
+    snd_pcm_sw_params_free (sw_params);
+  }
 	
   if ((err = snd_pcm_prepare (*capture_handle)) < 0) {
     fprintf (stderr, "cannot prepare audio interface for use (%s)\n",
@@ -129,6 +175,45 @@ void snd_param_init(snd_pcm_t **capture_handle,
   }  
 }
 
+/*
+  Raw CLOCK_MONOTONIC time of the first frame of the block just read.
+  `position` counts the frames read since the stream started, this block
+  included. The status carries the time of the driver's last pointer
+  update and how far capture had got by then: from the audio timestamp
+  when the driver reports one (sub-period resolution), otherwise from the
+  frames still queued behind us (delay).
+*/
+static bool block_capture_ns(snd_pcm_t *handle, snd_pcm_status_t *status, unsigned int rate,
+                             uint64_t position, snd_pcm_sframes_t frames, int64_t *raw_ns)
+{
+  snd_htimestamp_t ts, audio_ts;
+  snd_pcm_audio_tstamp_config_t config;
+  snd_pcm_audio_tstamp_report_t report;
+
+  memset(&config, 0, sizeof(config));
+  config.type_requested = SND_PCM_AUDIO_TSTAMP_TYPE_LINK;
+  snd_pcm_status_set_audio_htstamp_config(status, &config);
+  if (snd_pcm_status(handle, status) < 0)
+    return false;
+
+  snd_pcm_status_get_htstamp(status, &ts);
+  if (!ts.tv_sec && !ts.tv_nsec)
+    return false;
+  int64_t at_ns = (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+  // Frames captured after the end of our block, as of at_ns.
+  double behind = snd_pcm_status_get_delay(status);
+  snd_pcm_status_get_audio_htstamp_report(status, &report);
+  if (report.valid && report.actual_type != SND_PCM_AUDIO_TSTAMP_TYPE_COMPAT) {
+    snd_pcm_status_get_audio_htstamp(status, &audio_ts);
+    double captured = ((double) audio_ts.tv_sec + audio_ts.tv_nsec / 1e9) * rate;
+    if (captured >= position && captured - position <= behind + frames)
+      behind = captured - position;
+  }
+  *raw_ns = at_ns - (int64_t) ((behind + frames) * 1e9 / rate);
+  return true;
+}
+
 int main (int argc, char *argv[])
 {
   int i;
@@ -136,34 +221,161 @@ int main (int argc, char *argv[])
   char *buffer;
   int buffer_frames = 22050;
   unsigned int rate = 44100;
+  unsigned int channels = 1;
   snd_pcm_hw_params_t *hw_params;
   snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+  const char *sink_url = argc > 2 ? argv[2] : NULL;
+  snd_pcm_status_t *status;
+  capture_clock stream_clock;
+  uint64_t position = 0;
+  const char *log_path = getenv("CAPTURE_LOG");
+  const char *replay_path = getenv("CAPTURE_REPLAY");
+  const char *mock_spec = getenv("CAPTURE_MOCK");
+  const char *filter_spec = getenv("CAPTURE_FILTER");
+  biquad_bank filter;
+
+  // Workload overrides, so every backend can be benchmarked alike
+  // (capture-backend-bench.cc).
+  if (getenv("CAPTURE_RATE")) rate = atoi(getenv("CAPTURE_RATE"));
+  if (getenv("CAPTURE_CHANNELS")) channels = atoi(getenv("CAPTURE_CHANNELS"));
+  if (getenv("CAPTURE_BLOCK_FRAMES")) buffer_frames = atoi(getenv("CAPTURE_BLOCK_FRAMES"));
 
   init_signal();
-  snd_param_init(&capture_handle, argv[1], buffer_frames, rate, hw_params, format);
+  if (replay_path) {
+    if (capture_replay_open(&replay, replay_path, capture_replay_parse_speed(getenv("CAPTURE_REPLAY_SPEED"))) < 0 ||
+        replay.header.format != CAPTURE_LOG_S16LE || replay.header.rate != rate || replay.header.channels != channels) {
+      fprintf (stderr, "cannot replay %s: not a %u Hz %u channel S16_LE capture log\n", replay_path, rate, channels);
+      exit (1);
+    }
+    fprintf(stdout, "replaying %s\n", replay_path);
+  } else if (mock_spec) {
+    mock_capture_config cfg;
+    mock_capture_default_config(&cfg, rate, channels, MOCK_S16);
+    if (mock_capture_parse(&cfg, mock_spec) < 0) {
+      fprintf (stderr, "cannot parse CAPTURE_MOCK=%s\n", mock_spec);
+      exit (1);
+    }
+    mock_capture_open(&mock, &cfg);
+    fprintf(stdout, "mock device %s\n", mock_spec);
+  } else {
+    snd_param_init(&capture_handle, argv[1], buffer_frames, rate, channels, hw_params, format);
+    fprintf(stdout, "audio interface prepared\n");
+  }
+
+  if (log_path && capture_log_open(&recording, log_path, CAPTURE_LOG_S16LE, rate, channels, "alsa") < 0) {
+    fprintf (stderr, "cannot write capture log %s (%s)\n", log_path, strerror (errno));
+    exit (1);
+  }
 
-  fprintf(stdout, "audio interface prepared\n");
+  if (filter_spec && (!biquad_bank_init(&filter, channels, 1, buffer_frames) ||
+                      !biquad_bank_configure(&filter, rate, filter_spec))) {
+    fprintf (stderr, "cannot parse CAPTURE_FILTER=%s\n", filter_spec);
+    exit (1);
+  }
 
-  buffer = (char*) malloc(128 * snd_pcm_format_width(format) / 8 * 2);
+  buffer = (char*) malloc(buffer_frames * channels * snd_pcm_format_width(format) / 8);
 
   fprintf(stdout, "buffer allocated\n");
 
+  snd_pcm_status_alloca(&status);
+  capture_clock_init(&stream_clock, rate, CAPTURE_CLOCK_TAU_SEC);
+
+  if (sink_url) {
+    if (net_audio_sink_open(&sink, sink_url, getpid(), NET_AUDIO_S16LE, rate, channels,
+                            SINK_BATCH_PACKETS, SINK_MAX_DELAY_MS) < 0)
+      exit (1);
+    fprintf(stdout, "sending to %s\n", sink_url);
+  }
+
   while(running){
     auto start = std::chrono::high_resolution_clock::now();
-    if ((err = snd_pcm_readi (capture_handle, buffer, buffer_frames)) != buffer_frames) {
+    int64_t read_start_ns = capture_log_monotonic_ns(), logged_capture_ns = 0;
+    if (replay_path)
+      err = capture_replay_read (&replay, buffer, buffer_frames, &logged_capture_ns);
+    else if (mock_spec)
+      err = mock_capture_read (&mock, buffer, buffer_frames, &logged_capture_ns);
+    else
+      err = snd_pcm_readi (capture_handle, buffer, buffer_frames);
+    int64_t read_end_ns = capture_log_monotonic_ns();
+    if (replay_path && err == 0)
+      break;
+    if (err != buffer_frames) {
       fprintf (stderr, "read from audio interface failed (%s)\n",
-               err, snd_strerror (err));
+               snd_strerror (err));
+    }
+    if (err < 0) {
+      if (recording.file)
+        capture_log_xrun(&recording, read_end_ns);
+      // Overrun or suspend: the stream restarts from position 0.
+      if (capture_handle && snd_pcm_recover (capture_handle, err, 1) < 0)
+        break;
+      capture_clock_reset(&stream_clock);
+      position = 0;
+      continue;
     }
     
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-    fprintf(stdout, "read %d done %ld ms \n", buffer[0], duration);
+
+    int64_t raw_ns, capture_ns;
+    position += err;
+    if (logged_capture_ns) {
+      // Replayed or mocked: keep the source's timestamps, so runs are comparable.
+      capture_ns = logged_capture_ns;
+    } else {
+      if (!capture_handle || !block_capture_ns(capture_handle, status, rate, position, err, &raw_ns))
+        raw_ns = capture_clock_monotonic_ns() - (int64_t) err * 1000000000LL / rate;
+      capture_ns = capture_clock_update(&stream_clock, position - err, raw_ns)
+          + monotonic_to_realtime_ns();
+    }
+
+    if (recording.file)
+      capture_log_block(&recording, buffer, err, read_start_ns, read_end_ns, capture_ns);
+
+    // After the log, so a replay runs the filter again on the raw input.
+    if (filter_spec)
+      biquad_process_s16(&filter, (int16_t*) buffer, err);
+
+    fprintf(stdout, "read %d done %ld ms, captured at %ld.%06ld \n", buffer[0], duration,
+            (long) (capture_ns / 1000000000LL), (long) (capture_ns % 1000000000LL / 1000));
+
+    // A fatal socket error (the receiver went away) ends the streaming,
+    // not the capture.
+    if (sink_url && net_audio_sink_push(&sink, buffer, err, capture_ns) < 0) {
+      fprintf(stderr, "sending to %s failed (%s), streaming stopped\n", sink_url, strerror(errno));
+      net_audio_sink_print_stats(&sink, stdout);
+      net_audio_sink_close(&sink);
+      sink_url = NULL;
+    }
   }
 
+  capture_clock_print_stats(&stream_clock, stdout);
+
+  if (sink_url) {
+    net_audio_sink_print_stats(&sink, stdout);
+    net_audio_sink_close(&sink);
+  }
+
+  if (recording.file) {
+    fprintf(stdout, "logged %lu blocks, %lu xruns\n", (unsigned long) recording.blocks,
+            (unsigned long) recording.xruns);
+    capture_log_close(&recording);
+  }
+  if (replay_path) {
+    capture_replay_print_stats(&replay, stdout);
+    capture_replay_close(&replay);
+  }
+  if (mock_spec)
+    mock_capture_print_stats(&mock, stdout);
+
+  if (filter_spec)
+    biquad_bank_free(&filter);
   free(buffer);
   fprintf(stdout, "buffer freed\n");
 	
-  snd_pcm_close (capture_handle);
-  fprintf(stdout, "audio interface closed\n");
+  if (capture_handle) {
+    snd_pcm_close (capture_handle);
+    fprintf(stdout, "audio interface closed\n");
+  }
   return 0;
 }
\ No newline at end of file
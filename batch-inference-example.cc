@@ -0,0 +1,372 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "frame-batcher.h"
+#include "mock-capture.h"
+#include "resample.h"
+#include "stream-executor.h"
+
+// Many streams feeding one model through frame-batcher.h.
+//
+// --streams mock sources (one capture thread, paced in real time) go to
+// the stream-executor.h pool, where each stream is mixed to mono,
+// resampled to 16 kHz and cut into --window-ms windows every --hop-ms.
+// Every window goes to the batcher; one inference thread takes batches
+// and runs a stand-in model on them: a dense layer (--hidden units over
+// the whole window, weights bigger than the caches), ReLU, and a mean.
+// Batched, the layer reads each weight row once per batch; with
+// --max-batch=1 it reads all the weights once per window.
+//
+// At the end: windows and batches (full, or sealed at --max-wait-ms),
+// the inference thread's CPU per window and windows per core second,
+// the latency from a window being ready to its result (p50, p99, max),
+// and the windows that missed --deadline-ms or were dropped.
+//
+// g++ -O2 batch-inference-example.cc -o batch-inference-example -lm -std=c++11 -lpthread
+// ./batch-inference-example --streams=128 --max-batch=1
+// ./batch-inference-example --streams=128 --max-batch=64 --max-wait-ms=40
+
+#define OUT_RATE 16000
+#define CHUNK 1024   /* window samples per pass over the batch */
+
+struct options {
+  uint32_t streams, rate, channels, max_batch, hidden;
+  int threads;
+  double seconds, block_ms, window_ms, hop_ms, max_wait_ms, deadline_ms;
+};
+
+/* One stream's DSP: mono 16 kHz, cut into overlapping windows. */
+struct stream_state {
+  uint32_t id;
+  resampler rs;
+  std::vector<float> mono, out, window;
+  uint32_t fill;           /* samples in window */
+  uint64_t seq;            /* windows so far */
+  int64_t base;            /* the output sample at window[0] */
+  int64_t start_ns;        /* capture time of output sample 0 */
+};
+
+static block_pool blocks;
+static frame_batcher batcher;
+static uint32_t channels, window_len, hop_len;
+static int64_t block_ns;
+
+static void dsp(exec_stream *s, const block_ref *b, int) {
+  stream_state *st = (stream_state*) s->user;
+  const float *x = (const float*) b->data;
+  if (!st->start_ns)
+    st->start_ns = b->capture_ns - block_ns;
+  for (uint32_t f = 0; f < b->frames; f++) {
+    float sum = 0;
+    for (uint32_t c = 0; c < channels; c++)
+      sum += x[(size_t) f * channels + c];
+    st->mono[f] = sum / channels;
+  }
+  block_pool_put(&blocks, b->data);
+  uint32_t n = resampler_process(&st->rs, st->mono.data(), b->frames, st->out.data(), (uint32_t) st->out.size());
+  for (uint32_t i = 0; i < n;) {
+    uint32_t take = std::min(n - i, window_len - st->fill);
+    memcpy(&st->window[st->fill], &st->out[i], take * sizeof(float));
+    st->fill += take;
+    i += take;
+    if (st->fill == window_len) {
+      int64_t at = st->start_ns + st->base * 1000000000 / OUT_RATE;
+      frame_batcher_add(&batcher, st->id, st->seq++, at, st->window.data());
+      memmove(&st->window[0], &st->window[hop_len], (window_len - hop_len) * sizeof(float));
+      st->fill -= hop_len;
+      st->base += hop_len;
+    }
+  }
+}
+
+/* The stand-in model. */
+struct model {
+  uint32_t inputs, hidden;
+  std::vector<float> weights, bias, acc;
+};
+
+/* Four windows against one weight row: each weight is loaded once for
+   all four. n is a multiple of 4 (rows are padded to 16). */
+static void dot4(const float *x0, const float *x1, const float *x2, const float *x3, const float *w, uint32_t n,
+                 float out[4]) {
+  float s0[4] = { 0, 0, 0, 0 }, s1[4] = { 0, 0, 0, 0 }, s2[4] = { 0, 0, 0, 0 }, s3[4] = { 0, 0, 0, 0 };
+  for (uint32_t i = 0; i < n; i += 4)
+    for (int k = 0; k < 4; k++) {
+      float wk = w[i + k];
+      s0[k] += x0[i + k] * wk;
+      s1[k] += x1[i + k] * wk;
+      s2[k] += x2[i + k] * wk;
+      s3[k] += x3[i + k] * wk;
+    }
+  out[0] = (s0[0] + s0[1]) + (s0[2] + s0[3]);
+  out[1] = (s1[0] + s1[1]) + (s1[2] + s1[3]);
+  out[2] = (s2[0] + s2[1]) + (s2[2] + s2[3]);
+  out[3] = (s3[0] + s3[1]) + (s3[2] + s3[3]);
+}
+
+static float dot(const float *x, const float *w, uint32_t n) {
+  float s[4] = { 0, 0, 0, 0 };
+  for (uint32_t i = 0; i < n; i += 4)
+    for (int k = 0; k < 4; k++)
+      s[k] += x[i + k] * w[i + k];
+  return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+/* Chunk by chunk of the window: a chunk of every weight row, against
+   that chunk of every window in the batch, four windows at a time. */
+static double model_run(model *m, const frame_batch *t, uint32_t stride) {
+  m->acc.assign((size_t) t->count * m->hidden, 0.0f);
+  for (uint32_t d = 0; d < stride; d += CHUNK) {
+    uint32_t len = std::min((uint32_t) CHUNK, stride - d);
+    for (uint32_t h = 0; h < m->hidden; h++) {
+      const float *w = &m->weights[(size_t) h * stride + d];
+      uint32_t i = 0;
+      for (; i + 4 <= t->count; i += 4) {
+        const float *x = t->data + (size_t) i * stride + d;
+        float out[4];
+        dot4(x, x + stride, x + 2 * stride, x + 3 * stride, w, len, out);
+        for (uint32_t r = 0; r < 4; r++)
+          m->acc[(size_t) (i + r) * m->hidden + h] += out[r];
+      }
+      for (; i < t->count; i++)
+        m->acc[(size_t) i * m->hidden + h] += dot(t->data + (size_t) i * stride + d, w, len);
+    }
+  }
+  double check = 0;
+  for (uint32_t i = 0; i < t->count; i++) {
+    float mean = 0;
+    for (uint32_t h = 0; h < m->hidden; h++)
+      mean += std::max(0.0f, m->acc[(size_t) i * m->hidden + h] + m->bias[h]);
+    check += mean / m->hidden;
+  }
+  return check;
+}
+
+struct inference_stats {
+  std::vector<float> latency_ms;
+  uint64_t windows, batches, missed;
+  double cpu_s, check;
+};
+
+static double thread_cpu_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void inference(model *m, double deadline_ms, inference_stats *out) {
+  frame_batch *t;
+  while ((t = frame_batcher_next(&batcher, -1)) != NULL) {
+    double cpu = thread_cpu_seconds();
+    out->check += model_run(m, t, batcher.stride);
+    out->cpu_s += thread_cpu_seconds() - cpu;
+    int64_t done = frame_batcher_now_ns();
+    for (uint32_t i = 0; i < t->count; i++) {
+      float ms = (float) ((done - t->items[i].ready_ns) / 1e6);
+      out->latency_ms.push_back(ms);
+      if (ms > deadline_ms) out->missed++;
+    }
+    out->windows += t->count;
+    out->batches++;
+    frame_batcher_release(&batcher, t);
+  }
+}
+
+static void sleep_until(int64_t ns) {
+  struct timespec ts = { (time_t) (ns / 1000000000), (long) (ns % 1000000000) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  --streams=N        mock sources (128)\n"
+          "  --threads=N        DSP workers (the online cores)\n"
+          "  --seconds=S        (10)\n"
+          "  --window-ms=MS     model input, at 16 kHz (1000)\n"
+          "  --hop-ms=MS        between windows of a stream (500)\n"
+          "  --max-batch=N      windows per batch, at most (64)\n"
+          "  --max-wait-ms=MS   a batch is sealed this long after its first window (40)\n"
+          "  --deadline-ms=MS   window ready to result, for the report (100)\n"
+          "  --hidden=N         model units (64)\n"
+          "  --rate=HZ          capture rate (48000)\n"
+          "  --channels=N       (2)\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  options o;
+  o.streams = 128;
+  o.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  o.seconds = 10;
+  o.block_ms = 10;
+  o.window_ms = 1000;
+  o.hop_ms = 500;
+  o.max_batch = 64;
+  o.max_wait_ms = 40;
+  o.deadline_ms = 100;
+  o.hidden = 64;
+  o.rate = 48000;
+  o.channels = 2;
+
+  enum { STREAMS = 256, THREADS, SECONDS, WINDOW_MS, HOP_MS, MAX_BATCH, MAX_WAIT_MS, DEADLINE_MS, HIDDEN, RATE, CHANNELS };
+  static const struct option long_options[] = {
+    {"streams", 1, NULL, STREAMS}, {"threads", 1, NULL, THREADS}, {"seconds", 1, NULL, SECONDS},
+    {"window-ms", 1, NULL, WINDOW_MS}, {"hop-ms", 1, NULL, HOP_MS}, {"max-batch", 1, NULL, MAX_BATCH},
+    {"max-wait-ms", 1, NULL, MAX_WAIT_MS}, {"deadline-ms", 1, NULL, DEADLINE_MS}, {"hidden", 1, NULL, HIDDEN},
+    {"rate", 1, NULL, RATE}, {"channels", 1, NULL, CHANNELS}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case STREAMS: o.streams = (uint32_t) atoi(optarg); break;
+      case THREADS: o.threads = atoi(optarg); break;
+      case SECONDS: o.seconds = atof(optarg); break;
+      case WINDOW_MS: o.window_ms = atof(optarg); break;
+      case HOP_MS: o.hop_ms = atof(optarg); break;
+      case MAX_BATCH: o.max_batch = (uint32_t) atoi(optarg); break;
+      case MAX_WAIT_MS: o.max_wait_ms = atof(optarg); break;
+      case DEADLINE_MS: o.deadline_ms = atof(optarg); break;
+      case HIDDEN: o.hidden = (uint32_t) atoi(optarg); break;
+      case RATE: o.rate = (uint32_t) atoi(optarg); break;
+      case CHANNELS: o.channels = (uint32_t) atoi(optarg); break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  uint32_t block_frames = (uint32_t) (o.rate * o.block_ms / 1000);
+  window_len = (uint32_t) (OUT_RATE * o.window_ms / 1000);
+  hop_len = (uint32_t) (OUT_RATE * o.hop_ms / 1000);
+  channels = o.channels;
+  if (!o.streams || o.threads < 1 || o.seconds <= 0 || !block_frames || !window_len || !hop_len ||
+      hop_len > window_len || !o.max_batch || !o.hidden || !o.channels || o.max_wait_ms < 0) {
+    help(argv[0]);
+    return 1;
+  }
+  block_ns = (int64_t) block_frames * 1000000000 / o.rate;
+
+  /* Each stream's blocks wait at most 16 periods. */
+  size_t block_bytes = (size_t) block_frames * o.channels * sizeof(float);
+  if (block_pool_init(&blocks, o.streams * 16 + 64, (uint32_t) block_bytes, false) != 0) {
+    perror("block_pool_init");
+    return 1;
+  }
+  /* Room for a window from every stream at once, and at least 4. */
+  uint32_t batches = std::max(4u, (o.streams + o.max_batch - 1) / o.max_batch + 2);
+  if (!frame_batcher_init(&batcher, window_len, o.max_batch, (int64_t) (o.max_wait_ms * 1e6), batches)) {
+    fprintf(stderr, "no memory for %u batches of %u x %u\n", batches, o.max_batch, window_len);
+    return 1;
+  }
+
+  /* Weight rows padded like the batch rows, with zeros. */
+  model m;
+  m.inputs = window_len;
+  m.hidden = o.hidden;
+  m.weights.assign((size_t) m.hidden * batcher.stride, 0.0f);
+  m.bias.resize(m.hidden);
+  uint64_t seed = 1;
+  for (uint32_t h = 0; h < m.hidden; h++)
+    for (uint32_t i = 0; i < m.inputs; i++) {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      m.weights[(size_t) h * batcher.stride + i] = ((float) (seed >> 40) / (1 << 24) - 0.5f) * 0.02f;
+    }
+  for (uint32_t h = 0; h < m.hidden; h++)
+    m.bias[h] = 0.01f * h;
+
+  /* One second of mock signal, read by each stream from its own place. */
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, o.rate, o.channels, MOCK_F32);
+  cfg.speed = 0;
+  mock_capture mock;
+  mock_capture_open(&mock, &cfg);
+  uint32_t signal_blocks = std::max(1u, o.rate / block_frames);
+  std::vector<float> signal((size_t) signal_blocks * block_frames * o.channels);
+  int64_t unused_ns;
+  mock_capture_read(&mock, signal.data(), signal_blocks * block_frames, &unused_ns);
+
+  work_pool pool;
+  work_pool_start(&pool, o.threads);
+  stream_exec x;
+  stream_exec_init(&x, &pool, 4);
+  std::vector<stream_state*> states;
+  std::vector<exec_stream*> streams;
+  for (uint32_t i = 0; i < o.streams; i++) {
+    stream_state *st = new stream_state;
+    st->id = i;
+    resampler_init(&st->rs, o.rate, OUT_RATE, 1);
+    st->mono.resize(block_frames);
+    st->out.resize((size_t) block_frames * OUT_RATE / o.rate + 2);
+    st->window.resize(window_len);
+    /* Streams that started at different times: their windows come at
+       different points of the hop. */
+    st->fill = (uint32_t) ((uint64_t) i * hop_len / o.streams);
+    st->seq = 0;
+    st->base = -(int64_t) st->fill;
+    st->start_ns = 0;
+    states.push_back(st);
+    streams.push_back(exec_stream_new(&x, 16, dsp, st));
+  }
+
+  inference_stats stats;
+  stats.windows = stats.batches = stats.missed = 0;
+  stats.cpu_s = stats.check = 0;
+  std::thread infer(inference, &m, o.deadline_ms, &stats);
+
+  uint64_t ticks = (uint64_t) (o.seconds * 1e9 / block_ns), dropped = 0;
+  int64_t start = frame_batcher_now_ns();
+  for (uint64_t t = 0; t < ticks; t++) {
+    int64_t due = start + (int64_t) (t + 1) * block_ns;
+    sleep_until(due);
+    for (uint32_t i = 0; i < o.streams; i++) {
+      uint8_t *b = block_pool_get(&blocks);
+      if (!b) {
+        dropped++;
+        continue;
+      }
+      memcpy(b, &signal[(size_t) ((i * 37 + t) % signal_blocks) * block_frames * o.channels], block_bytes);
+      if (!exec_stream_push(streams[i], b, block_frames, due)) {
+        block_pool_put(&blocks, b);
+        dropped++;
+      }
+    }
+  }
+  work_pool_wait(&pool);
+  frame_batcher_close(&batcher);
+  infer.join();
+  double wall = (frame_batcher_now_ns() - start) / 1e9;
+
+  std::vector<float> &lat = stats.latency_ms;
+  std::sort(lat.begin(), lat.end());
+  size_t n = lat.size();
+  frame_batcher_print_stats(&batcher, stderr);
+  stream_exec_print_stats(streams.data(), streams.size(), stderr);
+  printf("%u streams, %.1f s: %lu windows of %u samples in %lu batches (%.1f per batch), %lu blocks dropped\n",
+         o.streams, wall, (unsigned long) stats.windows, window_len, (unsigned long) stats.batches,
+         stats.batches ? (double) stats.windows / stats.batches : 0.0, (unsigned long) dropped);
+  printf("inference: %.3f ms cpu per window, %.0f windows per core second, %.1f%% of a core\n",
+         stats.windows ? stats.cpu_s * 1e3 / stats.windows : 0.0, stats.cpu_s > 0 ? stats.windows / stats.cpu_s : 0.0,
+         100.0 * stats.cpu_s / wall);
+  if (n)
+    printf("latency ready -> result: p50 %.2f p99 %.2f max %.2f ms; %lu of %lu past the %.0f ms deadline\n",
+           lat[n / 2], lat[std::min(n - 1, n * 99 / 100)], lat[n - 1], (unsigned long) stats.missed,
+           (unsigned long) n, o.deadline_ms);
+  fprintf(stderr, "(checksum %g)\n", stats.check);
+
+  work_pool_stop(&pool);
+  for (uint32_t i = 0; i < o.streams; i++) {
+    exec_stream_free(streams[i]);
+    delete states[i];
+  }
+  frame_batcher_free(&batcher);
+  block_pool_free(&blocks);
+  return 0;
+}
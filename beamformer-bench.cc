@@ -0,0 +1,215 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "beamformer.h"
+#include "mock-capture.h"
+
+// Correctness and cost of beamformer.h, on synthetic plane waves reaching
+// a circular array (8 microphones, 4.25 cm radius) with exact fractional
+// delays.
+//
+//   gain      a tone from a beam's own direction comes out within 0.5 dB,
+//             250 Hz to 5 kHz at 16 kHz
+//   steer     tones from each of the 8 beam directions: the loudest beam is
+//             that one; from half-way between two beams: one of the two
+//   noise     uncorrelated noise on every microphone: down at least
+//             10 log10(8) - 0.5 dB
+//   blocks    blocks of 1, 7, 160 and 480 frames: the same beams, bit for
+//             bit
+//   cost      ns per frame per beam and the share of a core for 4, 8 and 16
+//             microphones and beams at 16 and 48 kHz, against a plain
+//             scalar loop over interleaved samples
+//
+// g++ -O2 beamformer-bench.cc -o beamformer-bench -lm -std=c++11
+// ./beamformer-bench
+
+#define MICS 8
+#define RADIUS 0.0425
+#define BLOCK 160
+
+static int failures = 0;
+
+static void expect(bool ok, const char *name, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL %s: %s\n", name, what);
+    failures++;
+  }
+}
+
+/* Interleaved: a sum of tones from `azimuth`, each microphone hearing it
+   (p . u) / c early. */
+static void plane_wave(std::vector<float> *x, uint32_t rate, uint32_t mics, uint32_t frames, double azimuth,
+                       const double *hz, int tones) {
+  x->assign((size_t) frames * mics, 0.0f);
+  for (uint32_t m = 0; m < mics; m++) {
+    double px = RADIUS * cos(2 * M_PI * m / mics), py = RADIUS * sin(2 * M_PI * m / mics);
+    double lead = (px * cos(azimuth) + py * sin(azimuth)) / BEAM_SOUND_SPEED;
+    for (uint32_t f = 0; f < frames; f++) {
+      double t = (double) f / rate + lead, v = 0;
+      for (int k = 0; k < tones; k++) v += sin(2 * M_PI * hz[k] * t) / tones;
+      (*x)[(size_t) f * mics + m] = (float) (0.5 * v);
+    }
+  }
+}
+
+static double power(const std::vector<float> &x, size_t from, size_t step) {
+  double s = 0;
+  size_t n = 0;
+  for (size_t i = from; i < x.size(); i += step, n++) s += (double) x[i] * x[i];
+  return s / n;
+}
+
+/* Runs every block through, returns the beams interleaved. */
+static void run(beam_former *bf, const std::vector<float> &x, uint32_t block, std::vector<float> *beams) {
+  uint32_t frames = (uint32_t) (x.size() / bf->mics);
+  beams->assign((size_t) frames * bf->beams, 0.0f);
+  for (uint32_t f = 0; f < frames; f += block) {
+    uint32_t n = frames - f < block ? frames - f : block;
+    beam_former_input_f32(bf, &x[(size_t) f * bf->mics], n);
+    beam_former_process(bf, n);
+    beam_former_output_f32(bf, &(*beams)[(size_t) f * bf->beams], n);
+  }
+}
+
+static void check_gain_and_steer() {
+  const uint32_t rate = 16000, frames = rate;
+  beam_former bf;
+  beam_former_init(&bf, rate, MICS, BLOCK);
+  beam_circular_array(&bf, RADIUS);
+  beam_former_steer(&bf, 8);
+  beam_former_print(&bf, stdout);
+  double worst = 0;
+  for (double hz = 250; hz <= 5000; hz *= 1.5) {
+    for (uint32_t i = 0; i < bf.beams; i++) {
+      std::vector<float> x, y;
+      plane_wave(&x, rate, MICS, frames, bf.azimuth[i], &hz, 1);
+      run(&bf, x, BLOCK, &y);
+      double g = 10 * log10(power(y, (size_t) rate / 10 * bf.beams + i, bf.beams) / power(x, 0, MICS));
+      if (fabs(g) > fabs(worst)) worst = g;
+    }
+  }
+  printf("gain:   on-axis within %.2f dB, 250 Hz to 5 kHz\n", fabs(worst));
+  expect(fabs(worst) < 0.5, "gain", "a beam changes its own direction's level");
+
+  const double tones[] = { 1800, 2900, 4100 };
+  uint32_t right = 0, between = 0;
+  double e[BEAM_MAX_BEAMS];
+  for (uint32_t i = 0; i < bf.beams; i++) {
+    std::vector<float> x, y;
+    plane_wave(&x, rate, MICS, frames, bf.azimuth[i], tones, 3);
+    beam_former_energy(&bf, 0, e);
+    run(&bf, x, BLOCK, &y);
+    if (beam_former_loudest(&bf, frames) == i) right++;
+    plane_wave(&x, rate, MICS, frames, bf.azimuth[i] + M_PI / bf.beams, tones, 3);
+    beam_former_energy(&bf, 0, e);
+    run(&bf, x, BLOCK, &y);
+    uint32_t l = beam_former_loudest(&bf, frames);
+    if (l == i || l == (i + 1) % bf.beams) between++;
+  }
+  printf("steer:  loudest beam right for %u of %u directions, next to it for %u of %u in between\n", right,
+         bf.beams, between, bf.beams);
+  expect(right == bf.beams, "steer", "the loudest beam is not the source's");
+  expect(between == bf.beams, "steer", "a source between beams is loudest elsewhere");
+  beam_former_free(&bf);
+}
+
+static void check_noise() {
+  const uint32_t rate = 16000, frames = 2 * rate;
+  std::vector<float> x((size_t) frames * MICS), y;
+  uint64_t seed = 5;
+  for (size_t i = 0; i < x.size(); i++) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    x[i] = (float) (0.1 * (2.0 * (double) (seed >> 11) / 9007199254740992.0 - 1));
+  }
+  beam_former bf;
+  beam_former_init(&bf, rate, MICS, BLOCK);
+  beam_circular_array(&bf, RADIUS);
+  beam_former_steer(&bf, 8);
+  run(&bf, x, BLOCK, &y);
+  double least = 1e9;
+  for (uint32_t i = 0; i < bf.beams; i++) {
+    double drop = 10 * log10(power(x, 0, 1) / power(y, (size_t) rate / 10 * bf.beams + i, bf.beams));
+    if (drop < least) least = drop;
+  }
+  printf("noise:  uncorrelated noise down %.2f dB at least (%.2f dB for %d microphones)\n", least,
+         10 * log10((double) MICS), MICS);
+  expect(least > 10 * log10((double) MICS) - 0.5, "noise", "uncorrelated noise is not averaged out");
+  beam_former_free(&bf);
+}
+
+static void check_blocks() {
+  const uint32_t rate = 48000, frames = rate / 2;
+  const double tones[] = { 700, 3100 };
+  std::vector<float> x, ref, y;
+  plane_wave(&x, rate, MICS, frames, 1.0, tones, 2);
+  uint32_t sizes[] = { 480, 1, 7, 160 };
+  bool same = true;
+  for (int k = 0; k < 4; k++) {
+    beam_former bf;
+    beam_former_init(&bf, rate, MICS, sizes[k]);
+    beam_circular_array(&bf, RADIUS);
+    beam_former_steer(&bf, 6);
+    run(&bf, x, sizes[k], k == 0 ? &ref : &y);
+    if (k) same = same && memcmp(ref.data(), y.data(), y.size() * sizeof(float)) == 0;
+    beam_former_free(&bf);
+  }
+  printf("blocks: 1, 7, 160 and 480 frames %s\n", same ? "agree bit for bit" : "DISAGREE");
+  expect(same, "blocks", "the beams depend on the block size");
+}
+
+/* What it costs without the planes: per frame, beam, microphone and tap,
+   straight from interleaved history. */
+static void scalar_beams(const beam_former *bf, const float *x, uint32_t frames, float *out) {
+  for (uint32_t f = 0; f < frames; f++)
+    for (uint32_t i = 0; i < bf->beams; i++) {
+      float acc = 0;
+      for (uint32_t m = 0; m < bf->mics; m++)
+        for (int t = 0; t < BEAM_TAPS; t++)
+          acc += bf->taps[i][m][t] * x[((size_t) f + bf->history - bf->delay[i][m] - t) * bf->mics + m];
+      out[(size_t) f * bf->beams + i] = acc;
+    }
+}
+
+static void check_cost() {
+  const uint32_t shapes[][3] = { { 16000, 4, 4 }, { 16000, 8, 8 }, { 48000, 8, 8 }, { 48000, 16, 16 } };
+  for (int k = 0; k < 4; k++) {
+    uint32_t rate = shapes[k][0], mics = shapes[k][1], beams = shapes[k][2], block = rate / 100;
+    beam_former bf;
+    beam_former_init(&bf, rate, mics, block);
+    beam_circular_array(&bf, RADIUS * mics / 8);
+    beam_former_steer(&bf, beams);
+    std::vector<int16_t> in((size_t) block * mics);
+    for (size_t i = 0; i < in.size(); i++) in[i] = (int16_t) (3000 * sin(i * 0.013));
+    std::vector<float> interleaved(((size_t) block + bf.history) * mics, 0.1f), out((size_t) block * beams);
+    uint32_t blocks = 200;
+    int64_t t = mock_monotonic_ns();
+    for (uint32_t n = 0; n < blocks; n++) {
+      beam_former_input_s16(&bf, in.data(), block);
+      beam_former_process(&bf, block);
+    }
+    double ns = (double) (mock_monotonic_ns() - t);
+    t = mock_monotonic_ns();
+    for (uint32_t n = 0; n < blocks; n++)
+      scalar_beams(&bf, interleaved.data(), block, out.data());
+    double scalar = (double) (mock_monotonic_ns() - t);
+    double per = (double) blocks * block * beams;
+    printf("cost:   %2u mics -> %2u beams at %u Hz: %.2f ns per frame per beam (scalar %.2f), %.2f%% of a core\n",
+           mics, beams, rate, ns / per, scalar / per, 100 * ns / (blocks * 1e7));
+    beam_former_free(&bf);
+  }
+}
+
+int main() {
+  check_gain_and_steer();
+  check_noise();
+  check_blocks();
+  check_cost();
+  if (failures) {
+    fprintf(stderr, "%d failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+/*
+  Delay-and-sum beams from a microphone array: N fixed look directions,
+  computed on the device so only the beams go upstream, not every raw
+  channel.
+
+  For a far-field source in direction u, microphone m at position p_m
+  hears the wave (p_m . u) / c earlier than the array's centre. Beam b
+  delays every channel by its lead for the beam's direction (less the
+  smallest lead, so all delays are causal) and averages: the look
+  direction adds up coherently, sound from elsewhere and uncorrelated
+  noise do not (noise drops by 10 log10(mics) dB). The delays are
+  fractional: each (beam, channel) pair is an integer delay and a
+  BEAM_TAPS-tap windowed-sinc interpolator, worked out once at init.
+
+  Channels are kept planar, each plane `history` samples of the previous
+  block followed by the current one, 64-byte aligned. The kernel walks
+  the block BEAM_CHUNK frames at a time with the chunk's accumulators in
+  L1, and for each channel and tap adds a shifted run of that plane,
+  BEAM_GROUP frames per step, so the inner loop is a contiguous
+  multiply-add over frames which the compiler vectorizes. Beams are
+  planar too.
+
+    beam_former bf;
+    beam_former_init(&bf, rate, mics, max_block_frames);
+    beam_circular_array(&bf, 0.0425);              // or set bf.x[m], bf.y[m]
+    beam_former_steer(&bf, 8);                     // 8 beams, 45 degrees apart
+    beam_former_input_s16(&bf, samples, frames);   // interleaved, or
+    beam_former_input_plane(&bf, m, plane, frames);   // per channel
+    beam_former_process(&bf, frames);
+    const float *beam = beam_former_beam(&bf, b);  // frames samples
+
+  beam_former_energy() and beam_former_loudest() say which beam has the
+  most power, a coarse direction of arrival. Azimuths are radians,
+  counterclockwise from the x axis; microphone 0 of a circular array is
+  on the x axis. C++11.
+*/
+#ifndef BEAMFORMER_H_
+#define BEAMFORMER_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BEAM_MAX_MICS 32
+#define BEAM_MAX_BEAMS 32
+#define BEAM_TAPS 8
+#define BEAM_CHUNK 64
+#define BEAM_GROUP 8           /* frames per vector step; the planes are padded for one */
+#define BEAM_SOUND_SPEED 343.0
+
+struct beam_former {
+  uint32_t rate;
+  uint32_t mics;
+  uint32_t max_frames;
+  uint32_t beams;
+  uint32_t history;        /* samples of the last block kept per plane */
+  float x[BEAM_MAX_MICS], y[BEAM_MAX_MICS];   /* metres */
+  double azimuth[BEAM_MAX_BEAMS];
+  /* Per beam and microphone: whole samples of delay, and the taps that
+     add the fraction (already divided by mics). */
+  uint32_t delay[BEAM_MAX_BEAMS][BEAM_MAX_MICS];
+  float taps[BEAM_MAX_BEAMS][BEAM_MAX_MICS][BEAM_TAPS];
+  uint32_t stride;         /* floats per plane */
+  float *planes;           /* mics x stride */
+  float *out;              /* beams x max_frames */
+  double energy[BEAM_MAX_BEAMS];   /* sum of squares since the last read */
+};
+
+static inline void beam_former_free(beam_former *b) {
+  free(b->planes);
+  free(b->out);
+  b->planes = b->out = NULL;
+}
+
+/* The planes hold up to `max_delay_ms` of past samples, enough for an
+   array `c * max_delay_ms` across. False on bad parameters or no memory. */
+static inline bool beam_former_init(beam_former *b, uint32_t rate, uint32_t mics, uint32_t max_frames,
+                                    double max_delay_ms = 2.0) {
+  memset(b, 0, sizeof(*b));
+  if (!rate || !mics || mics > BEAM_MAX_MICS || !max_frames)
+    return false;
+  b->rate = rate;
+  b->mics = mics;
+  b->max_frames = max_frames;
+  b->history = ((uint32_t) ceil(max_delay_ms * rate / 1000) + BEAM_TAPS + 15) & ~15u;
+  b->stride = (b->history + max_frames + BEAM_GROUP + 15) & ~15u;
+  if (posix_memalign((void**) &b->planes, 64, sizeof(float) * mics * b->stride) != 0 ||
+      posix_memalign((void**) &b->out, 64, sizeof(float) * BEAM_MAX_BEAMS * max_frames) != 0) {
+    beam_former_free(b);
+    return false;
+  }
+  memset(b->planes, 0, sizeof(float) * mics * b->stride);
+  memset(b->out, 0, sizeof(float) * BEAM_MAX_BEAMS * max_frames);
+  return true;
+}
+
+/* Microphones evenly on a circle, the first on the x axis. */
+static inline void beam_circular_array(beam_former *b, double radius) {
+  for (uint32_t m = 0; m < b->mics; m++) {
+    b->x[m] = (float) (radius * cos(2 * M_PI * m / b->mics));
+    b->y[m] = (float) (radius * sin(2 * M_PI * m / b->mics));
+  }
+}
+
+/* Delays for one more look direction; false when full or when the array
+   is too wide for the history. */
+static inline bool beam_former_add(beam_former *b, double azimuth) {
+  if (b->beams == BEAM_MAX_BEAMS)
+    return false;
+  uint32_t i = b->beams;
+  double lead[BEAM_MAX_MICS], least = 0;
+  for (uint32_t m = 0; m < b->mics; m++) {
+    lead[m] = (b->x[m] * cos(azimuth) + b->y[m] * sin(azimuth)) / BEAM_SOUND_SPEED * b->rate;
+    if (m == 0 || lead[m] < least) least = lead[m];
+  }
+  for (uint32_t m = 0; m < b->mics; m++) {
+    /* The filter's own centre is BEAM_TAPS / 2 - 1 samples in. */
+    double d = lead[m] - least;
+    uint32_t whole = (uint32_t) floor(d);
+    double frac = d - whole, sum = 0;
+    if (whole + BEAM_TAPS > b->history)
+      return false;
+    float *h = b->taps[i][m];
+    for (int t = 0; t < BEAM_TAPS; t++) {
+      double u = t - (BEAM_TAPS / 2 - 1) - frac;
+      double w = 0.5 + 0.5 * cos(M_PI * u / (BEAM_TAPS / 2));   /* Hann, over +-taps/2 */
+      double s = fabs(u) < 1e-9 ? 1.0 : sin(M_PI * u) / (M_PI * u);
+      h[t] = (float) (s * w);
+      sum += s * w;
+    }
+    /* Unity gain at DC, and the average over the channels. */
+    for (int t = 0; t < BEAM_TAPS; t++)
+      h[t] = (float) (h[t] / sum / b->mics);
+    b->delay[i][m] = whole;
+  }
+  b->azimuth[i] = azimuth;
+  b->beams++;
+  return true;
+}
+
+/* `beams` directions evenly around the circle, the first along x. */
+static inline bool beam_former_steer(beam_former *b, uint32_t beams) {
+  b->beams = 0;
+  for (uint32_t i = 0; i < beams; i++)
+    if (!beam_former_add(b, 2 * M_PI * i / beams))
+      return false;
+  return true;
+}
+
+static inline float *beam_former_plane(beam_former *b, uint32_t mic) {
+  return b->planes + (size_t) mic * b->stride + b->history;
+}
+
+/* One channel's block, already planar. */
+static inline void beam_former_input_plane(beam_former *b, uint32_t mic, const float *x, uint32_t frames) {
+  memcpy(beam_former_plane(b, mic), x, sizeof(float) * frames);
+}
+
+template <typename T>
+static inline void beam_former_input(beam_former *b, const T *x, uint32_t frames, float scale) {
+  for (uint32_t m = 0; m < b->mics; m++) {
+    float *p = beam_former_plane(b, m);
+    const T *s = x + m;
+    for (uint32_t f = 0; f < frames; f++, s += b->mics)
+      p[f] = (float) *s * scale;
+  }
+}
+
+/* An interleaved block of all the microphones. */
+static inline void beam_former_input_s16(beam_former *b, const int16_t *x, uint32_t frames) {
+  beam_former_input(b, x, frames, 1.0f / 32768);
+}
+
+static inline void beam_former_input_f32(beam_former *b, const float *x, uint32_t frames) {
+  beam_former_input(b, x, frames, 1.0f);
+}
+
+/* Every beam for the block put in (at most max_frames). */
+static inline void beam_former_process(beam_former *b, uint32_t frames) {
+  for (uint32_t i = 0; i < b->beams; i++) {
+    float *out = b->out + (size_t) i * b->max_frames;
+    double energy = 0;
+    for (uint32_t f = 0; f < frames; f += BEAM_CHUNK) {
+      uint32_t n = frames - f < BEAM_CHUNK ? frames - f : BEAM_CHUNK;
+      /* Whole groups: a few frames past the block are summed and dropped. */
+      uint32_t groups = (n + BEAM_GROUP - 1) / BEAM_GROUP;
+      float acc[BEAM_CHUNK] = {};
+      for (uint32_t m = 0; m < b->mics; m++) {
+        /* Tap t reads the sample delay + t before each output frame. */
+        const float *src = beam_former_plane(b, m) + f - b->delay[i][m];
+        const float *h = b->taps[i][m];
+        for (int t = 0; t < BEAM_TAPS; t++) {
+          const float g = h[t], *s = src - t;
+          for (uint32_t j = 0; j < groups * BEAM_GROUP; j += BEAM_GROUP)
+            for (uint32_t k = 0; k < BEAM_GROUP; k++)
+              acc[j + k] += g * s[j + k];
+        }
+      }
+      float sum = 0;
+      for (uint32_t k = 0; k < n; k++) {
+        out[f + k] = acc[k];
+        sum += acc[k] * acc[k];
+      }
+      energy += sum;
+    }
+    b->energy[i] += energy;
+  }
+  /* The end of this block is the next one's past. */
+  for (uint32_t m = 0; m < b->mics; m++) {
+    float *p = beam_former_plane(b, m);
+    memmove(p - b->history, p + frames - b->history, sizeof(float) * b->history);
+  }
+}
+
+static inline const float *beam_former_beam(const beam_former *b, uint32_t beam) {
+  return b->out + (size_t) beam * b->max_frames;
+}
+
+/* Each beam's mean square since the last call, over `frames` frames;
+   then starts again. */
+static inline void beam_former_energy(beam_former *b, uint64_t frames, double *energy) {
+  for (uint32_t i = 0; i < b->beams; i++) {
+    energy[i] = frames ? b->energy[i] / frames : 0;
+    b->energy[i] = 0;
+  }
+}
+
+/* The loudest beam over `frames` frames (as beam_former_energy). */
+static inline uint32_t beam_former_loudest(beam_former *b, uint64_t frames) {
+  double e[BEAM_MAX_BEAMS];
+  beam_former_energy(b, frames, e);
+  uint32_t best = 0;
+  for (uint32_t i = 1; i < b->beams; i++)
+    if (e[i] > e[best]) best = i;
+  return best;
+}
+
+/* Interleaved beams, one per channel of x. */
+static inline void beam_former_output_s16(const beam_former *b, int16_t *x, uint32_t frames) {
+  for (uint32_t i = 0; i < b->beams; i++) {
+    const float *p = beam_former_beam(b, i);
+    for (uint32_t f = 0; f < frames; f++) {
+      float v = p[f] * 32768.0f;
+      x[(size_t) f * b->beams + i] =
+          (int16_t) (v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : (int) (v + (v < 0 ? -0.5f : 0.5f)));
+    }
+  }
+}
+
+static inline void beam_former_output_f32(const beam_former *b, float *x, uint32_t frames) {
+  for (uint32_t i = 0; i < b->beams; i++) {
+    const float *p = beam_former_beam(b, i);
+    for (uint32_t f = 0; f < frames; f++)
+      x[(size_t) f * b->beams + i] = p[f];
+  }
+}
+
+static inline void beam_former_print(const beam_former *b, FILE *out) {
+  uint32_t most = 0;
+  for (uint32_t i = 0; i < b->beams; i++)
+    for (uint32_t m = 0; m < b->mics; m++)
+      if (b->delay[i][m] > most) most = b->delay[i][m];
+  fprintf(out, "beamformer: %u microphones at %u Hz, %u beams, delays up to %u samples (+%d taps), %u kept\n",
+          b->mics, b->rate, b->beams, most, BEAM_TAPS, b->history);
+}
+
+#endif  // BEAMFORMER_H_
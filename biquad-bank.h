@@ -0,0 +1,298 @@
+/*
+  Signal conditioning right after capture: a cascade of biquads (a DC
+  blocker, a high-pass against rumble, anything else) and an optional
+  band split, for many channels and streams at once.
+
+  Cheap USB microphones come with large DC offsets and low-frequency
+  rumble, which throw off levels, loudness, onsets and codecs alike. The
+  bank runs the same chain on every lane, one lane per channel of each
+  stream (lane = stream * channels + channel), like loudness-meter.h:
+  blocks are put side by side, and each section runs over the whole
+  block BIQUAD_LANES lanes at a time (the last 4 at a time) in transposed
+  direct form II, which the compiler vectorizes. The state of every
+  section and lane carries over from block to block, so the output does
+  not depend on how the signal was cut.
+
+  The split is a 4th-order Linkwitz-Riley crossover (two Butterworth
+  sections each way) after the chain: low + high is the conditioned
+  signal up to phase, flat in magnitude.
+
+    biquad_bank bank;
+    biquad_bank_init(&bank, channels, streams, max_block_frames);
+    biquad_bank_add(&bank, biquad_dc_blocker(rate, 10));
+    biquad_bank_add(&bank, biquad_highpass(rate, 80, M_SQRT1_2));
+    biquad_bank_split(&bank, rate, 1000);                     // optional
+    biquad_bank_input_s16(&bank, stream, samples, frames);    // each stream
+    biquad_bank_process(&bank, frames);                       // then all at once
+    biquad_bank_output_s16(&bank, stream, samples, frames, BIQUAD_FULL);
+
+  One stream, in place: biquad_process_s16(&bank, samples, frames). From a
+  spec ("dc=10,hp=80,order=4,split=1000"): biquad_bank_configure().
+  C++11.
+*/
+#ifndef BIQUAD_BANK_H_
+#define BIQUAD_BANK_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIQUAD_LANES 8
+#define BIQUAD_MAX_SECTIONS 8
+
+enum biquad_band { BIQUAD_FULL, BIQUAD_LOW, BIQUAD_HIGH };
+
+/* y = b0 x + s1; s1 = b1 x - a1 y + s2; s2 = b2 x - a2 y */
+struct biquad_coeffs {
+  float b0, b1, b2, a1, a2;
+};
+
+struct biquad_bank {
+  uint32_t channels;
+  uint32_t streams;
+  uint32_t lanes;          /* streams * channels, rounded up to 4 */
+  uint32_t max_frames;
+  uint32_t sections;
+  biquad_coeffs chain[BIQUAD_MAX_SECTIONS];
+  bool split;
+  biquad_coeffs split_low[2], split_high[2];
+  /* Per section, then the split's four: s1 and s2 per lane. */
+  float *state;
+  float *input;            /* max_frames x lanes, filtered in place */
+  float *low, *high;       /* the same, when split */
+};
+
+/* First order, as a biquad: (1 - z^-1) / (1 - R z^-1), unity gain at
+   Nyquist; -3 dB at hz. */
+static inline biquad_coeffs biquad_dc_blocker(double rate, double hz) {
+  double r = exp(-2 * M_PI * hz / rate), g = (1 + r) / 2;
+  biquad_coeffs c = { (float) g, (float) -g, 0.0f, (float) -r, 0.0f };
+  return c;
+}
+
+/* The Audio EQ Cookbook's. */
+static inline biquad_coeffs biquad_highpass(double rate, double hz, double q) {
+  double w = 2 * M_PI * hz / rate, alpha = sin(w) / (2 * q), cw = cos(w), a0 = 1 + alpha;
+  biquad_coeffs c = { (float) ((1 + cw) / 2 / a0), (float) (-(1 + cw) / a0), (float) ((1 + cw) / 2 / a0),
+                      (float) (-2 * cw / a0), (float) ((1 - alpha) / a0) };
+  return c;
+}
+
+static inline biquad_coeffs biquad_lowpass(double rate, double hz, double q) {
+  double w = 2 * M_PI * hz / rate, alpha = sin(w) / (2 * q), cw = cos(w), a0 = 1 + alpha;
+  biquad_coeffs c = { (float) ((1 - cw) / 2 / a0), (float) ((1 - cw) / a0), (float) ((1 - cw) / 2 / a0),
+                      (float) (-2 * cw / a0), (float) ((1 - alpha) / a0) };
+  return c;
+}
+
+static inline void biquad_bank_free(biquad_bank *b) {
+  free(b->state);
+  free(b->input);
+  b->state = b->input = b->low = b->high = NULL;
+}
+
+/* Returns false on bad parameters or no memory. */
+static inline bool biquad_bank_init(biquad_bank *b, uint32_t channels, uint32_t streams, uint32_t max_frames) {
+  memset(b, 0, sizeof(*b));
+  if (!channels || !streams || !max_frames)
+    return false;
+  b->channels = channels;
+  b->streams = streams;
+  b->lanes = (streams * channels + 3) / 4 * 4;
+  b->max_frames = max_frames;
+  size_t state = sizeof(float) * 2 * b->lanes * (BIQUAD_MAX_SECTIONS + 4);
+  size_t planes = sizeof(float) * b->lanes * max_frames;
+  if (posix_memalign((void**) &b->state, 64, state) != 0 || posix_memalign((void**) &b->input, 64, 3 * planes) != 0) {
+    biquad_bank_free(b);
+    return false;
+  }
+  memset(b->state, 0, state);
+  memset(b->input, 0, 3 * planes);
+  b->low = b->input + (size_t) b->lanes * max_frames;
+  b->high = b->low + (size_t) b->lanes * max_frames;
+  return true;
+}
+
+/* False when the chain is full. */
+static inline bool biquad_bank_add(biquad_bank *b, biquad_coeffs c) {
+  if (b->sections == BIQUAD_MAX_SECTIONS)
+    return false;
+  b->chain[b->sections++] = c;
+  return true;
+}
+
+static inline void biquad_bank_split(biquad_bank *b, double rate, double hz) {
+  b->split = true;
+  b->split_low[0] = b->split_low[1] = biquad_lowpass(rate, hz, M_SQRT1_2);
+  b->split_high[0] = b->split_high[1] = biquad_highpass(rate, hz, M_SQRT1_2);
+}
+
+/* Silence in every section. */
+static inline void biquad_bank_reset(biquad_bank *b) {
+  memset(b->state, 0, sizeof(float) * 2 * b->lanes * (BIQUAD_MAX_SECTIONS + 4));
+}
+
+/* "dc=HZ,hp=HZ,q=Q,order=2|4,split=HZ", any of them: the DC blocker, a
+   high-pass of one or two sections, the crossover. False when malformed. */
+static inline bool biquad_bank_configure(biquad_bank *b, double rate, const char *spec) {
+  double dc = 0, hp = 0, q = M_SQRT1_2, split = 0;
+  int order = 2;
+  while (spec && *spec) {
+    char key[16];
+    double v;
+    int used = 0;
+    if (sscanf(spec, "%15[a-z]=%lf%n", key, &v, &used) != 2)
+      return false;
+    if (!strcmp(key, "dc")) dc = v;
+    else if (!strcmp(key, "hp")) hp = v;
+    else if (!strcmp(key, "q")) q = v;
+    else if (!strcmp(key, "order")) order = (int) v;
+    else if (!strcmp(key, "split")) split = v;
+    else return false;
+    spec += used;
+    if (*spec == ',') spec++;
+    else if (*spec) return false;
+  }
+  if (dc < 0 || hp < 0 || split < 0 || q <= 0 || (order != 2 && order != 4) || dc >= rate / 2 || hp >= rate / 2 ||
+      split >= rate / 2)
+    return false;
+  if (dc > 0)
+    biquad_bank_add(b, biquad_dc_blocker(rate, dc));
+  /* Fourth order: two Butterworth sections, Q 0.54 and 1.31. */
+  if (hp > 0 && order == 2)
+    biquad_bank_add(b, biquad_highpass(rate, hp, q));
+  if (hp > 0 && order == 4) {
+    biquad_bank_add(b, biquad_highpass(rate, hp, 0.5411961));
+    biquad_bank_add(b, biquad_highpass(rate, hp, 1.3065630));
+  }
+  if (split > 0)
+    biquad_bank_split(b, rate, split);
+  return true;
+}
+
+/* Put one stream's interleaved block into its lanes. */
+template <typename T>
+static inline void biquad_bank_input(biquad_bank *b, uint32_t stream, const T *x, uint32_t frames, float scale) {
+  float *in = b->input + stream * b->channels;
+  for (uint32_t f = 0; f < frames; f++, in += b->lanes, x += b->channels)
+    for (uint32_t c = 0; c < b->channels; c++)
+      in[c] = (float) x[c] * scale;
+}
+
+static inline void biquad_bank_input_s16(biquad_bank *b, uint32_t stream, const int16_t *x, uint32_t frames) {
+  biquad_bank_input(b, stream, x, frames, 1.0f / 32768);
+}
+
+static inline void biquad_bank_input_f32(biquad_bank *b, uint32_t stream, const float *x, uint32_t frames) {
+  biquad_bank_input(b, stream, x, frames, 1.0f);
+}
+
+/* One section over lanes base .. base + width of `frames` frames; in and
+   out may be the same plane. */
+template <uint32_t width>
+static inline void biquad_section(const biquad_coeffs &c, float *state, uint32_t lanes, uint32_t base,
+                                  const float *in, float *out, uint32_t frames) {
+  const float b0 = c.b0, b1 = c.b1, b2 = c.b2, a1 = c.a1, a2 = c.a2;
+  float s1[width], s2[width];
+  for (uint32_t k = 0; k < width; k++) {
+    s1[k] = state[base + k];
+    s2[k] = state[lanes + base + k];
+  }
+  in += base;
+  out += base;
+  for (uint32_t f = 0; f < frames; f++, in += lanes, out += lanes) {
+    /* All loads before any store: in and out may be the same. */
+    float x[width], y[width];
+    for (uint32_t k = 0; k < width; k++)
+      x[k] = in[k];
+    for (uint32_t k = 0; k < width; k++) {
+      y[k] = b0 * x[k] + s1[k];
+      s1[k] = b1 * x[k] - a1 * y[k] + s2[k];
+      s2[k] = b2 * x[k] - a2 * y[k];
+    }
+    for (uint32_t k = 0; k < width; k++)
+      out[k] = y[k];
+  }
+  for (uint32_t k = 0; k < width; k++) {
+    /* No denormals in the tail of a silence. */
+    state[base + k] = fabsf(s1[k]) < 1e-20f ? 0 : s1[k];
+    state[lanes + base + k] = fabsf(s2[k]) < 1e-20f ? 0 : s2[k];
+  }
+}
+
+static inline void biquad_bank_run(biquad_bank *b, const biquad_coeffs &c, float *state, const float *in, float *out,
+                                   uint32_t frames) {
+  uint32_t base = 0;
+  for (; base + BIQUAD_LANES <= b->lanes; base += BIQUAD_LANES)
+    biquad_section<BIQUAD_LANES>(c, state, b->lanes, base, in, out, frames);
+  if (base < b->lanes)
+    biquad_section<BIQUAD_LANES / 2>(c, state, b->lanes, base, in, out, frames);
+}
+
+/* Filter the block every stream has put in (at most max_frames). */
+static inline void biquad_bank_process(biquad_bank *b, uint32_t frames) {
+  float *state = b->state;
+  for (uint32_t i = 0; i < b->sections; i++, state += 2 * b->lanes)
+    biquad_bank_run(b, b->chain[i], state, b->input, b->input, frames);
+  if (!b->split)
+    return;
+  state = b->state + 2 * b->lanes * BIQUAD_MAX_SECTIONS;
+  biquad_bank_run(b, b->split_low[0], state, b->input, b->low, frames);
+  biquad_bank_run(b, b->split_low[1], state + 2 * b->lanes, b->low, b->low, frames);
+  biquad_bank_run(b, b->split_high[0], state + 4 * b->lanes, b->input, b->high, frames);
+  biquad_bank_run(b, b->split_high[1], state + 6 * b->lanes, b->high, b->high, frames);
+}
+
+static inline const float *biquad_bank_plane(const biquad_bank *b, biquad_band band) {
+  return band == BIQUAD_LOW && b->split ? b->low : band == BIQUAD_HIGH && b->split ? b->high : b->input;
+}
+
+/* One stream's lanes back to interleaved samples. */
+static inline void biquad_bank_output_f32(const biquad_bank *b, uint32_t stream, float *x, uint32_t frames,
+                                          biquad_band band) {
+  const float *out = biquad_bank_plane(b, band) + stream * b->channels;
+  for (uint32_t f = 0; f < frames; f++, out += b->lanes, x += b->channels)
+    for (uint32_t c = 0; c < b->channels; c++)
+      x[c] = out[c];
+}
+
+static inline void biquad_bank_output_s16(const biquad_bank *b, uint32_t stream, int16_t *x, uint32_t frames,
+                                          biquad_band band) {
+  const float *out = biquad_bank_plane(b, band) + stream * b->channels;
+  for (uint32_t f = 0; f < frames; f++, out += b->lanes, x += b->channels)
+    for (uint32_t c = 0; c < b->channels; c++) {
+      float v = out[c] * 32768.0f;
+      x[c] = (int16_t) (v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : (int) (v + (v < 0 ? -0.5f : 0.5f)));
+    }
+}
+
+/* A bank of one stream, in place: any block size. */
+template <typename T>
+static inline void biquad_process(biquad_bank *b, T *x, uint32_t frames, biquad_band band) {
+  while (frames) {
+    uint32_t n = frames < b->max_frames ? frames : b->max_frames;
+    biquad_bank_input(b, 0, x, n, sizeof(T) == 2 ? 1.0f / 32768 : 1.0f);
+    biquad_bank_process(b, n);
+    if (sizeof(T) == 2) biquad_bank_output_s16(b, 0, (int16_t*) x, n, band);
+    else biquad_bank_output_f32(b, 0, (float*) x, n, band);
+    x += (size_t) n * b->channels;
+    frames -= n;
+  }
+}
+
+static inline void biquad_process_s16(biquad_bank *b, int16_t *x, uint32_t frames) {
+  biquad_process(b, x, frames, BIQUAD_FULL);
+}
+
+static inline void biquad_process_f32(biquad_bank *b, float *x, uint32_t frames) {
+  biquad_process(b, x, frames, BIQUAD_FULL);
+}
+
+static inline void biquad_bank_print(const biquad_bank *b, FILE *out) {
+  fprintf(out, "biquad bank: %u streams x %u channels in %u lanes, %u sections%s\n", b->streams, b->channels,
+          b->lanes, b->sections, b->split ? " and a 4-section band split" : "");
+}
+
+#endif  // BIQUAD_BANK_H_
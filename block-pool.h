@@ -0,0 +1,249 @@
+/*
+  Preallocated audio blocks and the queues that hand them between threads.
+
+  The capture -> process -> sink path should not touch the heap once it
+  runs: malloc takes locks other threads may hold, and fresh memory page
+  faults on first use, and both land in the worst-case latency. So every
+  block the path will ever use is allocated up front in one mapping,
+  populated (and optionally locked) before capture starts, and blocks
+  circulate instead of being allocated:
+
+    capture: block_pool_get()  -> fill -> block_queue_push(to_process)
+    process: block_queue_pop() -> work -> block_queue_push(to_sink)
+    sink:    block_queue_pop() -> write -> block_pool_put()
+
+  The pool is a lock-free stack of block indices (tagged against ABA), so
+  any thread may get and put. A queue is single-producer single-consumer
+  and bounded; a consumer with nothing to do sleeps on a futex, which the
+  producer only wakes when someone is asleep. When the pool is empty the
+  capture side gets NULL and drops the block (counted) rather than
+  allocating one.
+
+    block_pool pool;
+    block_pool_init(&pool, 64, block_bytes, false);
+    block_queue q;
+    block_queue_init(&q, 64);
+    uint8_t *b = block_pool_get(&pool);
+    block_queue_push(&q, b, frames, capture_ns);
+    block_ref r;
+    if (block_queue_pop(&q, &r, 100)) ...
+    block_pool_put(&pool, r.data);
+
+  Linux only (mmap, futex), C++11.
+*/
+#ifndef BLOCK_POOL_H_
+#define BLOCK_POOL_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <atomic>
+
+#define BLOCK_POOL_ALIGN 64
+#define BLOCK_POOL_EMPTY 0xffffffffu
+
+struct block_pool {
+  uint8_t *memory;
+  size_t mapped;
+  size_t stride;          /* block_bytes rounded up to BLOCK_POOL_ALIGN */
+  uint32_t block_bytes;
+  uint32_t count;
+  bool locked;            /* mlock() succeeded */
+  uint32_t *next;         /* free-list links, inside the mapping */
+  std::atomic<uint64_t> top;        /* tag << 32 | index of the first free block */
+  std::atomic<uint32_t> available;
+  std::atomic<uint64_t> exhausted;  /* block_pool_get() that found nothing */
+  std::atomic<uint32_t> min_available;  /* low-water mark, for sizing */
+};
+
+/* A block in flight: its memory, and what the producer put in it. */
+struct block_ref {
+  uint8_t *data;
+  uint32_t frames;
+  int64_t capture_ns;
+};
+
+struct block_queue {
+  block_ref *slots;
+  uint32_t mask;
+  char pad0[64];
+  std::atomic<uint64_t> head;       /* next slot to write, producer */
+  char pad1[64];
+  std::atomic<uint64_t> tail;       /* next slot to read, consumer */
+  char pad2[64];
+  std::atomic<uint32_t> epoch;      /* futex word, bumped per push */
+  std::atomic<uint32_t> waiters;
+  std::atomic<bool> closed;
+  uint64_t full;                    /* pushes refused, producer side */
+  uint64_t max_depth;
+};
+
+static inline void block_pool_free(block_pool *p) {
+  if (p->memory) {
+    if (p->locked)
+      munlock(p->memory, p->mapped);
+    munmap(p->memory, p->mapped);
+  }
+  p->memory = NULL;
+}
+
+/* All memory is mapped and touched here, so nothing faults later; lock
+   also pins it (needs RLIMIT_MEMLOCK, otherwise it stays unlocked and
+   init still succeeds). Returns -1 with errno set on failure. */
+static inline int block_pool_init(block_pool *p, uint32_t count, uint32_t block_bytes, bool lock) {
+  p->memory = NULL;
+  if (!count || count == BLOCK_POOL_EMPTY || !block_bytes) {
+    errno = EINVAL;
+    return -1;
+  }
+  p->stride = ((size_t) block_bytes + BLOCK_POOL_ALIGN - 1) & ~(size_t) (BLOCK_POOL_ALIGN - 1);
+  p->block_bytes = block_bytes;
+  p->count = count;
+  size_t links = ((size_t) count * sizeof(uint32_t) + BLOCK_POOL_ALIGN - 1) & ~(size_t) (BLOCK_POOL_ALIGN - 1);
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  p->mapped = (p->stride * count + links + page - 1) / page * page;
+  void *m = mmap(NULL, p->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (m == MAP_FAILED)
+    return -1;
+  p->memory = (uint8_t*) m;
+  /* MAP_POPULATE is only a hint: write every page once. */
+  for (size_t off = 0; off < p->mapped; off += page)
+    p->memory[off] = 0;
+  p->locked = lock && mlock(p->memory, p->mapped) == 0;
+
+  p->next = (uint32_t*) (p->memory + p->stride * count);
+  for (uint32_t i = 0; i < count; i++)
+    p->next[i] = i + 1 < count ? i + 1 : BLOCK_POOL_EMPTY;
+  p->top.store(0);
+  p->available.store(count);
+  p->exhausted.store(0);
+  p->min_available.store(count);
+  return 0;
+}
+
+static inline uint8_t *block_pool_get(block_pool *p) {
+  uint64_t top = p->top.load(std::memory_order_acquire);
+  for (;;) {
+    uint32_t index = (uint32_t) top;
+    if (index == BLOCK_POOL_EMPTY) {
+      p->exhausted.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+    /* Another thread may be relinking this block; the tag makes the CAS
+       fail then, but the read itself must not tear. */
+    uint64_t next = ((top >> 32) + 1) << 32 | __atomic_load_n(&p->next[index], __ATOMIC_RELAXED);
+    if (p->top.compare_exchange_weak(top, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      uint32_t left = p->available.fetch_sub(1, std::memory_order_relaxed) - 1;
+      if (left < p->min_available.load(std::memory_order_relaxed))
+        p->min_available.store(left, std::memory_order_relaxed);  /* racy, only a statistic */
+      return p->memory + p->stride * index;
+    }
+  }
+}
+
+static inline void block_pool_put(block_pool *p, uint8_t *block) {
+  uint32_t index = (uint32_t) ((size_t) (block - p->memory) / p->stride);
+  uint64_t top = p->top.load(std::memory_order_relaxed);
+  for (;;) {
+    __atomic_store_n(&p->next[index], (uint32_t) top, __ATOMIC_RELAXED);
+    uint64_t next = ((top >> 32) + 1) << 32 | index;
+    if (p->top.compare_exchange_weak(top, next, std::memory_order_release, std::memory_order_relaxed))
+      break;
+  }
+  p->available.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* capacity must be a power of two. The slots are allocated here, once. */
+static inline bool block_queue_init(block_queue *q, uint32_t capacity) {
+  if (!capacity || (capacity & (capacity - 1)))
+    return false;
+  if (posix_memalign((void**) &q->slots, BLOCK_POOL_ALIGN, capacity * sizeof(block_ref)) != 0)
+    return false;
+  memset(q->slots, 0, capacity * sizeof(block_ref));
+  q->mask = capacity - 1;
+  q->head.store(0);
+  q->tail.store(0);
+  q->epoch.store(0);
+  q->waiters.store(0);
+  q->closed.store(false);
+  q->full = q->max_depth = 0;
+  return true;
+}
+
+static inline void block_queue_free(block_queue *q) {
+  free(q->slots);
+  q->slots = NULL;
+}
+
+static inline void block_queue_wake(block_queue *q) {
+  q->epoch.fetch_add(1, std::memory_order_release);
+  if (q->waiters.load(std::memory_order_acquire))
+    syscall(SYS_futex, &q->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Producer. False when the queue is full: the caller still owns the block. */
+static inline bool block_queue_push(block_queue *q, uint8_t *data, uint32_t frames, int64_t capture_ns) {
+  uint64_t head = q->head.load(std::memory_order_relaxed);
+  uint64_t depth = head - q->tail.load(std::memory_order_acquire);
+  if (depth > q->mask) {
+    q->full++;
+    return false;
+  }
+  block_ref *r = &q->slots[head & q->mask];
+  r->data = data;
+  r->frames = frames;
+  r->capture_ns = capture_ns;
+  q->head.store(head + 1, std::memory_order_release);
+  if (depth + 1 > q->max_depth)
+    q->max_depth = depth + 1;
+  block_queue_wake(q);
+  return true;
+}
+
+/* Producer: no more blocks; the consumer drains what is left, then pop fails. */
+static inline void block_queue_close(block_queue *q) {
+  q->closed.store(true, std::memory_order_release);
+  block_queue_wake(q);
+}
+
+/* Consumer. Waits up to timeout_ms (-1 forever) for a block; false on
+   timeout, or once closed and drained. */
+static inline bool block_queue_pop(block_queue *q, block_ref *out, int timeout_ms) {
+  for (;;) {
+    uint32_t epoch = q->epoch.load(std::memory_order_acquire);
+    uint64_t tail = q->tail.load(std::memory_order_relaxed);
+    if (tail != q->head.load(std::memory_order_acquire)) {
+      *out = q->slots[tail & q->mask];
+      q->tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+    if (q->closed.load(std::memory_order_acquire) || !timeout_ms)
+      return false;
+    struct timespec ts = { timeout_ms / 1000, (long) (timeout_ms % 1000) * 1000000 };
+    q->waiters.fetch_add(1, std::memory_order_acq_rel);
+    if (q->epoch.load(std::memory_order_acquire) == epoch) {
+      long r = syscall(SYS_futex, &q->epoch, FUTEX_WAIT_PRIVATE, epoch, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+      if (r < 0 && errno == ETIMEDOUT) {
+        q->waiters.fetch_sub(1, std::memory_order_acq_rel);
+        return false;
+      }
+    }
+    q->waiters.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+static inline void block_pool_print_stats(const block_pool *p, FILE *out) {
+  fprintf(out, "block pool: %u blocks of %u bytes (%lu KiB%s), %u in use at most, %lu times empty\n",
+          p->count, p->block_bytes, (unsigned long) (p->mapped / 1024), p->locked ? ", locked" : "",
+          p->count - p->min_available.load(), (unsigned long) p->exhausted.load());
+}
+
+#endif  // BLOCK_POOL_H_
@@ -0,0 +1,249 @@
+/*
+  Single-producer, multi-consumer broadcast ring.
+
+  The capture loop writes every block once into a fixed ring of slots.
+  Each consumer keeps its own read cursor and reads the slots in place,
+  so N consumers cost no copies. The producer never waits for a
+  consumer: a consumer that falls a full ring behind is lapped, and its
+  policy decides where it resumes.
+
+    BROADCAST_DROP  jump to the newest block (meters, live displays)
+    BROADCAST_LAG   resume from the oldest block still in the ring
+                    (recorders: lose as little as possible)
+
+  Slots carry a sequence number written around the data (seqlock), so a
+  consumer that was still reading a slot while it got overwritten finds
+  out in broadcast_release() and can discard what it computed.
+
+  Linux only (futex wake-ups), C++11.
+*/
+#ifndef BROADCAST_RING_H_
+#define BROADCAST_RING_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <atomic>
+
+#define BROADCAST_MAX_CONSUMERS 16
+#define BROADCAST_CACHELINE 64
+
+enum broadcast_policy { BROADCAST_DROP, BROADCAST_LAG };
+
+struct broadcast_block {
+  uint64_t seq;
+  int64_t timestamp_ns;   /* capture time of the first frame */
+  uint32_t frames;
+  uint32_t bytes;
+  const void *data;
+};
+
+struct broadcast_slot {
+  std::atomic<uint64_t> seq;
+  int64_t timestamp_ns;
+  uint32_t frames;
+  uint32_t bytes;
+  uint8_t *data;
+};
+
+struct alignas(BROADCAST_CACHELINE) broadcast_consumer {
+  const char *name;
+  broadcast_policy policy;
+  uint64_t slow_threshold;      /* lag in blocks that counts as slow */
+  uint64_t next;                /* next seq to read */
+  std::atomic<bool> active;
+  std::atomic<bool> slow;
+  std::atomic<uint64_t> read;
+  std::atomic<uint64_t> dropped;  /* blocks skipped after being lapped */
+  std::atomic<uint64_t> torn;     /* blocks overwritten while being read */
+  std::atomic<uint64_t> slow_events;
+  std::atomic<uint64_t> max_lag;
+};
+
+struct broadcast_ring {
+  broadcast_slot *slots;
+  uint64_t mask;
+  uint64_t guard;               /* slots kept between a lapped reader and the writer */
+  uint32_t block_bytes;
+  uint8_t *memory;
+  alignas(BROADCAST_CACHELINE) std::atomic<uint64_t> head;   /* seq of the next block to write */
+  alignas(BROADCAST_CACHELINE) std::atomic<uint32_t> epoch;  /* futex word, bumped per commit */
+  std::atomic<uint32_t> waiters;
+  std::atomic<bool> closed;
+  broadcast_consumer consumers[BROADCAST_MAX_CONSUMERS];
+};
+
+static const uint64_t BROADCAST_WRITING = ~(uint64_t) 0;
+
+/* slots must be a power of two, at least 4. */
+static inline bool broadcast_init(broadcast_ring *r, uint32_t slots, uint32_t block_bytes) {
+  if (slots < 4 || (slots & (slots - 1)))
+    return false;
+  uint32_t stride = (block_bytes + BROADCAST_CACHELINE - 1) & ~(BROADCAST_CACHELINE - 1);
+  if (posix_memalign((void**) &r->memory, BROADCAST_CACHELINE, (size_t) stride * slots) != 0)
+    return false;
+  r->slots = new broadcast_slot[slots];
+  for (uint32_t i = 0; i < slots; i++) {
+    /* Nothing is valid yet: seq i + slots is never expected before lap 1. */
+    r->slots[i].seq.store(BROADCAST_WRITING, std::memory_order_relaxed);
+    r->slots[i].data = r->memory + (size_t) stride * i;
+    r->slots[i].frames = r->slots[i].bytes = 0;
+  }
+  r->mask = slots - 1;
+  r->guard = slots / 4;
+  r->block_bytes = block_bytes;
+  r->head.store(0);
+  r->epoch.store(0);
+  r->waiters.store(0);
+  r->closed.store(false);
+  for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++)
+    r->consumers[i].active.store(false);
+  return true;
+}
+
+static inline void broadcast_free(broadcast_ring *r) {
+  delete[] r->slots;
+  free(r->memory);
+  r->slots = NULL;
+  r->memory = NULL;
+}
+
+/* Register a consumer; it starts at the current head. Returns its id or -1. */
+static inline int broadcast_add_consumer(broadcast_ring *r, const char *name,
+                                         broadcast_policy policy,
+                                         uint64_t slow_threshold) {
+  for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+    broadcast_consumer *c = &r->consumers[i];
+    if (c->active.load())
+      continue;
+    c->name = name;
+    c->policy = policy;
+    c->slow_threshold = slow_threshold;
+    c->next = r->head.load(std::memory_order_acquire);
+    c->slow.store(false);
+    c->read.store(0);
+    c->dropped.store(0);
+    c->torn.store(0);
+    c->slow_events.store(0);
+    c->max_lag.store(0);
+    c->active.store(true);
+    return i;
+  }
+  return -1;
+}
+
+/* Producer: the slot to fill for the next block (never blocks). */
+static inline uint8_t *broadcast_begin_write(broadcast_ring *r) {
+  uint64_t seq = r->head.load(std::memory_order_relaxed);
+  broadcast_slot *slot = &r->slots[seq & r->mask];
+  slot->seq.store(BROADCAST_WRITING, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return slot->data;
+}
+
+static inline void broadcast_commit(broadcast_ring *r, uint32_t frames, uint32_t bytes,
+                                    int64_t timestamp_ns) {
+  uint64_t seq = r->head.load(std::memory_order_relaxed);
+  broadcast_slot *slot = &r->slots[seq & r->mask];
+  slot->frames = frames;
+  slot->bytes = bytes;
+  slot->timestamp_ns = timestamp_ns;
+  slot->seq.store(seq, std::memory_order_release);
+  r->head.store(seq + 1, std::memory_order_release);
+  r->epoch.fetch_add(1, std::memory_order_release);
+  if (r->waiters.load(std::memory_order_acquire))
+    syscall(SYS_futex, &r->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Producer: wake every consumer and make them return false once drained. */
+static inline void broadcast_close(broadcast_ring *r) {
+  r->closed.store(true, std::memory_order_release);
+  r->epoch.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, &r->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Consumer: get the next block without copying. Waits up to timeout_ms
+   (-1 forever) when caught up. Returns false on timeout or after close. */
+static inline bool broadcast_acquire(broadcast_ring *r, int id, broadcast_block *out,
+                                     int timeout_ms) {
+  broadcast_consumer *c = &r->consumers[id];
+  uint64_t capacity = r->mask + 1;
+
+  for (;;) {
+    uint32_t epoch = r->epoch.load(std::memory_order_acquire);
+    uint64_t head = r->head.load(std::memory_order_acquire);
+
+    if (c->next < head) {
+      uint64_t lag = head - c->next;
+      if (lag > c->max_lag.load(std::memory_order_relaxed))
+        c->max_lag.store(lag, std::memory_order_relaxed);
+      bool slow = lag > c->slow_threshold;
+      if (slow && !c->slow.load(std::memory_order_relaxed))
+        c->slow_events.fetch_add(1, std::memory_order_relaxed);
+      c->slow.store(slow, std::memory_order_relaxed);
+
+      /* Lapped, or close enough that the writer would reach the slot
+         while we read it: resume according to policy. */
+      if (lag > capacity - r->guard) {
+        uint64_t resume = c->policy == BROADCAST_DROP ? head - 1 : head - (capacity - r->guard);
+        c->dropped.fetch_add(resume - c->next, std::memory_order_relaxed);
+        c->next = resume;
+      }
+
+      broadcast_slot *slot = &r->slots[c->next & r->mask];
+      if (slot->seq.load(std::memory_order_acquire) != c->next) {
+        /* Overwritten between the head load and here. */
+        continue;
+      }
+      out->seq = c->next;
+      out->timestamp_ns = slot->timestamp_ns;
+      out->frames = slot->frames;
+      out->bytes = slot->bytes;
+      out->data = slot->data;
+      return true;
+    }
+
+    if (r->closed.load(std::memory_order_acquire))
+      return false;
+    if (timeout_ms == 0)
+      return false;
+
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms > 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (long) (timeout_ms % 1000) * 1000000;
+      tsp = &ts;
+    }
+    r->waiters.fetch_add(1, std::memory_order_acq_rel);
+    long w = syscall(SYS_futex, &r->epoch, FUTEX_WAIT_PRIVATE, epoch, tsp, NULL, 0);
+    r->waiters.fetch_sub(1, std::memory_order_acq_rel);
+    if (w < 0 && errno == ETIMEDOUT)
+      return false;
+  }
+}
+
+/* Consumer: done with the block from broadcast_acquire. Returns false if
+   the writer overwrote it meanwhile; results computed from it are bad. */
+static inline bool broadcast_release(broadcast_ring *r, int id, const broadcast_block *b) {
+  broadcast_consumer *c = &r->consumers[id];
+  std::atomic_thread_fence(std::memory_order_acquire);
+  bool valid = r->slots[b->seq & r->mask].seq.load(std::memory_order_relaxed) == b->seq;
+  c->next = b->seq + 1;
+  if (valid)
+    c->read.fetch_add(1, std::memory_order_relaxed);
+  else
+    c->torn.fetch_add(1, std::memory_order_relaxed);
+  return valid;
+}
+
+static inline void broadcast_remove_consumer(broadcast_ring *r, int id) {
+  r->consumers[id].active.store(false);
+}
+
+#endif  // BROADCAST_RING_H_
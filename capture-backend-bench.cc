@@ -0,0 +1,461 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "capture-log.h"
+
+// Runs the same capture workload (rate, channels, block size) through
+// every backend and reports what it costs, one JSON object per backend
+// per line, so results can be kept and compared across releases:
+//
+//   alsa          ./alsa-record-example on --alsa-device (ALSA "null" by
+//                 default; a `file` PCM or hw:Dummy from snd-dummy work too)
+//   pulse-simple  ./pulseaudio-record-example (pa_simple)
+//   pulse-async   ./pulseaudio-stream-example (pa_mainloop + callbacks)
+//   portaudio     ./portaudio-record-exmple
+//   pipewire      pw-record; the tree has no PipeWire capture example
+//
+// Pulse, PortAudio and PipeWire record from --source, the monitor of a
+// null sink; --setup loads one with pactl for the run (on PipeWire the
+// same command gives a null sink driven by the dummy driver). The
+// examples get the workload from CAPTURE_RATE, CAPTURE_CHANNELS and
+// CAPTURE_BLOCK_FRAMES, and write a capture log (CAPTURE_LOG) that gives
+// the block timing.
+//
+// Per backend, `--streams` processes run at once. After a warm-up the
+// benchmark samples /proc for each of them over the measured window:
+//
+//   cpu_percent     user + system time per stream, % of one core
+//   wakeups_per_sec voluntary context switches per stream (each is a
+//                   sleep that ended in a wake-up), all threads
+//   preempted_per_sec involuntary switches
+//   rss_kb          resident memory at the end, and the peak (VmHWM)
+//   interval_*      time between consecutive blocks minus the block's own
+//                   duration: mean, standard deviation, p99 and max of the
+//                   absolute value, in ms; null without a capture log
+//
+// g++ -O2 capture-backend-bench.cc -o capture-backend-bench -lm -std=c++11
+// ./capture-backend-bench --setup --block=480 --label=$(git describe --always) >> bench.jsonl
+
+struct options {
+  unsigned rate, channels, block, streams;
+  double seconds, warmup;
+  std::string label, bin_dir, alsa_device, source, pipewire_target, pipewire_cmd;
+  std::vector<std::string> backends;
+  bool setup;
+};
+
+struct backend {
+  std::string name;
+  std::vector<std::string> argv;
+  std::vector<std::string> env;
+  bool logs;  // writes CAPTURE_LOG
+};
+
+struct proc_sample {
+  double cpu_sec;
+  uint64_t voluntary, involuntary;
+  long rss_kb, hwm_kb;
+  bool ok;
+};
+
+struct stream_run {
+  pid_t pid;
+  std::string log_path, err_path;
+  proc_sample begin, end;
+  int status;
+};
+
+static int64_t monotonic_ns() {
+  return capture_log_monotonic_ns();
+}
+
+static void sleep_until(int64_t due) {
+  struct timespec ts = { (time_t) (due / 1000000000LL), (long) (due % 1000000000LL) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static bool read_file(const std::string &path, std::string *out) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+    return false;
+  char buf[4096];
+  size_t n;
+  out->clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out->append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static uint64_t status_field(const std::string &status, const char *key) {
+  size_t at = status.find(key);
+  return at == std::string::npos ? 0 : strtoull(status.c_str() + at + strlen(key), NULL, 10);
+}
+
+// CPU of the whole process, context switches summed over its threads.
+static proc_sample sample_proc(pid_t pid) {
+  proc_sample s;
+  memset(&s, 0, sizeof(s));
+  std::string stat, status, dir = "/proc/" + std::to_string(pid);
+  if (!read_file(dir + "/stat", &stat) || !read_file(dir + "/status", &status))
+    return s;
+  // Fields after the command name, which may contain spaces: state is 3,
+  // utime 14, stime 15.
+  size_t paren = stat.rfind(')');
+  unsigned long utime = 0, stime = 0;
+  char state = 0;
+  if (paren == std::string::npos ||
+      sscanf(stat.c_str() + paren + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &state, &utime, &stime) != 3 ||
+      state == 'Z')
+    return s;  // gone, or exited and not reaped yet
+  s.cpu_sec = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+  s.rss_kb = (long) status_field(status, "VmRSS:");
+  s.hwm_kb = (long) status_field(status, "VmHWM:");
+
+  DIR *tasks = opendir((dir + "/task").c_str());
+  if (tasks) {
+    struct dirent *e;
+    while ((e = readdir(tasks))) {
+      if (e->d_name[0] == '.')
+        continue;
+      std::string task;
+      if (read_file(dir + "/task/" + e->d_name + "/status", &task)) {
+        s.voluntary += status_field(task, "voluntary_ctxt_switches:");
+        s.involuntary += status_field(task, "nonvoluntary_ctxt_switches:");
+      }
+    }
+    closedir(tasks);
+  }
+  s.ok = true;
+  return s;
+}
+
+static pid_t spawn(const backend &b, const std::string &log_path, const std::string &err_path) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  for (size_t i = 0; i < b.env.size(); i++)
+    putenv(strdup(b.env[i].c_str()));
+  if (b.logs)
+    setenv("CAPTURE_LOG", log_path.c_str(), 1);
+  int null_fd = open("/dev/null", O_RDWR), err_fd = open(err_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(null_fd, STDIN_FILENO);
+  dup2(null_fd, STDOUT_FILENO);
+  dup2(err_fd >= 0 ? err_fd : null_fd, STDERR_FILENO);
+  std::vector<char*> argv;
+  for (size_t i = 0; i < b.argv.size(); i++)
+    argv.push_back(const_cast<char*>(b.argv[i].c_str()));
+  argv.push_back(NULL);
+  execvp(argv[0], argv.data());
+  fprintf(stderr, "cannot run %s: %s\n", argv[0], strerror(errno));
+  _exit(127);
+}
+
+static void stop(stream_run *r) {
+  kill(r->pid, SIGTERM);
+  int64_t deadline = monotonic_ns() + 3000000000LL;
+  while (waitpid(r->pid, &r->status, WNOHANG) == 0) {
+    if (monotonic_ns() > deadline) {
+      kill(r->pid, SIGKILL);
+      waitpid(r->pid, &r->status, 0);
+      break;
+    }
+    usleep(10000);
+  }
+}
+
+struct interval_stats {
+  std::vector<double> dev_ms;
+  double sum, sum2;
+  uint64_t blocks, xruns, frames;
+};
+
+// Block-to-block intervals minus block durations, inside [from, to).
+static void read_intervals(const std::string &path, unsigned rate, int64_t from, int64_t to,
+                           interval_stats *st) {
+  capture_replay r;
+  if (capture_replay_open(&r, path.c_str(), CAPTURE_REPLAY_ASAP) < 0)
+    return;
+  int64_t prev_end = 0;
+  while (capture_replay_advance(&r)) {
+    const capture_log_record *rec = r.cur;
+    if (rec->read_end_ns < from || rec->read_end_ns >= to) {
+      prev_end = rec->type == CAPTURE_LOG_BLOCK ? rec->read_end_ns : 0;
+      continue;
+    }
+    if (rec->type == CAPTURE_LOG_XRUN) {
+      st->xruns++;
+      prev_end = 0;
+      continue;
+    }
+    st->blocks++;
+    st->frames += rec->frames;
+    if (prev_end) {
+      double dev = (rec->read_end_ns - prev_end) / 1e6 - rec->frames * 1e3 / rate;
+      st->dev_ms.push_back(fabs(dev));
+      st->sum += dev;
+      st->sum2 += dev * dev;
+    }
+    prev_end = rec->read_end_ns;
+  }
+  capture_replay_close(&r);
+}
+
+static std::string json_escape(const std::string &s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') out += '\\';
+    if ((unsigned char) s[i] >= 0x20) out += s[i];
+  }
+  return out;
+}
+
+static void json_number(FILE *out, const char *key, double v, bool valid) {
+  if (valid) fprintf(out, ",\"%s\":%.4g", key, v);
+  else fprintf(out, ",\"%s\":null", key);
+}
+
+static void run_backend(const options &o, const backend &b, FILE *out) {
+  char tmpl[] = "/tmp/capture-bench-XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    return;
+  }
+  std::string dir = tmpl;
+  std::vector<stream_run> runs(o.streams);
+  for (unsigned i = 0; i < o.streams; i++) {
+    runs[i].log_path = dir + "/" + std::to_string(i) + ".caplog";
+    runs[i].err_path = dir + "/" + std::to_string(i) + ".err";
+    runs[i].pid = spawn(b, runs[i].log_path, runs[i].err_path);
+    runs[i].status = 0;
+  }
+
+  int64_t t0 = monotonic_ns();
+  int64_t from = t0 + (int64_t) (o.warmup * 1e9), to = from + (int64_t) (o.seconds * 1e9);
+  sleep_until(from);
+  for (unsigned i = 0; i < o.streams; i++) runs[i].begin = sample_proc(runs[i].pid);
+  sleep_until(to);
+  double window = (monotonic_ns() - from) / 1e9;
+  for (unsigned i = 0; i < o.streams; i++) runs[i].end = sample_proc(runs[i].pid);
+  for (unsigned i = 0; i < o.streams; i++) stop(&runs[i]);
+
+  unsigned ok = 0;
+  double cpu = 0, wakeups = 0, preempted = 0, rss = 0, hwm = 0;
+  interval_stats iv;
+  iv.sum = iv.sum2 = 0;
+  iv.blocks = iv.xruns = iv.frames = 0;
+  std::string first_error;
+  for (unsigned i = 0; i < o.streams; i++) {
+    stream_run &r = runs[i];
+    if (r.begin.ok && r.end.ok) {
+      ok++;
+      cpu += (r.end.cpu_sec - r.begin.cpu_sec) / window * 100;
+      wakeups += (r.end.voluntary - r.begin.voluntary) / window;
+      preempted += (r.end.involuntary - r.begin.involuntary) / window;
+      rss += r.end.rss_kb;
+      hwm = std::max(hwm, (double) r.end.hwm_kb);
+    } else if (first_error.empty()) {
+      read_file(r.err_path, &first_error);
+      if (first_error.size() > 200) first_error.resize(200);
+      while (!first_error.empty() && first_error[first_error.size() - 1] == '\n')
+        first_error.resize(first_error.size() - 1);
+    }
+    if (b.logs)
+      read_intervals(r.log_path, o.rate, from, to, &iv);
+    unlink(r.log_path.c_str());
+    unlink(r.err_path.c_str());
+  }
+  rmdir(dir.c_str());
+
+  struct utsname u;
+  uname(&u);
+  time_t now = time(NULL);
+  char when[32];
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  std::string command;
+  for (size_t i = 0; i < b.argv.size(); i++)
+    command += (i ? " " : "") + b.argv[i];
+
+  fprintf(out, "{\"label\":\"%s\",\"time\":\"%s\",\"host\":\"%s\",\"kernel\":\"%s\",\"backend\":\"%s\",\"command\":\"%s\"",
+          json_escape(o.label).c_str(), when, json_escape(u.nodename).c_str(), json_escape(u.release).c_str(),
+          b.name.c_str(), json_escape(command).c_str());
+  fprintf(out, ",\"rate\":%u,\"channels\":%u,\"block_frames\":%u,\"streams\":%u,\"running\":%u,\"seconds\":%.3f",
+          o.rate, o.channels, o.block, o.streams, ok, window);
+  json_number(out, "cpu_percent", ok ? cpu / ok : 0, ok);
+  json_number(out, "wakeups_per_sec", ok ? wakeups / ok : 0, ok);
+  json_number(out, "preempted_per_sec", ok ? preempted / ok : 0, ok);
+  json_number(out, "rss_kb", ok ? rss / ok : 0, ok);
+  json_number(out, "max_rss_kb", hwm, ok);
+  bool timed = !iv.dev_ms.empty();
+  size_t n = iv.dev_ms.size();
+  double mean = timed ? iv.sum / n : 0;
+  std::sort(iv.dev_ms.begin(), iv.dev_ms.end());
+  json_number(out, "blocks_per_sec", ok ? iv.blocks / window / ok : 0, b.logs && ok);
+  json_number(out, "frames_per_sec", ok ? iv.frames / window / ok : 0, b.logs && ok);
+  json_number(out, "xruns", (double) iv.xruns, b.logs && ok);
+  json_number(out, "interval_mean_ms", mean, timed);
+  json_number(out, "interval_stddev_ms", timed ? sqrt(fmax(0, iv.sum2 / n - mean * mean)) : 0, timed);
+  json_number(out, "interval_p99_ms", timed ? iv.dev_ms[std::min(n - 1, (size_t) (0.99 * n))] : 0, timed);
+  json_number(out, "interval_max_ms", timed ? iv.dev_ms[n - 1] : 0, timed);
+  if (!first_error.empty())
+    fprintf(out, ",\"error\":\"%s\"", json_escape(first_error).c_str());
+  fprintf(out, "}\n");
+  fflush(out);
+
+  fprintf(stderr, "%-13s %u/%u running, %6.2f%% cpu, %7.1f wakeups/s, %7.0f kB, interval sd %.3f ms max %.3f ms\n",
+          b.name.c_str(), ok, o.streams, ok ? cpu / ok : 0.0, ok ? wakeups / ok : 0.0, ok ? rss / ok : 0.0,
+          timed ? sqrt(fmax(0, iv.sum2 / n - mean * mean)) : 0.0, timed ? iv.dev_ms[n - 1] : 0.0);
+}
+
+static std::vector<backend> make_backends(const options &o) {
+  std::vector<std::string> workload = {
+    "CAPTURE_RATE=" + std::to_string(o.rate),
+    "CAPTURE_CHANNELS=" + std::to_string(o.channels),
+    "CAPTURE_BLOCK_FRAMES=" + std::to_string(o.block),
+  };
+  std::vector<std::string> pulse = workload;
+  pulse.push_back("PULSE_SOURCE=" + o.source);
+  std::string latency = std::to_string(o.block) + "/" + std::to_string(o.rate);
+
+  std::vector<backend> all = {
+    { "alsa", { o.bin_dir + "/alsa-record-example", o.alsa_device }, workload, true },
+    { "pulse-simple", { o.bin_dir + "/pulseaudio-record-example" }, pulse, true },
+    { "pulse-async", { o.bin_dir + "/pulseaudio-stream-example", "--device=" + o.source }, pulse, true },
+    { "portaudio", { o.bin_dir + "/portaudio-record-exmple" }, pulse, true },
+    { "pipewire", {}, workload, false },
+  };
+  if (!o.pipewire_cmd.empty()) {
+    all.back().argv = { "/bin/sh", "-c", o.pipewire_cmd };
+  } else {
+    all.back().argv = { "pw-record", "--target=" + o.pipewire_target, "--rate=" + std::to_string(o.rate),
+                        "--channels=" + std::to_string(o.channels), "--latency=" + latency, "-" };
+  }
+
+  std::vector<backend> chosen;
+  for (size_t i = 0; i < all.size(); i++)
+    if (o.backends.empty() || std::find(o.backends.begin(), o.backends.end(), all[i].name) != o.backends.end())
+      chosen.push_back(all[i]);
+  return chosen;
+}
+
+// A null sink for the run; returns the module index, or -1.
+static int load_null_sink(const options &o) {
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "pactl load-module module-null-sink sink_name=capture_bench rate=%u channels=%u",
+           o.rate, o.channels);
+  FILE *p = popen(cmd, "r");
+  int index = -1;
+  if (p) {
+    if (fscanf(p, "%d", &index) != 1) index = -1;
+    pclose(p);
+  }
+  if (index < 0)
+    fprintf(stderr, "could not load a null sink with pactl\n");
+  return index;
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options] > results.jsonl\n"
+          "  --rate=HZ --channels=N --block=FRAMES   workload (48000, 2, 480)\n"
+          "  --seconds=S          measured window per backend (10), after --warmup=S (2)\n"
+          "  --streams=N          processes per backend at once (1)\n"
+          "  --backends=LIST      alsa,pulse-simple,pulse-async,portaudio,pipewire (all)\n"
+          "  --label=TEXT         tag for the results, e.g. a release\n"
+          "  --bin-dir=DIR        where the examples are built (.)\n"
+          "  --alsa-device=PCM    ALSA stand-in (null)\n"
+          "  --source=NAME        Pulse source (capture_bench.monitor)\n"
+          "  --pipewire-target=N  pw-record target (capture_bench)\n"
+          "  --pipewire-cmd=CMD   run this instead of pw-record\n"
+          "  --setup              load the null sink with pactl for the run\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  options o;
+  o.rate = 48000;
+  o.channels = 2;
+  o.block = 480;
+  o.streams = 1;
+  o.seconds = 10;
+  o.warmup = 2;
+  o.bin_dir = ".";
+  o.alsa_device = "null";
+  o.source = "capture_bench.monitor";
+  o.pipewire_target = "capture_bench";
+  o.setup = false;
+
+  enum { RATE = 256, CHANNELS, BLOCK, SECONDS, WARMUP, STREAMS, BACKENDS, LABEL, BIN_DIR,
+         ALSA_DEVICE, SOURCE, PW_TARGET, PW_CMD, SETUP };
+  static const struct option long_options[] = {
+    {"rate", 1, NULL, RATE}, {"channels", 1, NULL, CHANNELS}, {"block", 1, NULL, BLOCK},
+    {"seconds", 1, NULL, SECONDS}, {"warmup", 1, NULL, WARMUP}, {"streams", 1, NULL, STREAMS},
+    {"backends", 1, NULL, BACKENDS}, {"label", 1, NULL, LABEL}, {"bin-dir", 1, NULL, BIN_DIR},
+    {"alsa-device", 1, NULL, ALSA_DEVICE}, {"source", 1, NULL, SOURCE},
+    {"pipewire-target", 1, NULL, PW_TARGET}, {"pipewire-cmd", 1, NULL, PW_CMD},
+    {"setup", 0, NULL, SETUP}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case RATE: o.rate = atoi(optarg); break;
+      case CHANNELS: o.channels = atoi(optarg); break;
+      case BLOCK: o.block = atoi(optarg); break;
+      case SECONDS: o.seconds = atof(optarg); break;
+      case WARMUP: o.warmup = atof(optarg); break;
+      case STREAMS: o.streams = atoi(optarg); break;
+      case BACKENDS: {
+        std::string list = optarg;
+        for (size_t at = 0, comma; at <= list.size(); at = comma + 1) {
+          comma = list.find(',', at);
+          if (comma == std::string::npos) comma = list.size();
+          if (comma > at) o.backends.push_back(list.substr(at, comma - at));
+        }
+        break;
+      }
+      case LABEL: o.label = optarg; break;
+      case BIN_DIR: o.bin_dir = optarg; break;
+      case ALSA_DEVICE: o.alsa_device = optarg; break;
+      case SOURCE: o.source = optarg; break;
+      case PW_TARGET: o.pipewire_target = optarg; break;
+      case PW_CMD: o.pipewire_cmd = optarg; break;
+      case SETUP: o.setup = true; break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (!o.rate || !o.channels || !o.block || !o.streams || o.seconds <= 0) {
+    help(argv[0]);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  int module = o.setup ? load_null_sink(o) : -1;
+
+  std::vector<backend> backends = make_backends(o);
+  for (size_t i = 0; i < backends.size(); i++)
+    run_backend(o, backends[i], stdout);
+
+  if (module >= 0) {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "pactl unload-module %d", module);
+    if (system(cmd) != 0)
+      fprintf(stderr, "could not unload module %d\n", module);
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+  Capture timestamps for blocks of audio.
+
+  A blocking read returns when the driver decides to wake us up, which is
+  some period boundary plus scheduling noise, so "now" after the read says
+  little about when the samples hit the ADC. The backends can tell better:
+
+    ALSA   snd_pcm_status() gives the system time of the last pointer update
+           (htstamp) together with the frames captured but not read yet
+           (delay), or the audio position itself (audio_htstamp) when the
+           driver reports one.
+    Pulse  pa_stream_get_latency() gives how long ago the next unread
+           sample was captured; with PA_STREAM_INTERPOLATE_TIMING it is
+           interpolated locally, without a server round trip.
+
+  Both give a raw (frame position, time) pair per block that is still off
+  by scheduling and pointer-granularity jitter. capture_clock fits a line
+  through these pairs, least squares with exponentially decaying weights
+  (time constant of a few seconds, so it follows thermal drift), which
+  gives a smooth time for every frame plus the device's actual sample
+  rate as measured against the system clock. It is O(1) per block: only
+  the weighted sums are kept, re-centred on the newest point so that
+  doubles stay exact over days of frames.
+
+    capture_clock clock;
+    capture_clock_init(&clock, rate, CAPTURE_CLOCK_TAU_SEC);
+    ...after each read of `frames` frames starting at position `pos`:
+    int64_t raw_ns = ...time of frame `pos` according to the backend...;
+    int64_t first_ns = capture_clock_update(&clock, pos, raw_ns);
+
+  Times are CLOCK_MONOTONIC; add monotonic_to_realtime_ns() to compare
+  across machines. Linux only, C++11.
+*/
+#ifndef CAPTURE_CLOCK_H_
+#define CAPTURE_CLOCK_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* A raw time this far from the prediction is a discontinuity (xrun,
+   suspend, clock step): the fit starts over instead of slewing. */
+#define CAPTURE_CLOCK_RELOCK_NS 20000000LL
+#define CAPTURE_CLOCK_TAU_SEC 5.0
+
+struct capture_clock {
+  double nominal_ns_per_frame;
+  double tau_frames;       /* weight decays by 1/e over this many frames */
+  double prior;            /* pull of the nominal rate, in frames^2 */
+  bool locked;
+  uint64_t ref_frame;      /* newest update; the sums are relative to it */
+  int64_t ref_ns;
+  double s0, sx, sy, sxx, sxy;
+  double offset_ns;        /* fitted time of ref_frame, relative to ref_ns */
+  double ns_per_frame;     /* fitted slope, 1e9 / measured rate */
+  double jitter_ns;        /* smoothed |raw - predicted| */
+  uint64_t updates;
+  uint64_t relocks;
+};
+
+static inline int64_t capture_clock_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Offset to add to a CLOCK_MONOTONIC time to get CLOCK_REALTIME. Read it
+   per block: it moves when NTP/PTP steps or slews the wall clock. */
+static inline int64_t monotonic_to_realtime_ns() {
+  struct timespec mono, real;
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  return ((int64_t) real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+}
+
+static inline void capture_clock_init(capture_clock *c, uint32_t rate, double tau_sec) {
+  memset(c, 0, sizeof(*c));
+  c->nominal_ns_per_frame = 1e9 / rate;
+  c->tau_frames = tau_sec * rate;
+  /* Worth about one second of evenly spread blocks: the fit trusts the
+     nominal rate until it has seen enough of the real one. */
+  c->prior = (double) rate * rate;
+  c->ns_per_frame = c->nominal_ns_per_frame;
+}
+
+/* Forget the fit, e.g. after an xrun restarted the stream. */
+static inline void capture_clock_reset(capture_clock *c) {
+  c->locked = false;
+}
+
+/* Fitted time of any frame position, extrapolated from the last update. */
+static inline int64_t capture_clock_time(const capture_clock *c, uint64_t frame) {
+  return c->ref_ns + (int64_t) (c->offset_ns + ((double) frame - (double) c->ref_frame) * c->ns_per_frame);
+}
+
+/* Measured sample rate of the device against CLOCK_MONOTONIC. */
+static inline double capture_clock_rate(const capture_clock *c) {
+  return 1e9 / c->ns_per_frame;
+}
+
+/* Feed the raw time of frame position `frame`; returns its fitted time. */
+static inline int64_t capture_clock_update(capture_clock *c, uint64_t frame, int64_t raw_ns) {
+  c->updates++;
+  if (!c->locked || frame <= c->ref_frame) {
+    c->locked = true;
+    c->ref_frame = frame;
+    c->ref_ns = raw_ns;
+    c->s0 = 1;
+    c->sx = c->sy = c->sxx = c->sxy = 0;
+    c->offset_ns = 0;
+    c->ns_per_frame = c->nominal_ns_per_frame;
+    return raw_ns;
+  }
+
+  double dx = (double) (frame - c->ref_frame);
+  double dy = (double) (raw_ns - c->ref_ns);
+  double e = dy - (c->offset_ns + dx * c->ns_per_frame);
+  if (fabs(e) > CAPTURE_CLOCK_RELOCK_NS) {
+    c->relocks++;
+    c->locked = false;
+    return capture_clock_update(c, frame, raw_ns);
+  }
+  c->jitter_ns += (fabs(e) - c->jitter_ns) / 32;
+
+  /* Age the old points, move the origin to the new one, add it. */
+  double decay = exp(-dx / c->tau_frames);
+  c->s0 *= decay; c->sx *= decay; c->sy *= decay; c->sxx *= decay; c->sxy *= decay;
+  c->sxx += -2 * dx * c->sx + dx * dx * c->s0;
+  c->sxy += -dx * c->sy - dy * c->sx + dx * dy * c->s0;
+  c->sx -= dx * c->s0;
+  c->sy -= dy * c->s0;
+  c->s0 += 1;
+  c->ref_frame = frame;
+  c->ref_ns = raw_ns;
+
+  double var = c->sxx - c->sx * c->sx / c->s0;
+  double cov = c->sxy - c->sx * c->sy / c->s0;
+  c->ns_per_frame = (cov + c->prior * c->nominal_ns_per_frame) / (var + c->prior);
+  c->offset_ns = (c->sy - c->ns_per_frame * c->sx) / c->s0;
+  return c->ref_ns + (int64_t) c->offset_ns;
+}
+
+static inline void capture_clock_print_stats(const capture_clock *c, FILE *out) {
+  fprintf(out, "clock: rate %.3f Hz (%+.1f ppm), raw jitter %.1f us, %lu updates, %lu relocks\n",
+          capture_clock_rate(c), (c->nominal_ns_per_frame / c->ns_per_frame - 1.0) * 1e6,
+          c->jitter_ns / 1e3, (unsigned long) c->updates, (unsigned long) c->relocks);
+}
+
+#endif  // CAPTURE_CLOCK_H_
@@ -0,0 +1,609 @@
+/*
+  Awaitable capture for coroutine code: a task waits for the next block
+  of a stream with co_await and no thread blocks on any device, so
+  thousands of capture and processing tasks share a few threads.
+
+    coro_task record(coro_stream *s) {
+      while (coro_block b = co_await coro_next_block(s)) {
+        ... b.data, b.frames, b.capture_ns ...
+      }   // b goes back to its pool here
+      // !b: the stream ended (s->error says why)
+    }
+
+    coro_reactor r;
+    coro_reactor_init(&r);
+    block_pool pool;                 // block-pool.h, shared by the streams
+    block_pool_init(&pool, 4 * streams, block_frames * frame_bytes, false);
+    coro_stream s;
+    coro_stream_open_mock(&s, &r, &pool, &mock_cfg, block_frames);
+    coro_spawn(&r, record(&s));
+    coro_reactor_run(&r, threads);   // until every task has returned
+    coro_stream_close(&s);
+    coro_reactor_free(&r);
+
+  The reactor is one epoll set. Every stream is a file descriptor in it,
+  armed one-shot while a task waits on the stream; when it fires, the
+  thread that got it reads the block (non-blocking) and resumes the task
+  right there. Handles posted from elsewhere (coro_spawn, coro_yield)
+  go on a ready list, with an eventfd to wake a thread out of
+  epoll_wait. Any number of threads may run the reactor; one-shot arming
+  means one stream is only ever handled by one thread at a time.
+
+  Streams:
+
+    mock      mock-capture.h device, paced by a timerfd at each block's
+              due time (its jitter is not simulated)
+    alsa      an opened and configured snd_pcm_t, made non-blocking and
+              driven by its poll descriptors (define CAPTURE_CORO_ALSA,
+              link -lasound)
+    queue     blocks pushed from another thread with coro_stream_push(),
+              signalled through an eventfd: the bridge for callback APIs.
+              With CAPTURE_CORO_PULSE, coro_pulse_process() is a
+              pulse_engine (pulse-capture-engine.h) process callback that
+              feeds one; a PipeWire on_process can call coro_stream_push()
+              the same way. A full queue or pool drops the block (counted)
+              rather than block the callback.
+
+  Blocks come from a block_pool and go back when the coro_block is
+  destroyed; nothing is allocated per block. A coro_task is started
+  detached and owns its frame: it is destroyed when it returns.
+
+  Linux only, C++20.
+*/
+#ifndef CAPTURE_CORO_H_
+#define CAPTURE_CORO_H_
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "block-pool.h"
+#include "mock-capture.h"
+
+#ifdef CAPTURE_CORO_ALSA
+#include <alsa/asoundlib.h>
+#endif
+#ifdef CAPTURE_CORO_PULSE
+#include "pulse-capture-engine.h"
+#endif
+
+#define CORO_EVENTS 64              /* per epoll_wait */
+#define CORO_ALSA_MAX_FDS 4
+
+struct coro_reactor {
+  int epoll_fd;
+  int wake_fd;                      /* eventfd: the ready list has work, or stop */
+  std::mutex lock;
+  std::deque<std::coroutine_handle<> > ready;
+  std::atomic<int64_t> tasks;       /* spawned and not yet returned */
+  std::atomic<bool> stop;
+  std::atomic<uint64_t> resumes, waits, events;
+};
+
+/* A detached task: starts when the reactor first runs it, frees itself
+   when it returns. */
+struct coro_task {
+  struct promise_type {
+    coro_reactor *reactor = NULL;
+    coro_task get_return_object() { return coro_task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+    ~promise_type();
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+/* A block on loan from a pool: moves, does not copy, and goes back to the
+   pool when destroyed. False when the stream has ended. */
+struct coro_block {
+  uint8_t *data = NULL;
+  uint32_t frames = 0;
+  int64_t capture_ns = 0;           /* CLOCK_REALTIME of the first frame */
+  block_pool *pool = NULL;
+
+  coro_block() {}
+  coro_block(coro_block &&o) noexcept { *this = static_cast<coro_block&&>(o); }
+  coro_block &operator=(coro_block &&o) noexcept {
+    if (this != &o) {
+      release();
+      data = o.data;
+      frames = o.frames;
+      capture_ns = o.capture_ns;
+      pool = o.pool;
+      o.data = NULL;
+    }
+    return *this;
+  }
+  coro_block(const coro_block&) = delete;
+  coro_block &operator=(const coro_block&) = delete;
+  ~coro_block() { release(); }
+  explicit operator bool() const { return data != NULL; }
+  void release() {
+    if (data && pool) block_pool_put(pool, data);
+    data = NULL;
+  }
+};
+
+struct coro_stream;
+/* Non-blocking: 1 with *b filled, 0 when nothing is ready yet (the
+   stream is re-armed), or a negative errno when the stream has ended. */
+typedef int (*coro_read_fn)(coro_stream *s, coro_block *b);
+
+struct coro_stream {
+  coro_reactor *reactor;
+  block_pool *pool;
+  coro_read_fn read;
+  int fds[CORO_ALSA_MAX_FDS];       /* what epoll waits on */
+  int nfds;
+  uint32_t frames;                  /* per block */
+  uint32_t frame_bytes;
+  std::atomic<bool> armed;          /* a one-shot is pending for a waiter */
+  std::coroutine_handle<> waiter;
+  coro_block result;
+  int error;                        /* why the stream ended */
+
+  /* Per kind. */
+  mock_capture mock;
+  int timer_fd;
+  block_queue queue;
+#ifdef CAPTURE_CORO_ALSA
+  snd_pcm_t *pcm;
+  struct pollfd pfds[CORO_ALSA_MAX_FDS];
+  uint8_t *partial;                 /* a block being filled by short reads */
+  uint32_t partial_frames;
+  uint32_t rate;
+#endif
+
+  /* Stats: the reactor thread handling the stream. */
+  uint64_t blocks, suspends, spurious, xruns;
+  std::atomic<uint64_t> dropped;    /* queue: pushes that found no room */
+};
+
+static inline int64_t coro_now_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Reactor. */
+static inline int coro_reactor_init(coro_reactor *r) {
+  r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (r->epoll_fd < 0 || r->wake_fd < 0)
+    return -1;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;              /* level: every thread sees a stop */
+  ev.data.ptr = NULL;
+  if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &ev) < 0)
+    return -1;
+  r->tasks.store(0);
+  r->stop.store(false);
+  r->resumes.store(0);
+  r->waits.store(0);
+  r->events.store(0);
+  return 0;
+}
+
+static inline void coro_reactor_free(coro_reactor *r) {
+  close(r->epoll_fd);
+  close(r->wake_fd);
+}
+
+static inline void coro_reactor_wake(coro_reactor *r) {
+  uint64_t one = 1;
+  if (write(r->wake_fd, &one, sizeof(one)) < 0) {}
+}
+
+/* Run h on a reactor thread soon. Any thread. */
+static inline void coro_post(coro_reactor *r, std::coroutine_handle<> h) {
+  {
+    std::lock_guard<std::mutex> hold(r->lock);
+    r->ready.push_back(h);
+  }
+  coro_reactor_wake(r);
+}
+
+inline coro_task::promise_type::~promise_type() {
+  if (reactor && reactor->tasks.fetch_sub(1) == 1) {
+    reactor->stop.store(true);
+    coro_reactor_wake(reactor);
+  }
+}
+
+static inline void coro_spawn(coro_reactor *r, coro_task t) {
+  t.handle.promise().reactor = r;
+  r->tasks.fetch_add(1);
+  coro_post(r, t.handle);
+}
+
+/* co_await coro_yield(r): back of the ready list, to let others run. */
+struct coro_yield {
+  coro_reactor *reactor;
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) { coro_post(reactor, h); }
+  void await_resume() const noexcept {}
+};
+
+/* Streams. */
+static inline int coro_stream_arm(coro_stream *s) {
+  s->armed.store(true, std::memory_order_release);
+  for (int i = 0; i < s->nfds; i++) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = s;
+    if (epoll_ctl(s->reactor->epoll_fd, EPOLL_CTL_MOD, s->fds[i], &ev) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* A reactor thread: the stream's fd fired. Read, and resume the waiter
+   if there is something for it. */
+static inline void coro_stream_ready(coro_stream *s) {
+  if (!s->armed.exchange(false, std::memory_order_acq_rel))
+    return;  /* another of its descriptors got here first */
+  int got = s->read(s, &s->result);
+  if (got == 0) {
+    s->spurious++;
+    coro_stream_arm(s);
+    return;
+  }
+  if (got < 0)
+    s->error = got;
+  else
+    s->blocks++;
+  std::coroutine_handle<> h = s->waiter;
+  s->waiter = nullptr;
+  s->reactor->resumes.fetch_add(1, std::memory_order_relaxed);
+  h.resume();
+}
+
+struct coro_next_block {
+  coro_stream *stream;
+  int got = 0;
+  explicit coro_next_block(coro_stream *s) : stream(s) {}
+  bool await_ready() {
+    if (stream->error < 0)
+      return true;
+    got = stream->read(stream, &stream->result);
+    if (got < 0) stream->error = got;
+    else if (got > 0) stream->blocks++;
+    return got != 0;
+  }
+  void await_suspend(std::coroutine_handle<> h) {
+    /* Once armed, another thread may resume the task (and this awaiter
+       may be gone) before arm returns: only locals from here. */
+    coro_stream *s = stream;
+    s->waiter = h;
+    s->suspends++;
+    s->reactor->waits.fetch_add(1, std::memory_order_relaxed);
+    if (coro_stream_arm(s) < 0 && s->armed.exchange(false)) {
+      s->error = -errno;
+      s->waiter = nullptr;
+      coro_post(s->reactor, h);
+    }
+  }
+  coro_block await_resume() {
+    return static_cast<coro_block&&>(stream->result);
+  }
+};
+
+static inline void coro_stream_init(coro_stream *s, coro_reactor *r, block_pool *pool, uint32_t frames,
+                                    uint32_t frame_bytes, coro_read_fn read) {
+  s->reactor = r;
+  s->pool = pool;
+  s->read = read;
+  s->nfds = 0;
+  s->frames = frames;
+  s->frame_bytes = frame_bytes;
+  s->armed.store(false);
+  s->waiter = nullptr;
+  s->error = 0;
+  s->timer_fd = -1;
+  s->queue.slots = NULL;
+  s->blocks = s->suspends = s->spurious = s->xruns = 0;
+  s->dropped.store(0);
+}
+
+/* Registered disarmed: armed when a task first waits. */
+static inline int coro_stream_watch(coro_stream *s, int fd) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = 0;
+  ev.data.ptr = s;
+  if (s->nfds == CORO_ALSA_MAX_FDS || epoll_ctl(s->reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    return -1;
+  s->fds[s->nfds++] = fd;
+  return 0;
+}
+
+static inline uint8_t *coro_stream_take_block(coro_stream *s) {
+  return block_pool_get(s->pool);
+}
+
+/* mock */
+static inline int coro_mock_read(coro_stream *s, coro_block *b) {
+  mock_capture *m = &s->mock;
+  uint64_t expirations;
+  if (read(s->timer_fd, &expirations, sizeof(expirations)) < 0) {}
+  for (;;) {
+    /* Early: wait for the timer rather than let the mock sleep. */
+    if (m->cfg.speed > 0) {
+      int64_t due = mock_capture_frame_ns(m, m->position + s->frames);
+      if (coro_now_ns(CLOCK_MONOTONIC) < due) {
+        struct itimerspec when;
+        memset(&when, 0, sizeof(when));
+        when.it_value.tv_sec = (time_t) (due / 1000000000);
+        when.it_value.tv_nsec = (long) (due % 1000000000);
+        timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+        return 0;
+      }
+    }
+    uint8_t *data = coro_stream_take_block(s);
+    if (!data) {
+      s->dropped.fetch_add(1, std::memory_order_relaxed);
+      return -ENOBUFS;
+    }
+    long n = mock_capture_read(m, data, s->frames, &b->capture_ns);
+    if (n == -EPIPE) {
+      /* Overrun: the device moved on to now, which may be early again. */
+      block_pool_put(s->pool, data);
+      s->xruns++;
+      continue;
+    }
+    b->data = data;
+    b->frames = (uint32_t) n;
+    b->pool = s->pool;
+    return 1;
+  }
+}
+
+/* cfg->jitter_ms is ignored: a jittered read would sleep on the reactor. */
+static inline int coro_stream_open_mock(coro_stream *s, coro_reactor *r, block_pool *pool,
+                                        const mock_capture_config *cfg, uint32_t frames) {
+  uint32_t bytes = cfg->channels * (cfg->format == MOCK_F32 ? 4 : 2);
+  coro_stream_init(s, r, pool, frames, bytes, coro_mock_read);
+  mock_capture_config c = *cfg;
+  c.jitter_ms = 0;
+  mock_capture_open(&s->mock, &c);
+  /* Set by each read that is early; an unpaced mock never waits (and
+     its task never yields on its own). */
+  s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (s->timer_fd < 0)
+    return -1;
+  return coro_stream_watch(s, s->timer_fd);
+}
+
+/* queue */
+static inline int coro_queue_read(coro_stream *s, coro_block *b) {
+  uint64_t count;
+  /* Drain the eventfd before looking, so a push after the look re-fires it. */
+  if (read(s->fds[0], &count, sizeof(count)) < 0) {}
+  block_ref ref;
+  if (block_queue_pop(&s->queue, &ref, 0)) {
+    b->data = ref.data;
+    b->frames = ref.frames;
+    b->capture_ns = ref.capture_ns;
+    b->pool = s->pool;
+    return 1;
+  }
+  return s->queue.closed.load(std::memory_order_acquire) ? -EPIPE : 0;
+}
+
+/* capacity: blocks, a power of two. */
+static inline int coro_stream_open_queue(coro_stream *s, coro_reactor *r, block_pool *pool, uint32_t frames,
+                                         uint32_t frame_bytes, uint32_t capacity) {
+  coro_stream_init(s, r, pool, frames, frame_bytes, coro_queue_read);
+  if (!block_queue_init(&s->queue, capacity))
+    return -1;
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  return coro_stream_watch(s, fd);
+}
+
+/* One producer thread at a time: a copy of up to s->frames frames into a
+   pooled block, or a counted drop. Never waits. */
+static inline bool coro_stream_push(coro_stream *s, const void *data, uint32_t frames, int64_t capture_ns) {
+  uint8_t *block = block_pool_get(s->pool);
+  if (!block) {
+    s->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (frames > s->frames) frames = s->frames;
+  memcpy(block, data, (size_t) frames * s->frame_bytes);
+  if (!block_queue_push(&s->queue, block, frames, capture_ns)) {
+    block_pool_put(s->pool, block);
+    s->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  uint64_t one = 1;
+  if (write(s->fds[0], &one, sizeof(one)) < 0) {}
+  return true;
+}
+
+/* The producer is done: the task gets what is queued, then the end. */
+static inline void coro_stream_end(coro_stream *s) {
+  block_queue_close(&s->queue);
+  uint64_t one = 1;
+  if (write(s->fds[0], &one, sizeof(one)) < 0) {}
+}
+
+#ifdef CAPTURE_CORO_PULSE
+/* A pulse_engine process callback; user is the queue coro_stream. */
+static inline void coro_pulse_process(pulse_engine_stream *, const void *data, uint32_t frames, int64_t capture_ns,
+                                      void *user) {
+  coro_stream_push((coro_stream*) user, data, frames, capture_ns);
+}
+#endif
+
+#ifdef CAPTURE_CORO_ALSA
+static inline int coro_alsa_read(coro_stream *s, coro_block *b) {
+  unsigned short revents = 0;
+  if (poll(s->pfds, s->nfds, 0) < 0)
+    return 0;
+  snd_pcm_poll_descriptors_revents(s->pcm, s->pfds, s->nfds, &revents);
+  if (revents & (POLLERR | POLLNVAL)) {
+    /* An overrun shows as POLLERR: recover, and wait for new data. */
+    int err = snd_pcm_recover(s->pcm, -EPIPE, 1);
+    if (err < 0)
+      return err;
+    s->xruns++;
+    snd_pcm_start(s->pcm);
+    return 0;
+  }
+  if (!(revents & POLLIN))
+    return 0;
+  if (!s->partial && !(s->partial = coro_stream_take_block(s))) {
+    s->dropped.fetch_add(1, std::memory_order_relaxed);
+    return -ENOBUFS;
+  }
+  while (s->partial_frames < s->frames) {
+    snd_pcm_sframes_t n = snd_pcm_readi(s->pcm, s->partial + (size_t) s->partial_frames * s->frame_bytes,
+                                        s->frames - s->partial_frames);
+    if (n == -EAGAIN)
+      return 0;
+    if (n < 0) {
+      int err = snd_pcm_recover(s->pcm, (int) n, 1);
+      if (err < 0)
+        return err;
+      s->xruns++;
+      snd_pcm_start(s->pcm);
+      return 0;
+    }
+    s->partial_frames += (uint32_t) n;
+  }
+  /* Dated from the read: the last frame arrived about now. */
+  b->capture_ns = coro_now_ns(CLOCK_REALTIME) - (int64_t) s->frames * 1000000000 / s->rate;
+  b->data = s->partial;
+  b->frames = s->frames;
+  b->pool = s->pool;
+  s->partial = NULL;
+  s->partial_frames = 0;
+  return 1;
+}
+
+/* pcm: opened for capture with its hw params set (alsa-record-example.cc);
+   it is made non-blocking and started here. */
+static inline int coro_stream_open_alsa(coro_stream *s, coro_reactor *r, block_pool *pool, snd_pcm_t *pcm,
+                                        uint32_t rate, uint32_t frames, uint32_t frame_bytes) {
+  coro_stream_init(s, r, pool, frames, frame_bytes, coro_alsa_read);
+  s->pcm = pcm;
+  s->rate = rate;
+  s->partial = NULL;
+  s->partial_frames = 0;
+  if (snd_pcm_nonblock(pcm, 1) < 0)
+    return -1;
+  int n = snd_pcm_poll_descriptors(pcm, s->pfds, CORO_ALSA_MAX_FDS);
+  if (n <= 0)
+    return -1;
+  for (int i = 0; i < n; i++)
+    if (coro_stream_watch(s, s->pfds[i].fd) < 0)
+      return -1;
+  return snd_pcm_start(pcm) < 0 ? -1 : 0;
+}
+#endif
+
+/* After the tasks using it have finished. */
+static inline void coro_stream_close(coro_stream *s) {
+  for (int i = 0; i < s->nfds; i++) {
+    epoll_ctl(s->reactor->epoll_fd, EPOLL_CTL_DEL, s->fds[i], NULL);
+    if (s->read == coro_queue_read || s->read == coro_mock_read)
+      close(s->fds[i]);
+  }
+  s->nfds = 0;
+  s->result.release();
+  if (s->queue.slots) {
+    block_ref ref;
+    while (block_queue_pop(&s->queue, &ref, 0))
+      block_pool_put(s->pool, ref.data);
+    block_queue_free(&s->queue);
+  }
+#ifdef CAPTURE_CORO_ALSA
+  if (s->read == coro_alsa_read && s->partial) {
+    block_pool_put(s->pool, s->partial);
+    s->partial = NULL;
+  }
+#endif
+}
+
+/* Resume posted handles and dispatch stream events until every spawned
+   task has returned (or coro_reactor_stop). */
+static inline void coro_reactor_loop(coro_reactor *r) {
+  struct epoll_event events[CORO_EVENTS];
+  while (!r->stop.load(std::memory_order_acquire)) {
+    std::coroutine_handle<> h = nullptr;
+    {
+      std::lock_guard<std::mutex> hold(r->lock);
+      if (!r->ready.empty()) {
+        h = r->ready.front();
+        r->ready.pop_front();
+      }
+    }
+    if (h) {
+      r->resumes.fetch_add(1, std::memory_order_relaxed);
+      h.resume();
+      continue;
+    }
+    int n = epoll_wait(r->epoll_fd, events, CORO_EVENTS, -1);
+    for (int i = 0; i < n; i++) {
+      if (!events[i].data.ptr) {
+        /* Left readable once stopping, so every thread wakes. */
+        uint64_t count;
+        if (!r->stop.load() && read(r->wake_fd, &count, sizeof(count)) < 0) {}
+        continue;
+      }
+      r->events.fetch_add(1, std::memory_order_relaxed);
+      coro_stream_ready((coro_stream*) events[i].data.ptr);
+    }
+  }
+}
+
+/* This thread and threads - 1 more. */
+static inline void coro_reactor_run(coro_reactor *r, int threads) {
+  if (r->tasks.load() == 0)
+    return;
+  std::vector<std::thread> more;
+  for (int i = 1; i < threads; i++)
+    more.push_back(std::thread(coro_reactor_loop, r));
+  coro_reactor_loop(r);
+  for (size_t i = 0; i < more.size(); i++)
+    more[i].join();
+}
+
+/* Any thread: return from coro_reactor_run with tasks still waiting. */
+static inline void coro_reactor_stop(coro_reactor *r) {
+  r->stop.store(true);
+  coro_reactor_wake(r);
+}
+
+static inline void coro_stream_print_stats(const coro_stream *s, FILE *out) {
+  fprintf(out, "%lu blocks, %lu waits (%lu spurious wakeups), %lu xruns, %lu dropped\n", (unsigned long) s->blocks,
+          (unsigned long) s->suspends, (unsigned long) s->spurious, (unsigned long) s->xruns,
+          (unsigned long) s->dropped.load());
+}
+
+static inline void coro_reactor_print_stats(const coro_reactor *r, FILE *out) {
+  fprintf(out, "reactor: %lu resumes, %lu waits, %lu stream events\n", (unsigned long) r->resumes.load(),
+          (unsigned long) r->waits.load(), (unsigned long) r->events.load());
+}
+
+#endif  // CAPTURE_CORO_H_
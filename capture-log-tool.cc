@@ -0,0 +1,182 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "capture-log.h"
+
+// Inspect, replay and fake capture logs (capture-log.h).
+//
+//   synth FILE [seconds]        write a log without hardware: 10 ms blocks of
+//                               a 440 Hz tone at 48 kHz, read times with
+//                               scheduling jitter, one xrun in the middle
+//   info FILE                   format, duration, block sizes, read-interval
+//                               jitter, xruns
+//   replay FILE [speed] [frames]
+//                               feed the log through capture_replay_read() at
+//                               realtime, asap or N x speed, in reads of
+//                               `frames` (default: as logged), through a stand-in
+//                               processing stage; prints pacing, stage cost and a
+//                               checksum that must not depend on speed or read size
+//
+// g++ -O2 capture-log-tool.cc -o capture-log-tool -lm -std=c++11
+// CAPTURE_LOG=field.caplog ./alsa-record-example hw:1,0
+// ./capture-log-tool replay field.caplog asap
+
+#define SYNTH_RATE 48000
+#define SYNTH_BLOCK (SYNTH_RATE / 100)
+
+static int synth(const char *path, double seconds) {
+  capture_log log;
+  if (capture_log_open(&log, path, CAPTURE_LOG_S16LE, SYNTH_RATE, 1, "synth") < 0) {
+    perror(path);
+    return 1;
+  }
+  std::vector<int16_t> block(SYNTH_BLOCK);
+  int64_t t0 = capture_log_monotonic_ns();
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  int64_t real0 = (int64_t) real.tv_sec * 1000000000LL + real.tv_nsec;
+  uint64_t blocks = (uint64_t) (seconds * SYNTH_RATE / SYNTH_BLOCK);
+  uint64_t frame = 0;
+  srand(1);
+  for (uint64_t i = 0; i < blocks; i++) {
+    if (i == blocks / 2) {
+      capture_log_xrun(&log, t0 + (int64_t) (frame * 1e9 / SYNTH_RATE));
+      frame += SYNTH_BLOCK * 5;  /* what the xrun lost */
+    }
+    for (int k = 0; k < SYNTH_BLOCK; k++)
+      block[k] = (int16_t) (10000 * sin(2 * M_PI * 440 * (double) (frame + k) / SYNTH_RATE));
+    int64_t due = t0 + (int64_t) ((frame + SYNTH_BLOCK) * 1e9 / SYNTH_RATE);
+    int64_t end = due + rand() % 2000000;
+    capture_log_block(&log, block.data(), SYNTH_BLOCK, end - 10000000, end,
+                      real0 + (int64_t) (frame * 1e9 / SYNTH_RATE));
+    frame += SYNTH_BLOCK;
+  }
+  fprintf(stdout, "%s: %lu blocks, %lu xruns, %lu bytes\n", path, (unsigned long) log.blocks,
+          (unsigned long) log.xruns, (unsigned long) log.bytes);
+  capture_log_close(&log);
+  return 0;
+}
+
+static int info(const char *path) {
+  capture_replay r;
+  if (capture_replay_open(&r, path, CAPTURE_REPLAY_ASAP) < 0) {
+    perror(path);
+    return 1;
+  }
+  const capture_log_header &h = r.header;
+  fprintf(stdout, "%s: backend %s, format %u, %u Hz, %u ch, started %ld.%03ld\n", path, h.backend,
+          h.format, h.rate, h.channels, (long) (h.start_realtime_ns / 1000000000LL),
+          (long) (h.start_realtime_ns % 1000000000LL / 1000000));
+
+  uint64_t blocks = 0, xruns = 0, frames = 0;
+  uint32_t min_frames = UINT32_MAX, max_frames = 0;
+  int64_t first_ns = 0, last_ns = 0, prev_end = 0;
+  double interval_sum = 0, interval_sum2 = 0, interval_max = 0;
+  while (capture_replay_advance(&r)) {
+    const capture_log_record *rec = r.cur;
+    if (rec->type == CAPTURE_LOG_XRUN) {
+      xruns++;
+      prev_end = 0;
+      continue;
+    }
+    if (!blocks) first_ns = rec->read_start_ns;
+    last_ns = rec->read_end_ns;
+    blocks++;
+    frames += rec->frames;
+    if (rec->frames < min_frames) min_frames = rec->frames;
+    if (rec->frames > max_frames) max_frames = rec->frames;
+    if (prev_end) {
+      double interval = (rec->read_end_ns - prev_end) / 1e6;
+      interval_sum += interval;
+      interval_sum2 += interval * interval;
+      if (interval > interval_max) interval_max = interval;
+    }
+    prev_end = rec->read_end_ns;
+  }
+  uint64_t intervals = blocks > xruns + 1 ? blocks - xruns - 1 : 0;
+  double mean = intervals ? interval_sum / intervals : 0;
+  fprintf(stdout, "%lu blocks (%u..%u frames), %lu frames = %.3f s of audio over %.3f s, %lu xruns\n",
+          (unsigned long) blocks, blocks ? min_frames : 0, max_frames, (unsigned long) frames,
+          h.rate ? (double) frames / h.rate : 0.0, (last_ns - first_ns) / 1e9, (unsigned long) xruns);
+  fprintf(stdout, "read interval: mean %.3f ms, stddev %.3f ms, max %.3f ms\n", mean,
+          intervals ? sqrt(fmax(0, interval_sum2 / intervals - mean * mean)) : 0.0, interval_max);
+  capture_replay_close(&r);
+  return 0;
+}
+
+static int64_t monotonic_ns() {
+  return capture_log_monotonic_ns();
+}
+
+static int replay(const char *path, double speed, uint32_t read_frames) {
+  capture_replay r;
+  if (capture_replay_open(&r, path, speed) < 0) {
+    perror(path);
+    return 1;
+  }
+  if (!read_frames) {
+    /* As logged: the size of the first block. */
+    capture_replay probe;
+    capture_replay_open(&probe, path, CAPTURE_REPLAY_ASAP);
+    while (capture_replay_advance(&probe) && probe.cur->type != CAPTURE_LOG_BLOCK) {}
+    read_frames = probe.cur ? probe.cur->frames : 1024;
+    capture_replay_close(&probe);
+  }
+
+  const uint32_t frame_bytes = r.header.frame_bytes;
+  std::vector<uint8_t> buffer((size_t) read_frames * frame_bytes);
+  uint64_t checksum = 1469598103934665603ULL, reads = 0;
+  int64_t stage_ns = 0, capture_ns;
+  double level = 0;
+  int64_t start = monotonic_ns();
+  long n;
+
+  while ((n = capture_replay_read(&r, buffer.data(), read_frames, &capture_ns)) != 0) {
+    if (n == -EPIPE) {
+      fprintf(stdout, "xrun after %lu frames\n", (unsigned long) r.frames);
+      continue;
+    }
+    /* Stand-in processing stage: mean square of the block. */
+    int64_t t = monotonic_ns();
+    double sum = 0;
+    if (r.header.format == CAPTURE_LOG_S16LE) {
+      const int16_t *s = (const int16_t*) buffer.data();
+      for (long i = 0; i < n * (long) r.header.channels; i++)
+        sum += (double) s[i] * s[i];
+    }
+    level = sum / (n * r.header.channels);
+    stage_ns += monotonic_ns() - t;
+    reads++;
+
+    for (size_t i = 0; i < (size_t) n * frame_bytes; i++)
+      checksum = (checksum ^ buffer[i]) * 1099511628211ULL;
+  }
+  double seconds = (monotonic_ns() - start) / 1e9;
+  double audio = (double) r.frames / r.header.rate;
+
+  fprintf(stdout, "speed %s, reads of %u frames: %.3f s of audio in %.3f s (%.1fx)\n",
+          speed > 0 ? (speed == 1 ? "realtime" : "factor") : "asap", read_frames, audio, seconds,
+          seconds > 0 ? audio / seconds : 0.0);
+  fprintf(stdout, "stage: %lu reads, %.0f ns per read, last level %.1f dBFS\n", (unsigned long) reads,
+          reads ? (double) stage_ns / reads : 0.0, level > 0 ? 10 * log10(level / (32768.0 * 32768.0)) : -999.0);
+  fprintf(stdout, "checksum %016lx\n", (unsigned long) checksum);
+  capture_replay_print_stats(&r, stdout);
+  capture_replay_close(&r);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 3 && !strcmp(argv[1], "synth"))
+    return synth(argv[2], argc > 3 ? atof(argv[3]) : 10);
+  if (argc >= 3 && !strcmp(argv[1], "info"))
+    return info(argv[2]);
+  if (argc >= 3 && !strcmp(argv[1], "replay"))
+    return replay(argv[2], capture_replay_parse_speed(argc > 3 ? argv[3] : NULL),
+                  argc > 4 ? atoi(argv[4]) : 0);
+  fprintf(stderr, "%s synth FILE [seconds] | info FILE | replay FILE [realtime|asap|N] [frames]\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,328 @@
+/*
+  Capture log: the blocks a read loop got, exactly as it got them, and a
+  replay source that hands them out again.
+
+  A log is a header followed by records. Each record is either a block
+  (raw samples as read, plus when the read started, when it returned and
+  the capture timestamp of its first frame) or an xrun. Everything is
+  little-endian and records are padded to 8 bytes:
+
+    capture_log_header     80 bytes, once
+    capture_log_record     40 bytes
+    payload                bytes, padded to a multiple of 8
+    ...
+
+  Writing goes through a large stdio buffer, so the capture loop pays a
+  memcpy per block. Replay maps the file and behaves like the read call it
+  replaces: it blocks until the data would have arrived (scaled by the
+  speed factor, or not at all), returns -EPIPE where the original loop saw
+  an xrun, and 0 at the end of the log.
+
+    capture_log log;                           // recording
+    capture_log_open(&log, path, CAPTURE_LOG_S16LE, rate, channels, "alsa");
+    capture_log_block(&log, buffer, frames, read_start_ns, read_end_ns, capture_ns);
+    capture_log_xrun(&log, when_ns);
+    capture_log_close(&log);
+
+    capture_replay replay;                     // instead of the device
+    capture_replay_open(&replay, path, CAPTURE_REPLAY_REALTIME);  // or _ASAP, or a factor
+    long n = capture_replay_read(&replay, buffer, frames, &capture_ns);
+
+  The examples pick this up from the environment: CAPTURE_LOG=path records
+  what they read, CAPTURE_REPLAY=path reads from a log instead of the
+  device, CAPTURE_REPLAY_SPEED=realtime|asap|<factor> sets the pacing.
+  Linux only, C++11.
+*/
+#ifndef CAPTURE_LOG_H_
+#define CAPTURE_LOG_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_LOG_MAGIC "CAPLOG\0\1"
+#define CAPTURE_LOG_VERSION 1
+
+/* Sample formats, same codes as net-audio-sink.h. */
+#define CAPTURE_LOG_S16LE 1
+#define CAPTURE_LOG_S32LE 2
+#define CAPTURE_LOG_F32LE 3
+
+#define CAPTURE_LOG_BLOCK 1
+#define CAPTURE_LOG_XRUN 2
+
+#define CAPTURE_REPLAY_ASAP 0.0
+#define CAPTURE_REPLAY_REALTIME 1.0
+
+struct capture_log_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint32_t rate;
+  uint32_t channels;
+  uint32_t frame_bytes;
+  uint32_t reserved;
+  int64_t start_realtime_ns;
+  int64_t start_monotonic_ns;
+  char backend[32];
+};
+
+struct capture_log_record {
+  uint32_t type;
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t reserved;
+  int64_t read_start_ns;   /* CLOCK_MONOTONIC; for an xrun, when it was seen */
+  int64_t read_end_ns;
+  int64_t capture_ns;      /* first frame, CLOCK_REALTIME; 0 if unknown */
+};
+
+static inline int64_t capture_log_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint32_t capture_log_sample_bytes(uint32_t format) {
+  return format == CAPTURE_LOG_S16LE ? 2 : 4;
+}
+
+/* Recording. */
+
+struct capture_log {
+  FILE *file;
+  uint32_t frame_bytes;
+  uint64_t blocks;
+  uint64_t xruns;
+  uint64_t bytes;
+};
+
+static inline int capture_log_open(capture_log *log, const char *path, uint32_t format,
+                                   uint32_t rate, uint32_t channels, const char *backend) {
+  capture_log_header h;
+  memset(log, 0, sizeof(*log));
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CAPTURE_LOG_MAGIC, sizeof(h.magic));
+  h.version = CAPTURE_LOG_VERSION;
+  h.format = format;
+  h.rate = rate;
+  h.channels = channels;
+  h.frame_bytes = capture_log_sample_bytes(format) * channels;
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  h.start_realtime_ns = (int64_t) real.tv_sec * 1000000000LL + real.tv_nsec;
+  h.start_monotonic_ns = capture_log_monotonic_ns();
+  strncpy(h.backend, backend, sizeof(h.backend) - 1);
+
+  if (!(log->file = fopen(path, "wb")))
+    return -1;
+  setvbuf(log->file, NULL, _IOFBF, 1 << 20);
+  log->frame_bytes = h.frame_bytes;
+  if (fwrite(&h, sizeof(h), 1, log->file) != 1) {
+    fclose(log->file);
+    log->file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static inline int capture_log_write(capture_log *log, const capture_log_record *rec, const void *data) {
+  static const uint8_t pad[8] = { 0 };
+  size_t padding = (8 - rec->bytes % 8) % 8;
+  if (fwrite(rec, sizeof(*rec), 1, log->file) != 1 ||
+      (rec->bytes && data && fwrite(data, rec->bytes, 1, log->file) != 1) ||
+      (padding && fwrite(pad, padding, 1, log->file) != 1))
+    return -1;
+  log->bytes += sizeof(*rec) + rec->bytes + padding;
+  return 0;
+}
+
+static inline int capture_log_block(capture_log *log, const void *data, uint32_t frames,
+                                    int64_t read_start_ns, int64_t read_end_ns, int64_t capture_ns) {
+  capture_log_record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.type = CAPTURE_LOG_BLOCK;
+  rec.frames = frames;
+  rec.bytes = frames * log->frame_bytes;
+  rec.read_start_ns = read_start_ns;
+  rec.read_end_ns = read_end_ns;
+  rec.capture_ns = capture_ns;
+  log->blocks++;
+  return capture_log_write(log, &rec, data);
+}
+
+static inline int capture_log_xrun(capture_log *log, int64_t when_ns) {
+  capture_log_record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.type = CAPTURE_LOG_XRUN;
+  rec.read_start_ns = rec.read_end_ns = when_ns;
+  log->xruns++;
+  return capture_log_write(log, &rec, NULL);
+}
+
+static inline void capture_log_close(capture_log *log) {
+  if (log->file) {
+    fclose(log->file);
+    log->file = NULL;
+  }
+}
+
+/* Replay. */
+
+struct capture_replay {
+  uint8_t *map;
+  size_t size;
+  capture_log_header header;
+  double speed;                   /* 0: as fast as possible */
+  size_t next;                    /* offset of the next record */
+  const capture_log_record *cur;  /* record being consumed */
+  uint32_t used;                  /* frames of cur already handed out */
+  int64_t start_ns;               /* replay start, CLOCK_MONOTONIC */
+  int64_t log_start_ns;           /* the log's own start, same clock */
+  uint64_t blocks;
+  uint64_t xruns;
+  uint64_t frames;
+  int64_t max_late_ns;            /* worst delivery behind schedule */
+  bool corrupt;                   /* stopped at a record that does not add up */
+};
+
+/* "realtime", "asap" or a factor such as "4". */
+static inline double capture_replay_parse_speed(const char *s) {
+  if (!s || !strcmp(s, "realtime")) return CAPTURE_REPLAY_REALTIME;
+  if (!strcmp(s, "asap")) return CAPTURE_REPLAY_ASAP;
+  return atof(s);
+}
+
+static inline int capture_replay_open(capture_replay *r, const char *path, double speed) {
+  struct stat st;
+  memset(r, 0, sizeof(*r));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(capture_log_header)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  r->size = st.st_size;
+  r->map = (uint8_t*) mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    return -1;
+  }
+  memcpy(&r->header, r->map, sizeof(r->header));
+  const capture_log_header &h = r->header;
+  if (memcmp(h.magic, CAPTURE_LOG_MAGIC, sizeof(h.magic)) || h.version != CAPTURE_LOG_VERSION || !h.rate ||
+      !h.channels || (h.format != CAPTURE_LOG_S16LE && h.format != CAPTURE_LOG_S32LE &&
+                      h.format != CAPTURE_LOG_F32LE) ||
+      (uint64_t) h.frame_bytes != (uint64_t) capture_log_sample_bytes(h.format) * h.channels) {
+    munmap(r->map, r->size);
+    r->map = NULL;
+    errno = EINVAL;
+    return -1;
+  }
+  madvise(r->map, r->size, MADV_SEQUENTIAL);
+  r->speed = speed;
+  r->next = sizeof(capture_log_header);
+  r->log_start_ns = r->header.start_monotonic_ns;
+  r->start_ns = capture_log_monotonic_ns();
+  return 0;
+}
+
+/* Move to the next record; false at the end, a truncated tail, or a
+   record whose size does not match its frames (r->corrupt). */
+static inline bool capture_replay_advance(capture_replay *r) {
+  r->cur = NULL;
+  r->used = 0;
+  if (r->corrupt || r->next + sizeof(capture_log_record) > r->size)
+    return false;
+  const capture_log_record *rec = (const capture_log_record*) (r->map + r->next);
+  size_t padded = ((size_t) rec->bytes + 7) / 8 * 8;
+  if (r->next + sizeof(*rec) + rec->bytes > r->size)
+    return false;
+  if ((rec->type == CAPTURE_LOG_BLOCK && (uint64_t) rec->bytes != (uint64_t) rec->frames * r->header.frame_bytes) ||
+      (rec->type == CAPTURE_LOG_XRUN && rec->bytes)) {
+    r->corrupt = true;
+    return false;
+  }
+  r->cur = rec;
+  r->next += sizeof(*rec) + padded;
+
+  /* Hold the record back until it would have been read originally. */
+  if (r->speed > 0) {
+    int64_t due = r->start_ns + (int64_t) ((rec->read_end_ns - r->log_start_ns) / r->speed);
+    int64_t now = capture_log_monotonic_ns();
+    if (now < due) {
+      struct timespec ts = { (time_t) (due / 1000000000LL), (long) (due % 1000000000LL) };
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    } else if (now - due > r->max_late_ns) {
+      r->max_late_ns = now - due;
+    }
+  }
+  if (rec->type == CAPTURE_LOG_BLOCK)
+    r->blocks++;
+  return true;
+}
+
+/* Read up to `frames` frames, like snd_pcm_readi(): returns the frames
+   read, -EPIPE for a logged xrun (once, before the data after it), or 0
+   at the end of the log. Blocks are joined or split as needed; the
+   capture time of the first frame returned goes to *capture_ns. */
+static inline long capture_replay_read(capture_replay *r, void *buffer, uint32_t frames,
+                                       int64_t *capture_ns) {
+  const uint32_t frame_bytes = r->header.frame_bytes;
+  uint32_t filled = 0;
+  if (capture_ns) *capture_ns = 0;
+
+  while (filled < frames) {
+    if (!r->cur || (r->cur->type == CAPTURE_LOG_BLOCK && r->used == r->cur->frames)) {
+      if (!capture_replay_advance(r))
+        break;
+    }
+    if (r->cur->type == CAPTURE_LOG_XRUN) {
+      if (filled)
+        break;  /* hand out what we have, the xrun comes next call */
+      r->cur = NULL;
+      r->xruns++;
+      return -EPIPE;
+    }
+    if (r->cur->type != CAPTURE_LOG_BLOCK) {
+      r->cur = NULL;
+      continue;
+    }
+
+    uint32_t n = r->cur->frames - r->used;
+    if (n > frames - filled) n = frames - filled;
+    if (!filled && capture_ns && r->cur->capture_ns)
+      *capture_ns = r->cur->capture_ns + (int64_t) r->used * 1000000000LL / r->header.rate;
+    memcpy((uint8_t*) buffer + (size_t) filled * frame_bytes,
+           (const uint8_t*) (r->cur + 1) + (size_t) r->used * frame_bytes, (size_t) n * frame_bytes);
+    r->used += n;
+    filled += n;
+  }
+  r->frames += filled;
+  return filled;
+}
+
+static inline void capture_replay_close(capture_replay *r) {
+  if (r->map) {
+    munmap(r->map, r->size);
+    r->map = NULL;
+  }
+}
+
+static inline void capture_replay_print_stats(const capture_replay *r, FILE *out) {
+  fprintf(out, "replay: %lu blocks, %lu frames, %lu xruns, at most %.2f ms behind schedule%s\n",
+          (unsigned long) r->blocks, (unsigned long) r->frames, (unsigned long) r->xruns,
+          r->max_late_ns / 1e6, r->corrupt ? "; stopped at a corrupt record" : "");
+}
+
+#endif  // CAPTURE_LOG_H_
@@ -0,0 +1,309 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "capture-coro.h"
+
+// Thousands of capture tasks on a few threads (capture-coro.h). Every
+// task awaits its stream's blocks and meters them (RMS and peak), and no
+// thread blocks on any device:
+//
+//   --streams=N    paced mock devices, each woken by its own timerfd
+//   --callback=N   streams fed from one producer thread through
+//                  coro_stream_push(), the way a Pulse mainloop or a
+//                  PipeWire on_process would feed them
+//   --alsa=DEV     plus one ALSA device, on its poll descriptors
+//                  (built with -DCAPTURE_CORO_ALSA -lasound)
+//   --pulse        plus the default Pulse source through pulse_engine
+//                  (built with -DCAPTURE_CORO_PULSE -lpulse)
+//
+// At the end: blocks, CPU time, and how late the mock tasks ran after
+// each block was due (the reactor's wake-up latency under that load).
+//
+// g++ -O2 -std=c++20 coro-capture-example.cc -o coro-capture-example -lm -lpthread
+// g++ -O2 -std=c++20 -DCAPTURE_CORO_ALSA -DCAPTURE_CORO_PULSE coro-capture-example.cc -o coro-capture-example -lm -lpthread -lasound -lpulse
+// ./coro-capture-example --streams=2000 --threads=2 --seconds=10
+
+#define RATE 48000
+#define LATE_BUCKETS 24   /* powers of two of microseconds */
+
+struct task_stats {
+  uint64_t blocks, frames;
+  double sum_squares;
+  float peak;
+  uint64_t late[LATE_BUCKETS];
+  int64_t late_max_ns;
+  double late_sum_ns;
+};
+
+static void meter(task_stats *t, const coro_block &b, uint32_t channels) {
+  const int16_t *x = (const int16_t*) b.data;
+  size_t n = (size_t) b.frames * channels;
+  for (size_t i = 0; i < n; i++) {
+    float v = x[i] * (1.0f / 32768);
+    t->sum_squares += (double) v * v;
+    if (fabsf(v) > t->peak) t->peak = fabsf(v);
+  }
+  t->blocks++;
+  t->frames += b.frames;
+}
+
+static coro_task record_mock(coro_stream *s, task_stats *t) {
+  while (coro_block b = co_await coro_next_block(s)) {
+    /* The block just read was due when its last frame was. */
+    int64_t late = coro_now_ns(CLOCK_MONOTONIC) - mock_capture_frame_ns(&s->mock, s->mock.position);
+    if (late < 0) late = 0;
+    int bucket = 0;
+    while (bucket < LATE_BUCKETS - 1 && (late >> 10) >> bucket) bucket++;
+    t->late[bucket]++;
+    t->late_sum_ns += late;
+    if (late > t->late_max_ns) t->late_max_ns = late;
+    meter(t, b, s->mock.cfg.channels);
+  }
+}
+
+static coro_task record(coro_stream *s, task_stats *t, uint32_t channels) {
+  while (coro_block b = co_await coro_next_block(s))
+    meter(t, b, channels);
+}
+
+/* Stands in for a callback API's thread: one thread, many streams. */
+static void produce(std::vector<coro_stream*> *streams, uint32_t frames, double seconds, std::atomic<bool> *stop) {
+  std::vector<int16_t> block((size_t) frames * 2);
+  for (size_t i = 0; i < block.size(); i++)
+    block[i] = (int16_t) (8000 * sin(i * 0.05));
+  int64_t start = coro_now_ns(CLOCK_MONOTONIC), period = (int64_t) frames * 1000000000 / RATE;
+  for (uint64_t k = 0; !stop->load() && k * period < seconds * 1e9; k++) {
+    int64_t due = start + (int64_t) (k + 1) * period;
+    struct timespec ts = { (time_t) (due / 1000000000), (long) (due % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    for (size_t i = 0; i < streams->size(); i++)
+      coro_stream_push((*streams)[i], block.data(), frames, coro_now_ns(CLOCK_REALTIME) - period);
+  }
+  for (size_t i = 0; i < streams->size(); i++)
+    coro_stream_end((*streams)[i]);
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  --streams=N      mock streams (1000)\n"
+          "  --callback=N     streams fed from a producer thread (16)\n"
+          "  --threads=N      reactor threads (2)\n"
+          "  --seconds=S      how long (5)\n"
+          "  --block-ms=MS    block length (50)\n"
+#ifdef CAPTURE_CORO_ALSA
+          "  --alsa=DEV       an ALSA capture device too\n"
+#endif
+#ifdef CAPTURE_CORO_PULSE
+          "  --pulse          the default Pulse source too\n"
+#endif
+          , argv0);
+}
+
+int main(int argc, char *argv[]) {
+  int mocks = 1000, callbacks = 16, threads = 2;
+  double seconds = 5, block_ms = 50;
+  const char *alsa_device = NULL;
+  bool pulse = false;
+
+  enum { STREAMS = 256, CALLBACK, THREADS, SECONDS, BLOCK_MS, ALSA, PULSE };
+  static const struct option long_options[] = {
+    {"streams", 1, NULL, STREAMS}, {"callback", 1, NULL, CALLBACK}, {"threads", 1, NULL, THREADS},
+    {"seconds", 1, NULL, SECONDS}, {"block-ms", 1, NULL, BLOCK_MS}, {"alsa", 1, NULL, ALSA},
+    {"pulse", 0, NULL, PULSE}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case STREAMS: mocks = atoi(optarg); break;
+      case CALLBACK: callbacks = atoi(optarg); break;
+      case THREADS: threads = atoi(optarg); break;
+      case SECONDS: seconds = atof(optarg); break;
+      case BLOCK_MS: block_ms = atof(optarg); break;
+      case ALSA: alsa_device = optarg; break;
+      case PULSE: pulse = true; break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  uint32_t frames = (uint32_t) (RATE * block_ms / 1000);
+  if (mocks < 0 || callbacks < 0 || threads < 1 || seconds <= 0 || !frames) {
+    help(argv[0]);
+    return 1;
+  }
+
+  /* A descriptor per stream. */
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  static coro_reactor reactor;
+  if (coro_reactor_init(&reactor) < 0) {
+    perror("coro_reactor_init");
+    return 1;
+  }
+  int total = mocks + callbacks + (alsa_device ? 1 : 0) + (pulse ? 1 : 0);
+  static block_pool pool;
+  /* A block in hand per task, and full queues for the fed streams. */
+  if (block_pool_init(&pool, 2 * total + 10 * callbacks + 64, frames * 2 * sizeof(int16_t), false) < 0) {
+    perror("block_pool_init");
+    return 1;
+  }
+
+  std::vector<coro_stream*> streams;
+  std::vector<task_stats> stats(total);
+  memset(stats.data(), 0, stats.size() * sizeof(task_stats));
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, RATE, 2, MOCK_S16);
+  cfg.noise_amp = 0.05f;
+  for (int i = 0; i < mocks; i++) {
+    coro_stream *s = new coro_stream;
+    cfg.seed = i + 1;
+    cfg.sine_hz = 220 + i % 1000;
+    if (coro_stream_open_mock(s, &reactor, &pool, &cfg, frames) < 0) {
+      perror("mock stream");
+      return 1;
+    }
+    /* Devices are not in phase: spread their block boundaries. */
+    s->mock.start_ns -= (int64_t) frames * 1000000000 / RATE * i / mocks;
+    streams.push_back(s);
+    coro_spawn(&reactor, record_mock(s, &stats[i]));
+  }
+  std::vector<coro_stream*> fed;
+  for (int i = 0; i < callbacks; i++) {
+    coro_stream *s = new coro_stream;
+    if (coro_stream_open_queue(s, &reactor, &pool, frames, 2 * sizeof(int16_t), 8) < 0) {
+      perror("queue stream");
+      return 1;
+    }
+    streams.push_back(s);
+    fed.push_back(s);
+    coro_spawn(&reactor, record(s, &stats[mocks + i], 2));
+  }
+  int next = mocks + callbacks;
+
+#ifdef CAPTURE_CORO_ALSA
+  snd_pcm_t *pcm = NULL;
+  if (alsa_device) {
+    coro_stream *s = new coro_stream;
+    int err;
+    if ((err = snd_pcm_open(&pcm, alsa_device, SND_PCM_STREAM_CAPTURE, 0)) < 0 ||
+        (err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 2, RATE, 1,
+                                  (unsigned) (block_ms * 4000))) < 0) {
+      fprintf(stderr, "%s: %s\n", alsa_device, snd_strerror(err));
+      return 1;
+    }
+    if (coro_stream_open_alsa(s, &reactor, &pool, pcm, RATE, frames, 2 * sizeof(int16_t)) < 0) {
+      fprintf(stderr, "%s: cannot drive it from the reactor\n", alsa_device);
+      return 1;
+    }
+    streams.push_back(s);
+    coro_spawn(&reactor, record(s, &stats[next++], 2));
+  }
+#else
+  if (alsa_device) {
+    fprintf(stderr, "built without CAPTURE_CORO_ALSA\n");
+    return 1;
+  }
+#endif
+#ifdef CAPTURE_CORO_PULSE
+  static pulse_engine engine;
+  coro_stream *pulse_stream = NULL;
+  if (pulse) {
+    pulse_stream = new coro_stream;
+    pa_sample_spec spec = { PA_SAMPLE_S16LE, RATE, 2 };
+    if (coro_stream_open_queue(pulse_stream, &reactor, &pool, frames, 2 * sizeof(int16_t), 8) < 0 ||
+        pulse_engine_start(&engine, "coro-capture-example", 1) < 0 ||
+        !pulse_engine_add_stream(&engine, "coro", NULL, &spec, frames, 4 * frames, coro_pulse_process,
+                                 pulse_stream)) {
+      fprintf(stderr, "cannot record from Pulse\n");
+      return 1;
+    }
+    streams.push_back(pulse_stream);
+    coro_spawn(&reactor, record(pulse_stream, &stats[next++], 2));
+  }
+#else
+  if (pulse) {
+    fprintf(stderr, "built without CAPTURE_CORO_PULSE\n");
+    return 1;
+  }
+#endif
+  (void) next;
+
+  std::atomic<bool> stop_producer(false);
+  std::thread producer(produce, &fed, frames, seconds, &stop_producer);
+  /* The mocks run until --seconds, then every device "unplugs". */
+  std::thread timer([&]() {
+    struct timespec ts = { (time_t) seconds, (long) ((seconds - (time_t) seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    coro_reactor_stop(&reactor);
+  });
+
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  int64_t start = coro_now_ns(CLOCK_MONOTONIC);
+  coro_reactor_run(&reactor, threads);
+  double wall = (coro_now_ns(CLOCK_MONOTONIC) - start) / 1e9;
+  getrusage(RUSAGE_SELF, &after);
+  timer.join();
+  stop_producer.store(true);
+  producer.join();
+#ifdef CAPTURE_CORO_PULSE
+  if (pulse) pulse_engine_stop(&engine);
+#endif
+#ifdef CAPTURE_CORO_ALSA
+  if (pcm) snd_pcm_close(pcm);
+#endif
+
+  task_stats all;
+  memset(&all, 0, sizeof(all));
+  uint64_t mock_blocks = 0, dropped = 0, xruns = 0;
+  for (int i = 0; i < total; i++) {
+    task_stats *t = &stats[i];
+    all.blocks += t->blocks;
+    all.frames += t->frames;
+    if (t->peak > all.peak) all.peak = t->peak;
+    if (i < mocks) mock_blocks += t->blocks;
+    for (int k = 0; k < LATE_BUCKETS; k++) all.late[k] += t->late[k];
+    all.late_sum_ns += t->late_sum_ns;
+    if (t->late_max_ns > all.late_max_ns) all.late_max_ns = t->late_max_ns;
+  }
+  for (size_t i = 0; i < streams.size(); i++) {
+    dropped += streams[i]->dropped.load();
+    xruns += streams[i]->xruns;
+  }
+  double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6 +
+               (after.ru_stime.tv_sec - before.ru_stime.tv_sec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+  printf("%d streams (%d mock, %d fed) on %d threads for %.2f s: %lu blocks, %.1f s of audio, %lu dropped, %lu xruns\n",
+         total, mocks, callbacks, threads, wall, (unsigned long) all.blocks, (double) all.frames / RATE,
+         (unsigned long) dropped, (unsigned long) xruns);
+  printf("cpu %.2f s (%.1f%% of one core), %.2f us per block\n", cpu, wall > 0 ? cpu / wall * 100 : 0.0,
+         all.blocks ? cpu * 1e6 / all.blocks : 0.0);
+  if (mock_blocks) {
+    /* The bucket holding the 99th percentile, by its upper edge. */
+    uint64_t seen = 0;
+    int p99 = 0;
+    for (; p99 < LATE_BUCKETS - 1; p99++)
+      if ((seen += all.late[p99]) >= mock_blocks * 99 / 100) break;
+    printf("wake-up after due: mean %.1f us, p99 < %lu us, max %.1f us\n", all.late_sum_ns / mock_blocks / 1e3,
+           (unsigned long) (1024ul << p99) / 1000, all.late_max_ns / 1e3);
+  }
+  coro_reactor_print_stats(&reactor, stdout);
+  block_pool_print_stats(&pool, stdout);
+
+  /* Tasks still waiting when the reactor stopped are simply left. */
+  for (size_t i = 0; i < streams.size(); i++)
+    coro_stream_close(streams[i]);
+  coro_reactor_free(&reactor);
+  return 0;
+}
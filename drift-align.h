@@ -0,0 +1,264 @@
+/*
+  Keeps several capture devices sample-aligned although every crystal
+  runs at its own "48000 Hz".
+
+  Each stream gets a capture_clock (capture-clock.h) fed with its per-block
+  timestamps, which says at what time each of its frames was captured and
+  how fast the device really runs. Output is rendered on one reference
+  timeline: either CLOCK_MONOTONIC at the nominal rate, or the frames of a
+  master device. For every output block a stream works out which input
+  position belongs to that block's time, and a fine-ratio resampler reads
+  its input at
+
+    ratio = reference period / measured input period + error / horizon
+
+  where error is how far the resampler's read position is from where it
+  should be. The first term follows the drift, the second removes what is
+  left (and timestamp noise) slowly enough not to be heard. The
+  resampler is a 16-tap windowed sinc with 256 interpolated phases: the
+  same few multiply-adds per output sample at any ratio, no buffers
+  that grow with the drift.
+
+    drift_stream st;
+    drift_stream_init(&st, rate, channels);
+    ...capture thread, per block:
+    drift_stream_capture(&st, frame_pos, raw_ns, samples, frames);
+    ...output, per block, first frame at time first_ns:
+    drift_stream_render(&st, first_ns, ns_per_out_frame, out, frames);
+
+  Positions are kept as integer frame plus fraction, so nothing is lost to
+  double rounding over days. Not thread safe: capture and render for one
+  stream must be serialized by the caller. Linux only, C++11.
+*/
+#ifndef DRIFT_ALIGN_H_
+#define DRIFT_ALIGN_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "capture-clock.h"
+
+#define DRIFT_TAPS 16
+#define DRIFT_PHASES 256
+/* Time over which a position error is corrected, and the most the ratio
+   may deviate from the measured drift to do it. */
+#define DRIFT_HORIZON_SEC 1.0
+#define DRIFT_MAX_CORRECTION 0.001
+/* Further off than this (xrun, relock) the read position jumps. */
+#define DRIFT_JUMP_SEC 0.05
+
+static inline double drift_bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/* Windowed sinc, (DRIFT_PHASES + 1) rows of DRIFT_TAPS coefficients for
+   fractional offsets 0, 1/DRIFT_PHASES, ... 1. */
+static inline std::vector<float> drift_build_sinc_table() {
+  const double cutoff = 0.9, beta = 8.0;
+  const int half = DRIFT_TAPS / 2;
+  std::vector<float> t((DRIFT_PHASES + 1) * DRIFT_TAPS);
+  for (int p = 0; p <= DRIFT_PHASES; p++) {
+    double mu = (double) p / DRIFT_PHASES, sum = 0;
+    float *row = &t[p * DRIFT_TAPS];
+    for (int k = 0; k < DRIFT_TAPS; k++) {
+      double x = (k - (half - 1)) - mu;
+      double s = x == 0 ? cutoff : sin(M_PI * cutoff * x) / (M_PI * x);
+      double w = x / half;
+      double win = fabs(w) >= 1 ? 0 : drift_bessel_i0(beta * sqrt(1 - w * w)) / drift_bessel_i0(beta);
+      row[k] = (float) (s * win);
+      sum += row[k];
+    }
+    for (int k = 0; k < DRIFT_TAPS; k++)
+      row[k] = (float) (row[k] / sum);
+  }
+  return t;
+}
+
+/* Built once, on first use; a static's initializer is thread-safe, so
+   streams may start together. */
+static inline const float *drift_sinc_table() {
+  static const std::vector<float> table = drift_build_sinc_table();
+  return table.data();
+}
+
+struct drift_stream {
+  int channels;
+  double rate;
+  capture_clock clock;
+  /* Input FIFO, interleaved: frame `base` is at history[0], frame `end`
+     is the next one to be captured. */
+  std::vector<float> history;
+  uint64_t base;
+  uint64_t end;
+  std::vector<float> silence;   /* one frame of zeros, read where there is no input */
+  /* Read position of the next output frame. */
+  bool started;
+  uint64_t pos_frame;
+  double pos_frac;
+  double ratio;
+  double error_frames;   /* target minus read position, last render */
+  uint64_t rendered;
+  uint64_t jumps;
+  uint64_t starved;      /* output frames rendered without input */
+};
+
+static inline void drift_stream_init(drift_stream *st, uint32_t rate, int channels) {
+  st->channels = channels;
+  st->rate = rate;
+  capture_clock_init(&st->clock, rate, CAPTURE_CLOCK_TAU_SEC);
+  st->history.clear();
+  st->silence.assign(channels, 0.0f);
+  st->base = st->end = 0;
+  st->started = false;
+  st->pos_frame = 0;
+  st->pos_frac = 0;
+  st->ratio = 1;
+  st->error_frames = 0;
+  st->rendered = st->jumps = st->starved = 0;
+  drift_sinc_table();
+}
+
+/* A block captured at frame position `frame` (the device's count, which
+   restarts after an xrun), raw time of its first frame `raw_ns`.
+   samples == NULL advances the stream without keeping audio, for
+   simulations that only look at positions. */
+static inline void drift_stream_capture(drift_stream *st, uint64_t frame, int64_t raw_ns,
+                                        const float *samples, uint32_t frames) {
+  if (st->clock.locked && frame != st->end) {
+    /* The device count jumped: start the input over. */
+    capture_clock_reset(&st->clock);
+    st->started = false;
+    st->history.clear();
+    st->base = st->end = frame;
+  }
+  if (!st->clock.locked)
+    st->base = st->end = frame;
+  capture_clock_update(&st->clock, frame, raw_ns);
+
+  if (samples) {
+    if (st->history.empty())
+      st->base = frame;
+    st->history.insert(st->history.end(), samples, samples + (size_t) frames * st->channels);
+  } else {
+    st->history.clear();
+    st->base = frame + frames;
+  }
+  st->end = frame + frames;
+}
+
+/* Input frame n as stored, silence where there is none. */
+static inline const float *drift_stream_frame(const drift_stream *st, uint64_t n, const float *silence) {
+  if (n < st->base || n >= st->base + st->history.size() / st->channels)
+    return silence;
+  return &st->history[(size_t) (n - st->base) * st->channels];
+}
+
+/* Where the read position should be for an output frame at `time_ns`. */
+static inline double drift_stream_target(const drift_stream *st, int64_t time_ns) {
+  const capture_clock *c = &st->clock;
+  return (double) c->ref_frame +
+         ((double) (time_ns - c->ref_ns) - c->offset_ns) / c->ns_per_frame;
+}
+
+/* Render `frames` output frames, the first at `first_ns` on the reference
+   timeline which advances `ns_per_frame` per frame. out == NULL only
+   moves the read position. Returns the frames rendered from real input. */
+static inline uint32_t drift_stream_render(drift_stream *st, int64_t first_ns, double ns_per_frame,
+                                           float *out, uint32_t frames) {
+  const float *silence = st->silence.data();
+  double target = st->clock.locked ? drift_stream_target(st, first_ns) : -1;
+  if (target < 0) {
+    /* Not started, or before this stream's first frame. */
+    if (out) memset(out, 0, sizeof(float) * frames * st->channels);
+    st->starved += frames;
+    return 0;
+  }
+  double pos = (double) st->pos_frame + st->pos_frac;
+  if (!st->started || fabs(target - pos) > DRIFT_JUMP_SEC * st->rate) {
+    if (st->started) st->jumps++;
+    st->started = true;
+    st->pos_frame = (uint64_t) floor(target);
+    st->pos_frac = target - floor(target);
+    pos = target;
+  }
+  st->error_frames = target - pos;
+
+  double correction = st->error_frames / (DRIFT_HORIZON_SEC * st->rate);
+  if (correction > DRIFT_MAX_CORRECTION) correction = DRIFT_MAX_CORRECTION;
+  if (correction < -DRIFT_MAX_CORRECTION) correction = -DRIFT_MAX_CORRECTION;
+  st->ratio = ns_per_frame / st->clock.ns_per_frame + correction;
+
+  uint32_t real = 0;
+  if (out) {
+    const float *table = drift_sinc_table();
+    const int ch = st->channels;
+    float h[DRIFT_TAPS];
+    for (uint32_t i = 0; i < frames; i++) {
+      double p = st->pos_frac + st->ratio * i;
+      double whole = floor(p);
+      uint64_t n = st->pos_frame + (uint64_t) whole;
+      double phase = (p - whole) * DRIFT_PHASES;
+      int j = (int) phase;
+      float f = (float) (phase - j);
+      const float *h0 = table + j * DRIFT_TAPS, *h1 = h0 + DRIFT_TAPS;
+      for (int k = 0; k < DRIFT_TAPS; k++)
+        h[k] = h0[k] + f * (h1[k] - h0[k]);
+
+      float *o = out + (size_t) i * ch;
+      for (int c = 0; c < ch; c++) o[c] = 0;
+      uint64_t first = n - (DRIFT_TAPS / 2 - 1);
+      for (int k = 0; k < DRIFT_TAPS; k++) {
+        const float *x = drift_stream_frame(st, first + k, silence);
+        for (int c = 0; c < ch; c++)
+          o[c] += h[k] * x[c];
+      }
+      if (n + DRIFT_TAPS / 2 < st->end) real++;
+    }
+  } else {
+    double last = st->pos_frac + st->ratio * (frames - 1);
+    real = st->pos_frame + (uint64_t) floor(last) + DRIFT_TAPS / 2 < st->end ? frames : 0;
+  }
+  st->starved += frames - real;
+  st->rendered += frames;
+
+  double advance = st->pos_frac + st->ratio * frames;
+  double whole = floor(advance);
+  st->pos_frame += (uint64_t) whole;
+  st->pos_frac = advance - whole;
+
+  /* Keep only what the next render can still reach. */
+  uint64_t keep_from = st->pos_frame > DRIFT_TAPS ? st->pos_frame - DRIFT_TAPS : 0;
+  if (keep_from > st->base + 4096 && !st->history.empty()) {
+    size_t drop = (size_t) (keep_from - st->base);
+    if (drop * st->channels >= st->history.size()) {
+      st->history.clear();
+      st->base = st->end;
+    } else {
+      st->history.erase(st->history.begin(), st->history.begin() + drop * st->channels);
+      st->base = keep_from;
+    }
+  }
+  return real;
+}
+
+/* Read position of the next output frame, in input frames. */
+static inline double drift_stream_position(const drift_stream *st) {
+  return (double) st->pos_frame + st->pos_frac;
+}
+
+static inline void drift_stream_print_stats(const drift_stream *st, FILE *out) {
+  fprintf(out, "ratio %.6f, error %+.3f frames, %lu rendered, %lu starved, %lu jumps, ",
+          st->ratio, st->error_frames, (unsigned long) st->rendered, (unsigned long) st->starved,
+          (unsigned long) st->jumps);
+  capture_clock_print_stats(&st->clock, out);
+}
+
+#endif  // DRIFT_ALIGN_H_
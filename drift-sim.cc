@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "drift-align.h"
+
+// Simulates three USB cards that all claim SAMPLE_RATE for a day and
+// checks that drift-align.h keeps them aligned.
+//
+// Every card has its own offset (ppm) plus a slow thermal wander, starts
+// at its own moment, and stamps its blocks with up to TIMESTAMP_JITTER_US
+// of error, like snd_pcm_status() times would have. The simulator knows
+// the true time of every frame, so it can measure, for each output block,
+// how far a stream's read position is from the frame that was really
+// captured at that block's time:
+//
+//   alignment   read position vs truth, per stream and between streams,
+//               after a LOCK_SEC warm-up (max and RMS, in microseconds)
+//   quality     for AUDIO_SEC after the warm-up and at the end, audio
+//               is captured and resampled for real; SNR against the
+//               ideal signal at the resampler's own read positions, and
+//               ns per output frame
+//
+// Both reference timelines run: CLOCK_MONOTONIC at the nominal rate, and
+// card 0 as master. Positions alone are simulated for the rest of the day.
+// Exits nonzero if any stream, or any pair, is ever more than
+// MAX_ALIGN_US out, or a stream jumps.
+//
+// g++ -O2 drift-sim.cc -o drift-sim -lm -std=c++11
+// ./drift-sim [hours]      (24 by default, a few minutes of CPU)
+
+#define SAMPLE_RATE 48000
+#define STREAMS 3
+#define BLOCK_FRAMES 480
+#define TICK_NS 10000000LL
+#define LATENCY_NS 40000000LL
+#define LOCK_SEC 30
+#define AUDIO_SEC 10
+#define TIMESTAMP_JITTER_US 500
+#define MONOTONIC_EPOCH_NS 1000000000000LL
+#define MAX_ALIGN_US 250
+
+struct source {
+  long double offset;     // fractional rate error
+  long double wander;     // amplitude of the slow sinusoidal rate change
+  long double period_s;
+  long double phase;
+  long double start_s;    // true time of frame 0
+  uint64_t next_frame;    // next block to capture
+};
+
+static const source templates[STREAMS] = {
+  {   0e-6, 10e-6, 7200, 0.0, 0.0000, 0 },
+  {  80e-6, 15e-6, 10800, 1.0, 0.0123, 0 },
+  { -120e-6, 8e-6, 18000, 2.0, 0.0371, 0 },
+};
+
+// Frames a source has captured by true time t (fractional).
+static long double frames_at(const source &s, long double t) {
+  long double x = t - s.start_s;
+  long double w = 2 * M_PI / s.period_s;
+  return SAMPLE_RATE * ((1 + s.offset) * x + s.wander / w * (cosl(s.phase) - cosl(w * x + s.phase)));
+}
+
+// True time at which a source captured (fractional) frame n.
+static long double time_of(const source &s, long double n) {
+  long double w = 2 * M_PI / s.period_s;
+  long double t = s.start_s + n / (SAMPLE_RATE * (1 + s.offset));
+  for (int i = 0; i < 4; i++) {
+    long double rate = SAMPLE_RATE * (1 + s.offset + s.wander * sinl(w * (t - s.start_s) + s.phase));
+    t -= (frames_at(s, t) - n) / rate;
+  }
+  return t;
+}
+
+static double signal_at(long double t) {
+  long double f1 = fmodl(997 * t, 1), f2 = fmodl(5003 * t, 1);
+  return 0.5 * sin(2 * M_PI * (double) f1) + 0.3 * sin(2 * M_PI * (double) f2);
+}
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct error_stats {
+  double max, sum2;
+  uint64_t n;
+  void add(double e) { if (fabs(e) > max) max = fabs(e); sum2 += e * e; n++; }
+  double rms() const { return n ? sqrt(sum2 / n) : 0; }
+};
+
+struct snr_stats {
+  double signal, noise;
+  void add(double ideal, double got) { signal += ideal * ideal; noise += (got - ideal) * (got - ideal); }
+  double db() const { return noise > 0 ? 10 * log10(signal / noise) : 999; }
+};
+
+static bool run(bool master_reference, double hours) {
+  source src[STREAMS];
+  static drift_stream st[STREAMS];
+  error_stats align[STREAMS], pair[STREAMS];
+  snr_stats resampler_snr;
+  memset(align, 0, sizeof(align));
+  memset(pair, 0, sizeof(pair));
+  memset(&resampler_snr, 0, sizeof(resampler_snr));
+  for (int i = 0; i < STREAMS; i++) {
+    src[i] = templates[i];
+    drift_stream_init(&st[i], SAMPLE_RATE, 1);
+  }
+  srand(1);
+
+  std::vector<float> in(BLOCK_FRAMES), out(BLOCK_FRAMES);
+  int64_t total_ticks = (int64_t) (hours * 3600 * 1e9 / TICK_NS);
+  int64_t render_ns = 0, rendered_frames = 0;
+  uint64_t m = 0;
+  const double out_ns_per_frame = 1e9 / SAMPLE_RATE;
+  const long double out_start_s = 0.1;
+
+  for (int64_t tick = 1; tick <= total_ticks; tick++) {
+    long double now = (long double) tick * TICK_NS / 1e9;
+    // Audio runs from a second before each measured window, to fill the
+    // resampler history.
+    long double end_window = hours * 3600 - AUDIO_SEC;
+    bool audio = (now >= LOCK_SEC - 1 && now < LOCK_SEC + AUDIO_SEC) || now >= end_window - 1;
+    bool measure = (now >= LOCK_SEC && now < LOCK_SEC + AUDIO_SEC) || now >= end_window;
+
+    for (int i = 0; i < STREAMS; i++) {
+      source &s = src[i];
+      while (s.next_frame + BLOCK_FRAMES <= frames_at(s, now)) {
+        long double t0 = time_of(s, s.next_frame);
+        double jitter = ((double) rand() / RAND_MAX * 2 - 1) * TIMESTAMP_JITTER_US * 1000;
+        int64_t raw_ns = MONOTONIC_EPOCH_NS + (int64_t) (t0 * 1e9L) + (int64_t) jitter;
+        if (audio)
+          for (int k = 0; k < BLOCK_FRAMES; k++)
+            in[k] = (float) signal_at(time_of(s, s.next_frame + k));
+        drift_stream_capture(&st[i], s.next_frame, raw_ns, audio ? in.data() : NULL, BLOCK_FRAMES);
+        s.next_frame += BLOCK_FRAMES;
+      }
+    }
+
+    // Output blocks whose time is at least LATENCY_NS in the past.
+    long double horizon = now - (long double) LATENCY_NS / 1e9;
+    while (true) {
+      long double t_next;
+      int64_t first_ns;
+      double ns_per_frame;
+      if (master_reference) {
+        if (frames_at(src[0], horizon) < m + BLOCK_FRAMES || !st[0].clock.locked)
+          break;
+        first_ns = capture_clock_time(&st[0].clock, m);
+        ns_per_frame = st[0].clock.ns_per_frame;
+        t_next = time_of(src[0], m + BLOCK_FRAMES);
+      } else {
+        long double t_first = out_start_s + m / (long double) SAMPLE_RATE;
+        t_next = out_start_s + (m + BLOCK_FRAMES) / (long double) SAMPLE_RATE;
+        if (t_next > horizon)
+          break;
+        first_ns = MONOTONIC_EPOCH_NS + (int64_t) (t_first * 1e9L);
+        ns_per_frame = out_ns_per_frame;
+      }
+
+      for (int i = 0; i < STREAMS; i++) {
+        double pos_before = drift_stream_position(&st[i]);
+        uint64_t jumps = st[i].jumps;
+        int64_t start = monotonic_ns();
+        drift_stream_render(&st[i], first_ns, ns_per_frame, audio ? out.data() : NULL, BLOCK_FRAMES);
+        if (audio) {
+          render_ns += monotonic_ns() - start;
+          rendered_frames += BLOCK_FRAMES;
+        }
+
+        if (measure && jumps == st[i].jumps && (!master_reference || i > 0))
+          for (int k = 0; k < BLOCK_FRAMES; k++)
+            resampler_snr.add(signal_at(time_of(src[i], pos_before + st[i].ratio * k)), out[k]);
+      }
+
+      // Where each stream will read the next output frame, vs the frame
+      // it really captured at that frame's time.
+      if (t_next > LOCK_SEC) {
+        double e0 = 0;
+        for (int i = 0; i < STREAMS; i++) {
+          double e = (drift_stream_position(&st[i]) - (double) frames_at(src[i], t_next)) / SAMPLE_RATE * 1e6;
+          align[i].add(e);
+          if (i == 0) e0 = e;
+          else pair[i].add(e - e0);
+        }
+      }
+      m += BLOCK_FRAMES;
+    }
+  }
+
+  fprintf(stdout, "reference: %s, %.1f h, timestamp jitter +-%d us, %d ms latency\n",
+          master_reference ? "card 0 (master)" : "CLOCK_MONOTONIC", hours, TIMESTAMP_JITTER_US,
+          (int) (LATENCY_NS / 1000000));
+  long double end = hours * 3600;
+  bool ok = true;
+  for (int i = 0; i < STREAMS; i++) {
+    bool aligned = align[i].max <= MAX_ALIGN_US && pair[i].max <= MAX_ALIGN_US && st[i].jumps == 0;
+    double free_running = (double) (frames_at(src[i], end) - frames_at(src[0], end)) / SAMPLE_RATE * 1e3;
+    fprintf(stdout, "  card %d (%+.0f ppm): alignment max %.1f us rms %.1f us", i,
+            (double) src[i].offset * 1e6, align[i].max, align[i].rms());
+    if (i > 0)
+      fprintf(stdout, ", vs card 0 max %.1f us (uncompensated: %+.0f ms)", pair[i].max, free_running);
+    fprintf(stdout, " %s\n    ", aligned ? "ok" : "WRONG");
+    ok &= aligned;
+    drift_stream_print_stats(&st[i], stdout);
+  }
+  fprintf(stdout, "  resampler SNR %.1f dB, %.1f ns per output frame\n", resampler_snr.db(),
+          rendered_frames ? (double) render_ns / rendered_frames : 0.0);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  double hours = argc > 1 ? atof(argv[1]) : 24;
+  bool ok = run(false, hours);
+  ok &= run(true, hours);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/*
+  Batches of feature or audio windows from many streams, for inference.
+
+  A model runs far more efficiently on many windows at once (its weights
+  are read once per batch, not once per window), but each stream's DSP
+  produces one window at a time. The batcher gathers them, from any
+  number of threads, into batch tensors: `max_batch` rows of
+  `item_floats` floats, contiguous and 64-byte aligned (rows are padded
+  to a multiple of 16 floats, the padding zeroed), with per-row metadata
+  (stream, sequence, capture time, when it was ready).
+
+  A batch is handed to the consumer when it is full or when its first
+  window has waited `max_wait_ns`, whichever comes first; set max_wait so
+  that it plus the inference time fits the latency budget. The batches
+  are allocated up front and circulate (open -> ready -> consumer ->
+  free); when the consumer holds them all, a window is dropped and
+  counted rather than blocking the producer.
+
+    frame_batcher b;
+    frame_batcher_init(&b, 8000, 32, 50000000, 4);    // 32 x 8000, 50 ms
+    frame_batcher_add(&b, stream, seq, capture_ns, window);   // producers
+    frame_batch *t;
+    while ((t = frame_batcher_next(&b, 100)) != NULL) { // consumer
+      run_model(t->data, t->count, b.stride);
+      frame_batcher_release(&b, t);
+    }
+    frame_batcher_close(&b);   // seals what is open; next() drains, then NULL
+
+  A producer copies its window outside the lock; next() returns a batch
+  once every row handed out in it is written. Linux only, C++11.
+*/
+#ifndef FRAME_BATCHER_H_
+#define FRAME_BATCHER_H_
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+struct frame_batch_item {
+  uint32_t stream;
+  uint64_t seq;           /* the stream's window number */
+  int64_t capture_ns;     /* the window's first frame */
+  int64_t ready_ns;       /* added to the batcher */
+};
+
+struct frame_batch {
+  float *data;            /* count rows of stride floats */
+  frame_batch_item *items;
+  uint32_t count;
+  bool full;              /* sealed at max_batch, not by the wait */
+  int64_t opened_ns, sealed_ns;
+  std::atomic<uint32_t> written;
+};
+
+struct frame_batcher {
+  uint32_t item_floats, stride, max_batch;
+  int64_t max_wait_ns;
+  std::vector<frame_batch*> all;
+  std::mutex lock;
+  std::condition_variable ready_cv;
+  std::vector<frame_batch*> free_list;
+  std::vector<frame_batch*> ready;  /* FIFO ring of all.size() slots */
+  size_t ready_head, ready_count;
+  frame_batch *open;
+  bool closed;
+  /* Under the lock. */
+  uint64_t items, dropped, batches, full_batches, max_ready;
+  int64_t wait_ns;                  /* opened to sealed, summed */
+};
+
+static inline int64_t frame_batcher_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void frame_batcher_free(frame_batcher *b) {
+  for (size_t i = 0; i < b->all.size(); i++) {
+    free(b->all[i]->data);
+    delete[] b->all[i]->items;
+    delete b->all[i];
+  }
+  b->all.clear();
+  b->free_list.clear();
+  b->ready.clear();
+}
+
+/* `batches` tensors of max_batch rows. False without memory. */
+static inline bool frame_batcher_init(frame_batcher *b, uint32_t item_floats, uint32_t max_batch, int64_t max_wait_ns,
+                                      uint32_t batches) {
+  b->item_floats = item_floats;
+  b->stride = (item_floats + 15) & ~15u;
+  b->max_batch = max_batch ? max_batch : 1;
+  b->max_wait_ns = max_wait_ns;
+  b->ready_head = b->ready_count = 0;
+  b->open = NULL;
+  b->closed = false;
+  b->items = b->dropped = b->batches = b->full_batches = b->max_ready = 0;
+  b->wait_ns = 0;
+  if (!item_floats || batches < 2)
+    return false;
+  for (uint32_t i = 0; i < batches; i++) {
+    frame_batch *t = new frame_batch;
+    t->items = new frame_batch_item[b->max_batch];
+    t->count = 0;
+    t->written.store(0);
+    size_t bytes = (size_t) b->max_batch * b->stride * sizeof(float);
+    if (posix_memalign((void**) &t->data, 64, bytes) != 0) {
+      delete[] t->items;
+      delete t;
+      frame_batcher_free(b);
+      return false;
+    }
+    /* Touched now, not on the first batch. */
+    memset(t->data, 0, bytes);
+    b->all.push_back(t);
+    b->free_list.push_back(t);
+  }
+  /* Every batch fits at once, so the ring never grows under the lock. */
+  b->ready.assign(batches, NULL);
+  return true;
+}
+
+/* Under the lock. */
+static inline void frame_batcher_seal(frame_batcher *b, bool full) {
+  frame_batch *t = b->open;
+  b->open = NULL;
+  t->full = full;
+  t->sealed_ns = frame_batcher_now_ns();
+  b->batches++;
+  if (full) b->full_batches++;
+  b->wait_ns += t->sealed_ns - t->opened_ns;
+  b->ready[(b->ready_head + b->ready_count++) % b->ready.size()] = t;
+  if (b->ready_count > b->max_ready)
+    b->max_ready = b->ready_count;
+  b->ready_cv.notify_one();
+}
+
+/* Any thread. Copies item_floats floats; false when every batch is
+   with the consumer (the window is dropped) or the batcher is closed. */
+static inline bool frame_batcher_add(frame_batcher *b, uint32_t stream, uint64_t seq, int64_t capture_ns,
+                                     const float *x) {
+  int64_t now = frame_batcher_now_ns();
+  frame_batch *t;
+  uint32_t row;
+  {
+    std::lock_guard<std::mutex> hold(b->lock);
+    if (b->closed || (!b->open && b->free_list.empty())) {
+      b->dropped++;
+      return false;
+    }
+    if (!b->open) {
+      b->open = b->free_list.back();
+      b->free_list.pop_back();
+      b->open->count = 0;
+      b->open->written.store(0, std::memory_order_relaxed);
+      b->open->opened_ns = now;
+      /* The consumer's deadline starts now. */
+      b->ready_cv.notify_one();
+    }
+    t = b->open;
+    row = t->count++;
+    b->items++;
+    if (t->count == b->max_batch)
+      frame_batcher_seal(b, true);
+  }
+  frame_batch_item *it = &t->items[row];
+  it->stream = stream;
+  it->seq = seq;
+  it->capture_ns = capture_ns;
+  it->ready_ns = now;
+  float *dst = t->data + (size_t) row * b->stride;
+  memcpy(dst, x, b->item_floats * sizeof(float));
+  memset(dst + b->item_floats, 0, (b->stride - b->item_floats) * sizeof(float));
+  t->written.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+/* The consumer. Waits up to timeout_ms (-1 forever) for a batch, sealing
+   the open one at its deadline; NULL on timeout, or once closed and
+   drained. */
+static inline frame_batch *frame_batcher_next(frame_batcher *b, int timeout_ms) {
+  std::chrono::steady_clock::time_point until =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms < 0 ? 0 : timeout_ms);
+  std::unique_lock<std::mutex> hold(b->lock);
+  for (;;) {
+    if (b->ready_count) {
+      frame_batch *t = b->ready[b->ready_head];
+      b->ready_head = (b->ready_head + 1) % b->ready.size();
+      b->ready_count--;
+      hold.unlock();
+      /* Rows handed out before the seal are being copied in. */
+      while (t->written.load(std::memory_order_acquire) != t->count)
+        sched_yield();
+      return t;
+    }
+    int64_t now = frame_batcher_now_ns();
+    if (b->open && (b->closed || now >= b->open->opened_ns + b->max_wait_ns)) {
+      frame_batcher_seal(b, false);
+      continue;
+    }
+    if (b->closed)
+      return NULL;
+    std::chrono::steady_clock::time_point wake = std::chrono::steady_clock::now();
+    if (timeout_ms >= 0 && wake >= until)
+      return NULL;
+    if (b->open) {
+      wake += std::chrono::nanoseconds(b->open->opened_ns + b->max_wait_ns - now);
+      if (timeout_ms >= 0 && until < wake) wake = until;
+      b->ready_cv.wait_until(hold, wake);
+    } else if (timeout_ms >= 0) {
+      b->ready_cv.wait_until(hold, until);
+    } else {
+      b->ready_cv.wait(hold);
+    }
+  }
+}
+
+/* The consumer, done with a batch. */
+static inline void frame_batcher_release(frame_batcher *b, frame_batch *t) {
+  std::lock_guard<std::mutex> hold(b->lock);
+  b->free_list.push_back(t);
+}
+
+/* No more adds; what is open is sealed by the next next(). */
+static inline void frame_batcher_close(frame_batcher *b) {
+  std::lock_guard<std::mutex> hold(b->lock);
+  b->closed = true;
+  b->ready_cv.notify_all();
+}
+
+static inline void frame_batcher_print_stats(frame_batcher *b, FILE *out) {
+  std::lock_guard<std::mutex> hold(b->lock);
+  fprintf(out, "batcher: %lu windows of %u floats (rows of %u) in %lu batches of %.1f on average, %lu full and "
+          "%lu at the %.1f ms wait (%.2f ms open on average); %lu dropped, %lu batches ready at most\n",
+          (unsigned long) b->items, b->item_floats, b->stride, (unsigned long) b->batches,
+          b->batches ? (double) b->items / b->batches : 0.0, (unsigned long) b->full_batches,
+          (unsigned long) (b->batches - b->full_batches), b->max_wait_ns / 1e6,
+          b->batches ? b->wait_ns / 1e6 / b->batches : 0.0, (unsigned long) b->dropped,
+          (unsigned long) b->max_ready);
+}
+
+#endif  // FRAME_BATCHER_H_
@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "level-meter.h"
+#include "mock-capture.h"
+
+// Cost and correctness of level-meter.h.
+//
+//   cost      ns per sample of the lane pass against a straightforward
+//             per-sample, per-channel loop, for s16 and f32 at 1, 2, 6 and
+//             8 channels, and what that is as a share of one core for a
+//             48 kHz stream (the budget is well under 1%)
+//   accuracy  peak, RMS, DC and clip counts against a double-precision
+//             reference, on a sine with an offset and clipped peaks
+//   publish   a reader thread hammering level_meter_read() while the
+//             meter publishes every block: no torn snapshot may get out
+//
+// g++ -O2 level-meter-bench.cc -o level-meter-bench -lm -std=c++11 -lpthread
+// ./level-meter-bench
+
+#define SAMPLE_RATE 48000
+#define BLOCK_FRAMES 480
+
+static int64_t monotonic_ns() {
+  return mock_monotonic_ns();
+}
+
+// The loop the examples would have written.
+template <typename T>
+static void naive(level_channel *out, const T *x, uint32_t frames, uint32_t channels, float scale) {
+  for (uint32_t c = 0; c < channels; c++) {
+    double sum = 0, squares = 0;
+    float peak = 0;
+    uint32_t clips = 0;
+    for (uint32_t f = 0; f < frames; f++) {
+      float v = x[f * channels + c] * scale;
+      if (fabsf(v) > peak) peak = fabsf(v);
+      sum += v;
+      squares += (double) v * v;
+      if (fabsf(v) >= LEVEL_METER_CLIP) clips++;
+    }
+    out[c].peak = peak;
+    out[c].rms = (float) sqrt(squares / frames);
+    out[c].dc = (float) (sum / frames);
+    out[c].clips = clips;
+  }
+}
+
+template <typename T>
+static void fill(std::vector<T> &x, uint32_t frames, uint32_t channels, float full_scale) {
+  x.resize((size_t) frames * channels);
+  for (uint32_t f = 0; f < frames; f++)
+    for (uint32_t c = 0; c < channels; c++) {
+      /* Per channel: its own frequency, a small offset, peaks clipped at 1.2x. */
+      double v = 1.2 * sin(2 * M_PI * (300.0 + 100 * c) * f / SAMPLE_RATE) + 0.01 * (c + 1);
+      v = v > 1 ? 1 : v < -1 ? -1 : v;
+      x[(size_t) f * channels + c] = (T) (v * full_scale);
+    }
+}
+
+template <typename T>
+static void cost(const char *name, uint32_t channels, float full_scale, float scale,
+                 void (*process)(level_meter*, const T*, uint32_t, int64_t)) {
+  const uint32_t blocks = 20000;
+  std::vector<T> x;
+  fill(x, BLOCK_FRAMES, channels, full_scale);
+  level_meter m;
+  level_meter_init(&m, SAMPLE_RATE, channels, 100);
+
+  int64_t t = monotonic_ns();
+  for (uint32_t i = 0; i < blocks; i++)
+    process(&m, x.data(), BLOCK_FRAMES, i);
+  double lanes = (double) (monotonic_ns() - t) / ((double) blocks * BLOCK_FRAMES * channels);
+
+  level_channel ref[LEVEL_METER_MAX_CHANNELS];
+  t = monotonic_ns();
+  for (uint32_t i = 0; i < blocks; i++)
+    naive(ref, x.data(), BLOCK_FRAMES, channels, scale);
+  double plain = (double) (monotonic_ns() - t) / ((double) blocks * BLOCK_FRAMES * channels);
+
+  /* Share of a core: ns per second of audio. */
+  double core = lanes * SAMPLE_RATE * channels / 1e9 * 100;
+  fprintf(stdout, "  %s %2u ch: %6.3f ns/sample (plain loop %6.3f, %4.1fx), %.4f%% of a core per stream\n",
+          name, channels, lanes, plain, plain / lanes, core);
+}
+
+template <typename T>
+static bool accuracy(const char *name, uint32_t channels, float full_scale, float scale,
+                     void (*process)(level_meter*, const T*, uint32_t, int64_t)) {
+  const uint32_t frames = SAMPLE_RATE;  /* one window of a second, uneven blocks */
+  std::vector<T> x;
+  fill(x, frames, channels, full_scale);
+  level_meter m;
+  level_meter_init(&m, SAMPLE_RATE, channels, 1000);
+  for (uint32_t f = 0; f < frames; ) {
+    uint32_t n = frames - f < 333 ? frames - f : 333;
+    process(&m, x.data() + (size_t) f * channels, n, f);
+    f += n;
+  }
+  level_snapshot s;
+  level_channel ref[LEVEL_METER_MAX_CHANNELS];
+  naive(ref, x.data(), frames, channels, scale);
+  bool ok = level_meter_read(&m, &s) && s.frames == frames;
+  double worst = 0;
+  for (uint32_t c = 0; ok && c < channels; c++) {
+    worst = fmax(worst, fabs(s.channel[c].peak - ref[c].peak));
+    worst = fmax(worst, fabs(s.channel[c].rms - ref[c].rms));
+    worst = fmax(worst, fabs(s.channel[c].dc - ref[c].dc));
+    ok = s.channel[c].clips == ref[c].clips && ref[c].clips > 0;
+  }
+  ok = ok && worst < 1e-4;
+  fprintf(stdout, "  %s %2u ch: %s, worst level error %.1e", name, channels, ok ? "ok" : "MISMATCH", worst);
+  if (ok)
+    fprintf(stdout, ", ch0 rms %.1f dBFS dc %+.4f, %u clipped", level_db(s.channel[0].rms), s.channel[0].dc,
+            s.channel[0].clips);
+  fprintf(stdout, "\n");
+  return ok;
+}
+
+// Every snapshot's channels are filled from one block value; a torn read
+// would mix two.
+static bool publish() {
+  const uint32_t channels = 8, blocks = 200000;
+  static level_meter m;
+  level_meter_init(&m, SAMPLE_RATE, channels, 1);
+  std::atomic<bool> done(false);
+  uint64_t reads = 0, torn = 0;
+  std::thread reader([&] {
+    level_snapshot s;
+    while (!done.load()) {
+      if (!level_meter_read(&m, &s))
+        continue;
+      reads++;
+      for (uint32_t c = 1; c < channels; c++)
+        if (s.channel[c].peak != s.channel[0].peak)
+          torn++;
+    }
+  });
+  std::vector<int16_t> x(48 * channels);
+  for (uint32_t i = 0; i < blocks; i++) {
+    std::fill(x.begin(), x.end(), (int16_t) (i % 30000));
+    level_meter_process_s16(&m, x.data(), 48, i);
+  }
+  done.store(true);
+  reader.join();
+  fprintf(stdout, "publish: %u windows, %lu reads, %lu torn\n", blocks, (unsigned long) reads,
+          (unsigned long) torn);
+  return torn == 0;
+}
+
+int main() {
+  static const uint32_t channel_counts[] = { 1, 2, 6, 8 };
+  bool ok = true;
+  fprintf(stdout, "cost, %u-frame blocks at %d Hz\n", BLOCK_FRAMES, SAMPLE_RATE);
+  for (size_t i = 0; i < sizeof(channel_counts) / sizeof(channel_counts[0]); i++) {
+    cost<int16_t>("s16", channel_counts[i], 32767, 1.0f / 32768, level_meter_process_s16);
+    cost<float>("f32", channel_counts[i], 1, 1, level_meter_process_f32);
+  }
+  fprintf(stdout, "accuracy\n");
+  for (size_t i = 0; i < sizeof(channel_counts) / sizeof(channel_counts[0]); i++) {
+    ok &= accuracy<int16_t>("s16", channel_counts[i], 32767, 1.0f / 32768, level_meter_process_s16);
+    ok &= accuracy<float>("f32", channel_counts[i], 1, 1, level_meter_process_f32);
+  }
+  ok &= publish();
+  return ok ? 0 : 1;
+}
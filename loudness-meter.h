@@ -0,0 +1,351 @@
+/*
+  Streaming loudness (EBU R128 / ITU-R BS.1770): momentary, short-term and
+  gated integrated loudness, computed as blocks arrive.
+
+  Every channel goes through the K-weighting filter (a high shelf, then
+  the RLB high-pass), and the filtered energy is summed over 100 ms
+  sub-blocks. From the sub-blocks of each stream:
+
+    momentary    the last 4 (400 ms), every 100 ms
+    short-term   the last 30 (3 s)
+    integrated   every 400 ms block (75% overlap) above -70 LUFS, then
+                 those within 10 LU of their mean
+
+  Nothing is re-scanned: the last 30 sub-blocks are a ring, and the gated
+  blocks go into a histogram of 0.1 LU bins that keeps each bin's block
+  count and energy, so the integrated loudness is one pass over the bins
+  however long the recording. Only the bin the relative gate cuts is
+  approximate: it counts for the share of it above the gate.
+
+  The filter runs on lanes, one lane per channel of each stream: a bank
+  holds several streams of the same rate and channel count, their blocks
+  are put side by side (lane = stream * channels + channel) and one loop
+  over frames filters LOUDNESS_LANES lanes at a time (the last 4 at a
+  time), which the compiler vectorizes. A bank of one stereo stream pads
+  its lanes to 4; a bank of 64 mono microphones fills them.
+
+    loudness_bank bank;
+    loudness_bank_init(&bank, rate, channels, streams, max_block_frames);
+    loudness_bank_input_s16(&bank, stream, samples, frames);  // each stream
+    loudness_bank_process(&bank, frames);                     // then all at once
+    loudness_momentary(&bank.stream[i]) ... loudness_integrated(...)
+
+  One stream: loudness_process_s16(&bank, samples, frames) does both.
+  C++11.
+*/
+#ifndef LOUDNESS_METER_H_
+#define LOUDNESS_METER_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOUDNESS_LANES 8
+#define LOUDNESS_MOMENTARY_SUBS 4
+#define LOUDNESS_SHORT_SUBS 30
+#define LOUDNESS_ABSOLUTE_GATE -70.0
+#define LOUDNESS_RELATIVE_GATE -10.0
+#define LOUDNESS_HIST_MIN -70.0
+#define LOUDNESS_HIST_BINS 1000   /* 0.1 LU each: -70 .. +30 LUFS */
+
+struct loudness_stream {
+  double weight[LOUDNESS_LANES];       /* per channel, BS.1770 G_i */
+  double sub[LOUDNESS_SHORT_SUBS];     /* weighted energy of the last sub-blocks */
+  uint64_t subs;
+  uint64_t hist_count[LOUDNESS_HIST_BINS];
+  double hist_energy[LOUDNESS_HIST_BINS];
+  uint64_t gated;                      /* blocks above the absolute gate */
+};
+
+struct loudness_bank {
+  uint32_t rate;
+  uint32_t channels;
+  uint32_t streams;
+  uint32_t lanes;          /* streams * channels, rounded up to 4 */
+  uint32_t max_frames;
+  uint32_t sub_frames;     /* 100 ms */
+  uint32_t sub_fill;
+  /* K-weighting: shelf b0 b1 b2 a1 a2, then high-pass a1 a2 (b = 1 -2 1). */
+  float shelf[5];
+  float hp[2];
+  /* Per lane. */
+  float *s1, *s2, *h1, *h2;
+  float *energy;
+  float *input;            /* max_frames x lanes */
+  loudness_stream *stream;
+};
+
+static inline void loudness_bank_free(loudness_bank *b) {
+  free(b->s1);
+  free(b->input);
+  delete[] b->stream;
+  b->s1 = b->input = NULL;
+  b->stream = NULL;
+}
+
+/* Coefficients for any rate, from the analog prototypes of the 48 kHz
+   filters in BS.1770. */
+static inline void loudness_k_weighting(loudness_bank *b) {
+  double f0 = 1681.974450955533, gain_db = 3.999843853973347, q = 0.7071752369554196;
+  double k = tan(M_PI * f0 / b->rate);
+  double vh = pow(10.0, gain_db / 20.0), vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  b->shelf[0] = (float) ((vh + vb * k / q + k * k) / a0);
+  b->shelf[1] = (float) (2.0 * (k * k - vh) / a0);
+  b->shelf[2] = (float) ((vh - vb * k / q + k * k) / a0);
+  b->shelf[3] = (float) (2.0 * (k * k - 1.0) / a0);
+  b->shelf[4] = (float) ((1.0 - k / q + k * k) / a0);
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / b->rate);
+  a0 = 1.0 + k / q + k * k;
+  b->hp[0] = (float) (2.0 * (k * k - 1.0) / a0);
+  b->hp[1] = (float) ((1.0 - k / q + k * k) / a0);
+}
+
+/* Returns false on bad parameters or no memory. */
+static inline bool loudness_bank_init(loudness_bank *b, uint32_t rate, uint32_t channels, uint32_t streams,
+                                      uint32_t max_frames) {
+  memset(b, 0, sizeof(*b));
+  if (!rate || !channels || channels > LOUDNESS_LANES || !streams || !max_frames)
+    return false;
+  b->rate = rate;
+  b->channels = channels;
+  b->streams = streams;
+  b->lanes = (streams * channels + 3) / 4 * 4;
+  b->max_frames = max_frames;
+  b->sub_frames = rate / 10;
+  loudness_k_weighting(b);
+
+  /* State and energy in one allocation, input in another. */
+  if (posix_memalign((void**) &b->s1, 64, 5 * sizeof(float) * b->lanes) != 0 ||
+      posix_memalign((void**) &b->input, 64, sizeof(float) * b->lanes * max_frames) != 0) {
+    loudness_bank_free(b);
+    return false;
+  }
+  memset(b->s1, 0, 5 * sizeof(float) * b->lanes);
+  memset(b->input, 0, sizeof(float) * b->lanes * max_frames);
+  b->s2 = b->s1 + b->lanes;
+  b->h1 = b->s2 + b->lanes;
+  b->h2 = b->h1 + b->lanes;
+  b->energy = b->h2 + b->lanes;
+
+  b->stream = new loudness_stream[streams];
+  for (uint32_t i = 0; i < streams; i++) {
+    loudness_stream *s = &b->stream[i];
+    memset(s, 0, sizeof(*s));
+    for (uint32_t c = 0; c < channels; c++)
+      s->weight[c] = 1.0;
+    /* 5.0 / 5.1 in L R C (LFE) Ls Rs order: surrounds +1.5 dB, no LFE. */
+    if (channels == 5)
+      s->weight[3] = s->weight[4] = 1.41;
+    if (channels == 6) {
+      s->weight[3] = 0;
+      s->weight[4] = s->weight[5] = 1.41;
+    }
+  }
+  return true;
+}
+
+/* Put one stream's interleaved block into its lanes. */
+template <typename T>
+static inline void loudness_bank_input(loudness_bank *b, uint32_t stream, const T *x, uint32_t frames, float scale) {
+  float *in = b->input + stream * b->channels;
+  for (uint32_t f = 0; f < frames; f++, in += b->lanes, x += b->channels)
+    for (uint32_t c = 0; c < b->channels; c++)
+      in[c] = (float) x[c] * scale;
+}
+
+static inline void loudness_bank_input_s16(loudness_bank *b, uint32_t stream, const int16_t *x, uint32_t frames) {
+  loudness_bank_input(b, stream, x, frames, 1.0f / 32768);
+}
+
+static inline void loudness_bank_input_f32(loudness_bank *b, uint32_t stream, const float *x, uint32_t frames) {
+  loudness_bank_input(b, stream, x, frames, 1.0f);
+}
+
+/* Filter `frames` frames of input in lanes base .. base + width. */
+template <uint32_t width>
+static inline void loudness_bank_filter(loudness_bank *b, uint32_t base, uint32_t first, uint32_t frames) {
+  const float b0 = b->shelf[0], b1 = b->shelf[1], b2 = b->shelf[2], a1 = b->shelf[3], a2 = b->shelf[4];
+  const float c1 = b->hp[0], c2 = b->hp[1];
+  float s1[width], s2[width], h1[width], h2[width], e[width];
+  for (uint32_t k = 0; k < width; k++) {
+    s1[k] = b->s1[base + k];
+    s2[k] = b->s2[base + k];
+    h1[k] = b->h1[base + k];
+    h2[k] = b->h2[base + k];
+    e[k] = 0;
+  }
+  const float *in = b->input + (size_t) first * b->lanes + base;
+  for (uint32_t f = 0; f < frames; f++, in += b->lanes) {
+    for (uint32_t k = 0; k < width; k++) {
+      float x = in[k];
+      float y = b0 * x + s1[k];           /* shelf, transposed direct form II */
+      s1[k] = b1 * x - a1 * y + s2[k];
+      s2[k] = b2 * x - a2 * y;
+      float z = y + h1[k];                /* high-pass */
+      h1[k] = -2.0f * y - c1 * z + h2[k];
+      h2[k] = y - c2 * z;
+      e[k] += z * z;
+    }
+  }
+  for (uint32_t k = 0; k < width; k++) {
+    b->s1[base + k] = s1[k];
+    b->s2[base + k] = s2[k];
+    b->h1[base + k] = h1[k];
+    b->h2[base + k] = h2[k];
+    b->energy[base + k] += e[k];
+  }
+}
+
+static inline double loudness_lufs(double energy) {
+  return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+/* Mean of the last n sub-blocks, -inf until there are n. */
+static inline double loudness_window(const loudness_stream *s, uint32_t n) {
+  if (s->subs < n)
+    return -HUGE_VAL;
+  double sum = 0;
+  for (uint32_t i = 1; i <= n; i++)
+    sum += s->sub[(s->subs - i) % LOUDNESS_SHORT_SUBS];
+  return loudness_lufs(sum / n);
+}
+
+static inline double loudness_momentary(const loudness_stream *s) {
+  return loudness_window(s, LOUDNESS_MOMENTARY_SUBS);
+}
+
+static inline double loudness_short_term(const loudness_stream *s) {
+  return loudness_window(s, LOUDNESS_SHORT_SUBS);
+}
+
+static inline double loudness_integrated(const loudness_stream *s) {
+  if (!s->gated)
+    return -HUGE_VAL;
+  double total = 0;
+  for (int i = 0; i < LOUDNESS_HIST_BINS; i++)
+    total += s->hist_energy[i];
+  double gate = loudness_lufs(total / s->gated) + LOUDNESS_RELATIVE_GATE;
+  double position = (gate - LOUDNESS_HIST_MIN) * 10;
+  int first = (int) floor(position);
+  double energy = 0, count = 0;
+  if (first < 0) {
+    first = 0;
+    position = 0;
+  }
+  /* The bin the gate falls in counts for the share of it above the gate. */
+  if (first < LOUDNESS_HIST_BINS) {
+    double above = 1 - (position - first);
+    energy = above * s->hist_energy[first];
+    count = above * s->hist_count[first];
+  }
+  for (int i = first + 1; i < LOUDNESS_HIST_BINS; i++) {
+    energy += s->hist_energy[i];
+    count += s->hist_count[i];
+  }
+  return count > 0 ? loudness_lufs(energy / count) : -HUGE_VAL;
+}
+
+/* Start integrating afresh, keeping the momentary and short-term
+   windows: a later piece of a recording, after a pre-roll. */
+static inline void loudness_reset_integrated(loudness_stream *s) {
+  memset(s->hist_count, 0, sizeof(s->hist_count));
+  memset(s->hist_energy, 0, sizeof(s->hist_energy));
+  s->gated = 0;
+}
+
+/* Integrate `from` into `into`, as if they had been one recording. */
+static inline void loudness_merge_integrated(loudness_stream *into, const loudness_stream *from) {
+  for (int i = 0; i < LOUDNESS_HIST_BINS; i++) {
+    into->hist_count[i] += from->hist_count[i];
+    into->hist_energy[i] += from->hist_energy[i];
+  }
+  into->gated += from->gated;
+}
+
+/* A sub-block is complete: fold the lanes into each stream. */
+static inline void loudness_bank_close_sub(loudness_bank *b) {
+  for (uint32_t i = 0; i < b->streams; i++) {
+    loudness_stream *s = &b->stream[i];
+    double sum = 0;
+    for (uint32_t c = 0; c < b->channels; c++)
+      sum += s->weight[c] * b->energy[i * b->channels + c] / b->sub_frames;
+    s->sub[s->subs % LOUDNESS_SHORT_SUBS] = sum;
+    s->subs++;
+    if (s->subs < LOUDNESS_MOMENTARY_SUBS)
+      continue;
+    double block = 0;
+    for (uint32_t k = 1; k <= LOUDNESS_MOMENTARY_SUBS; k++)
+      block += s->sub[(s->subs - k) % LOUDNESS_SHORT_SUBS];
+    block /= LOUDNESS_MOMENTARY_SUBS;
+    double l = loudness_lufs(block);
+    if (l <= LOUDNESS_ABSOLUTE_GATE)
+      continue;
+    int bin = (int) ((l - LOUDNESS_HIST_MIN) * 10);
+    if (bin >= LOUDNESS_HIST_BINS) bin = LOUDNESS_HIST_BINS - 1;
+    s->hist_count[bin]++;
+    s->hist_energy[bin] += block;
+    s->gated++;
+  }
+  for (uint32_t k = 0; k < b->lanes; k++) {
+    b->energy[k] = 0;
+    /* Flush decayed state before it turns denormal on silence. */
+    if (fabsf(b->s1[k]) < 1e-15f) b->s1[k] = 0;
+    if (fabsf(b->s2[k]) < 1e-15f) b->s2[k] = 0;
+    if (fabsf(b->h1[k]) < 1e-15f) b->h1[k] = 0;
+    if (fabsf(b->h2[k]) < 1e-15f) b->h2[k] = 0;
+  }
+}
+
+/* Filter the block every stream has put in (at most max_frames). */
+static inline void loudness_bank_process(loudness_bank *b, uint32_t frames) {
+  uint32_t done = 0;
+  while (done < frames) {
+    uint32_t n = b->sub_frames - b->sub_fill;
+    if (n > frames - done)
+      n = frames - done;
+    uint32_t base = 0;
+    for (; base + LOUDNESS_LANES <= b->lanes; base += LOUDNESS_LANES)
+      loudness_bank_filter<LOUDNESS_LANES>(b, base, done, n);
+    if (base < b->lanes)
+      loudness_bank_filter<LOUDNESS_LANES / 2>(b, base, done, n);
+    done += n;
+    b->sub_fill += n;
+    if (b->sub_fill == b->sub_frames) {
+      loudness_bank_close_sub(b);
+      b->sub_fill = 0;
+    }
+  }
+}
+
+/* A bank of one stream: any block size. */
+template <typename T>
+static inline void loudness_process(loudness_bank *b, const T *x, uint32_t frames, float scale) {
+  while (frames) {
+    uint32_t n = frames < b->max_frames ? frames : b->max_frames;
+    loudness_bank_input(b, 0, x, n, scale);
+    loudness_bank_process(b, n);
+    x += (size_t) n * b->channels;
+    frames -= n;
+  }
+}
+
+static inline void loudness_process_s16(loudness_bank *b, const int16_t *x, uint32_t frames) {
+  loudness_process(b, x, frames, 1.0f / 32768);
+}
+
+static inline void loudness_process_f32(loudness_bank *b, const float *x, uint32_t frames) {
+  loudness_process(b, x, frames, 1.0f);
+}
+
+static inline void loudness_print(const loudness_stream *s, FILE *out) {
+  fprintf(out, "momentary %6.1f, short-term %6.1f, integrated %6.1f LUFS\n", loudness_momentary(s),
+          loudness_short_term(s), loudness_integrated(s));
+}
+
+#endif  // LOUDNESS_METER_H_
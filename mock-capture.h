@@ -0,0 +1,285 @@
+/*
+  Mock capture device: a deterministic signal delivered on a real-time
+  clock, for running the examples and benchmarks without a sound card or
+  audio server.
+
+  The signal is a sum of a sine, white noise and periodic impulses. The
+  sine is a block version of SineOscillator from pulseaudio-record-save.cc:
+  eight phasors are seeded with sin/cos at the start of each block and then
+  rotated with plain multiply-adds, so the compiler vectorizes the loop and
+  the phase is recomputed exactly (in double) once per block instead of
+  drifting. Impulses are single full-scale samples at known capture times:
+  whoever finds one downstream knows exactly how long it took to get there.
+
+  Reads behave like snd_pcm_readi() on a device running at `rate`: they
+  block until the frames have been "captured" (plus an optional random
+  wake-up jitter), return -EPIPE on an xrun, and a reader that falls more
+  than `buffer_frames` behind gets a real overrun: the old frames are lost
+  and the read position jumps to the present. Xruns can also be injected
+  at random.
+
+    mock_capture mock;
+    mock_capture_config cfg;
+    mock_capture_default_config(&cfg, rate, channels, MOCK_F32);
+    mock_capture_parse(&cfg, "sine=440,noise=0.01,impulse=1,jitter=2,xrun=0.001");
+    mock_capture_open(&mock, &cfg);
+    long n = mock_capture_read(&mock, buffer, frames, &capture_ns);
+
+  The examples take the configuration from CAPTURE_MOCK, e.g.
+  CAPTURE_MOCK=sine=440,impulse=0.5 ./alsa-record-example -
+  Linux only, C++11.
+*/
+#ifndef MOCK_CAPTURE_H_
+#define MOCK_CAPTURE_H_
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+/* Sample formats, same codes as capture-log.h and net-audio-sink.h. */
+#define MOCK_S16 1
+#define MOCK_F32 3
+
+#define MOCK_LANES 8
+#define MOCK_IMPULSE_THRESHOLD 0.9f
+
+struct mock_capture_config {
+  uint32_t rate;
+  uint32_t channels;
+  uint32_t format;
+  float sine_hz;
+  float sine_amp;
+  float noise_amp;
+  double impulse_sec;       /* period between impulses, 0 for none */
+  double jitter_ms;         /* extra wake-up delay, uniform in [0, jitter_ms] */
+  double xrun_probability;  /* injected xruns, per read */
+  uint32_t buffer_frames;   /* device buffer: how far a reader may fall behind */
+  double speed;             /* 1: real time, N: N times faster, 0: no pacing */
+  uint64_t seed;
+};
+
+struct mock_capture {
+  mock_capture_config cfg;
+  int64_t start_ns;         /* CLOCK_MONOTONIC at frame 0 */
+  int64_t start_realtime_ns;
+  uint64_t position;        /* next frame to deliver */
+  uint64_t rng;
+  std::vector<float> scratch;
+  uint64_t reads;
+  uint64_t frames;
+  uint64_t injected_xruns;
+  uint64_t overruns;
+  uint64_t impulses;
+};
+
+static inline int64_t mock_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void mock_capture_default_config(mock_capture_config *cfg, uint32_t rate,
+                                               uint32_t channels, uint32_t format) {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->rate = rate;
+  cfg->channels = channels;
+  cfg->format = format;
+  cfg->sine_hz = 440;
+  cfg->sine_amp = 0.5f;
+  cfg->buffer_frames = rate;  /* one second, like a generous ALSA buffer */
+  cfg->speed = 1;
+  cfg->seed = 1;
+}
+
+/* "key=value,..." with keys sine, amp, noise, impulse, jitter, xrun,
+   buffer, speed, seed. Returns -1 on an unknown key. */
+static inline int mock_capture_parse(mock_capture_config *cfg, const char *spec) {
+  char key[32];
+  double value;
+  int used;
+  while (spec && *spec) {
+    if (sscanf(spec, "%31[^=]=%lf%n", key, &value, &used) != 2)
+      return -1;
+    if (!strcmp(key, "sine")) cfg->sine_hz = (float) value;
+    else if (!strcmp(key, "amp")) cfg->sine_amp = (float) value;
+    else if (!strcmp(key, "noise")) cfg->noise_amp = (float) value;
+    else if (!strcmp(key, "impulse")) cfg->impulse_sec = value;
+    else if (!strcmp(key, "jitter")) cfg->jitter_ms = value;
+    else if (!strcmp(key, "xrun")) cfg->xrun_probability = value;
+    else if (!strcmp(key, "buffer")) cfg->buffer_frames = (uint32_t) value;
+    else if (!strcmp(key, "speed")) cfg->speed = value;
+    else if (!strcmp(key, "seed")) cfg->seed = (uint64_t) value;
+    else return -1;
+    spec += used;
+    if (*spec == ',') spec++;
+  }
+  return 0;
+}
+
+static inline void mock_capture_open(mock_capture *m, const mock_capture_config *cfg) {
+  m->cfg = *cfg;
+  m->position = 0;
+  m->rng = cfg->seed ? cfg->seed : 1;
+  m->reads = m->frames = m->injected_xruns = m->overruns = m->impulses = 0;
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  m->start_realtime_ns = (int64_t) real.tv_sec * 1000000000LL + real.tv_nsec;
+  m->start_ns = mock_monotonic_ns();
+}
+
+/* xorshift64*: cheap and the same on every machine. */
+static inline uint64_t mock_random(mock_capture *m) {
+  m->rng ^= m->rng >> 12;
+  m->rng ^= m->rng << 25;
+  m->rng ^= m->rng >> 27;
+  return m->rng * 2685821657736338717ULL;
+}
+
+static inline double mock_uniform(mock_capture *m) {
+  return (mock_random(m) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Monotonic time at which frame `frame` has been captured. */
+static inline int64_t mock_capture_frame_ns(const mock_capture *m, uint64_t frame) {
+  if (m->cfg.speed <= 0)
+    return m->start_ns;
+  return m->start_ns + (int64_t) (frame * 1e9 / m->cfg.rate / m->cfg.speed);
+}
+
+/* Whether frame `frame` carries an impulse. A detector downstream that
+   counts frames can take mock_capture_frame_ns() of it as the moment the
+   impulse was captured. */
+static inline bool mock_capture_is_impulse(const mock_capture *m, uint64_t frame) {
+  if (m->cfg.impulse_sec <= 0)
+    return false;
+  double period = m->cfg.impulse_sec * m->cfg.rate;
+  return (uint64_t) llround(floor(frame / period + 0.5) * period) == frame;
+}
+
+/* One channel of signal for frames [first, first + n). */
+static inline void mock_capture_generate(mock_capture *m, uint64_t first, float *out, uint32_t n) {
+  const mock_capture_config &c = m->cfg;
+  for (uint32_t i = 0; i < n; i++) out[i] = 0;
+
+  if (c.sine_amp != 0 && c.sine_hz > 0) {
+    double cycles = c.sine_hz / c.rate;
+    double step = 2 * M_PI * cycles;
+    float re[MOCK_LANES], im[MOCK_LANES];
+    for (int k = 0; k < MOCK_LANES; k++) {
+      /* Exact phase of lane k, from the integer frame position. */
+      double phase = fmod((double) (first % c.rate) * cycles + (double) (first / c.rate) * c.sine_hz + k * cycles, 1.0);
+      re[k] = (float) cos(2 * M_PI * phase);
+      im[k] = (float) sin(2 * M_PI * phase);
+    }
+    const float rot_re = (float) cos(step * MOCK_LANES), rot_im = (float) sin(step * MOCK_LANES);
+    const float amp = c.sine_amp;
+    uint32_t i = 0;
+    for (; i + MOCK_LANES <= n; i += MOCK_LANES) {
+      for (int k = 0; k < MOCK_LANES; k++) {
+        out[i + k] += amp * im[k];
+        float r = re[k] * rot_re - im[k] * rot_im;
+        im[k] = re[k] * rot_im + im[k] * rot_re;
+        re[k] = r;
+      }
+    }
+    for (int k = 0; i < n && k < MOCK_LANES; i++, k++)
+      out[i] += amp * im[k];
+  }
+
+  if (c.noise_amp != 0)
+    for (uint32_t i = 0; i < n; i++)
+      out[i] += c.noise_amp * (float) (2 * mock_uniform(m) - 1);
+
+  if (c.impulse_sec > 0) {
+    double period = c.impulse_sec * c.rate;
+    uint64_t k = (uint64_t) ceil(first / period);
+    for (uint64_t frame; (frame = (uint64_t) llround(k * period)) < first + n; k++) {
+      if (frame >= first) {
+        out[frame - first] = 1.0f;
+        m->impulses++;
+      }
+    }
+  }
+}
+
+/* Read `frames` frames, blocking like a capture device. Returns the
+   frames read or -EPIPE; *capture_ns gets the CLOCK_REALTIME of the first
+   frame. */
+static inline long mock_capture_read(mock_capture *m, void *buffer, uint32_t frames, int64_t *capture_ns) {
+  const mock_capture_config &c = m->cfg;
+  m->reads++;
+
+  if (c.xrun_probability > 0 && mock_uniform(m) < c.xrun_probability) {
+    /* The device keeps running: what it captured up to now is lost, and
+       reading resumes at now, as after a real overrun. As fast as
+       possible, there is no now: a buffer's worth is lost. */
+    if (c.speed > 0) {
+      double captured = (mock_monotonic_ns() - m->start_ns) / 1e9 * c.rate * c.speed;
+      if (captured > (double) m->position)
+        m->position = (uint64_t) captured;
+    } else {
+      m->position += c.buffer_frames;
+    }
+    m->injected_xruns++;
+    return -EPIPE;
+  }
+
+  if (c.speed > 0) {
+    /* A reader this late has lost the oldest frames: overrun. */
+    int64_t now = mock_monotonic_ns();
+    double captured = (now - m->start_ns) / 1e9 * c.rate * c.speed;
+    if (captured > (double) m->position + c.buffer_frames) {
+      m->position = (uint64_t) captured;
+      m->overruns++;
+      return -EPIPE;
+    }
+
+    int64_t due = mock_capture_frame_ns(m, m->position + frames);
+    if (c.jitter_ms > 0)
+      due += (int64_t) (mock_uniform(m) * c.jitter_ms * 1e6);
+    if (now < due) {
+      struct timespec ts = { (time_t) (due / 1000000000LL), (long) (due % 1000000000LL) };
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    }
+  }
+
+  if (m->scratch.size() < frames)
+    m->scratch.resize(frames);
+  float *mono = m->scratch.data();
+  mock_capture_generate(m, m->position, mono, frames);
+
+  const uint32_t ch = c.channels;
+  if (c.format == MOCK_F32) {
+    float *out = (float*) buffer;
+    for (uint32_t i = 0; i < frames; i++)
+      for (uint32_t k = 0; k < ch; k++)
+        out[i * ch + k] = mono[i];
+  } else {
+    int16_t *out = (int16_t*) buffer;
+    for (uint32_t i = 0; i < frames; i++) {
+      float v = mono[i] * 32767.0f;
+      int16_t s = (int16_t) (v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v);
+      for (uint32_t k = 0; k < ch; k++)
+        out[i * ch + k] = s;
+    }
+  }
+
+  if (capture_ns)
+    *capture_ns = m->start_realtime_ns + (int64_t) (m->position * 1e9 / c.rate / (c.speed > 0 ? c.speed : 1));
+  m->position += frames;
+  m->frames += frames;
+  return frames;
+}
+
+static inline void mock_capture_print_stats(const mock_capture *m, FILE *out) {
+  fprintf(out, "mock: %lu reads, %lu frames, %lu impulses, %lu injected xruns, %lu overruns\n",
+          (unsigned long) m->reads, (unsigned long) m->frames, (unsigned long) m->impulses,
+          (unsigned long) m->injected_xruns, (unsigned long) m->overruns);
+}
+
+#endif  // MOCK_CAPTURE_H_
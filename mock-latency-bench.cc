@@ -0,0 +1,225 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "mock-capture.h"
+#include "pcm-pipe-sink.h"
+
+// End-to-end latency and throughput without a sound card: a mock device
+// (mock-capture.h) is read block by block, like the examples read theirs,
+// and every block goes through pcm-pipe-sink.h into a pipe. A reader
+// thread on the other end counts frames and looks for the impulses; the
+// mock knows when each impulse frame was captured, so the time from
+// capture to the moment the reader saw it is the true block-to-output
+// latency, including waiting for the block to fill, wake-up jitter and
+// the pipe.
+//
+//   latency     per block size and jitter: p50 / p99 / max, next to the
+//               mean that waiting for the block alone costs (half a block)
+//   xruns       injected xruns and a reader that stalls longer than the
+//               device buffer: both must be reported, and the stream
+//               must go on
+//   throughput  the same pipeline unpaced, in x real time
+//   generator   ns per sample of the vectorized sine vs the
+//               sample-at-a-time SineOscillator
+//
+// Runs in a container: no devices, no server.
+//
+// g++ -O2 mock-latency-bench.cc -o mock-latency-bench -lm -std=c++11 -lpthread
+// ./mock-latency-bench [seconds per case]
+
+#define SAMPLE_RATE 48000
+#define IMPULSE_SEC 0.0107   /* not a multiple of any block size */
+#define SINK_BUFFER_BYTES (1 << 20)
+
+static int64_t monotonic_ns() {
+  return mock_monotonic_ns();
+}
+
+struct reader_result {
+  std::vector<double> latency_ms;
+  uint64_t frames;
+};
+
+// Counts float frames coming out of the pipe, timestamps impulses.
+static void read_pipe(int fd, const mock_capture *m, bool measure, reader_result *result) {
+  std::vector<float> buffer(4096);
+  uint64_t frame = 0;
+  size_t partial = 0;
+  ssize_t n;
+  while ((n = read(fd, (uint8_t*) buffer.data() + partial, buffer.size() * sizeof(float) - partial)) > 0) {
+    int64_t now = monotonic_ns();
+    size_t bytes = partial + n, count = bytes / sizeof(float);
+    for (size_t i = 0; i < count; i++, frame++) {
+      if (measure && buffer[i] > MOCK_IMPULSE_THRESHOLD && mock_capture_is_impulse(m, frame))
+        result->latency_ms.push_back((now - mock_capture_frame_ns(m, frame)) / 1e6);
+    }
+    partial = bytes % sizeof(float);
+    memmove(buffer.data(), (uint8_t*) buffer.data() + count * sizeof(float), partial);
+  }
+  result->frames = frame;
+}
+
+struct run_stats {
+  double seconds;
+  uint64_t dropped;
+  reader_result reader;
+};
+
+// Capture `seconds` of audio in blocks of `block` frames and push it
+// through a pipe. stall_ms > 0 stops reading for that long once, halfway.
+static run_stats run(mock_capture *m, uint32_t block, double seconds, bool measure, double stall_ms) {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  pcm_pipe_sink sink;
+  pcm_pipe_sink_open(&sink, fds[1], SINK_BUFFER_BYTES, sizeof(float));
+
+  run_stats stats;
+  std::thread reader(read_pipe, fds[0], m, measure, &stats.reader);
+  std::vector<float> buffer(block);
+  uint64_t blocks = (uint64_t) (seconds * m->cfg.rate / block);
+  int64_t start = monotonic_ns(), capture_ns;
+  bool stalled = false;
+
+  for (uint64_t i = 0; i < blocks; i++) {
+    if (stall_ms > 0 && !stalled && i == blocks / 2) {
+      struct timespec ts = { (time_t) (stall_ms / 1000), (long) (fmod(stall_ms, 1000) * 1000000) };
+      nanosleep(&ts, NULL);
+      stalled = true;
+    }
+    long n = mock_capture_read(m, buffer.data(), block, &capture_ns);
+    if (n < 0)
+      continue;
+    pcm_pipe_sink_push(&sink, buffer.data(), n * sizeof(float));
+    while (pcm_pipe_sink_flush(&sink) > 0) {
+      struct pollfd p = { fds[1], POLLOUT, 0 };
+      poll(&p, 1, -1);
+    }
+  }
+  stats.seconds = (monotonic_ns() - start) / 1e9;
+  stats.dropped = sink.dropped_bytes / sizeof(float);
+  pcm_pipe_sink_close(&sink);
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+  return stats;
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+static void open_mock(mock_capture *m, const char *spec) {
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, SAMPLE_RATE, 1, MOCK_F32);
+  cfg.impulse_sec = IMPULSE_SEC;
+  cfg.noise_amp = 0.01f;
+  if (mock_capture_parse(&cfg, spec) < 0) {
+    fprintf(stderr, "bad mock spec %s\n", spec);
+    exit(1);
+  }
+  mock_capture_open(m, &cfg);
+}
+
+static void latency(double seconds) {
+  static const uint32_t blocks[] = { 64, 256, 1024, 4096 };
+  static const char *jitters[] = { "jitter=0", "jitter=2" };
+  fprintf(stdout, "latency, %d Hz, %.0f s per case, impulse every %.1f ms\n", SAMPLE_RATE, seconds,
+          IMPULSE_SEC * 1e3);
+  fprintf(stdout, "  %6s %8s %8s %8s %8s %10s %8s\n", "block", "jitter", "p50 ms", "p99 ms", "max ms",
+          "half blk", "impulses");
+  for (size_t j = 0; j < sizeof(jitters) / sizeof(jitters[0]); j++) {
+    for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+      mock_capture m;
+      open_mock(&m, jitters[j]);
+      run_stats s = run(&m, blocks[b], seconds, true, 0);
+      const std::vector<double> &l = s.reader.latency_ms;
+      fprintf(stdout, "  %6u %5.1f ms %8.3f %8.3f %8.3f %10.3f %8lu\n", blocks[b], m.cfg.jitter_ms,
+              percentile(l, 0.5), percentile(l, 0.99), percentile(l, 1.0),
+              blocks[b] * 500.0 / SAMPLE_RATE, (unsigned long) l.size());
+      if (s.dropped)
+        fprintf(stdout, "         %lu frames dropped by the sink\n", (unsigned long) s.dropped);
+    }
+  }
+}
+
+static void xruns(double seconds) {
+  fprintf(stdout, "xruns\n");
+  mock_capture m;
+  open_mock(&m, "xrun=0.01,buffer=4800");
+  run_stats s = run(&m, 256, seconds, false, 0);
+  fprintf(stdout, "  injected, 1%% of reads: %lu frames out, ", (unsigned long) s.reader.frames);
+  mock_capture_print_stats(&m, stdout);
+
+  open_mock(&m, "buffer=4800");
+  s = run(&m, 256, seconds, false, 250);
+  fprintf(stdout, "  reader stalled 250 ms, 100 ms buffer: %lu frames out, ", (unsigned long) s.reader.frames);
+  mock_capture_print_stats(&m, stdout);
+}
+
+static void throughput(double seconds) {
+  mock_capture m;
+  open_mock(&m, "speed=0");
+  double audio = seconds * 60;
+  run_stats s = run(&m, 1024, audio, false, 0);
+  fprintf(stdout, "throughput: %.0f s of audio in 1024-frame blocks in %.3f s (%.0fx real time), %lu frames out\n",
+          audio, s.seconds, audio / s.seconds, (unsigned long) s.reader.frames);
+}
+
+// pulseaudio-record-save.cc's oscillator, for comparison.
+class SineOscillator {
+  float frequency, amplitude, angle = 0.0f, offset = 0.0f;
+public:
+  SineOscillator(float freq, float amp) : frequency(freq), amplitude(amp) {
+    offset = 2 * M_PI * frequency / SAMPLE_RATE;
+  }
+  float process() {
+    auto sample = amplitude * sin(angle);
+    angle += offset;
+    return sample;
+  }
+};
+
+static void generator() {
+  const uint32_t block = 1024, count = 20000;
+  std::vector<float> out(block);
+  mock_capture m;
+  open_mock(&m, "speed=0,noise=0,impulse=0");
+  int64_t t = monotonic_ns();
+  for (uint32_t i = 0; i < count; i++)
+    mock_capture_generate(&m, (uint64_t) i * block, out.data(), block);
+  double vectorized = (double) (monotonic_ns() - t) / ((double) block * count);
+  float check = out[block - 1];
+
+  SineOscillator osc(440, 0.5f);
+  t = monotonic_ns();
+  for (uint32_t i = 0; i < count; i++)
+    for (uint32_t k = 0; k < block; k++)
+      out[k] = osc.process();
+  double scalar = (double) (monotonic_ns() - t) / ((double) block * count);
+
+  double expected = 0.5 * sin(2 * M_PI * fmod(440.0 * ((uint64_t) block * count - 1) / SAMPLE_RATE, 1.0));
+  fprintf(stdout, "generator: vectorized sine %.2f ns/sample, SineOscillator %.2f ns/sample (error at the end %.1e, %.1e)\n",
+          vectorized, scalar, fabs(check - expected), fabs(out[block - 1] - expected));
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 5;
+  latency(seconds);
+  xruns(seconds);
+  throughput(seconds);
+  generator();
+  return 0;
+}
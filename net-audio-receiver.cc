@@ -0,0 +1,242 @@
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+#include <vector>
+
+#include "net-audio-sink.h"
+
+// Tiny receiver for net-audio-sink.h, for loopback testing. Listens on
+// udp://, tcp:// or unix: and prints, once a second and per stream id,
+// what arrived, what was lost (sequence gaps) or reordered, and how old
+// the audio was on arrival (receive time minus capture time of the last
+// frame; only meaningful when both ends share a clock).
+//
+// g++ net-audio-receiver.cc -o net-audio-receiver -std=c++11
+// ./net-audio-receiver udp://0.0.0.0:5004
+// ./alsa-record-example hw:1,0 udp://127.0.0.1:5004
+
+#define MAX_CLIENTS 16
+#define RECV_BATCH 32
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static int64_t realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct stream_stats {
+  uint64_t next_seq;
+  bool started;
+  uint64_t packets, frames, lost, reordered, discontinuities;
+  int64_t age_sum_ns, age_max_ns;
+};
+
+static std::map<uint32_t, stream_stats> streams;
+
+static void on_packet(const net_audio_header *h) {
+  if (h->magic != NET_AUDIO_MAGIC || h->version != NET_AUDIO_VERSION)
+    return;
+  stream_stats &st = streams[h->stream_id];
+  if (st.started && h->seq < st.next_seq) {
+    st.reordered++;
+  } else {
+    if (st.started)
+      st.lost += h->seq - st.next_seq;
+    st.next_seq = h->seq + 1;
+    st.started = true;
+  }
+  if (h->flags & NET_AUDIO_FLAG_DISCONTINUITY)
+    st.discontinuities++;
+  st.packets++;
+  st.frames += h->frames;
+  int64_t age = realtime_ns() - (h->timestamp_ns + (int64_t) h->frames * 1000000000LL / h->rate);
+  st.age_sum_ns += age;
+  if (age > st.age_max_ns) st.age_max_ns = age;
+}
+
+static void print_stats() {
+  for (std::map<uint32_t, stream_stats>::iterator it = streams.begin(); it != streams.end(); ++it) {
+    stream_stats &st = it->second;
+    fprintf(stdout, "stream %u: %lu packets %lu frames, lost %lu reordered %lu discontinuities %lu, "
+            "age avg %.2f ms max %.2f ms\n", it->first,
+            (unsigned long) st.packets, (unsigned long) st.frames, (unsigned long) st.lost,
+            (unsigned long) st.reordered, (unsigned long) st.discontinuities,
+            st.packets ? st.age_sum_ns / 1e6 / st.packets : 0.0, st.age_max_ns / 1e6);
+    st.packets = st.frames = st.lost = st.reordered = st.discontinuities = 0;
+    st.age_sum_ns = st.age_max_ns = 0;
+  }
+  fflush(stdout);
+}
+
+static int listen_on(const char *url, bool *udp) {
+  int fd;
+  *udp = false;
+  if (!strncmp(url, "unix:", 5)) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, url + 5, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+      return -1;
+    return fd;
+  }
+
+  *udp = !strncmp(url, "udp://", 6);
+  if (!*udp && strncmp(url, "tcp://", 6))
+    return -1;
+  char host[256];
+  const char *hp = url + 6, *colon = strrchr(hp, ':');
+  if (!colon || (size_t) (colon - hp) >= sizeof(host))
+    return -1;
+  memcpy(host, hp, colon - hp);
+  host[colon - hp] = 0;
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = *udp ? SOCK_DGRAM : SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &res))
+    return -1;
+  int one = 1;
+  fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0 || (!*udp && listen(fd, 4) < 0)) {
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+  if (*udp) {
+    int size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  return fd;
+}
+
+/* Stream transports: reassemble header + payload from a byte stream. */
+struct stream_client {
+  int fd;
+  std::vector<uint8_t> buffer;
+};
+
+static bool read_stream(stream_client *c) {
+  uint8_t chunk[65536];
+  ssize_t r = read(c->fd, chunk, sizeof(chunk));
+  if (r <= 0)
+    return false;
+  c->buffer.insert(c->buffer.end(), chunk, chunk + r);
+  size_t at = 0;
+  while (c->buffer.size() - at >= sizeof(net_audio_header)) {
+    net_audio_header h;
+    memcpy(&h, &c->buffer[at], sizeof(h));
+    if (h.magic != NET_AUDIO_MAGIC)
+      return false;
+    if (c->buffer.size() - at < sizeof(h) + h.bytes)
+      break;
+    on_packet(&h);
+    at += sizeof(h) + h.bytes;
+  }
+  c->buffer.erase(c->buffer.begin(), c->buffer.begin() + at);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  bool udp;
+  const char *url = argc > 1 ? argv[1] : "udp://0.0.0.0:5004";
+
+  init_signal();
+
+  int fd = listen_on(url, &udp);
+  if (fd < 0) {
+    fprintf(stderr, "cannot listen on %s: %s\n", url, strerror(errno));
+    return 1;
+  }
+  fprintf(stdout, "listening on %s\n", url);
+
+  std::vector<stream_client> clients;
+  static uint8_t datagrams[RECV_BATCH][65536];
+  struct mmsghdr msgs[RECV_BATCH];
+  struct iovec iov[RECV_BATCH];
+  int64_t next_report = realtime_ns() + 1000000000LL;
+
+  while (running) {
+    struct pollfd pfd[MAX_CLIENTS + 1];
+    int n = 0;
+    pfd[n].fd = fd;
+    pfd[n++].events = POLLIN;
+    for (size_t i = 0; i < clients.size(); i++) {
+      pfd[n].fd = clients[i].fd;
+      pfd[n++].events = POLLIN;
+    }
+    poll(pfd, n, 200);
+
+    if (pfd[0].revents & POLLIN) {
+      if (udp) {
+        for (int i = 0; i < RECV_BATCH; i++) {
+          iov[i].iov_base = datagrams[i];
+          iov[i].iov_len = sizeof(datagrams[i]);
+          memset(&msgs[i], 0, sizeof(msgs[i]));
+          msgs[i].msg_hdr.msg_iov = &iov[i];
+          msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int r = recvmmsg(fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < r; i++)
+          if (msgs[i].msg_len >= sizeof(net_audio_header)) {
+            net_audio_header h;
+            memcpy(&h, datagrams[i], sizeof(h));
+            on_packet(&h);
+          }
+      } else {
+        int c = accept(fd, NULL, NULL);
+        if (c >= 0 && clients.size() < MAX_CLIENTS) {
+          stream_client client;
+          client.fd = c;
+          clients.push_back(client);
+        } else if (c >= 0) {
+          close(c);
+        }
+      }
+    }
+    for (int i = n - 1; i >= 1; i--) {
+      if (pfd[i].revents && !read_stream(&clients[i - 1])) {
+        close(clients[i - 1].fd);
+        clients.erase(clients.begin() + (i - 1));
+      }
+    }
+
+    if (realtime_ns() >= next_report) {
+      print_stats();
+      next_report += 1000000000LL;
+    }
+  }
+
+  for (size_t i = 0; i < clients.size(); i++)
+    close(clients[i].fd);
+  close(fd);
+  return 0;
+}
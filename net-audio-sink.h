@@ -0,0 +1,386 @@
+/*
+  Network sink for captured blocks: UDP, TCP or unix stream sockets.
+
+  Every packet starts with a fixed 40 byte header (little endian), so a
+  receiver can tell streams apart, detect loss and reordering, and place
+  the samples in time without any session state:
+
+    offset size
+         0    4  magic "ASTR"
+         4    1  version (1)
+         5    1  sample format (NET_AUDIO_S16LE, ...)
+         6    1  channels
+         7    1  flags (NET_AUDIO_FLAG_*)
+         8    4  stream id
+        12    4  sample rate
+        16    8  sequence number (per packet, per stream)
+        24    8  capture time of the first frame, ns (CLOCK_REALTIME)
+        32    4  frames in this packet
+        36    4  payload bytes
+
+  Blocks are queued into a preallocated arena and sent in batches: with
+  UDP a batch is one sendmmsg() (one datagram per packet), on stream
+  sockets one writev(). `batch_packets` and `max_delay_ms` trade latency
+  for syscalls and packets per second. Blocks larger than a datagram are
+  split on frame boundaries, each part with its own header and time.
+
+  Sending never blocks the capture loop. What the socket does not accept
+  stays queued up to the arena size; beyond that new packets are dropped
+  and counted. Sent packets are skipped by moving the arena's head, not
+  by moving what is left: the arena rewinds for free when the queue
+  drains, and the unsent rest is moved down only when the tail runs out
+  of room.
+
+    net_audio_sink sink;
+    net_audio_sink_open(&sink, "udp://10.0.0.2:5004", stream_id, NET_AUDIO_S16LE,
+                        rate, channels, 8, 20);
+    net_audio_sink_push(&sink, buffer, frames, capture_ns);  // per block
+    net_audio_sink_close(&sink);
+
+  Linux only.
+*/
+#ifndef NET_AUDIO_SINK_H_
+#define NET_AUDIO_SINK_H_
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define NET_AUDIO_MAGIC 0x52545341u  /* "ASTR" */
+#define NET_AUDIO_VERSION 1
+#define NET_AUDIO_MAX_BATCH 64
+/* Keeps UDP datagrams under a 1500 byte MTU with IPv6 + UDP headers. */
+#define NET_AUDIO_MAX_DATAGRAM 1432
+#define NET_AUDIO_ARENA_BYTES (1 << 20)
+
+enum net_audio_format {
+  NET_AUDIO_S16LE = 1,
+  NET_AUDIO_S32LE = 2,
+  NET_AUDIO_F32LE = 3,
+};
+
+enum net_audio_transport { NET_AUDIO_UDP, NET_AUDIO_TCP, NET_AUDIO_UNIX };
+
+#define NET_AUDIO_FLAG_DISCONTINUITY 0x01  /* frames were lost before this packet */
+
+struct __attribute__((packed)) net_audio_header {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t format;
+  uint8_t channels;
+  uint8_t flags;
+  uint32_t stream_id;
+  uint32_t rate;
+  uint64_t seq;
+  int64_t timestamp_ns;
+  uint32_t frames;
+  uint32_t bytes;
+};
+
+static inline size_t net_audio_sample_bytes(uint8_t format) {
+  return format == NET_AUDIO_S16LE ? 2 : 4;
+}
+
+struct net_audio_sink {
+  int fd;
+  net_audio_transport transport;
+  uint32_t stream_id;
+  uint8_t format;
+  uint8_t channels;
+  uint32_t rate;
+  size_t frame_bytes;
+  size_t max_packet_frames;
+
+  /* Arena of queued packets (header + payload back to back), from
+     arena_head to arena_used. */
+  uint8_t *arena;
+  size_t arena_head;
+  size_t arena_used;
+  size_t sent_offset;           /* stream sockets: bytes past arena_head already written */
+  uint32_t packet_offsets[NET_AUDIO_ARENA_BYTES / sizeof(net_audio_header)];
+  uint32_t packet_head;         /* first queued entry of packet_offsets */
+  uint32_t packets;             /* end of packet_offsets */
+
+  int batch_packets;
+  int64_t max_delay_ns;
+  int64_t oldest_queued_ns;
+
+  uint64_t seq;
+  bool discontinuity;
+  uint64_t sent_packets;
+  uint64_t sent_bytes;
+  uint64_t dropped_packets;
+  uint64_t dropped_frames;
+  uint64_t syscalls;
+  uint64_t compactions;
+};
+
+static inline int64_t net_audio_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* udp://host:port, tcp://host:port, unix:/path */
+static inline int net_audio_connect(const char *url, net_audio_transport *transport) {
+  if (!strncmp(url, "unix:", 5)) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, url + 5, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      fprintf(stderr, "cannot connect to %s: %s\n", url, strerror(errno));
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+    *transport = NET_AUDIO_UNIX;
+    return fd;
+  }
+
+  bool udp = !strncmp(url, "udp://", 6);
+  if (!udp && strncmp(url, "tcp://", 6)) {
+    fprintf(stderr, "unsupported sink url %s\n", url);
+    return -1;
+  }
+  char host[256];
+  const char *hp = url + 6;
+  const char *colon = strrchr(hp, ':');
+  if (!colon || colon == hp || (size_t) (colon - hp) >= sizeof(host)) {
+    fprintf(stderr, "missing port in %s\n", url);
+    return -1;
+  }
+  memcpy(host, hp, colon - hp);
+  host[colon - hp] = 0;
+  /* [v6 address] */
+  char *h = host;
+  if (h[0] == '[' && h[strlen(h) - 1] == ']') {
+    h[strlen(h) - 1] = 0;
+    h++;
+  }
+
+  struct addrinfo hints, *res, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+  int err = getaddrinfo(h, colon + 1, &hints, &res);
+  if (err) {
+    fprintf(stderr, "cannot resolve %s: %s\n", url, gai_strerror(err));
+    return -1;
+  }
+  int fd = -1;
+  for (ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    fprintf(stderr, "cannot connect to %s: %s\n", url, strerror(errno));
+    return -1;
+  }
+  if (!udp) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  *transport = udp ? NET_AUDIO_UDP : NET_AUDIO_TCP;
+  return fd;
+}
+
+static inline int net_audio_sink_open(net_audio_sink *s, const char *url, uint32_t stream_id,
+                                      net_audio_format format, uint32_t rate, uint8_t channels,
+                                      int batch_packets, int max_delay_ms) {
+  memset(s, 0, sizeof(*s));
+  if ((s->fd = net_audio_connect(url, &s->transport)) < 0)
+    return -1;
+  s->stream_id = stream_id;
+  s->format = format;
+  s->channels = channels;
+  s->rate = rate;
+  s->frame_bytes = net_audio_sample_bytes(format) * channels;
+  /* Stream sockets have no datagram limit; keep packets moderate anyway
+     so one header never describes more than ~64 KB. */
+  size_t max_payload = s->transport == NET_AUDIO_UDP
+      ? NET_AUDIO_MAX_DATAGRAM - sizeof(net_audio_header) : 65536;
+  s->max_packet_frames = max_payload / s->frame_bytes;
+  s->batch_packets = batch_packets < 1 ? 1 : batch_packets > NET_AUDIO_MAX_BATCH ? NET_AUDIO_MAX_BATCH : batch_packets;
+  s->max_delay_ns = (int64_t) max_delay_ms * 1000000;
+  s->arena = (uint8_t*) malloc(NET_AUDIO_ARENA_BYTES);
+  return s->arena ? 0 : -1;
+}
+
+static inline uint32_t net_audio_sink_queued(const net_audio_sink *s) {
+  return s->packets - s->packet_head;
+}
+
+/* Where packet i starts in the arena; the end of the queue for i == packets. */
+static inline size_t net_audio_sink_offset(const net_audio_sink *s, uint32_t i) {
+  return i < s->packets ? s->packet_offsets[i] : s->arena_used;
+}
+
+/* Forget the first `packets` queued packets, fully sent, which end at
+   arena offset `end`. */
+static inline void net_audio_sink_consume(net_audio_sink *s, uint32_t packets, size_t end) {
+  s->packet_head += packets;
+  s->arena_head = end;
+  if (s->packet_head == s->packets)
+    s->packet_head = s->packets = s->arena_head = s->arena_used = 0;
+}
+
+/* Move what is still queued to the start of the arena. */
+static inline void net_audio_sink_compact(net_audio_sink *s) {
+  memmove(s->arena, s->arena + s->arena_head, s->arena_used - s->arena_head);
+  for (uint32_t i = s->packet_head; i < s->packets; i++)
+    s->packet_offsets[i - s->packet_head] = s->packet_offsets[i] - (uint32_t) s->arena_head;
+  s->packets -= s->packet_head;
+  s->arena_used -= s->arena_head;
+  s->packet_head = 0;
+  s->arena_head = 0;
+  s->compactions++;
+}
+
+/* Send what is queued without blocking. Returns -1 on a fatal socket error. */
+static inline int net_audio_sink_flush(net_audio_sink *s) {
+  while (net_audio_sink_queued(s)) {
+    uint32_t head = s->packet_head, queued = net_audio_sink_queued(s);
+    if (s->transport == NET_AUDIO_UDP) {
+      struct mmsghdr msgs[NET_AUDIO_MAX_BATCH];
+      struct iovec iov[NET_AUDIO_MAX_BATCH];
+      uint32_t n = queued < NET_AUDIO_MAX_BATCH ? queued : NET_AUDIO_MAX_BATCH;
+      memset(msgs, 0, sizeof(msgs[0]) * n);
+      for (uint32_t i = 0; i < n; i++) {
+        size_t at = s->packet_offsets[head + i];
+        iov[i].iov_base = s->arena + at;
+        iov[i].iov_len = net_audio_sink_offset(s, head + i + 1) - at;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int r = sendmmsg(s->fd, msgs, n, MSG_DONTWAIT);
+      s->syscalls++;
+      if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+          return 0;
+        if (errno == ECONNREFUSED) {
+          /* Nobody listening (ICMP): the datagrams are gone, move on. */
+          s->dropped_packets += n;
+          net_audio_sink_consume(s, n, net_audio_sink_offset(s, head + n));
+          continue;
+        }
+        return -1;
+      }
+      size_t end = net_audio_sink_offset(s, head + r);
+      s->sent_packets += r;
+      s->sent_bytes += end - s->arena_head;
+      net_audio_sink_consume(s, r, end);
+    } else {
+      const uint8_t *from = s->arena + s->arena_head + s->sent_offset;
+      ssize_t r = send(s->fd, from, s->arena + s->arena_used - from, MSG_DONTWAIT | MSG_NOSIGNAL);
+      s->syscalls++;
+      if (r < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+      s->sent_offset += r;
+      s->sent_bytes += r;
+      /* Drop whole packets that made it out; a partial one stays. */
+      uint32_t done = 0;
+      while (done < queued && net_audio_sink_offset(s, head + done + 1) - s->arena_head <= s->sent_offset)
+        done++;
+      size_t end = net_audio_sink_offset(s, head + done);
+      s->sent_packets += done;
+      s->sent_offset -= end - s->arena_head;
+      net_audio_sink_consume(s, done, end);
+      if (s->sent_offset)
+        return 0;
+    }
+  }
+  return 0;
+}
+
+/* Queue one captured block (interleaved) and send when the batch is full
+   or the oldest queued packet is max_delay_ms old. */
+static inline int net_audio_sink_push(net_audio_sink *s, const void *data, uint32_t frames,
+                                      int64_t timestamp_ns) {
+  const uint8_t *p = (const uint8_t*) data;
+  uint32_t done = 0;
+
+  while (done < frames) {
+    uint32_t n = frames - done;
+    if (n > s->max_packet_frames)
+      n = (uint32_t) s->max_packet_frames;
+    size_t bytes = n * s->frame_bytes;
+    size_t max_packets = sizeof(s->packet_offsets) / sizeof(s->packet_offsets[0]);
+
+    if ((s->arena_used + sizeof(net_audio_header) + bytes > NET_AUDIO_ARENA_BYTES || s->packets == max_packets) &&
+        s->packet_head)
+      net_audio_sink_compact(s);
+    if (s->arena_used + sizeof(net_audio_header) + bytes > NET_AUDIO_ARENA_BYTES ||
+        s->packets == max_packets) {
+      /* Receiver or network can't keep up: drop, and tell the receiver. */
+      s->dropped_packets++;
+      s->dropped_frames += n;
+      s->seq++;
+      s->discontinuity = true;
+      done += n;
+      continue;
+    }
+
+    net_audio_header h;
+    h.magic = NET_AUDIO_MAGIC;
+    h.version = NET_AUDIO_VERSION;
+    h.format = s->format;
+    h.channels = s->channels;
+    h.flags = s->discontinuity ? NET_AUDIO_FLAG_DISCONTINUITY : 0;
+    h.stream_id = s->stream_id;
+    h.rate = s->rate;
+    h.seq = s->seq++;
+    h.timestamp_ns = timestamp_ns + (int64_t) done * 1000000000LL / s->rate;
+    h.frames = n;
+    h.bytes = (uint32_t) bytes;
+    s->discontinuity = false;
+
+    if (!net_audio_sink_queued(s))
+      s->oldest_queued_ns = net_audio_monotonic_ns();
+    s->packet_offsets[s->packets++] = (uint32_t) s->arena_used;
+    memcpy(s->arena + s->arena_used, &h, sizeof(h));
+    memcpy(s->arena + s->arena_used + sizeof(h), p + (size_t) done * s->frame_bytes, bytes);
+    s->arena_used += sizeof(h) + bytes;
+    done += n;
+  }
+
+  uint32_t queued = net_audio_sink_queued(s);
+  if (queued >= (uint32_t) s->batch_packets ||
+      (queued && net_audio_monotonic_ns() - s->oldest_queued_ns >= s->max_delay_ns))
+    return net_audio_sink_flush(s);
+  return 0;
+}
+
+static inline void net_audio_sink_close(net_audio_sink *s) {
+  if (s->fd >= 0) {
+    net_audio_sink_flush(s);
+    close(s->fd);
+  }
+  free(s->arena);
+  s->arena = NULL;
+  s->fd = -1;
+}
+
+static inline void net_audio_sink_print_stats(const net_audio_sink *s, FILE *out) {
+  fprintf(out, "sent %lu packets (%lu bytes) in %lu syscalls, dropped %lu packets (%lu frames), "
+          "%lu compactions\n",
+          (unsigned long) s->sent_packets, (unsigned long) s->sent_bytes, (unsigned long) s->syscalls,
+          (unsigned long) s->dropped_packets, (unsigned long) s->dropped_frames, (unsigned long) s->compactions);
+}
+
+#endif  // NET_AUDIO_SINK_H_
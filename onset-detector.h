@@ -0,0 +1,362 @@
+/*
+  Streaming onset and band-energy events, for deciding what to record.
+
+  Runs on every captured block at a fixed cost per sample: the signal is
+  mixed to mono and cut into Hann-windowed frames of fft_size (about
+  20 ms), one every hop samples, each through one real FFT. Per frame:
+
+    flux   spectral flux, the summed increase of log-compressed bin
+           magnitudes over the previous frame. An onset is a local
+           maximum of the flux above flux_ratio times its mean over the
+           last ONSET_HISTORY frames plus flux_delta, at least min_gap_ms
+           after the last one.
+    bands  the energy in up to ONSET_MAX_BANDS frequency bands, in dB
+           relative to a full-scale sine. A band turns on when it reaches
+           its threshold and off once it has been release_db below it
+           for hold_ms.
+
+  Each event carries the sample position it happened at and its capture
+  time (from the block's capture time), and the flux or the band level:
+
+    onset_config cfg;
+    onset_default_config(&cfg, 48000, 2);
+    onset_parse_band(&cfg, "300-3000:-35");    // speech band over -35 dB
+    onset_detector d;
+    onset_detector_init(&d, &cfg);
+    onset_event ev[16];
+    size_t n = onset_detector_process_s16(&d, block, frames, capture_ns, ev, 16);
+    if (n || onset_detector_active(&d)) keep(block);
+
+  An onset is reported one frame late (it must be a peak). At most
+  max_events are returned per call; the rest are counted in d.lost.
+  Linux only, C++11.
+*/
+#ifndef ONSET_DETECTOR_H_
+#define ONSET_DETECTOR_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define ONSET_MAX_BANDS 8
+#define ONSET_HISTORY 16      /* flux frames in the adaptive threshold */
+#define ONSET_LOG_GAMMA 100.0f  /* magnitude compression: log(1 + g |X|) */
+
+enum onset_event_type { ONSET_FLUX, ONSET_BAND_ON, ONSET_BAND_OFF };
+static const char *const onset_event_names[] = { "onset", "band-on", "band-off" };
+
+struct onset_event {
+  onset_event_type type;
+  int band;                 /* ONSET_BAND_*, else -1 */
+  uint64_t position;        /* samples since the start */
+  int64_t capture_ns;
+  float value;              /* flux, or band dB */
+};
+
+struct onset_band_config {
+  float lo_hz, hi_hz, on_db;
+};
+
+struct onset_config {
+  uint32_t rate, channels;
+  uint32_t fft_size, hop;   /* a power of two; at most fft_size */
+  float flux_ratio, flux_delta, min_gap_ms;
+  float release_db, hold_ms;
+  onset_band_config bands[ONSET_MAX_BANDS];
+  int nbands;
+};
+
+struct onset_band {
+  uint32_t lo_bin, hi_bin;  /* [lo, hi] */
+  float on_db, off_db, db;
+  uint32_t hold_frames, below;
+  bool active;
+};
+
+struct onset_detector {
+  onset_config cfg;
+  uint32_t n, half;
+  std::vector<float> window, frame, ring;     /* ring: the last n samples */
+  std::vector<float> cos_t, sin_t;            /* twiddles for n/2 and n */
+  std::vector<uint32_t> bitrev;               /* for n/2 */
+  std::vector<float> re, im, mag, prev_mag, power;
+  uint32_t ring_pos, since_frame;
+  uint64_t position;                          /* samples in */
+  float power_scale;                          /* to mean square */
+  /* Peak picking, one frame behind. */
+  float flux_hist[ONSET_HISTORY];
+  uint32_t hist_count, hist_pos;
+  float hist_sum;
+  float flux_prev, flux_prev2, thr_prev;
+  uint64_t prev_position, last_onset;
+  bool have_onset;
+  uint32_t min_gap;
+  onset_band bands[ONSET_MAX_BANDS];
+  /* Counters. */
+  uint64_t frames, onsets, band_events, lost;
+};
+
+/* fft_size about 20 ms, a hop of half that. */
+static inline void onset_default_config(onset_config *c, uint32_t rate, uint32_t channels) {
+  memset(c, 0, sizeof(*c));
+  c->rate = rate;
+  c->channels = channels;
+  c->fft_size = 64;
+  while (c->fft_size < rate / 50 && c->fft_size < 8192)
+    c->fft_size *= 2;
+  c->hop = c->fft_size / 2;
+  c->flux_ratio = 1.5f;
+  c->flux_delta = 0.05f;
+  c->min_gap_ms = 50;
+  c->release_db = 3;
+  c->hold_ms = 300;
+}
+
+/* "LO-HI:DB", e.g. "300-3000:-35". False when malformed or full. */
+static inline bool onset_parse_band(onset_config *c, const char *spec) {
+  float lo, hi, db;
+  if (c->nbands >= ONSET_MAX_BANDS || sscanf(spec, "%f-%f:%f", &lo, &hi, &db) != 3 || lo < 0 || hi <= lo)
+    return false;
+  c->bands[c->nbands].lo_hz = lo;
+  c->bands[c->nbands].hi_hz = hi;
+  c->bands[c->nbands].on_db = db;
+  c->nbands++;
+  return true;
+}
+
+/* False on a bad configuration. */
+static inline bool onset_detector_init(onset_detector *d, const onset_config *c) {
+  uint32_t n = c->fft_size;
+  if (n < 16 || (n & (n - 1)) || !c->hop || c->hop > n || !c->rate || !c->channels || c->nbands < 0 ||
+      c->nbands > ONSET_MAX_BANDS)
+    return false;
+  d->cfg = *c;
+  d->n = n;
+  d->half = n / 2;
+  d->window.resize(n);
+  double wsum2 = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    d->window[i] = (float) (0.5 - 0.5 * cos(2 * M_PI * i / n));
+    wsum2 += (double) d->window[i] * d->window[i];
+  }
+  /* One-sided bin power to mean square: Parseval, and the window. */
+  d->power_scale = (float) (2.0 / (n * wsum2));
+  d->frame.assign(n, 0.0f);
+  d->ring.assign(n, 0.0f);
+  d->cos_t.resize(n / 2);
+  d->sin_t.resize(n / 2);
+  for (uint32_t k = 0; k < n / 2; k++) {
+    d->cos_t[k] = (float) cos(2 * M_PI * k / n);
+    d->sin_t[k] = (float) -sin(2 * M_PI * k / n);
+  }
+  uint32_t m = n / 2, bits = 0;
+  while ((1u << bits) < m) bits++;
+  d->bitrev.resize(m);
+  for (uint32_t i = 0; i < m; i++) {
+    uint32_t r = 0;
+    for (uint32_t b = 0; b < bits; b++)
+      if (i & (1u << b)) r |= 1u << (bits - 1 - b);
+    d->bitrev[i] = r;
+  }
+  d->re.assign(m, 0.0f);
+  d->im.assign(m, 0.0f);
+  d->mag.assign(m + 1, 0.0f);
+  d->prev_mag.assign(m + 1, 0.0f);
+  d->power.assign(m + 1, 0.0f);
+  d->ring_pos = 0;
+  d->since_frame = 0;
+  d->position = 0;
+  memset(d->flux_hist, 0, sizeof(d->flux_hist));
+  d->hist_count = d->hist_pos = 0;
+  d->hist_sum = 0;
+  d->flux_prev = d->flux_prev2 = d->thr_prev = 0;
+  d->prev_position = d->last_onset = 0;
+  d->have_onset = false;
+  d->min_gap = (uint32_t) (c->min_gap_ms * c->rate / 1000);
+  float frame_ms = 1000.0f * c->hop / c->rate;
+  for (int b = 0; b < c->nbands; b++) {
+    onset_band *band = &d->bands[b];
+    const onset_band_config *bc = &c->bands[b];
+    band->lo_bin = (uint32_t) ceil(bc->lo_hz * n / c->rate);
+    band->hi_bin = (uint32_t) floor(bc->hi_hz * n / c->rate);
+    if (band->hi_bin > m) band->hi_bin = m;
+    if (band->lo_bin > band->hi_bin) band->lo_bin = band->hi_bin;
+    band->on_db = bc->on_db;
+    band->off_db = bc->on_db - c->release_db;
+    band->db = -200;
+    band->hold_frames = (uint32_t) ceil(c->hold_ms / frame_ms);
+    band->below = 0;
+    band->active = false;
+  }
+  d->frames = d->onsets = d->band_events = d->lost = 0;
+  return true;
+}
+
+/* Real FFT of d->frame (n samples): n/2 + 1 bins in mag and power, from
+   a complex FFT of n/2 points over the even and odd samples. */
+static inline void onset_fft(onset_detector *d) {
+  uint32_t m = d->half;
+  float *re = d->re.data(), *im = d->im.data();
+  for (uint32_t i = 0; i < m; i++) {
+    uint32_t j = d->bitrev[i];
+    re[j] = d->frame[2 * i];
+    im[j] = d->frame[2 * i + 1];
+  }
+  for (uint32_t len = 2; len <= m; len *= 2) {
+    uint32_t step = d->n / len;   /* twiddle stride in the n-point table */
+    for (uint32_t i = 0; i < m; i += len)
+      for (uint32_t k = 0; k < len / 2; k++) {
+        float wr = d->cos_t[k * step], wi = d->sin_t[k * step];
+        uint32_t a = i + k, b = a + len / 2;
+        float tr = re[b] * wr - im[b] * wi, ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+  }
+  /* Split: X[k] = (Z[k] + Z*[m-k]) / 2 + W^k (Z[k] - Z*[m-k]) / 2i. */
+  for (uint32_t k = 0; k <= m; k++) {
+    uint32_t a = k % m, b = (m - k) % m;
+    float er = 0.5f * (re[a] + re[b]), ei = 0.5f * (im[a] - im[b]);
+    float or_ = 0.5f * (im[a] + im[b]), oi = -0.5f * (re[a] - re[b]);
+    float wr = k < m ? d->cos_t[k] : -1.0f, wi = k < m ? d->sin_t[k] : 0.0f;
+    float xr = er + wr * or_ - wi * oi, xi = ei + wr * oi + wi * or_;
+    float p = xr * xr + xi * xi;
+    d->power[k] = p;
+    d->mag[k] = sqrtf(p);
+  }
+}
+
+static inline void onset_emit(onset_detector *d, onset_event *out, size_t max, size_t *n, onset_event_type type,
+                              int band, uint64_t position, float value, uint64_t block_position,
+                              int64_t block_ns) {
+  if (*n >= max) {
+    d->lost++;
+    return;
+  }
+  onset_event *e = &out[(*n)++];
+  e->type = type;
+  e->band = band;
+  e->position = position;
+  e->capture_ns = block_ns + ((int64_t) position - (int64_t) block_position) * 1000000000 / d->cfg.rate;
+  e->value = value;
+}
+
+/* One frame, ending at d->position. */
+static inline void onset_frame(onset_detector *d, onset_event *out, size_t max, size_t *count,
+                               uint64_t block_position, int64_t block_ns) {
+  uint32_t n = d->n;
+  for (uint32_t i = 0; i < n; i++)
+    d->frame[i] = d->ring[(d->ring_pos + i) % n] * d->window[i];
+  onset_fft(d);
+  d->frames++;
+
+  float flux = 0;
+  for (uint32_t k = 0; k <= d->half; k++) {
+    float c = logf(1.0f + ONSET_LOG_GAMMA * d->mag[k]);
+    float rise = c - d->prev_mag[k];
+    if (rise > 0) flux += rise;
+    d->prev_mag[k] = c;
+  }
+  flux /= d->half + 1;
+
+  /* The previous frame is an onset when it peaks over its threshold. */
+  uint64_t at = d->prev_position;
+  if (d->frames > 2 && d->flux_prev > d->thr_prev && d->flux_prev >= d->flux_prev2 && d->flux_prev > flux &&
+      (!d->have_onset || at - d->last_onset >= d->min_gap)) {
+    d->have_onset = true;
+    d->last_onset = at;
+    d->onsets++;
+    onset_emit(d, out, max, count, ONSET_FLUX, -1, at, d->flux_prev, block_position, block_ns);
+  }
+  float mean = d->hist_count ? d->hist_sum / d->hist_count : 0;
+  d->thr_prev = d->cfg.flux_delta + d->cfg.flux_ratio * mean;
+  d->flux_prev2 = d->flux_prev;
+  d->flux_prev = flux;
+  /* The new samples started a hop before the frame's end. */
+  d->prev_position = d->position - d->cfg.hop;
+  d->hist_sum += flux - d->flux_hist[d->hist_pos];
+  d->flux_hist[d->hist_pos] = flux;
+  d->hist_pos = (d->hist_pos + 1) % ONSET_HISTORY;
+  if (d->hist_count < ONSET_HISTORY) d->hist_count++;
+
+  for (int b = 0; b < d->cfg.nbands; b++) {
+    onset_band *band = &d->bands[b];
+    float p = 0;
+    for (uint32_t k = band->lo_bin; k <= band->hi_bin; k++)
+      p += d->power[k];
+    band->db = 10 * log10f(p * d->power_scale / 0.5f + 1e-20f);
+    if (!band->active && band->db >= band->on_db) {
+      band->active = true;
+      band->below = 0;
+      d->band_events++;
+      onset_emit(d, out, max, count, ONSET_BAND_ON, b, d->position - d->cfg.hop, band->db, block_position, block_ns);
+    } else if (band->active) {
+      band->below = band->db < band->off_db ? band->below + 1 : 0;
+      if (band->below >= band->hold_frames) {
+        band->active = false;
+        d->band_events++;
+        onset_emit(d, out, max, count, ONSET_BAND_OFF, b, d->position, band->db, block_position, block_ns);
+      }
+    }
+  }
+}
+
+/* Interleaved frames captured from capture_ns on; returns the events
+   written to out. */
+template <typename T>
+static inline size_t onset_detector_process(onset_detector *d, const T *x, uint32_t frames, int64_t capture_ns,
+                                            float scale, onset_event *out, size_t max) {
+  size_t count = 0;
+  uint64_t block_position = d->position;
+  uint32_t ch = d->cfg.channels;
+  float mix = scale / ch;
+  for (uint32_t f = 0; f < frames; f++, x += ch) {
+    float s = 0;
+    for (uint32_t c = 0; c < ch; c++)
+      s += (float) x[c];
+    d->ring[d->ring_pos] = s * mix;
+    d->ring_pos = (d->ring_pos + 1) % d->n;
+    d->position++;
+    if (++d->since_frame == d->cfg.hop) {
+      d->since_frame = 0;
+      onset_frame(d, out, max, &count, block_position, capture_ns);
+    }
+  }
+  return count;
+}
+
+static inline size_t onset_detector_process_s16(onset_detector *d, const int16_t *x, uint32_t frames,
+                                                int64_t capture_ns, onset_event *out, size_t max) {
+  return onset_detector_process(d, x, frames, capture_ns, 1.0f / 32768, out, max);
+}
+
+static inline size_t onset_detector_process_f32(onset_detector *d, const float *x, uint32_t frames,
+                                                int64_t capture_ns, onset_event *out, size_t max) {
+  return onset_detector_process(d, x, frames, capture_ns, 1.0f, out, max);
+}
+
+/* Some band is on. */
+static inline bool onset_detector_active(const onset_detector *d) {
+  for (int b = 0; b < d->cfg.nbands; b++)
+    if (d->bands[b].active) return true;
+  return false;
+}
+
+static inline void onset_event_print(const onset_event *e, uint32_t rate, FILE *out) {
+  fprintf(out, "%.3f %s", (double) e->position / rate, onset_event_names[e->type]);
+  if (e->band >= 0) fprintf(out, " %d", e->band);
+  fprintf(out, " %.3f\n", e->value);
+}
+
+static inline void onset_detector_print_stats(const onset_detector *d, FILE *out) {
+  fprintf(out, "onset detector: %u-point frames every %u samples, %lu frames, %lu onsets, %lu band events, "
+          "%lu lost\n", d->n, d->cfg.hop, (unsigned long) d->frames, (unsigned long) d->onsets,
+          (unsigned long) d->band_events, (unsigned long) d->lost);
+}
+
+#endif  // ONSET_DETECTOR_H_
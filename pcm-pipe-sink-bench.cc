@@ -0,0 +1,142 @@
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "pcm-pipe-sink.h"
+
+// Exercises pcm-pipe-sink.h against two pipe readers:
+//
+//   null  reads everything and throws it away, like `cat > /dev/null`;
+//         the producer waits for POLLOUT when the ring is full, so this
+//         measures throughput with vmsplice and with plain writes
+//   slow  reads a little every 10 ms, far below the capture rate; the
+//         producer is paced like capture and never waits, so the sink
+//         has to drop, and memory must stay at the configured bound
+//
+// g++ -O2 pcm-pipe-sink-bench.cc -o pcm-pipe-sink-bench -std=c++11
+// ./pcm-pipe-sink-bench
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define BLOCK_FRAMES ((SAMPLE_RATE) / 100)
+#define FRAME_BYTES (CHANNELS * sizeof(int16_t))
+#define MAX_BUFFER_MS 500
+#define NULL_SECONDS_OF_AUDIO 3600
+#define SLOW_BLOCKS 300
+#define SLOW_READ_BYTES 1024
+#define SLOW_READ_PERIOD_US 10000
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long max_rss_kb() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static pid_t start_reader(int fds[2], bool slow) {
+  int fd = fds[0];
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[1]);
+    static char buffer[1 << 16];
+    ssize_t r;
+    while ((r = read(fd, buffer, slow ? SLOW_READ_BYTES : sizeof(buffer))) > 0)
+      if (slow) usleep(SLOW_READ_PERIOD_US);
+    _exit(0);
+  }
+  close(fd);
+  return pid;
+}
+
+static void run_null_reader(bool allow_vmsplice) {
+  int fds[2];
+  if (pipe(fds) < 0) exit(1);
+  pid_t reader = start_reader(fds, false);
+
+  pcm_pipe_sink sink;
+  size_t max_buffer = (size_t) SAMPLE_RATE * MAX_BUFFER_MS / 1000 * FRAME_BYTES;
+  if (pcm_pipe_sink_open(&sink, fds[1], max_buffer, FRAME_BYTES, allow_vmsplice) < 0) exit(1);
+
+  std::vector<int16_t> block(BLOCK_FRAMES * CHANNELS);
+  size_t block_bytes = block.size() * sizeof(int16_t);
+  uint64_t blocks = (uint64_t) NULL_SECONDS_OF_AUDIO * SAMPLE_RATE / BLOCK_FRAMES;
+  struct pollfd pfd = { fds[1], POLLOUT, 0 };
+
+  int64_t start = monotonic_ns();
+  for (uint64_t i = 0; i < blocks; i++) {
+    block[0] = (int16_t) i;
+    while (sink.capacity - sink.reserve - pcm_pipe_sink_pending(&sink) < block_bytes) {
+      if (pcm_pipe_sink_flush(&sink) > 0)
+        poll(&pfd, 1, -1);
+    }
+    pcm_pipe_sink_push(&sink, block.data(), block_bytes);
+    if (pcm_pipe_sink_flush(&sink) < 0) break;
+  }
+  while (pcm_pipe_sink_flush(&sink) > 0)
+    poll(&pfd, 1, -1);
+  double seconds = (monotonic_ns() - start) / 1e9;
+
+  fprintf(stdout, "null reader, %-8s: %.0f MB/s, %.0fx real time, ",
+          sink.use_vmsplice ? "vmsplice" : "write",
+          sink.send_pos / seconds / 1e6, NULL_SECONDS_OF_AUDIO / seconds);
+  pcm_pipe_sink_print_stats(&sink, stdout);
+  pcm_pipe_sink_close(&sink);
+  close(fds[1]);
+  waitpid(reader, NULL, 0);
+}
+
+static void run_slow_reader() {
+  int fds[2];
+  if (pipe(fds) < 0) exit(1);
+  pid_t reader = start_reader(fds, true);
+
+  pcm_pipe_sink sink;
+  size_t max_buffer = (size_t) SAMPLE_RATE * MAX_BUFFER_MS / 1000 * FRAME_BYTES;
+  if (pcm_pipe_sink_open(&sink, fds[1], max_buffer, FRAME_BYTES) < 0) exit(1);
+
+  std::vector<int16_t> block(BLOCK_FRAMES * CHANNELS);
+  size_t block_bytes = block.size() * sizeof(int16_t);
+  long rss_start = max_rss_kb();
+
+  // Paced like capture (10 ms blocks, at 4x to keep the run short).
+  int64_t next = monotonic_ns();
+  for (int i = 0; i < SLOW_BLOCKS; i++) {
+    pcm_pipe_sink_push(&sink, block.data(), block_bytes);
+    if (pcm_pipe_sink_flush(&sink) < 0) break;
+    next += 2500000;
+    struct timespec ts = { (time_t) (next / 1000000000LL), (long) (next % 1000000000LL) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+
+  fprintf(stdout, "slow reader, %-8s: rss %ld -> %ld kB, ", sink.use_vmsplice ? "vmsplice" : "write",
+          rss_start, max_rss_kb());
+  pcm_pipe_sink_print_stats(&sink, stdout);
+  bool bounded = sink.max_pending <= sink.capacity - sink.reserve && sink.dropped_bytes > 0 &&
+                 sink.dropped_bytes % FRAME_BYTES == 0;
+  fprintf(stdout, "slow reader: buffer %s\n", bounded ? "bounded, whole frames dropped" : "NOT bounded");
+
+  kill(reader, SIGKILL);
+  waitpid(reader, NULL, 0);
+  munmap(sink.ring, sink.capacity);
+  close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGPIPE, SIG_IGN);
+  run_null_reader(true);
+  run_null_reader(false);
+  run_slow_reader();
+  return 0;
+}
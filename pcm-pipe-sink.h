@@ -0,0 +1,185 @@
+/*
+  Non-blocking raw PCM sink for stdout / pipes.
+
+  Captured data is copied once into a fixed, page-aligned ring. From
+  there it goes out with vmsplice() when the fd is a pipe, so the pipe
+  references the ring pages instead of copying them, and with writev()
+  otherwise (files, terminals, sockets). Nothing ever blocks: when the
+  reader is slower than capture the ring fills up and new frames are
+  dropped whole (counted), so memory stays at the configured bound and
+  the output stays frame-aligned.
+
+  vmsplice without SPLICE_F_GIFT leaves the pages owned by us, and the
+  reader copies them out later. Bytes handed to the pipe must therefore
+  not be overwritten until the reader had a chance to consume them: the
+  ring keeps one pipe capacity behind the send position as a reserve.
+
+    pcm_pipe_sink sink;
+    pcm_pipe_sink_open(&sink, STDOUT_FILENO, max_buffer_bytes, frame_bytes);
+    pcm_pipe_sink_push(&sink, data, len);   // from the capture callback
+    if (pcm_pipe_sink_flush(&sink) > 0)     // bytes still pending:
+      ...wait for POLLOUT, then flush again...
+    pcm_pipe_sink_close(&sink);
+
+  Linux only.
+*/
+#ifndef PCM_PIPE_SINK_H_
+#define PCM_PIPE_SINK_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* Pipe size we ask for; the kernel may cap it (/proc/sys/fs/pipe-max-size). */
+#define PCM_PIPE_SINK_PIPE_SIZE (256 * 1024)
+
+struct pcm_pipe_sink {
+  int fd;
+  int saved_flags;
+  bool is_pipe;
+  bool use_vmsplice;
+  uint8_t *ring;
+  size_t capacity;        /* ring bytes, page multiple */
+  size_t reserve;         /* bytes behind send_pos the pipe may still reference */
+  size_t frame_bytes;
+  uint64_t write_pos;     /* total bytes pushed into the ring */
+  uint64_t send_pos;      /* total bytes handed to the fd */
+  uint64_t dropped_bytes;
+  uint64_t blocked;       /* flushes that stopped on EAGAIN */
+  size_t max_pending;
+};
+
+static inline size_t pcm_pipe_sink_pending(const pcm_pipe_sink *s) {
+  return (size_t) (s->write_pos - s->send_pos);
+}
+
+static inline int pcm_pipe_sink_open(pcm_pipe_sink *s, int fd, size_t max_buffer_bytes,
+                                     size_t frame_bytes, bool allow_vmsplice = true) {
+  struct stat st;
+  memset(s, 0, sizeof(*s));
+  s->fd = fd;
+  s->frame_bytes = frame_bytes;
+
+  if (fstat(fd, &st) < 0)
+    return -1;
+  s->is_pipe = S_ISFIFO(st.st_mode);
+  s->use_vmsplice = s->is_pipe && allow_vmsplice;
+
+  if (s->is_pipe) {
+    fcntl(fd, F_SETPIPE_SZ, PCM_PIPE_SINK_PIPE_SIZE);
+    int size = fcntl(fd, F_GETPIPE_SZ);
+    s->reserve = size > 0 ? size : 65536;
+  }
+  if (!s->use_vmsplice)
+    s->reserve = 0;
+
+  long page = sysconf(_SC_PAGESIZE);
+  s->capacity = (max_buffer_bytes + s->reserve + page - 1) / page * page;
+  s->ring = (uint8_t*) mmap(NULL, s->capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (s->ring == MAP_FAILED) {
+    s->ring = NULL;
+    return -1;
+  }
+
+  s->saved_flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, s->saved_flags | O_NONBLOCK);
+  return 0;
+}
+
+/* Queue captured bytes (NULL data queues len bytes of silence, for a
+   hole in the capture). Whole frames that don't fit are dropped.
+   Returns the number of bytes queued. */
+static inline size_t pcm_pipe_sink_push(pcm_pipe_sink *s, const void *data, size_t len) {
+  size_t free_bytes = s->capacity - s->reserve - pcm_pipe_sink_pending(s);
+  size_t n = len <= free_bytes ? len : free_bytes / s->frame_bytes * s->frame_bytes;
+  s->dropped_bytes += len - n;
+
+  size_t at = (size_t) (s->write_pos % s->capacity);
+  size_t first = n < s->capacity - at ? n : s->capacity - at;
+  if (data) {
+    memcpy(s->ring + at, data, first);
+    memcpy(s->ring, (const uint8_t*) data + first, n - first);
+  } else {
+    memset(s->ring + at, 0, first);
+    memset(s->ring, 0, n - first);
+  }
+  s->write_pos += n;
+  if (pcm_pipe_sink_pending(s) > s->max_pending)
+    s->max_pending = pcm_pipe_sink_pending(s);
+  return n;
+}
+
+/* Hand as much as possible to the fd without blocking. Returns the bytes
+   still pending (wait for POLLOUT before calling again), or -1 on error. */
+static inline ssize_t pcm_pipe_sink_flush(pcm_pipe_sink *s) {
+  while (pcm_pipe_sink_pending(s)) {
+    size_t pending = pcm_pipe_sink_pending(s);
+    size_t at = (size_t) (s->send_pos % s->capacity);
+    struct iovec iov[2];
+    int n = 1;
+    iov[0].iov_base = s->ring + at;
+    iov[0].iov_len = pending < s->capacity - at ? pending : s->capacity - at;
+    if (iov[0].iov_len < pending) {
+      iov[1].iov_base = s->ring;
+      iov[1].iov_len = pending - iov[0].iov_len;
+      n = 2;
+    }
+
+    ssize_t r;
+    if (s->use_vmsplice) {
+      r = vmsplice(s->fd, iov, n, SPLICE_F_NONBLOCK);
+      if (r < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        /* Not spliceable after all: copy from now on. */
+        s->use_vmsplice = false;
+        s->reserve = 0;
+        continue;
+      }
+    } else {
+      r = writev(s->fd, iov, n);
+    }
+
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        s->blocked++;
+        break;
+      }
+      return -1;
+    }
+    s->send_pos += r;
+  }
+  return (ssize_t) pcm_pipe_sink_pending(s);
+}
+
+static inline void pcm_pipe_sink_close(pcm_pipe_sink *s) {
+  if (s->ring) {
+    /* Last chance for what is queued, then give the fd its flags back. */
+    fcntl(s->fd, F_SETFL, s->saved_flags);
+    if (s->use_vmsplice) {
+      s->use_vmsplice = false;
+      s->reserve = 0;
+    }
+    pcm_pipe_sink_flush(s);
+    munmap(s->ring, s->capacity);
+    s->ring = NULL;
+  }
+}
+
+static inline void pcm_pipe_sink_print_stats(const pcm_pipe_sink *s, FILE *out) {
+  fprintf(out, "sent %lu bytes (%s), dropped %lu bytes (%lu frames), "
+          "peak buffered %lu of %lu bytes, %lu blocked flushes\n",
+          (unsigned long) s->send_pos, s->use_vmsplice ? "vmsplice" : "write",
+          (unsigned long) s->dropped_bytes, (unsigned long) (s->dropped_bytes / s->frame_bytes),
+          (unsigned long) s->max_pending, (unsigned long) (s->capacity - s->reserve),
+          (unsigned long) s->blocked);
+}
+
+#endif  // PCM_PIPE_SINK_H_
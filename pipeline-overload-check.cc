@@ -0,0 +1,256 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+#include "pipeline-stages.h"
+
+// Fails when a slow sink can stall capture, grow memory, or lose audio
+// without it being counted (pipeline.h overload policies).
+//
+// A paced mock device (mock-capture.h, --speed times real time) feeds a
+// sink that takes --overload times longer per block than the device
+// takes to deliver one, for minutes of audio. Per policy, two shapes:
+//
+//   direct   mic -> slow sink, the policy on the sink's queue
+//   chained  mic -> gain (pool) -> slow sink; the policy on the gain's
+//            queue, and the sink's queue blocks, so the overload backs
+//            up through a pooled stage before anything is dropped
+//
+// and per run these must hold:
+//
+//   capture  the source never waited for a queue, and the device never
+//            overran (it was read on time to the end)
+//   memory   no queue went past its capacity, the block pool was never
+//            empty, and the resident size did not grow after the first
+//            quarter of the run
+//   counts   per queue, frames offered = frames delivered + dropped,
+//            exactly; the sink saw exactly the frames delivered to it;
+//            the source's frames all entered the first queue
+//   shape    drop-oldest delivers the newest block last, drop-newest
+//            delivers the first blocks without gaps, decimate never
+//            skips more than a few blocks in a row
+//
+// policy=block runs too and must show the stall the others avoid.
+//
+// g++ -O2 pipeline-overload-check.cc -o pipeline-overload-check -lm -std=c++11 -lpthread
+// ./pipeline-overload-check && echo capture never stalled
+
+/* The slow sink: sleeps, and checks what arrives. */
+struct check_sink {
+  int64_t sleep_ns;
+  uint64_t blocks, frames;
+  uint64_t first_seq, last_seq, max_gap;
+  uint64_t lead;   /* blocks delivered before the first gap */
+  bool in_order;
+};
+
+static void *check_open(pipe_stage *s, std::string *) {
+  check_sink *c = new check_sink;
+  memset(c, 0, sizeof(*c));
+  c->sleep_ns = (int64_t) (pipe_arg_number(s, "sleep_us", 0) * 1000);
+  c->in_order = true;
+  return c;
+}
+
+static pipe_block *check_process(void *state, pipe_stage *, pipe_block *in) {
+  check_sink *c = (check_sink*) state;
+  if (!c->blocks) {
+    c->first_seq = in->seq;
+  } else {
+    if (in->seq <= c->last_seq) c->in_order = false;
+    else if (in->seq - c->last_seq - 1 > c->max_gap) c->max_gap = in->seq - c->last_seq - 1;
+  }
+  if (c->max_gap == 0 && c->first_seq == 0) c->lead++;
+  c->last_seq = in->seq;
+  c->blocks++;
+  c->frames += in->frames;
+  struct timespec ts = { (time_t) (c->sleep_ns / 1000000000), (long) (c->sleep_ns % 1000000000) };
+  nanosleep(&ts, NULL);
+  return NULL;
+}
+
+static void check_close(void *, FILE *) {
+  /* Read by the check before close; freed there. */
+}
+
+static const pipe_stage_type check_type = {
+  "check", PIPE_SINK, "slow sink that checks sequence numbers: sleep_us", check_open, NULL, check_process, NULL,
+  check_close
+};
+
+static const pipe_stage_type *const types[] = { PIPE_STOCK_STAGES, &check_type, NULL };
+
+static long resident_kib() {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int failures = 0;
+static FILE *quiet;   /* the stages' own reports */
+
+static void expect(bool ok, const char *name, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL %s: %s\n", name, what);
+    failures++;
+  }
+}
+
+static pipe_stage *find_stage(pipe_graph *g, const char *name) {
+  for (size_t i = 0; i < g->stages.size(); i++)
+    if (g->stages[i]->name == name) return g->stages[i];
+  return NULL;
+}
+
+static void run_case(const char *policy, bool chained, double seconds, double speed, double overload, int queue) {
+  uint32_t rate = 48000, frames = 480;
+  double period_us = frames * 1e6 / rate / speed;
+  char name[64], line[256];
+  snprintf(name, sizeof(name), "%s/%s", policy, chained ? "chained" : "direct");
+
+  pipe_graph g;
+  pipe_graph_init(&g, types, 2);
+  std::string err;
+  std::vector<std::string> lines;
+  snprintf(line, sizeof(line), "mic: mock rate=%u frames=%u speed=%g seconds=%g noise=0.1", rate, frames, speed,
+           seconds);
+  lines.push_back(line);
+  if (chained) {
+    snprintf(line, sizeof(line), "gain db=-6 run=pool queue=%d policy=%s decimate=4", queue, policy);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "sink: check sleep_us=%.0f queue=2", period_us * overload);
+  } else {
+    snprintf(line, sizeof(line), "sink: check sleep_us=%.0f queue=%d policy=%s decimate=4", period_us * overload,
+             queue, policy);
+  }
+  lines.push_back(line);
+  for (size_t i = 0; i < lines.size(); i++)
+    if (!pipe_graph_add(&g, lines[i], &err)) {
+      fprintf(stderr, "%s: %s\n", name, err.c_str());
+      exit(1);
+    }
+  if (!pipe_graph_open(&g, &err)) {
+    fprintf(stderr, "%s: %s\n", name, err.c_str());
+    exit(1);
+  }
+
+  int64_t start = pipe_now_ns();
+  pipe_graph_start(&g);
+  /* Resident size a quarter in, when every block and queue is in use. */
+  struct timespec quarter = { 0, 0 };
+  double q = seconds / speed / 4;
+  quarter.tv_sec = (time_t) q;
+  quarter.tv_nsec = (long) ((q - (double) quarter.tv_sec) * 1e9);
+  nanosleep(&quarter, NULL);
+  long rss_early = resident_kib();
+  pipe_graph_wait(&g);
+  long rss_late = resident_kib();
+  double wall = (pipe_now_ns() - start) / 1e9;
+
+  pipe_stage *mic = find_stage(&g, "mic"), *sink = find_stage(&g, "sink");
+  pipe_mock *m = (pipe_mock*) mic->state;
+  check_sink *c = (check_sink*) sink->state;
+  pipe_edge *first = mic->outputs[0];
+  bool blocking = !strcmp(policy, "block");
+
+  uint64_t dropped_frames = 0, waits = 0;
+  int64_t waited_ns = 0;
+  bool exact = true, bounded = true;
+  for (size_t i = 0; i < g.edges.size(); i++) {
+    pipe_edge *e = g.edges[i];
+    if (e->offered_frames != e->popped_frames + e->dropped_frames || e->count) exact = false;
+    if (e->max_depth > e->ring.size()) bounded = false;
+    dropped_frames += e->dropped_frames;
+  }
+  waits = first->waits;
+  waited_ns = first->wait_ns;
+
+  if (blocking) {
+    expect(waits > 0, name, "a blocking queue behind a slow sink never made capture wait");
+  } else {
+    expect(waits == 0, name, "capture waited for a queue");
+    expect(m->mock.overruns == 0, name, "the device overran: capture was not read on time");
+    expect(dropped_frames > 0, name, "nothing dropped: the sink was not slow enough to test anything");
+  }
+  expect(bounded, name, "a queue went past its capacity");
+  expect(g.blocks.exhausted.load() == 0, name, "the block pool ran out");
+  expect(rss_late - rss_early < 1024, name, "resident memory grew during the run");
+  expect(exact, name, "offered != delivered + dropped on a queue");
+  expect(m->mock.frames == first->offered_frames, name, "source frames missing from the first queue");
+  expect(c->frames == sink->input->popped_frames, name, "the sink did not see what was delivered to it");
+  expect(c->in_order, name, "blocks arrived out of order");
+  uint64_t last = m->mock.frames / frames - 1;
+  if (!strcmp(policy, "drop-oldest") && !chained)
+    expect(c->last_seq == last, name, "drop-oldest did not deliver the newest block last");
+  if (!strcmp(policy, "drop-newest") && !chained)
+    expect(c->lead > (uint64_t) queue, name, "drop-newest did not keep the first blocks");
+  if (!strcmp(policy, "decimate"))
+    expect(c->max_gap <= 12, name, "decimate skipped long runs of blocks");
+  if (blocking)
+    expect(dropped_frames == 0 && c->frames == m->mock.frames, name, "block lost audio");
+
+  printf("%-20s %6.2f s wall, capture waited %8.1f ms, %lu overruns; sink got %5lu blocks, longest gap %3lu; "
+         "dropped %7lu frames = %7.3f s; max depth %lu/%lu; rss %+ld KiB\n",
+         name, wall, waited_ns / 1e6, (unsigned long) m->mock.overruns, (unsigned long) c->blocks,
+         (unsigned long) c->max_gap, (unsigned long) dropped_frames, (double) dropped_frames / rate,
+         (unsigned long) first->max_depth, (unsigned long) first->ring.size(), rss_late - rss_early);
+  delete c;
+  pipe_graph_close(&g, quiet);
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  --seconds=S      audio per run (30)\n"
+          "  --speed=X        device pace, times real time (8)\n"
+          "  --overload=X     sink time per block over the device's (4)\n"
+          "  --queue=N        capacity of the policed queue (8)\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = 30, speed = 8, overload = 4;
+  int queue = 8;
+  enum { SECONDS = 256, SPEED, OVERLOAD, QUEUE };
+  static const struct option long_options[] = {
+    {"seconds", 1, NULL, SECONDS}, {"speed", 1, NULL, SPEED}, {"overload", 1, NULL, OVERLOAD},
+    {"queue", 1, NULL, QUEUE}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case SECONDS: seconds = atof(optarg); break;
+      case SPEED: speed = atof(optarg); break;
+      case OVERLOAD: overload = atof(optarg); break;
+      case QUEUE: queue = atoi(optarg); break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (seconds <= 0 || speed <= 0 || overload <= 1 || queue < 2) {
+    help(argv[0]);
+    return 1;
+  }
+
+  quiet = fopen("/dev/null", "w");
+  static const char *policies[] = { "drop-oldest", "drop-newest", "decimate", "block" };
+  for (int p = 0; p < 4; p++)
+    for (int chained = 0; chained < 2; chained++)
+      run_case(policies[p], chained, seconds, speed, overload, queue);
+  if (failures) {
+    fprintf(stderr, "%d failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
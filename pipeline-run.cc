@@ -0,0 +1,231 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#ifndef PIPELINE_NO_PULSE
+#include <pulse/error.h>
+#include <pulse/simple.h>
+#endif
+
+#include "pipeline.h"
+#include "pipeline-stages.h"
+
+// Runs a capture pipeline described by stage lines (pipeline.h), from a
+// config file or the command line, e.g. capture on one thread, metering
+// and resampling on the pool, and the file written on another core:
+//
+//   # record.pipeline
+//   mic: pulse rate=48000 channels=2 cpu=0
+//   loudness ms=1000 run=pool
+//   resample rate=16000 run=pool
+//   wav path=out-16k.wav cpu=1
+//   raw: wav path=out-48k.wav from=mic format=f32
+//
+//   ./pipeline-run --config=record.pipeline --stats=1000
+//
+// Ctrl-C stops the sources; what is queued is still processed and
+// written. --list shows the stage types and their arguments. Stage
+// statistics go to stderr every --stats milliseconds and at the end;
+// with --json, so do per-queue JSON lines (policy, depth, and the exact
+// blocks, frames and seconds dropped) to a file, for monitoring. A live
+// source should feed only queues that drop (policy=drop-oldest, ...):
+// with the default policy=block a slow sink stalls capture.
+//
+// g++ -O2 pipeline-run.cc -o pipeline-run -lm -std=c++11 -lpthread -lpulse -lpulse-simple
+// Without PulseAudio (the mock and replay sources only):
+// g++ -O2 -DPIPELINE_NO_PULSE pipeline-run.cc -o pipeline-run -lm -std=c++11 -lpthread
+
+#ifndef PIPELINE_NO_PULSE
+/* pulse: the default source (or device=), through the simple API. */
+struct pipe_pulse {
+  pa_simple *s;
+  uint32_t frames, rate;
+};
+
+static void *pipe_pulse_open(pipe_stage *s, std::string *err) {
+  pa_sample_spec ss;
+  ss.format = PA_SAMPLE_FLOAT32LE;
+  ss.rate = (uint32_t) pipe_arg_number(s, "rate", 48000);
+  ss.channels = (uint8_t) pipe_arg_number(s, "channels", 2);
+  pipe_pulse *p = new pipe_pulse;
+  p->rate = ss.rate;
+  p->frames = (uint32_t) pipe_arg_number(s, "frames", ss.rate / 100);
+  if (!p->frames) p->frames = 1;
+  pa_buffer_attr attr;
+  memset(&attr, 0xff, sizeof(attr));
+  attr.fragsize = p->frames * ss.channels * sizeof(float);
+  int error;
+  p->s = pa_simple_new(NULL, "pipeline-run", PA_STREAM_RECORD, pipe_arg(s, "device", NULL), s->name.c_str(), &ss,
+                       NULL, &attr, &error);
+  if (!p->s) {
+    *err = std::string("pa_simple_new() failed: ") + pa_strerror(error);
+    delete p;
+    return NULL;
+  }
+  s->out.rate = ss.rate;
+  s->out.channels = ss.channels;
+  s->out.max_frames = p->frames;
+  return p;
+}
+
+static bool pipe_pulse_read(void *state, pipe_block *b) {
+  pipe_pulse *p = (pipe_pulse*) state;
+  int error;
+  if (pa_simple_read(p->s, b->data, (size_t) p->frames * b->channels * sizeof(float), &error) < 0) {
+    fprintf(stderr, "pa_simple_read() failed: %s\n", pa_strerror(error));
+    return false;
+  }
+  b->frames = p->frames;
+  /* The first frame was captured a block before the read returned. */
+  b->capture_ns = pipe_now_ns() - (int64_t) p->frames * 1000000000 / p->rate;
+  return true;
+}
+
+static void pipe_pulse_close(void *state, FILE *) {
+  pipe_pulse *p = (pipe_pulse*) state;
+  pa_simple_free(p->s);
+  delete p;
+}
+
+static const pipe_stage_type pipe_pulse_type = {
+  "pulse", PIPE_SOURCE, "PulseAudio record stream: rate channels frames device",
+  pipe_pulse_open, pipe_pulse_read, NULL, NULL, pipe_pulse_close
+};
+#endif
+
+static const pipe_stage_type *const types[] = {
+#ifndef PIPELINE_NO_PULSE
+  &pipe_pulse_type,
+#endif
+  PIPE_STOCK_STAGES, NULL
+};
+
+static volatile sig_atomic_t running = 1;
+
+/* Signals handling */
+static void handle_sigterm(int) { running = 0; }
+
+static void init_signal() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static bool read_config(const char *path, std::vector<std::string> *lines) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    lines->push_back(line);
+  }
+  fclose(f);
+  return true;
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options] STAGE...\n"
+          "  STAGE            [NAME:] TYPE [key=value ...] [from=NAME] [queue=N]\n"
+          "                   [policy=block|drop-oldest|drop-newest|decimate] [decimate=N] [run=thread|pool] [cpu=N]\n"
+          "  --config=FILE    stage lines from a file ('#' starts a comment), before any given here\n"
+          "  --pool=N         threads for run=pool stages (2)\n"
+          "  --stats=MS       print stage statistics this often (only at the end)\n"
+          "  --json=FILE      and append per-queue JSON lines to FILE\n"
+          "  --list           the stage types\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> lines;
+  int pool_threads = 2, stats_ms = 0;
+  FILE *json = NULL;
+
+  enum { CONFIG = 256, POOL, STATS, JSON, LIST };
+  static const struct option long_options[] = {
+    {"config", 1, NULL, CONFIG}, {"pool", 1, NULL, POOL}, {"stats", 1, NULL, STATS},
+    {"json", 1, NULL, JSON}, {"list", 0, NULL, LIST}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case CONFIG:
+        if (!read_config(optarg, &lines)) return 1;
+        break;
+      case POOL: pool_threads = atoi(optarg); break;
+      case STATS: stats_ms = atoi(optarg); break;
+      case JSON:
+        if (!(json = fopen(optarg, "a"))) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case LIST:
+        pipe_print_types(types, stdout);
+        return 0;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  for (int i = optind; i < argc; i++)
+    lines.push_back(argv[i]);
+
+  static pipe_graph graph;
+  pipe_graph_init(&graph, types, pool_threads);
+  std::string err;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (!pipe_graph_add(&graph, lines[i], &err)) {
+      fprintf(stderr, "%s\n", err.c_str());
+      return 1;
+    }
+  }
+  if (graph.stages.empty()) {
+    help(argv[0]);
+    return 1;
+  }
+  if (!pipe_graph_open(&graph, &err)) {
+    fprintf(stderr, "%s\n", err.c_str());
+    pipe_graph_close(&graph, stderr);
+    return 1;
+  }
+
+  init_signal();
+  pipe_graph_start(&graph);
+  /* Poll for Ctrl-C and the end of the sources; print as asked. */
+  int64_t next_stats = pipe_now_ns() + (int64_t) stats_ms * 1000000;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> hold(graph.done_lock);
+      if (!graph.unfinished) break;
+    }
+    if (!running)
+      pipe_graph_stop(&graph);
+    if (stats_ms > 0 && pipe_now_ns() >= next_stats) {
+      pipe_graph_print_stats(&graph, stderr);
+      if (json) pipe_graph_print_json(&graph, json);
+      next_stats += (int64_t) stats_ms * 1000000;
+    }
+    struct timespec ts = { 0, 20000000 };
+    nanosleep(&ts, NULL);
+  }
+  pipe_graph_wait(&graph);
+  pipe_graph_print_stats(&graph, stderr);
+  if (json) {
+    pipe_graph_print_json(&graph, json);
+    fclose(json);
+  }
+  pipe_graph_close(&graph, stderr);
+  return 0;
+}
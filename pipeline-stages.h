@@ -0,0 +1,613 @@
+/*
+  The stock stages for pipeline.h, built from the headers the examples
+  already use. A program lists them with its own:
+
+    static const pipe_stage_type *const types[] = { PIPE_STOCK_STAGES, &my_stage, NULL };
+
+    source     mock       mock-capture.h device: rate channels frames seconds
+                          sine amp noise impulse jitter xrun speed seed
+    source     replay     a capture log (capture-log.h): path speed frames
+    transform  gain       db
+    transform  biquad     biquad-bank.h: dc hp q order split, band=full|low|high
+    transform  level      level-meter.h, printed per window: ms
+    transform  loudness   loudness-meter.h, printed every ms, integrated at the end
+    transform  resample   resample.h: rate
+    transform  beam       beamformer.h: radius beams, a channel per beam; the loudest every ms
+    transform  work       burns us microseconds of CPU per block (a stand-in DSP load)
+    sink       wav        path, format=s16|f32
+    sink       caplog     path: a capture log, for replay
+    sink       stdout     raw PCM, format=s16|f32
+    sink       null       discards, after sleep_us per block (a stand-in slow sink)
+
+  Stages that print do so to stderr, prefixed with their name. C++11.
+*/
+#ifndef PIPELINE_STAGES_H_
+#define PIPELINE_STAGES_H_
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "beamformer.h"
+#include "biquad-bank.h"
+#include "capture-log.h"
+#include "level-meter.h"
+#include "loudness-meter.h"
+#include "mock-capture.h"
+#include "pipeline.h"
+#include "resample.h"
+
+/* mock */
+struct pipe_mock {
+  mock_capture mock;
+  uint32_t frames;
+  uint64_t limit;   /* frames, 0 for no end */
+};
+
+static void *pipe_mock_open(pipe_stage *s, std::string *err) {
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, (uint32_t) pipe_arg_number(s, "rate", 48000),
+                              (uint32_t) pipe_arg_number(s, "channels", 2), MOCK_F32);
+  cfg.sine_hz = (float) pipe_arg_number(s, "sine", cfg.sine_hz);
+  cfg.sine_amp = (float) pipe_arg_number(s, "amp", cfg.sine_amp);
+  cfg.noise_amp = (float) pipe_arg_number(s, "noise", cfg.noise_amp);
+  cfg.impulse_sec = pipe_arg_number(s, "impulse", cfg.impulse_sec);
+  cfg.jitter_ms = pipe_arg_number(s, "jitter", cfg.jitter_ms);
+  cfg.xrun_probability = pipe_arg_number(s, "xrun", cfg.xrun_probability);
+  cfg.speed = pipe_arg_number(s, "speed", cfg.speed);
+  cfg.seed = (uint64_t) pipe_arg_number(s, "seed", (double) cfg.seed);
+  if (!cfg.rate || !cfg.channels) {
+    *err = "rate and channels must not be 0";
+    return NULL;
+  }
+  pipe_mock *m = new pipe_mock;
+  m->frames = (uint32_t) pipe_arg_number(s, "frames", cfg.rate / 100);
+  m->limit = (uint64_t) (pipe_arg_number(s, "seconds", 0) * cfg.rate);
+  if (!m->frames) m->frames = 1;
+  mock_capture_open(&m->mock, &cfg);
+  s->out.rate = cfg.rate;
+  s->out.channels = cfg.channels;
+  s->out.max_frames = m->frames;
+  return m;
+}
+
+static bool pipe_mock_read(void *state, pipe_block *b) {
+  pipe_mock *m = (pipe_mock*) state;
+  if (m->limit && m->mock.position >= m->limit)
+    return false;
+  long n = mock_capture_read(&m->mock, b->data, m->frames, &b->capture_ns);
+  b->frames = n > 0 ? (uint32_t) n : 0;  /* an xrun: nothing this time */
+  return true;
+}
+
+static void pipe_mock_close(void *state, FILE *report) {
+  pipe_mock *m = (pipe_mock*) state;
+  mock_capture_print_stats(&m->mock, report);
+  delete m;
+}
+
+static const pipe_stage_type pipe_mock_type = {
+  "mock", PIPE_SOURCE, "mock device: rate channels frames seconds sine amp noise impulse jitter xrun speed seed",
+  pipe_mock_open, pipe_mock_read, NULL, NULL, pipe_mock_close
+};
+
+/* replay */
+struct pipe_replay {
+  capture_replay replay;
+  uint32_t frames;
+  std::vector<uint8_t> raw;
+};
+
+static void *pipe_replay_open(pipe_stage *s, std::string *err) {
+  const char *path = pipe_arg(s, "path", NULL);
+  if (!path) {
+    *err = "path= is required";
+    return NULL;
+  }
+  pipe_replay *r = new pipe_replay;
+  if (capture_replay_open(&r->replay, path, capture_replay_parse_speed(pipe_arg(s, "speed", "realtime"))) < 0) {
+    *err = std::string(path) + ": " + strerror(errno);
+    delete r;
+    return NULL;
+  }
+  const capture_log_header &h = r->replay.header;
+  r->frames = (uint32_t) pipe_arg_number(s, "frames", h.rate / 100);
+  if (!r->frames) r->frames = 1;
+  r->raw.resize((size_t) r->frames * h.frame_bytes);
+  s->out.rate = h.rate;
+  s->out.channels = h.channels;
+  s->out.max_frames = r->frames;
+  return r;
+}
+
+static bool pipe_replay_read(void *state, pipe_block *b) {
+  pipe_replay *r = (pipe_replay*) state;
+  long n = capture_replay_read(&r->replay, r->raw.data(), r->frames, &b->capture_ns);
+  if (n == 0)
+    return false;
+  b->frames = n > 0 ? (uint32_t) n : 0;
+  size_t samples = (size_t) b->frames * r->replay.header.channels;
+  switch (r->replay.header.format) {
+    case CAPTURE_LOG_S16LE:
+      for (size_t i = 0; i < samples; i++) b->data[i] = ((const int16_t*) r->raw.data())[i] * (1.0f / 32768);
+      break;
+    case CAPTURE_LOG_S32LE:
+      for (size_t i = 0; i < samples; i++) b->data[i] = ((const int32_t*) r->raw.data())[i] * (1.0f / 2147483648.0f);
+      break;
+    default:
+      memcpy(b->data, r->raw.data(), samples * sizeof(float));
+  }
+  return true;
+}
+
+static void pipe_replay_close(void *state, FILE *report) {
+  pipe_replay *r = (pipe_replay*) state;
+  capture_replay_print_stats(&r->replay, report);
+  capture_replay_close(&r->replay);
+  delete r;
+}
+
+static const pipe_stage_type pipe_replay_type = {
+  "replay", PIPE_SOURCE, "capture log: path speed=realtime|asap|N frames",
+  pipe_replay_open, pipe_replay_read, NULL, NULL, pipe_replay_close
+};
+
+/* gain */
+static void *pipe_gain_open(pipe_stage *s, std::string *) {
+  float *gain = new float;
+  *gain = (float) pow(10.0, pipe_arg_number(s, "db", 0) / 20);
+  return gain;
+}
+
+static pipe_block *pipe_gain_process(void *state, pipe_stage *s, pipe_block *in) {
+  /* The input may be shared with other readers: write a new block. */
+  pipe_block *out = pipe_block_new(s->graph, &s->out);
+  if (!out)
+    return NULL;
+  float g = *(float*) state;
+  size_t n = (size_t) in->frames * in->channels;
+  for (size_t i = 0; i < n; i++)
+    out->data[i] = in->data[i] * g;
+  out->frames = in->frames;
+  out->seq = in->seq;
+  out->capture_ns = in->capture_ns;
+  return out;
+}
+
+static void pipe_gain_close(void *state, FILE *) {
+  delete (float*) state;
+}
+
+static const pipe_stage_type pipe_gain_type = {
+  "gain", PIPE_TRANSFORM, "db", pipe_gain_open, NULL, pipe_gain_process, NULL, pipe_gain_close
+};
+
+/* biquad */
+struct pipe_biquad {
+  biquad_bank bank;
+  biquad_band band;
+};
+
+static void *pipe_biquad_open(pipe_stage *s, std::string *err) {
+  static const char *const keys[] = { "dc", "hp", "q", "order", "split" };
+  std::string spec;
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    const char *v = pipe_arg(s, keys[i], NULL);
+    if (v) spec += std::string(spec.empty() ? "" : ",") + keys[i] + "=" + v;
+  }
+  std::string band = pipe_arg(s, "band", "full");
+  pipe_biquad *q = new pipe_biquad;
+  q->band = band == "low" ? BIQUAD_LOW : band == "high" ? BIQUAD_HIGH : BIQUAD_FULL;
+  if (!biquad_bank_init(&q->bank, s->in.channels, 1, s->in.max_frames)) {
+    *err = "cannot filter this format";
+    delete q;
+    return NULL;
+  }
+  if (!biquad_bank_configure(&q->bank, s->in.rate, spec.c_str()) ||
+      (band != "full" && band != "low" && band != "high") || (q->band != BIQUAD_FULL && !q->bank.split)) {
+    *err = "bad filter: " + spec + " band=" + band;
+    biquad_bank_free(&q->bank);
+    delete q;
+    return NULL;
+  }
+  return q;
+}
+
+static pipe_block *pipe_biquad_process(void *state, pipe_stage *s, pipe_block *in) {
+  pipe_biquad *q = (pipe_biquad*) state;
+  pipe_block *out = pipe_block_new(s->graph, &s->out);
+  if (!out)
+    return NULL;
+  biquad_bank_input_f32(&q->bank, 0, in->data, in->frames);
+  biquad_bank_process(&q->bank, in->frames);
+  biquad_bank_output_f32(&q->bank, 0, out->data, in->frames, q->band);
+  out->frames = in->frames;
+  out->seq = in->seq;
+  out->capture_ns = in->capture_ns;
+  return out;
+}
+
+static void pipe_biquad_close(void *state, FILE *) {
+  pipe_biquad *q = (pipe_biquad*) state;
+  biquad_bank_free(&q->bank);
+  delete q;
+}
+
+static const pipe_stage_type pipe_biquad_type = {
+  "biquad", PIPE_TRANSFORM, "biquad-bank.h: dc hp q order=2|4 split band=full|low|high", pipe_biquad_open, NULL,
+  pipe_biquad_process, NULL, pipe_biquad_close
+};
+
+/* level */
+struct pipe_level {
+  std::string name;
+  level_meter meter;
+  uint64_t shown;
+};
+
+static void *pipe_level_open(pipe_stage *s, std::string *err) {
+  pipe_level *l = new pipe_level;
+  l->name = s->name;
+  l->shown = 0;
+  if (!level_meter_init(&l->meter, s->in.rate, s->in.channels, (uint32_t) pipe_arg_number(s, "ms", 1000))) {
+    *err = "too many channels to meter";
+    delete l;
+    return NULL;
+  }
+  return l;
+}
+
+static pipe_block *pipe_level_process(void *state, pipe_stage *, pipe_block *in) {
+  pipe_level *l = (pipe_level*) state;
+  level_meter_process_f32(&l->meter, in->data, in->frames, in->capture_ns);
+  level_snapshot snap;
+  if (level_meter_read(&l->meter, &snap) && snap.window + 1 > l->shown) {
+    l->shown = snap.window + 1;
+    fprintf(stderr, "%s: ", l->name.c_str());
+    level_snapshot_print(&snap, stderr);
+  }
+  return in;
+}
+
+static void pipe_level_close(void *state, FILE *) {
+  delete (pipe_level*) state;
+}
+
+static const pipe_stage_type pipe_level_type = {
+  "level", PIPE_TRANSFORM, "peak/rms/dc/clips per window: ms", pipe_level_open, NULL, pipe_level_process, NULL,
+  pipe_level_close
+};
+
+/* loudness */
+struct pipe_loudness {
+  std::string name;
+  loudness_bank bank;
+  uint64_t every, next;   /* frames */
+  uint64_t frames;
+};
+
+static void *pipe_loudness_open(pipe_stage *s, std::string *err) {
+  pipe_loudness *l = new pipe_loudness;
+  l->name = s->name;
+  if (!loudness_bank_init(&l->bank, s->in.rate, s->in.channels, 1, s->in.max_frames)) {
+    *err = "cannot meter this format";
+    delete l;
+    return NULL;
+  }
+  l->every = (uint64_t) (pipe_arg_number(s, "ms", 1000) * s->in.rate / 1000);
+  l->next = l->every;
+  l->frames = 0;
+  return l;
+}
+
+static pipe_block *pipe_loudness_process(void *state, pipe_stage *, pipe_block *in) {
+  pipe_loudness *l = (pipe_loudness*) state;
+  loudness_process_f32(&l->bank, in->data, in->frames);
+  l->frames += in->frames;
+  if (l->every && l->frames >= l->next) {
+    l->next += l->every;
+    fprintf(stderr, "%s: ", l->name.c_str());
+    loudness_print(&l->bank.stream[0], stderr);
+  }
+  return in;
+}
+
+static void pipe_loudness_close(void *state, FILE *report) {
+  pipe_loudness *l = (pipe_loudness*) state;
+  fprintf(report, "%s: %.1f s, ", l->name.c_str(), (double) l->frames / l->bank.rate);
+  loudness_print(&l->bank.stream[0], report);
+  loudness_bank_free(&l->bank);
+  delete l;
+}
+
+static const pipe_stage_type pipe_loudness_type = {
+  "loudness", PIPE_TRANSFORM, "EBU R128 momentary/short-term/integrated: ms", pipe_loudness_open, NULL,
+  pipe_loudness_process, NULL, pipe_loudness_close
+};
+
+/* resample */
+static void *pipe_resample_open(pipe_stage *s, std::string *err) {
+  resampler *r = new resampler;
+  uint32_t rate = (uint32_t) pipe_arg_number(s, "rate", 16000);
+  if (!resampler_init(r, s->in.rate, rate, s->in.channels)) {
+    *err = "cannot resample between these rates";
+    delete r;
+    return NULL;
+  }
+  s->out.rate = rate;
+  /* What one input block can release, and what flush() can. */
+  s->out.max_frames = (uint32_t) (((uint64_t) s->in.max_frames + r->taps) * r->up / r->down + 2);
+  return r;
+}
+
+static pipe_block *pipe_resample_process(void *state, pipe_stage *s, pipe_block *in) {
+  resampler *r = (resampler*) state;
+  pipe_block *out = pipe_block_new(s->graph, &s->out);
+  if (!out)
+    return NULL;
+  out->frames = resampler_process(r, in->data, in->frames, out->data, s->out.max_frames);
+  out->seq = in->seq;
+  out->capture_ns = in->capture_ns;
+  return out;
+}
+
+static pipe_block *pipe_resample_flush(void *state, pipe_stage *s) {
+  resampler *r = (resampler*) state;
+  pipe_block *out = pipe_block_new(s->graph, &s->out);
+  if (out)
+    out->frames = resampler_flush(r, out->data, s->out.max_frames);
+  return out;
+}
+
+static void pipe_resample_close(void *state, FILE *) {
+  delete (resampler*) state;
+}
+
+static const pipe_stage_type pipe_resample_type = {
+  "resample", PIPE_TRANSFORM, "rate", pipe_resample_open, NULL, pipe_resample_process, pipe_resample_flush,
+  pipe_resample_close
+};
+
+/* beam */
+struct pipe_beam {
+  std::string name;
+  beam_former bf;
+  uint64_t every, frames;   /* frames between loudest-beam lines, since the last */
+};
+
+static void *pipe_beam_open(pipe_stage *s, std::string *err) {
+  pipe_beam *b = new pipe_beam;
+  b->name = s->name;
+  if (!beam_former_init(&b->bf, s->in.rate, s->in.channels, s->in.max_frames)) {
+    *err = "cannot beamform this format";
+    delete b;
+    return NULL;
+  }
+  beam_circular_array(&b->bf, pipe_arg_number(s, "radius", 0.0425));
+  if (!beam_former_steer(&b->bf, (uint32_t) pipe_arg_number(s, "beams", 8)) || !b->bf.beams) {
+    *err = "too many beams, or the array is too wide";
+    beam_former_free(&b->bf);
+    delete b;
+    return NULL;
+  }
+  s->out.channels = b->bf.beams;
+  b->every = (uint64_t) (pipe_arg_number(s, "ms", 0) * s->in.rate / 1000);
+  b->frames = 0;
+  return b;
+}
+
+static pipe_block *pipe_beam_process(void *state, pipe_stage *s, pipe_block *in) {
+  pipe_beam *b = (pipe_beam*) state;
+  pipe_block *out = pipe_block_new(s->graph, &s->out);
+  if (!out)
+    return NULL;
+  beam_former_input_f32(&b->bf, in->data, in->frames);
+  beam_former_process(&b->bf, in->frames);
+  beam_former_output_f32(&b->bf, out->data, in->frames);
+  out->frames = in->frames;
+  out->seq = in->seq;
+  out->capture_ns = in->capture_ns;
+  b->frames += in->frames;
+  if (b->every && b->frames >= b->every) {
+    uint32_t i = beam_former_loudest(&b->bf, b->frames);
+    fprintf(stderr, "%s: loudest beam %u (%.0f degrees)\n", b->name.c_str(), i, b->bf.azimuth[i] * 180 / M_PI);
+    b->frames = 0;
+  }
+  return out;
+}
+
+static void pipe_beam_close(void *state, FILE *report) {
+  pipe_beam *b = (pipe_beam*) state;
+  beam_former_print(&b->bf, report);
+  beam_former_free(&b->bf);
+  delete b;
+}
+
+static const pipe_stage_type pipe_beam_type = {
+  "beam", PIPE_TRANSFORM, "beamformer.h, one channel per microphone: radius beams ms", pipe_beam_open, NULL,
+  pipe_beam_process, NULL, pipe_beam_close
+};
+
+/* work */
+static void *pipe_work_open(pipe_stage *s, std::string *) {
+  int64_t *ns = new int64_t;
+  *ns = (int64_t) (pipe_arg_number(s, "us", 100) * 1000);
+  return ns;
+}
+
+static pipe_block *pipe_work_process(void *state, pipe_stage *, pipe_block *in) {
+  int64_t until = pipe_now_ns() + *(int64_t*) state;
+  while (pipe_now_ns() < until) {}
+  return in;
+}
+
+static void pipe_work_close(void *state, FILE *) {
+  delete (int64_t*) state;
+}
+
+static const pipe_stage_type pipe_work_type = {
+  "work", PIPE_TRANSFORM, "busy for us microseconds per block", pipe_work_open, NULL, pipe_work_process, NULL,
+  pipe_work_close
+};
+
+/* wav and stdout */
+struct pipe_pcm_out {
+  std::string name, path;
+  FILE *file;
+  bool f32, wav;
+  uint32_t rate, channels;
+  uint64_t frames;
+  std::vector<int16_t> s16;
+};
+
+static void pipe_wav_header(pipe_pcm_out *o) {
+  uint32_t bits = o->f32 ? 32 : 16, align = o->channels * bits / 8;
+  uint32_t data = (uint32_t) (o->frames * align), v;
+  uint16_t h;
+  fwrite("RIFF", 1, 4, o->file);
+  v = 36 + data; fwrite(&v, 4, 1, o->file);
+  fwrite("WAVEfmt ", 1, 8, o->file);
+  v = 16; fwrite(&v, 4, 1, o->file);
+  h = o->f32 ? 3 : 1; fwrite(&h, 2, 1, o->file);
+  h = (uint16_t) o->channels; fwrite(&h, 2, 1, o->file);
+  fwrite(&o->rate, 4, 1, o->file);
+  v = o->rate * align; fwrite(&v, 4, 1, o->file);
+  h = (uint16_t) align; fwrite(&h, 2, 1, o->file);
+  h = (uint16_t) bits; fwrite(&h, 2, 1, o->file);
+  fwrite("data", 1, 4, o->file);
+  fwrite(&data, 4, 1, o->file);
+}
+
+static pipe_pcm_out *pipe_pcm_out_open(pipe_stage *s, bool wav, std::string *err) {
+  pipe_pcm_out *o = new pipe_pcm_out;
+  o->name = s->name;
+  o->wav = wav;
+  o->f32 = !strcmp(pipe_arg(s, "format", "s16"), "f32");
+  o->rate = s->in.rate;
+  o->channels = s->in.channels;
+  o->frames = 0;
+  o->s16.resize((size_t) s->in.max_frames * s->in.channels);
+  if (wav) {
+    o->path = pipe_arg(s, "path", "pipeline.wav");
+    o->file = fopen(o->path.c_str(), "wb");
+    if (!o->file) {
+      *err = o->path + ": " + strerror(errno);
+      delete o;
+      return NULL;
+    }
+    pipe_wav_header(o);
+  } else {
+    o->file = stdout;
+  }
+  return o;
+}
+
+static void *pipe_wav_open(pipe_stage *s, std::string *err) {
+  return pipe_pcm_out_open(s, true, err);
+}
+
+static void *pipe_stdout_open(pipe_stage *s, std::string *err) {
+  return pipe_pcm_out_open(s, false, err);
+}
+
+static pipe_block *pipe_pcm_out_process(void *state, pipe_stage *, pipe_block *in) {
+  pipe_pcm_out *o = (pipe_pcm_out*) state;
+  size_t n = (size_t) in->frames * in->channels;
+  if (o->f32) {
+    fwrite(in->data, sizeof(float), n, o->file);
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      float v = in->data[i] * 32768.0f;
+      o->s16[i] = (int16_t) (v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v);
+    }
+    fwrite(o->s16.data(), sizeof(int16_t), n, o->file);
+  }
+  o->frames += in->frames;
+  return NULL;
+}
+
+static void pipe_pcm_out_close(void *state, FILE *report) {
+  pipe_pcm_out *o = (pipe_pcm_out*) state;
+  if (o->wav) {
+    rewind(o->file);
+    pipe_wav_header(o);
+    fclose(o->file);
+    fprintf(report, "%s: %lu frames to %s\n", o->name.c_str(), (unsigned long) o->frames, o->path.c_str());
+  } else {
+    fflush(o->file);
+  }
+  delete o;
+}
+
+static const pipe_stage_type pipe_wav_type = {
+  "wav", PIPE_SINK, "WAV file: path format=s16|f32", pipe_wav_open, NULL, pipe_pcm_out_process, NULL,
+  pipe_pcm_out_close
+};
+
+static const pipe_stage_type pipe_stdout_type = {
+  "stdout", PIPE_SINK, "raw PCM: format=s16|f32", pipe_stdout_open, NULL, pipe_pcm_out_process, NULL,
+  pipe_pcm_out_close
+};
+
+/* caplog */
+static void *pipe_caplog_open(pipe_stage *s, std::string *err) {
+  const char *path = pipe_arg(s, "path", NULL);
+  capture_log *log = new capture_log;
+  if (!path || capture_log_open(log, path, CAPTURE_LOG_F32LE, s->in.rate, s->in.channels, "pipeline") < 0) {
+    *err = path ? std::string(path) + ": " + strerror(errno) : "path= is required";
+    delete log;
+    return NULL;
+  }
+  return log;
+}
+
+static pipe_block *pipe_caplog_process(void *state, pipe_stage *, pipe_block *in) {
+  int64_t now = capture_log_monotonic_ns();
+  capture_log_block((capture_log*) state, in->data, in->frames, now, now, in->capture_ns);
+  return NULL;
+}
+
+static void pipe_caplog_close(void *state, FILE *) {
+  capture_log_close((capture_log*) state);
+  delete (capture_log*) state;
+}
+
+static const pipe_stage_type pipe_caplog_type = {
+  "caplog", PIPE_SINK, "capture log for replay: path", pipe_caplog_open, NULL, pipe_caplog_process, NULL,
+  pipe_caplog_close
+};
+
+/* null */
+static void *pipe_null_open(pipe_stage *s, std::string *) {
+  int64_t *ns = new int64_t;
+  *ns = (int64_t) (pipe_arg_number(s, "sleep_us", 0) * 1000);
+  return ns;
+}
+
+static pipe_block *pipe_null_process(void *state, pipe_stage *, pipe_block *) {
+  int64_t ns = *(int64_t*) state;
+  if (ns > 0) {
+    struct timespec ts = { (time_t) (ns / 1000000000), (long) (ns % 1000000000) };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+  }
+  return NULL;
+}
+
+static void pipe_null_close(void *state, FILE *) {
+  delete (int64_t*) state;
+}
+
+static const pipe_stage_type pipe_null_type = {
+  "null", PIPE_SINK, "discard: sleep_us per block", pipe_null_open, NULL, pipe_null_process, NULL, pipe_null_close
+};
+
+#define PIPE_STOCK_STAGES &pipe_mock_type, &pipe_replay_type, &pipe_gain_type, &pipe_biquad_type, \
+    &pipe_level_type, &pipe_loudness_type, &pipe_resample_type, &pipe_beam_type, \
+    &pipe_work_type, &pipe_wav_type, &pipe_caplog_type, &pipe_stdout_type, &pipe_null_type
+
+#endif  // PIPELINE_STAGES_H_
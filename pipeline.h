@@ -0,0 +1,759 @@
+/*
+  A capture pipeline as a graph of stages: sources (a device, a mock, a
+  replayed log), transforms (metering, resampling...) and sinks (files,
+  stdout), composed at run time from a config file or the command line
+  instead of being hardwired into one main loop. Stages are connected by
+  bounded queues, and every stage runs either on its own thread (pinned
+  to a CPU if asked) or on a shared work-stealing pool (work-pool.h), so
+  capture, DSP and I/O overlap across cores instead of adding up.
+
+  One stage per line (or per command line argument):
+
+    [NAME:] TYPE [key=value ...] [from=NAME] [queue=N] [policy=P] [run=thread|pool] [cpu=N]
+
+    mic:   mock rate=48000 channels=2 frames=480
+    meter: level ms=1000
+    rs:    resample rate=16000 run=pool
+    out:   wav path=out.wav from=rs cpu=3
+
+  A stage reads from the stage on the line before unless from= names
+  another; several stages may read from one (each gets every block).
+  queue= bounds the stage's input queue in blocks, and policy= says what
+  happens when it is full:
+
+    block        the producer waits (the default: nothing is lost, but a
+                 slow stage holds up everything before it, capture too)
+    drop-oldest  the oldest queued block makes room (the freshest audio
+                 goes through: meters, monitoring)
+    drop-newest  the arriving block is dropped (what is queued stays
+                 contiguous)
+    decimate     from half full on, only one block in decimate=N (2) is
+                 queued, and it displaces the oldest if it must: a
+                 thinned but evenly spread stream (level and spectrum
+                 displays)
+
+  Only block ever waits, so a source whose every path downstream drops
+  never stalls, and memory stays what the queues and the block pool were
+  given at open. Drops are counted per queue in blocks, frames and
+  seconds of audio (frames / rate, exact) and exported with
+  pipe_graph_print_json(). Blocks are float,
+  interleaved, and come from one pool allocated before anything runs
+  (block-pool.h); fan-out shares a block by reference count.
+
+  A stage type is a pipe_stage_type: open() reads its arguments and sets
+  its output format from its input, then a source's read() fills a block
+  (blocking like a device), a transform's process() returns the block to
+  pass on (the same one, a new one from pipe_block_new(), or none), and a
+  sink's process() returns NULL. close() gets a FILE to report to.
+
+    pipe_graph g;
+    pipe_graph_init(&g, types, pool_threads);  // types: NULL-terminated
+    pipe_graph_add(&g, "mic: mock rate=48000", &err);  // per stage
+    pipe_graph_open(&g, &err);
+    pipe_graph_start(&g);
+    ... pipe_graph_print_stats(&g, stderr) while running ...
+    ... pipe_graph_print_json(&g, file) for monitoring ...
+    pipe_graph_stop(&g);   // sources stop, queues drain, sinks finish
+    pipe_graph_wait(&g);
+    pipe_graph_close(&g, stderr);
+
+  Per stage: blocks in and out, service time (mean, max), the input
+  queue's depth (now, max, mean at each push), its policy and drops, and
+  how long the stage waited for room in the queues after it. A pooled stage never waits: it
+  leaves its input queued until every output has room, and a consumer
+  taking from a full queue puts its producer back on the pool.
+
+  Linux only, C++11.
+*/
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "block-pool.h"
+#include "work-pool.h"
+
+#define PIPE_DEFAULT_QUEUE 8
+#define PIPE_POOL_BATCH 16   /* blocks a pooled stage takes per turn */
+
+enum pipe_kind { PIPE_SOURCE, PIPE_TRANSFORM, PIPE_SINK };
+
+enum pipe_policy { PIPE_BLOCK, PIPE_DROP_OLDEST, PIPE_DROP_NEWEST, PIPE_DECIMATE };
+static const char *const pipe_policy_names[] = { "block", "drop-oldest", "drop-newest", "decimate" };
+
+struct pipe_format {
+  uint32_t rate;
+  uint32_t channels;
+  uint32_t max_frames;   /* per block */
+};
+
+struct pipe_graph;
+
+struct pipe_block {
+  std::atomic<int> refs;
+  uint32_t frames, channels, rate;
+  uint64_t seq;          /* per source */
+  int64_t capture_ns;
+  pipe_graph *graph;
+  float *data;
+};
+
+struct pipe_stage;
+
+struct pipe_stage_type {
+  const char *name;
+  pipe_kind kind;
+  const char *help;
+  /* Returns the stage's state, or NULL with *err set. */
+  void *(*open)(pipe_stage *s, std::string *err);
+  /* Sources: fill b->data with up to out.max_frames frames, set frames
+     and capture_ns; return false at the end of the stream. */
+  bool (*read)(void *state, pipe_block *b);
+  /* Transforms and sinks. */
+  pipe_block *(*process)(void *state, pipe_stage *s, pipe_block *in);
+  /* Input ended: a transform may pass on one last block. Optional. */
+  pipe_block *(*flush)(void *state, pipe_stage *s);
+  void (*close)(void *state, FILE *report);
+};
+
+struct pipe_edge {
+  pipe_stage *from, *to;
+  std::mutex lock;
+  std::condition_variable not_empty, not_full;
+  std::vector<pipe_block*> ring;
+  size_t head, count;
+  bool closed;
+  int policy;
+  uint32_t decimate, decimate_phase;
+  /* Stats, under lock. Offered = pushed + dropped arriving blocks;
+     dropped also counts queued blocks pushed out. */
+  uint64_t offered, pushed, popped, max_depth, depth_sum, waits;
+  uint64_t offered_frames, popped_frames, dropped, dropped_frames;
+  int64_t wait_ns;
+};
+
+/* A pooled stage's turn on the pool. */
+struct pipe_turn {
+  work_item item;
+  pipe_stage *stage;
+};
+
+struct pipe_stage {
+  std::string name;
+  std::string type_name;
+  std::vector<std::pair<std::string, std::string> > args;
+  std::string from;
+  uint32_t queue;
+  int policy;             /* of the input queue */
+  uint32_t decimate;
+  bool pooled;
+  int cpu;                /* -1: any */
+
+  const pipe_stage_type *type;
+  void *state;
+  pipe_graph *graph;
+  pipe_format in, out;
+  pipe_edge *input;
+  std::vector<pipe_edge*> outputs;
+
+  std::thread thread;
+  pipe_turn turn;         /* pooled */
+  std::atomic<bool> scheduled;
+  std::atomic<bool> finished;
+
+  std::atomic<uint64_t> blocks_in, blocks_out, service_ns, service_max_ns, dropped_no_block;
+};
+
+struct pipe_graph {
+  const pipe_stage_type *const *types;   /* NULL-terminated */
+  std::vector<pipe_stage*> stages;
+  std::vector<pipe_edge*> edges;
+  block_pool blocks;
+  uint32_t block_count;
+  int pool_threads;
+  bool pool_used;
+  work_pool pool;
+  std::atomic<bool> running;
+  std::mutex done_lock;
+  std::condition_variable done;
+  int unfinished;
+  int64_t start_ns;
+};
+
+static inline int64_t pipe_now_ns() {
+  return work_pool_now_ns();
+}
+
+/* Arguments. */
+static inline const char *pipe_arg(const pipe_stage *s, const char *key, const char *def) {
+  for (size_t i = 0; i < s->args.size(); i++)
+    if (s->args[i].first == key)
+      return s->args[i].second.c_str();
+  return def;
+}
+
+static inline double pipe_arg_number(const pipe_stage *s, const char *key, double def) {
+  const char *v = pipe_arg(s, key, NULL);
+  return v ? atof(v) : def;
+}
+
+/* Blocks. */
+static inline pipe_block *pipe_block_new(pipe_graph *g, const pipe_format *f) {
+  uint8_t *m = block_pool_get(&g->blocks);
+  if (!m)
+    return NULL;
+  pipe_block *b = (pipe_block*) m;
+  b->refs.store(1, std::memory_order_relaxed);
+  b->frames = 0;
+  b->channels = f->channels;
+  b->rate = f->rate;
+  b->seq = 0;
+  b->capture_ns = 0;
+  b->graph = g;
+  b->data = (float*) (m + ((sizeof(pipe_block) + BLOCK_POOL_ALIGN - 1) & ~(size_t) (BLOCK_POOL_ALIGN - 1)));
+  return b;
+}
+
+static inline void pipe_block_ref(pipe_block *b) {
+  b->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void pipe_block_release(pipe_block *b) {
+  if (b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    block_pool_put(&b->graph->blocks, (uint8_t*) b);
+}
+
+/* Edges. */
+static inline void pipe_schedule(pipe_stage *s);
+
+/* Room for a push without waiting: always, unless the policy is block. */
+static inline bool pipe_edge_has_room(pipe_edge *e) {
+  std::lock_guard<std::mutex> hold(e->lock);
+  return e->policy != PIPE_BLOCK || e->count < e->ring.size();
+}
+
+/* Takes over the caller's reference. When full, waits for room or drops
+   a block, as the edge's policy says. */
+static inline void pipe_edge_push(pipe_edge *e, pipe_block *b) {
+  pipe_block *dropped = NULL;
+  {
+    std::unique_lock<std::mutex> hold(e->lock);
+    size_t size = e->ring.size();
+    e->offered++;
+    e->offered_frames += b->frames;
+    if (e->policy == PIPE_DECIMATE && e->count * 2 >= size) {
+      if (e->decimate_phase++ % e->decimate)
+        dropped = b;
+    } else {
+      e->decimate_phase = 0;
+    }
+    if (!dropped && e->count == size) {
+      if (e->policy == PIPE_BLOCK) {
+        int64_t t = pipe_now_ns();
+        e->waits++;
+        while (e->count == size)
+          e->not_full.wait(hold);
+        e->wait_ns += pipe_now_ns() - t;
+      } else if (e->policy == PIPE_DROP_NEWEST) {
+        dropped = b;
+      } else {
+        dropped = e->ring[e->head];
+        e->head = (e->head + 1) % size;
+        e->count--;
+      }
+    }
+    if (dropped) {
+      e->dropped++;
+      e->dropped_frames += dropped->frames;
+    }
+    if (dropped != b) {
+      e->ring[(e->head + e->count) % size] = b;
+      e->count++;
+      e->pushed++;
+      e->depth_sum += e->count;
+      if (e->count > e->max_depth) e->max_depth = e->count;
+    }
+  }
+  if (dropped)
+    pipe_block_release(dropped);
+  if (dropped == b)
+    return;
+  e->not_empty.notify_one();
+  if (e->to->pooled)
+    pipe_schedule(e->to);
+}
+
+/* NULL when empty; *ended when also closed. wait: block until either. */
+static inline pipe_block *pipe_edge_pop(pipe_edge *e, bool wait, bool *ended) {
+  pipe_block *b = NULL;
+  bool was_full;
+  {
+    std::unique_lock<std::mutex> hold(e->lock);
+    while (wait && !e->count && !e->closed)
+      e->not_empty.wait(hold);
+    *ended = !e->count && e->closed;
+    if (!e->count)
+      return NULL;
+    was_full = e->count == e->ring.size();
+    b = e->ring[e->head];
+    e->head = (e->head + 1) % e->ring.size();
+    e->count--;
+    e->popped++;
+    e->popped_frames += b->frames;
+  }
+  e->not_full.notify_one();
+  if (was_full && e->from->pooled)
+    pipe_schedule(e->from);
+  return b;
+}
+
+static inline void pipe_edge_close(pipe_edge *e) {
+  {
+    std::lock_guard<std::mutex> hold(e->lock);
+    e->closed = true;
+  }
+  e->not_empty.notify_all();
+  if (e->to->pooled)
+    pipe_schedule(e->to);
+}
+
+/* Stages. */
+static inline void pipe_forward(pipe_stage *s, pipe_block *b) {
+  for (size_t i = 0; i < s->outputs.size(); i++) {
+    pipe_block_ref(b);
+    pipe_edge_push(s->outputs[i], b);
+  }
+  s->blocks_out.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void pipe_account(pipe_stage *s, int64_t t) {
+  uint64_t took = (uint64_t) (pipe_now_ns() - t);
+  s->service_ns.fetch_add(took, std::memory_order_relaxed);
+  if (took > s->service_max_ns.load(std::memory_order_relaxed))
+    s->service_max_ns.store(took, std::memory_order_relaxed);
+}
+
+/* One input block through a transform or sink. */
+static inline void pipe_stage_run_block(pipe_stage *s, pipe_block *in) {
+  s->blocks_in.fetch_add(1, std::memory_order_relaxed);
+  int64_t t = pipe_now_ns();
+  pipe_block *out = s->type->process(s->state, s, in);
+  pipe_account(s, t);
+  if (out)
+    pipe_forward(s, out);
+  if (out && out != in)
+    pipe_block_release(out);
+  pipe_block_release(in);
+}
+
+static inline void pipe_stage_finish(pipe_stage *s) {
+  if (s->type->flush) {
+    pipe_block *last = s->type->flush(s->state, s);
+    if (last) {
+      pipe_forward(s, last);
+      pipe_block_release(last);
+    }
+  }
+  for (size_t i = 0; i < s->outputs.size(); i++)
+    pipe_edge_close(s->outputs[i]);
+  s->finished.store(true);
+  pipe_graph *g = s->graph;
+  std::lock_guard<std::mutex> hold(g->done_lock);
+  if (--g->unfinished == 0)
+    g->done.notify_all();
+}
+
+static inline bool pipe_outputs_have_room(pipe_stage *s) {
+  for (size_t i = 0; i < s->outputs.size(); i++)
+    if (!pipe_edge_has_room(s->outputs[i]))
+      return false;
+  return true;
+}
+
+static inline void pipe_source_thread(pipe_stage *s) {
+  pipe_graph *g = s->graph;
+  uint64_t seq = 0;
+  while (g->running.load(std::memory_order_relaxed)) {
+    pipe_block *b = pipe_block_new(g, &s->out);
+    if (!b) {
+      /* Every block is queued somewhere: this one is lost. */
+      s->dropped_no_block.fetch_add(1, std::memory_order_relaxed);
+      sched_yield();
+      continue;
+    }
+    int64_t t = pipe_now_ns();
+    bool more = s->type->read(s->state, b);
+    if (!more) {
+      pipe_block_release(b);
+      break;
+    }
+    pipe_account(s, t);
+    b->seq = seq++;
+    if (b->frames)
+      pipe_forward(s, b);
+    pipe_block_release(b);
+  }
+  pipe_stage_finish(s);
+}
+
+static inline void pipe_stage_thread(pipe_stage *s) {
+  bool ended = false;
+  while (pipe_block *b = pipe_edge_pop(s->input, true, &ended))
+    pipe_stage_run_block(s, b);
+  pipe_stage_finish(s);
+}
+
+/* A pooled stage's turn: a batch of blocks, as long as its outputs have
+   room; then off the pool until a push or a pop puts it back. */
+static inline void pipe_pool_turn(work_item *w, int worker) {
+  pipe_stage *s = ((pipe_turn*) w)->stage;
+  (void) worker;
+  bool ended = false;
+  for (int i = 0; i < PIPE_POOL_BATCH && pipe_outputs_have_room(s); i++) {
+    pipe_block *b = pipe_edge_pop(s->input, false, &ended);
+    if (!b) break;
+    pipe_stage_run_block(s, b);
+  }
+  if (ended && !s->finished.load() && pipe_outputs_have_room(s)) {
+    pipe_stage_finish(s);
+    return;
+  }
+  s->scheduled.store(false);
+  /* Anything that arrived after the last look. */
+  std::unique_lock<std::mutex> hold(s->input->lock);
+  bool more = (s->input->count || s->input->closed) && !s->finished.load();
+  hold.unlock();
+  if (more && pipe_outputs_have_room(s))
+    pipe_schedule(s);
+}
+
+static inline void pipe_schedule(pipe_stage *s) {
+  if (s->finished.load() || s->scheduled.exchange(true))
+    return;
+  work_pool_submit(&s->graph->pool, &s->turn.item);
+}
+
+/* Graph. */
+static inline void pipe_graph_init(pipe_graph *g, const pipe_stage_type *const *types, int pool_threads) {
+  g->types = types;
+  g->pool_threads = pool_threads;
+  g->pool_used = false;
+  g->blocks.memory = NULL;
+  g->block_count = 0;
+  g->running.store(false);
+  g->unfinished = 0;
+}
+
+static inline const pipe_stage_type *pipe_find_type(const pipe_graph *g, const std::string &name) {
+  for (int i = 0; g->types[i]; i++)
+    if (name == g->types[i]->name)
+      return g->types[i];
+  return NULL;
+}
+
+static inline int pipe_parse_policy(const std::string &name) {
+  for (int i = 0; i < (int) (sizeof(pipe_policy_names) / sizeof(pipe_policy_names[0])); i++)
+    if (name == pipe_policy_names[i])
+      return i;
+  return -1;
+}
+
+/* One stage line. Returns false with *err set. */
+static inline bool pipe_graph_add(pipe_graph *g, const std::string &line, std::string *err) {
+  std::vector<std::string> words;
+  for (size_t at = 0; at < line.size();) {
+    while (at < line.size() && (line[at] == ' ' || line[at] == '\t')) at++;
+    if (at >= line.size() || line[at] == '#') break;
+    size_t end = line.find_first_of(" \t", at);
+    if (end == std::string::npos) end = line.size();
+    words.push_back(line.substr(at, end - at));
+    at = end;
+  }
+  if (words.empty())
+    return true;
+
+  pipe_stage *s = new pipe_stage;
+  size_t w = 0;
+  if (words[0][words[0].size() - 1] == ':') {
+    s->name = words[0].substr(0, words[0].size() - 1);
+    w++;
+  }
+  if (w >= words.size()) {
+    *err = "no stage type in: " + line;
+    delete s;
+    return false;
+  }
+  s->type_name = words[w++];
+  s->type = pipe_find_type(g, s->type_name);
+  if (!s->type) {
+    *err = "unknown stage type: " + s->type_name;
+    delete s;
+    return false;
+  }
+  if (s->name.empty()) {
+    char n[64];
+    snprintf(n, sizeof(n), "%s%lu", s->type_name.c_str(), (unsigned long) g->stages.size());
+    s->name = n;
+  }
+  s->queue = PIPE_DEFAULT_QUEUE;
+  s->policy = PIPE_BLOCK;
+  s->decimate = 2;
+  s->pooled = false;
+  s->cpu = -1;
+  for (; w < words.size(); w++) {
+    size_t eq = words[w].find('=');
+    if (eq == std::string::npos) {
+      *err = "expected key=value: " + words[w];
+      delete s;
+      return false;
+    }
+    std::string key = words[w].substr(0, eq), value = words[w].substr(eq + 1);
+    if (key == "from") s->from = value;
+    else if (key == "queue") s->queue = (uint32_t) atoi(value.c_str());
+    else if (key == "policy") s->policy = pipe_parse_policy(value);
+    else if (key == "decimate") s->decimate = (uint32_t) atoi(value.c_str());
+    else if (key == "run") s->pooled = value == "pool";
+    else if (key == "cpu") s->cpu = atoi(value.c_str());
+    else s->args.push_back(std::make_pair(key, value));
+  }
+  if (!s->queue) s->queue = 1;
+  if (s->decimate < 2) s->decimate = 2;
+  if (s->policy < 0) {
+    *err = s->name + ": policy must be block, drop-oldest, drop-newest or decimate";
+    delete s;
+    return false;
+  }
+  if (s->type->kind != PIPE_SOURCE && s->from.empty()) {
+    if (g->stages.empty()) {
+      *err = s->name + ": nothing to read from";
+      delete s;
+      return false;
+    }
+    s->from = g->stages.back()->name;
+  }
+  s->type_name = s->type->name;
+  s->graph = g;
+  s->state = NULL;
+  s->input = NULL;
+  s->scheduled.store(false);
+  s->finished.store(false);
+  s->blocks_in.store(0);
+  s->blocks_out.store(0);
+  s->service_ns.store(0);
+  s->service_max_ns.store(0);
+  s->dropped_no_block.store(0);
+  s->turn.item.run = pipe_pool_turn;
+  s->turn.stage = s;
+  g->stages.push_back(s);
+  return true;
+}
+
+/* Connect, open every stage in order, size the block pool. */
+static inline bool pipe_graph_open(pipe_graph *g, std::string *err) {
+  uint32_t max_floats = 0, queued = 0;
+  for (size_t i = 0; i < g->stages.size(); i++) {
+    pipe_stage *s = g->stages[i];
+    memset(&s->in, 0, sizeof(s->in));
+    if (s->type->kind != PIPE_SOURCE) {
+      pipe_stage *up = NULL;
+      for (size_t j = 0; j < i; j++)
+        if (g->stages[j]->name == s->from) up = g->stages[j];
+      if (!up || up->type->kind == PIPE_SINK) {
+        *err = s->name + ": no stage before it called " + s->from + " to read from";
+        return false;
+      }
+      pipe_edge *e = new pipe_edge;
+      e->from = up;
+      e->to = s;
+      e->ring.assign(s->queue, NULL);
+      e->head = e->count = 0;
+      e->closed = false;
+      e->policy = s->policy;
+      e->decimate = s->decimate;
+      e->decimate_phase = 0;
+      e->offered = e->pushed = e->popped = e->max_depth = e->depth_sum = e->waits = 0;
+      e->offered_frames = e->popped_frames = e->dropped = e->dropped_frames = 0;
+      e->wait_ns = 0;
+      up->outputs.push_back(e);
+      s->input = e;
+      s->in = up->out;
+      g->edges.push_back(e);
+      queued += s->queue;
+    }
+    s->out = s->in;
+    s->state = s->type->open(s, err);
+    if (!s->state) {
+      *err = s->name + ": " + *err;
+      return false;
+    }
+    if (s->out.channels * s->out.max_frames > max_floats)
+      max_floats = s->out.channels * s->out.max_frames;
+    /* A source blocks in read(): it always gets a thread. */
+    if (s->type->kind == PIPE_SOURCE) s->pooled = false;
+    if (s->pooled) g->pool_used = true;
+  }
+  /* Every queue full, and a block in hand at every stage. */
+  g->block_count = queued + 2 * (uint32_t) g->stages.size() + 4;
+  size_t header = (sizeof(pipe_block) + BLOCK_POOL_ALIGN - 1) & ~(size_t) (BLOCK_POOL_ALIGN - 1);
+  if (block_pool_init(&g->blocks, g->block_count, (uint32_t) (header + max_floats * sizeof(float)), false) < 0) {
+    *err = std::string("block pool: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+static inline void pipe_graph_start(pipe_graph *g) {
+  g->running.store(true);
+  g->start_ns = pipe_now_ns();
+  g->unfinished = (int) g->stages.size();
+  if (g->pool_used)
+    work_pool_start(&g->pool, g->pool_threads);
+  for (size_t i = 0; i < g->stages.size(); i++) {
+    pipe_stage *s = g->stages[i];
+    if (s->pooled)
+      continue;
+    if (s->type->kind == PIPE_SOURCE) s->thread = std::thread(pipe_source_thread, s);
+    else s->thread = std::thread(pipe_stage_thread, s);
+    if (s->cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(s->cpu, &set);
+      if (pthread_setaffinity_np(s->thread.native_handle(), sizeof(set), &set) != 0)
+        fprintf(stderr, "%s: cannot pin to cpu %d\n", s->name.c_str(), s->cpu);
+    }
+  }
+}
+
+/* Sources stop reading; what is queued still goes through. */
+static inline void pipe_graph_stop(pipe_graph *g) {
+  g->running.store(false);
+}
+
+/* Until every stage has finished (sources ended or were stopped). */
+static inline void pipe_graph_wait(pipe_graph *g) {
+  {
+    std::unique_lock<std::mutex> hold(g->done_lock);
+    while (g->unfinished > 0)
+      g->done.wait(hold);
+  }
+  for (size_t i = 0; i < g->stages.size(); i++)
+    if (g->stages[i]->thread.joinable())
+      g->stages[i]->thread.join();
+  if (g->pool_used) {
+    work_pool_wait(&g->pool);
+    work_pool_stop(&g->pool);
+  }
+}
+
+static inline void pipe_graph_print_stats(pipe_graph *g, FILE *out) {
+  double wall = (pipe_now_ns() - g->start_ns) / 1e9;
+  fprintf(out, "%-10s %-8s %8s %8s %14s %18s %6s %10s %11s %16s\n", "stage", "run", "in", "out",
+          "queue now/max/avg", "service avg/max ms", "busy%", "waited ms", "policy", "dropped blk/s");
+  for (size_t i = 0; i < g->stages.size(); i++) {
+    pipe_stage *s = g->stages[i];
+    char run[16], queue[32] = "-", waited[16] = "-", dropped[32] = "-";
+    const char *policy = "-";
+    if (s->pooled) snprintf(run, sizeof(run), "pool");
+    else if (s->cpu >= 0) snprintf(run, sizeof(run), "cpu%d", s->cpu);
+    else snprintf(run, sizeof(run), "thread");
+    if (s->input) {
+      std::lock_guard<std::mutex> hold(s->input->lock);
+      pipe_edge *e = s->input;
+      snprintf(queue, sizeof(queue), "%lu/%lu/%.1f", (unsigned long) e->count, (unsigned long) e->max_depth,
+               e->pushed ? (double) e->depth_sum / e->pushed : 0.0);
+      policy = pipe_policy_names[e->policy];
+      snprintf(dropped, sizeof(dropped), "%lu/%.3f", (unsigned long) e->dropped,
+               (double) e->dropped_frames / s->in.rate);
+    }
+    /* Time this stage spent waiting for room downstream. */
+    int64_t wait_ns = 0;
+    for (size_t k = 0; k < s->outputs.size(); k++) {
+      std::lock_guard<std::mutex> hold(s->outputs[k]->lock);
+      wait_ns += s->outputs[k]->wait_ns;
+    }
+    if (!s->outputs.empty())
+      snprintf(waited, sizeof(waited), "%.1f", wait_ns / 1e6);
+    uint64_t n = s->type->kind == PIPE_SOURCE ? s->blocks_out.load() : s->blocks_in.load();
+    double busy = s->service_ns.load() / 1e9;
+    fprintf(out, "%-10s %-8s %8lu %8lu %14s %9.3f/%8.3f %6.1f %10s %11s %16s\n", s->name.c_str(), run,
+            (unsigned long) s->blocks_in.load(), (unsigned long) s->blocks_out.load(), queue,
+            n ? busy * 1e3 / n : 0.0, s->service_max_ns.load() / 1e6, wall > 0 ? busy / wall * 100 : 0.0, waited,
+            policy, dropped);
+  }
+  if (g->blocks.memory)
+    block_pool_print_stats(&g->blocks, out);
+}
+
+static inline void pipe_json_string(FILE *out, const std::string &v) {
+  fputc('"', out);
+  for (size_t i = 0; i < v.size(); i++) {
+    unsigned char c = (unsigned char) v[i];
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20) fprintf(out, "\\u%04x", c);
+    else fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+/* One JSON object per queue and line, for monitoring: where the queue
+   is, its policy, and exactly what it dropped. */
+static inline void pipe_graph_print_json(pipe_graph *g, FILE *out) {
+  double t = (pipe_now_ns() - g->start_ns) / 1e9;
+  for (size_t i = 0; i < g->edges.size(); i++) {
+    pipe_edge *e = g->edges[i];
+    std::lock_guard<std::mutex> hold(e->lock);
+    uint32_t rate = e->to->in.rate;
+    fprintf(out, "{\"t\":%.3f,\"from\":", t);
+    pipe_json_string(out, e->from->name);
+    fprintf(out, ",\"to\":");
+    pipe_json_string(out, e->to->name);
+    fprintf(out, ",\"policy\":\"%s\",\"capacity\":%lu,\"depth\":%lu,\"max_depth\":%lu,"
+            "\"offered\":%lu,\"offered_frames\":%lu,\"delivered\":%lu,\"delivered_frames\":%lu,"
+            "\"dropped\":%lu,\"dropped_frames\":%lu,\"dropped_sec\":%.6f,\"waits\":%lu,\"wait_ms\":%.3f}\n",
+            pipe_policy_names[e->policy], (unsigned long) e->ring.size(), (unsigned long) e->count,
+            (unsigned long) e->max_depth, (unsigned long) e->offered, (unsigned long) e->offered_frames,
+            (unsigned long) e->popped, (unsigned long) e->popped_frames, (unsigned long) e->dropped,
+            (unsigned long) e->dropped_frames, rate ? (double) e->dropped_frames / rate : 0.0,
+            (unsigned long) e->waits, e->wait_ns / 1e6);
+  }
+  fflush(out);
+}
+
+static inline void pipe_graph_close(pipe_graph *g, FILE *report) {
+  for (size_t i = 0; i < g->stages.size(); i++) {
+    pipe_stage *s = g->stages[i];
+    if (s->state)
+      s->type->close(s->state, report);
+    delete s;
+  }
+  for (size_t i = 0; i < g->edges.size(); i++) {
+    pipe_edge *e = g->edges[i];
+    for (size_t k = 0; k < e->count; k++)
+      pipe_block_release(e->ring[(e->head + k) % e->ring.size()]);
+    delete e;
+  }
+  g->stages.clear();
+  g->edges.clear();
+  block_pool_free(&g->blocks);
+}
+
+static inline void pipe_print_types(const pipe_stage_type *const *types, FILE *out) {
+  static const char *kinds[] = { "source", "transform", "sink" };
+  for (int i = 0; types[i]; i++)
+    fprintf(out, "  %-10s %-9s %s\n", types[i]->name, kinds[types[i]->kind], types[i]->help);
+}
+
+#endif  // PIPELINE_H_
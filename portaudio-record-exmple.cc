@@ -43,6 +43,14 @@
  * license above.
  * 
  * g++ portaudio-record-exmple.cc -I/usr/include/  -o portaudio-record-exmple -lm -ldl -lportaudio
+ *
+ * Record the blocks as read / replay them without a device (capture-log.h):
+ * CAPTURE_LOG=field.caplog ./portaudio-record-exmple
+ * CAPTURE_REPLAY=field.caplog CAPTURE_REPLAY_SPEED=asap ./portaudio-record-exmple
+ * Or from a mock device (mock-capture.h):
+ * CAPTURE_MOCK=sine=440,impulse=1 ./portaudio-record-exmple
+ * Levels (level-meter.h) are printed per block, or per window of N ms:
+ * CAPTURE_METER_MS=1000 ./portaudio-record-exmple
  */
 
 #include <stdio.h>
@@ -52,6 +60,11 @@
 
 #include <portaudio.h>
 
+#include "biquad-bank.h"
+#include "capture-log.h"
+#include "level-meter.h"
+#include "mock-capture.h"
+
 /* #define SAMPLE_RATE  (17932) // Test failure to open with this value. */
 // #define SAMPLE_RATE  (44100)
 // #define FRAMES_PER_BUFFER (1024)
@@ -90,6 +103,9 @@ typedef unsigned char SAMPLE;
 #endif
 
 static bool running = true;
+static capture_log recording;
+static capture_replay replay;
+static mock_capture mock;
 
 /*******************************************************************/
 /* Signals handling */
@@ -116,14 +132,45 @@ int main(void)
     int totalFrames;
     int numSamples;
     int numBytes;
-    SAMPLE max, average, val;
+    static level_meter meter;
+    level_snapshot levels;
+    uint64_t levels_shown = 0;
+    const char *log_path = getenv("CAPTURE_LOG");
+    const char *replay_path = getenv("CAPTURE_REPLAY");
+    const char *mock_spec = replay_path ? NULL : getenv("CAPTURE_MOCK");
+    const char *filter_spec = getenv("CAPTURE_FILTER");
+    static biquad_bank filter;
+
+    int sampleRate = SAMPLE_RATE;
+    int numChannels = NUM_CHANNELS;
+    int framesPerBuffer = FRAMES_PER_BUFFER;
+
+    /* Workload overrides, so every backend can be benchmarked alike
+       (capture-backend-bench.cc). */
+    if( getenv("CAPTURE_RATE") ) sampleRate = atoi( getenv("CAPTURE_RATE") );
+    if( getenv("CAPTURE_CHANNELS") ) numChannels = atoi( getenv("CAPTURE_CHANNELS") );
+    if( getenv("CAPTURE_BLOCK_FRAMES") ) framesPerBuffer = atoi( getenv("CAPTURE_BLOCK_FRAMES") );
 
     init_signal();
 
     printf("patest_read_record.c\n"); fflush(stdout);
 
-    totalFrames = NUM_SECONDS * SAMPLE_RATE; /* Record for a few seconds. */
-    numSamples = totalFrames * NUM_CHANNELS;
+    totalFrames = getenv("CAPTURE_BLOCK_FRAMES") ? framesPerBuffer : NUM_SECONDS * sampleRate; /* Record for a few seconds. */
+    numSamples = totalFrames * numChannels;
+
+    if( !level_meter_init( &meter, sampleRate, numChannels,
+                           getenv("CAPTURE_METER_MS") ? atoi( getenv("CAPTURE_METER_MS") ) : 0 ) )
+    {
+        printf("Cannot meter %d channels.\n", numChannels);
+        exit(1);
+    }
+
+    if( filter_spec && ( !biquad_bank_init( &filter, numChannels, 1, totalFrames ) ||
+                         !biquad_bank_configure( &filter, sampleRate, filter_spec ) ) )
+    {
+        printf("Cannot parse CAPTURE_FILTER=%s.\n", filter_spec);
+        exit(1);
+    }
 
     numBytes = numSamples * sizeof(SAMPLE);
     recordedSamples = (SAMPLE *) malloc( numBytes );
@@ -134,6 +181,39 @@ int main(void)
     }
     for( i=0; i<numSamples; i++ ) recordedSamples[i] = 0;
 
+    if( log_path && capture_log_open( &recording, log_path, CAPTURE_LOG_F32LE, sampleRate,
+                                      numChannels, "portaudio" ) < 0 )
+    {
+        printf("Could not write capture log %s.\n", log_path);
+        exit(1);
+    }
+
+    if( replay_path )
+    {
+        if( capture_replay_open( &replay, replay_path, capture_replay_parse_speed( getenv("CAPTURE_REPLAY_SPEED") ) ) < 0 ||
+            replay.header.format != CAPTURE_LOG_F32LE || replay.header.rate != (uint32_t) sampleRate ||
+            replay.header.channels != (uint32_t) numChannels )
+        {
+            printf("Could not replay %s: not a %d Hz float32 capture log.\n", replay_path, sampleRate);
+            exit(1);
+        }
+        printf("Now replaying %s!!\n", replay_path); fflush(stdout);
+        goto record;
+    }
+    if( mock_spec )
+    {
+        mock_capture_config cfg;
+        mock_capture_default_config( &cfg, sampleRate, numChannels, MOCK_F32 );
+        if( mock_capture_parse( &cfg, mock_spec ) < 0 )
+        {
+            printf("Could not parse CAPTURE_MOCK=%s.\n", mock_spec);
+            exit(1);
+        }
+        mock_capture_open( &mock, &cfg );
+        printf("Now recording from a mock device!!\n"); fflush(stdout);
+        goto record;
+    }
+
     err = Pa_Initialize();
     if( err != paNoError ) goto error;
 
@@ -142,7 +222,7 @@ int main(void)
         fprintf(stderr,"Error: No default input device.\n");
         goto error;
     }
-    inputParameters.channelCount = NUM_CHANNELS;
+    inputParameters.channelCount = numChannels;
     inputParameters.sampleFormat = PA_SAMPLE_TYPE;
     inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputParameters.device )->defaultLowInputLatency;
     inputParameters.hostApiSpecificStreamInfo = NULL;
@@ -154,8 +234,8 @@ int main(void)
               &stream,
               &inputParameters,
               NULL,                  /* &outputParameters, */
-              SAMPLE_RATE,
-              FRAMES_PER_BUFFER,
+              sampleRate,
+              framesPerBuffer,
               paClipOff,      /* we won't output out of range samples so don't bother clipping them */
               NULL, /* no callback, use blocking API */
               NULL ); /* no callback, so no callback userData */
@@ -165,15 +245,71 @@ int main(void)
     if( err != paNoError ) goto error;
     printf("Now recording!!\n"); fflush(stdout);
 
+record:
     while(running) {
         auto start = std::chrono::high_resolution_clock::now();
+        int64_t read_start_ns = capture_log_monotonic_ns(), capture_ns = 0;
+
+        if( replay_path )
+        {
+            long n = capture_replay_read( &replay, recordedSamples, totalFrames, &capture_ns );
+            if( n == 0 ) break;
+            if( n != totalFrames ) continue;  /* an xrun, or a short last block */
+        }
+        else if( mock_spec )
+        {
+            if( mock_capture_read( &mock, recordedSamples, totalFrames, &capture_ns ) != totalFrames )
+            {
+                if( recording.file )
+                    capture_log_xrun( &recording, read_start_ns );
+                continue;
+            }
+        }
+        else
+        {
+            err = Pa_ReadStream( stream, recordedSamples, totalFrames );
+            /* An overflow still delivers the frames: note it and go on. */
+            if( err == paInputOverflowed )
+            {
+                if( recording.file )
+                    capture_log_xrun( &recording, read_start_ns );
+            }
+            else if( err != paNoError ) goto error;
+        }
+        if( recording.file )
+            capture_log_block( &recording, recordedSamples, totalFrames, read_start_ns,
+                               capture_log_monotonic_ns(), capture_ns );
+
+        /* After the log, so a replay runs the filter again on the raw input. */
+        if( filter_spec )
+            biquad_process_f32( &filter, recordedSamples, totalFrames );
 
-        err = Pa_ReadStream( stream, recordedSamples, totalFrames );
-        if( err != paNoError ) goto error;
+        level_meter_process_f32( &meter, recordedSamples, totalFrames, capture_ns );
 
         auto end = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
         fprintf(stdout, "read %f done %ld ms \n", recordedSamples[0], duration);
+        if( level_meter_read( &meter, &levels ) && levels.window + 1 > levels_shown )
+        {
+            levels_shown = levels.window + 1;
+            level_snapshot_print( &levels, stdout );
+        }
+    }
+
+    capture_log_close( &recording );
+    if( filter_spec )
+        biquad_bank_free( &filter );
+    if( replay_path || mock_spec )
+    {
+        if( replay_path )
+        {
+            capture_replay_print_stats( &replay, stdout );
+            capture_replay_close( &replay );
+        }
+        else
+            mock_capture_print_stats( &mock, stdout );
+        free( recordedSamples );
+        return 0;
     }
 
     err = Pa_CloseStream( stream );
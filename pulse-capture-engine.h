@@ -0,0 +1,453 @@
+/*
+  Many Pulseaudio record streams on one context, processed off the
+  mainloop.
+
+  All streams share one pa_context on a pa_threaded_mainloop. The read
+  callback does only what has to happen on the mainloop thread: peek each
+  fragment, date it, copy it into the stream's own ring and drop it. A
+  stream with at least a block in its ring is queued for a pool of worker
+  threads, which hand whole blocks to the processing callback. So:
+
+    - the mainloop never waits for processing: a stream whose consumer is
+      too slow fills its own ring and loses its own fragments (counted),
+      the other streams and the server connection carry on
+    - a stream is processed by one worker at a time, in order; a worker
+      takes at most PULSE_ENGINE_BATCH blocks from a stream before it goes
+      back to the queue, so one busy stream cannot starve the others
+    - a block is passed in place from the ring, or copied once when it
+      wraps around the end
+    - nothing is allocated once a stream runs: rings and scratch are sized
+      when it is added, and the ready queue is a list threaded through
+      the streams themselves
+
+    pulse_engine engine;
+    pulse_engine_start(&engine, "recorder", workers);
+    pulse_engine_add_stream(&engine, "mic", device, &spec, block_frames,
+                            ring_frames, process, user);
+    ...
+    pulse_engine_stop(&engine);
+
+  process(stream, data, frames, capture_ns, user) runs on a worker thread;
+  capture_ns is the CLOCK_REALTIME of the first frame (capture-clock.h).
+  Linux only, C++11.
+*/
+#ifndef PULSE_CAPTURE_ENGINE_H_
+#define PULSE_CAPTURE_ENGINE_H_
+
+#include <pulse/pulseaudio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture-clock.h"
+
+#define PULSE_ENGINE_CACHELINE 64
+/* Blocks a worker processes from one stream before taking the next. */
+#define PULSE_ENGINE_BATCH 8
+/* Fragment timestamps kept per stream, for dating the blocks. */
+#define PULSE_ENGINE_MARKS 256
+
+struct pulse_engine;
+struct pulse_engine_stream;
+
+typedef void (*pulse_engine_process_fn)(pulse_engine_stream *s, const void *data, uint32_t frames,
+                                        int64_t capture_ns, void *user);
+
+/* Ring frame `frame` was captured at `capture_ns`. */
+struct pulse_engine_mark {
+  uint64_t frame;
+  int64_t capture_ns;
+};
+
+struct pulse_engine_stream {
+  pulse_engine *engine;
+  std::string name;
+  pa_sample_spec spec;
+  size_t frame_bytes;
+  uint32_t block_frames;
+  pa_stream *stream;
+  pulse_engine_process_fn process;
+  void *user;
+
+  /* Byte ring: the mainloop thread writes, one worker at a time reads. */
+  uint8_t *ring;
+  size_t capacity;
+  /* Padded apart (not alignas: streams come from plain new, and C++11
+     new does not honour extended alignment). */
+  char pad0[PULSE_ENGINE_CACHELINE];
+  std::atomic<uint64_t> write_pos;
+  char pad1[PULSE_ENGINE_CACHELINE];
+  std::atomic<uint64_t> read_pos;
+  char pad2[PULSE_ENGINE_CACHELINE];
+  pulse_engine_mark marks[PULSE_ENGINE_MARKS];
+  std::atomic<uint64_t> marks_written;
+  std::atomic<uint64_t> marks_read;
+  std::vector<uint8_t> scratch;  /* blocks that wrap around the ring */
+
+  capture_clock clock;           /* mainloop thread */
+  uint64_t frames_captured;      /* mainloop thread, for the clock */
+  std::atomic<bool> queued;
+  pulse_engine_stream *next_ready;  /* engine lock, while queued */
+  std::atomic<bool> failed;
+
+  std::atomic<uint64_t> fragments;
+  std::atomic<uint64_t> dropped_bytes;  /* ring full: the consumer is too slow */
+  std::atomic<uint64_t> holes;          /* holes in the record stream, filled with silence */
+  std::atomic<uint64_t> overflows;      /* server-side overflows */
+  std::atomic<uint64_t> blocks;
+  std::atomic<uint64_t> process_ns;
+  std::atomic<uint64_t> max_process_ns;
+  std::atomic<uint64_t> max_fill;       /* bytes */
+};
+
+struct pulse_engine {
+  pa_threaded_mainloop *mainloop;
+  pa_context *context;
+  std::vector<pulse_engine_stream*> streams;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  pulse_engine_stream *ready_head, *ready_tail;  /* FIFO of queued streams */
+  bool stopping;
+  std::vector<std::thread> workers;
+};
+
+static inline uint64_t pulse_engine_available(const pulse_engine_stream *s) {
+  return s->write_pos.load(std::memory_order_acquire) - s->read_pos.load(std::memory_order_relaxed);
+}
+
+static inline void pulse_engine_schedule(pulse_engine_stream *s) {
+  if (s->queued.exchange(true))
+    return;
+  pulse_engine *e = s->engine;
+  {
+    std::lock_guard<std::mutex> hold(e->lock);
+    s->next_ready = NULL;
+    if (e->ready_tail)
+      e->ready_tail->next_ready = s;
+    else
+      e->ready_head = s;
+    e->ready_tail = s;
+  }
+  e->wake.notify_one();
+}
+
+/* Mainloop thread: append a fragment (NULL data is a hole) or drop it
+   whole when the ring has no room. */
+static inline void pulse_engine_push(pulse_engine_stream *s, const void *data, size_t length,
+                                     int64_t capture_ns) {
+  uint64_t w = s->write_pos.load(std::memory_order_relaxed);
+  uint64_t fill = w - s->read_pos.load(std::memory_order_acquire);
+  if (fill + length > s->capacity) {
+    s->dropped_bytes.fetch_add(length, std::memory_order_relaxed);
+    return;
+  }
+
+  uint64_t m = s->marks_written.load(std::memory_order_relaxed);
+  if (m - s->marks_read.load(std::memory_order_acquire) < PULSE_ENGINE_MARKS) {
+    pulse_engine_mark &mark = s->marks[m % PULSE_ENGINE_MARKS];
+    mark.frame = w / s->frame_bytes;
+    mark.capture_ns = capture_ns;
+    s->marks_written.store(m + 1, std::memory_order_release);
+  }
+
+  size_t at = (size_t) (w % s->capacity), first = length;
+  if (at + first > s->capacity)
+    first = s->capacity - at;
+  if (data) {
+    memcpy(s->ring + at, data, first);
+    memcpy(s->ring, (const uint8_t*) data + first, length - first);
+  } else {
+    memset(s->ring + at, 0, first);
+    memset(s->ring, 0, length - first);
+  }
+  s->write_pos.store(w + length, std::memory_order_release);
+  if (fill + length > s->max_fill.load(std::memory_order_relaxed))
+    s->max_fill.store(fill + length, std::memory_order_relaxed);
+}
+
+/* Like stamp_fragment() in pulseaudio-stream-example.cc: the latency of
+   a record stream is how long ago the frame at the read index was
+   captured. */
+static inline int64_t pulse_engine_stamp(pulse_engine_stream *s, size_t length) {
+  pa_usec_t l;
+  int negative = 0;
+  int64_t raw_ns;
+  if (pa_stream_get_latency(s->stream, &l, &negative) == 0)
+    raw_ns = capture_clock_monotonic_ns() - (negative ? -1 : 1) * (int64_t) l * 1000;
+  else if (s->clock.locked)
+    raw_ns = capture_clock_time(&s->clock, s->frames_captured);
+  else
+    raw_ns = capture_clock_monotonic_ns();
+  int64_t capture_ns = capture_clock_update(&s->clock, s->frames_captured, raw_ns) + monotonic_to_realtime_ns();
+  s->frames_captured += length / s->frame_bytes;
+  return capture_ns;
+}
+
+static inline void pulse_engine_read_callback(pa_stream *p, size_t nbytes, void *userdata) {
+  pulse_engine_stream *s = (pulse_engine_stream*) userdata;
+  const void *data;
+  size_t length;
+  while (pa_stream_readable_size(p) > 0) {
+    if (pa_stream_peek(p, &data, &length) < 0 || !length)
+      break;
+    int64_t capture_ns = pulse_engine_stamp(s, length);
+    if (!data)
+      s->holes.fetch_add(1, std::memory_order_relaxed);
+    pulse_engine_push(s, data, length, capture_ns);
+    s->fragments.fetch_add(1, std::memory_order_relaxed);
+    pa_stream_drop(p);
+  }
+  if (pulse_engine_available(s) >= s->block_frames * s->frame_bytes)
+    pulse_engine_schedule(s);
+}
+
+static inline void pulse_engine_overflow_callback(pa_stream *p, void *userdata) {
+  ((pulse_engine_stream*) userdata)->overflows.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void pulse_engine_stream_state_callback(pa_stream *p, void *userdata) {
+  pulse_engine_stream *s = (pulse_engine_stream*) userdata;
+  pa_stream_state_t state = pa_stream_get_state(p);
+  if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED)
+    s->failed.store(true);
+  pa_threaded_mainloop_signal(s->engine->mainloop, 0);
+}
+
+static inline void pulse_engine_context_state_callback(pa_context *c, void *userdata) {
+  pa_threaded_mainloop_signal(((pulse_engine*) userdata)->mainloop, 0);
+}
+
+/* Worker: one block of `s`, if there is one. Only one worker holds a
+   stream at a time (queued), so the read side needs no lock. */
+static inline bool pulse_engine_process_block(pulse_engine_stream *s) {
+  const size_t block_bytes = s->block_frames * s->frame_bytes;
+  if (pulse_engine_available(s) < block_bytes)
+    return false;
+  uint64_t r = s->read_pos.load(std::memory_order_relaxed);
+  size_t at = (size_t) (r % s->capacity);
+  const uint8_t *data = s->ring + at;
+  if (at + block_bytes > s->capacity) {
+    size_t first = s->capacity - at;
+    memcpy(s->scratch.data(), s->ring + at, first);
+    memcpy(s->scratch.data() + first, s->ring, block_bytes - first);
+    data = s->scratch.data();
+  }
+
+  /* Date the block from the newest mark at or before its first frame. */
+  uint64_t frame = r / s->frame_bytes, m = s->marks_read.load(std::memory_order_relaxed);
+  uint64_t written = s->marks_written.load(std::memory_order_acquire);
+  while (m + 1 < written && s->marks[(m + 1) % PULSE_ENGINE_MARKS].frame <= frame)
+    m++;
+  int64_t capture_ns = 0;
+  if (m < written) {
+    const pulse_engine_mark &mark = s->marks[m % PULSE_ENGINE_MARKS];
+    capture_ns = mark.capture_ns + (int64_t) ((frame - mark.frame) * 1e9 / s->spec.rate);
+  }
+  s->marks_read.store(m, std::memory_order_release);
+
+  int64_t start = capture_clock_monotonic_ns();
+  s->process(s, data, s->block_frames, capture_ns, s->user);
+  uint64_t took = (uint64_t) (capture_clock_monotonic_ns() - start);
+  s->read_pos.store(r + block_bytes, std::memory_order_release);
+
+  s->blocks.fetch_add(1, std::memory_order_relaxed);
+  s->process_ns.fetch_add(took, std::memory_order_relaxed);
+  if (took > s->max_process_ns.load(std::memory_order_relaxed))
+    s->max_process_ns.store(took, std::memory_order_relaxed);
+  return true;
+}
+
+static inline void pulse_engine_worker(pulse_engine *e) {
+  while (true) {
+    pulse_engine_stream *s;
+    {
+      std::unique_lock<std::mutex> hold(e->lock);
+      e->wake.wait(hold, [e] { return e->stopping || e->ready_head; });
+      if (e->stopping)
+        return;
+      s = e->ready_head;
+      if (!(e->ready_head = s->next_ready))
+        e->ready_tail = NULL;
+    }
+    for (int i = 0; i < PULSE_ENGINE_BATCH && pulse_engine_process_block(s); i++) {}
+    /* Data that came in after the last check finds queued set and is not
+       scheduled by the mainloop: look again once it is clear. */
+    s->queued.store(false);
+    if (pulse_engine_available(s) >= s->block_frames * s->frame_bytes)
+      pulse_engine_schedule(s);
+  }
+}
+
+/* Connect to the server and start `workers` threads. */
+static inline int pulse_engine_start(pulse_engine *e, const char *client_name, unsigned workers) {
+  e->stopping = false;
+  e->context = NULL;
+  e->ready_head = e->ready_tail = NULL;
+  if (!(e->mainloop = pa_threaded_mainloop_new()))
+    return -1;
+  pa_threaded_mainloop_lock(e->mainloop);
+  if (!(e->context = pa_context_new(pa_threaded_mainloop_get_api(e->mainloop), client_name)))
+    goto fail;
+  pa_context_set_state_callback(e->context, pulse_engine_context_state_callback, e);
+  if (pa_context_connect(e->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0 ||
+      pa_threaded_mainloop_start(e->mainloop) < 0)
+    goto fail;
+  while (true) {
+    pa_context_state_t state = pa_context_get_state(e->context);
+    if (state == PA_CONTEXT_READY)
+      break;
+    if (!PA_CONTEXT_IS_GOOD(state)) {
+      fprintf(stderr, "pulse_engine: connection failed: %s\n", pa_strerror(pa_context_errno(e->context)));
+      goto fail;
+    }
+    pa_threaded_mainloop_wait(e->mainloop);
+  }
+  pa_threaded_mainloop_unlock(e->mainloop);
+
+  for (unsigned i = 0; i < workers; i++)
+    e->workers.push_back(std::thread(pulse_engine_worker, e));
+  return 0;
+
+fail:
+  pa_threaded_mainloop_unlock(e->mainloop);
+  pa_threaded_mainloop_stop(e->mainloop);
+  if (e->context) pa_context_unref(e->context);
+  pa_threaded_mainloop_free(e->mainloop);
+  e->mainloop = NULL;
+  e->context = NULL;
+  return -1;
+}
+
+/* Add a record stream from `device` (NULL: the default source) delivering
+   blocks of `block_frames` to `process`, with a ring of `ring_frames`.
+   Waits until the stream is up; NULL if it could not be. */
+static inline pulse_engine_stream *pulse_engine_add_stream(pulse_engine *e, const char *name, const char *device,
+                                                           const pa_sample_spec *spec, uint32_t block_frames,
+                                                           uint32_t ring_frames, pulse_engine_process_fn process,
+                                                           void *user) {
+  pulse_engine_stream *s = new pulse_engine_stream();
+  s->engine = e;
+  s->name = name;
+  s->spec = *spec;
+  s->frame_bytes = pa_frame_size(spec);
+  s->block_frames = block_frames;
+  s->process = process;
+  s->user = user;
+  if (ring_frames < 2 * block_frames)
+    ring_frames = 2 * block_frames;
+  s->capacity = (size_t) ring_frames * s->frame_bytes;
+  s->ring = new uint8_t[s->capacity];
+  s->scratch.resize((size_t) block_frames * s->frame_bytes);
+  s->write_pos = 0;
+  s->read_pos = 0;
+  s->marks_written = 0;
+  s->marks_read = 0;
+  capture_clock_init(&s->clock, spec->rate, CAPTURE_CLOCK_TAU_SEC);
+  s->frames_captured = 0;
+  s->queued = false;
+  s->next_ready = NULL;
+  s->failed = false;
+  s->fragments = s->dropped_bytes = s->holes = s->overflows = 0;
+  s->blocks = s->process_ns = s->max_process_ns = s->max_fill = 0;
+
+  /* Fragments of one block: one wake-up of the mainloop per block. */
+  pa_buffer_attr attr;
+  attr.maxlength = (uint32_t) -1;
+  attr.tlength = attr.prebuf = attr.minreq = (uint32_t) -1;
+  attr.fragsize = (uint32_t) (block_frames * s->frame_bytes);
+  pa_stream_flags_t flags = (pa_stream_flags_t) (PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+                                                 PA_STREAM_AUTO_TIMING_UPDATE);
+
+  pa_threaded_mainloop_lock(e->mainloop);
+  bool ok = (s->stream = pa_stream_new(e->context, name, spec, NULL)) != NULL;
+  if (ok) {
+    pa_stream_set_state_callback(s->stream, pulse_engine_stream_state_callback, s);
+    pa_stream_set_read_callback(s->stream, pulse_engine_read_callback, s);
+    pa_stream_set_overflow_callback(s->stream, pulse_engine_overflow_callback, s);
+    ok = pa_stream_connect_record(s->stream, device, &attr, flags) == 0;
+  }
+  while (ok) {
+    pa_stream_state_t state = pa_stream_get_state(s->stream);
+    if (state == PA_STREAM_READY)
+      break;
+    if (!PA_STREAM_IS_GOOD(state))
+      ok = false;
+    else
+      pa_threaded_mainloop_wait(e->mainloop);
+  }
+  if (!ok) {
+    fprintf(stderr, "pulse_engine: cannot record %s from %s: %s\n", name, device ? device : "default",
+            pa_strerror(pa_context_errno(e->context)));
+    if (s->stream) {
+      pa_stream_set_state_callback(s->stream, NULL, NULL);
+      pa_stream_set_read_callback(s->stream, NULL, NULL);
+      pa_stream_set_overflow_callback(s->stream, NULL, NULL);
+      pa_stream_disconnect(s->stream);
+      pa_stream_unref(s->stream);
+    }
+    pa_threaded_mainloop_unlock(e->mainloop);
+    delete[] s->ring;
+    delete s;
+    return NULL;
+  }
+  e->streams.push_back(s);
+  pa_threaded_mainloop_unlock(e->mainloop);
+  return s;
+}
+
+/* Disconnect every stream, let the workers finish the block they are on,
+   and close the connection. */
+static inline void pulse_engine_stop(pulse_engine *e) {
+  if (!e->mainloop)
+    return;
+  pa_threaded_mainloop_lock(e->mainloop);
+  for (size_t i = 0; i < e->streams.size(); i++) {
+    pa_stream *p = e->streams[i]->stream;
+    pa_stream_set_state_callback(p, NULL, NULL);
+    pa_stream_set_read_callback(p, NULL, NULL);
+    pa_stream_set_overflow_callback(p, NULL, NULL);
+    pa_stream_disconnect(p);
+    pa_stream_unref(p);
+  }
+  pa_context_disconnect(e->context);
+  pa_context_unref(e->context);
+  pa_threaded_mainloop_unlock(e->mainloop);
+  pa_threaded_mainloop_stop(e->mainloop);
+  pa_threaded_mainloop_free(e->mainloop);
+  e->mainloop = NULL;
+
+  {
+    std::lock_guard<std::mutex> hold(e->lock);
+    e->stopping = true;
+  }
+  e->wake.notify_all();
+  for (size_t i = 0; i < e->workers.size(); i++)
+    e->workers[i].join();
+  e->workers.clear();
+  for (size_t i = 0; i < e->streams.size(); i++) {
+    delete[] e->streams[i]->ring;
+    delete e->streams[i];
+  }
+  e->streams.clear();
+  e->ready_head = e->ready_tail = NULL;
+}
+
+static inline void pulse_engine_print_stream_stats(const pulse_engine_stream *s, FILE *out) {
+  uint64_t blocks = s->blocks.load();
+  fprintf(out, "%-16s %lu blocks, %lu fragments, %lu bytes dropped, %lu holes, %lu overflows, "
+          "ring max %.0f%%, process %.1f us avg %.1f us max%s\n",
+          s->name.c_str(), (unsigned long) blocks, (unsigned long) s->fragments.load(),
+          (unsigned long) s->dropped_bytes.load(), (unsigned long) s->holes.load(),
+          (unsigned long) s->overflows.load(), 100.0 * s->max_fill.load() / s->capacity,
+          blocks ? s->process_ns.load() / 1e3 / blocks : 0.0, s->max_process_ns.load() / 1e3,
+          s->failed.load() ? ", FAILED" : "");
+}
+
+#endif  // PULSE_CAPTURE_ENGINE_H_
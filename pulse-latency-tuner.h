@@ -0,0 +1,165 @@
+/*
+  Record-stream buffer attributes from a latency target, tuned at run time.
+
+  A record stream's latency is mostly its fragment size: the server hands
+  data over a fragment at a time. Small fragments mean low latency and
+  more wake-ups, and on a busy host a client that is woken too often falls
+  behind and the server overflows. The smallest fragment that does not
+  overflow depends on the host, so the tuner looks for it:
+
+    - start from the target: fragsize = target, maxlength = MAXLENGTH_FRAGMENTS
+      fragments (room to fall behind before the server overflows)
+    - an overflow doubles the fragment, and the size that overflowed plus
+      a step becomes a floor; the next attempt to go lower waits twice as
+      long as the last one, so a host at its limit settles instead of
+      oscillating
+    - after a clean probe interval the fragment shrinks by a quarter, down
+      to the floor (forgotten once the interval reaches its maximum) or the
+      minimum
+
+  The caller feeds it overflow callbacks and pa_stream_get_latency()
+  readings, calls pulse_tuner_tick() periodically and passes the new
+  attributes to pa_stream_set_buffer_attr() when it returns true.
+
+    pulse_latency_tuner tuner;
+    pulse_tuner_init(&tuner, rate, frame_bytes, target_usec, auto_tune);
+    pulse_tuner_attr(&tuner, &attr);            // for pa_stream_connect_record()
+    pulse_tuner_overflow(&tuner);               // overflow callback
+    pulse_tuner_latency(&tuner, usec);          // whenever measured
+    if (pulse_tuner_tick(&tuner, now_ns)) ...   // timer; set_buffer_attr
+    pulse_tuner_print_stats(&tuner, stderr);    // achieved vs target
+
+  C++11, no Pulse calls: only the attribute arithmetic.
+*/
+#ifndef PULSE_LATENCY_TUNER_H_
+#define PULSE_LATENCY_TUNER_H_
+
+#include <pulse/def.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PULSE_TUNER_MIN_USEC 1000
+#define PULSE_TUNER_MAX_USEC 2000000
+#define PULSE_TUNER_MAXLENGTH_FRAGMENTS 4
+#define PULSE_TUNER_PROBE_NS 2000000000LL
+#define PULSE_TUNER_MAX_PROBE_NS 64000000000LL
+
+struct pulse_latency_tuner {
+  uint32_t rate;
+  uint32_t frame_bytes;
+  uint64_t target_usec;
+  bool auto_tune;
+  uint32_t fragsize;        /* bytes, what we ask for */
+  uint32_t granted;         /* bytes, what the server gave, 0 if unknown */
+  uint32_t min_fragsize, max_fragsize, floor_fragsize;
+  int64_t last_change_ns;
+  int64_t probe_ns;
+  uint64_t overflows, overflows_seen;
+  uint64_t adjustments;
+  /* Measured latency. */
+  uint64_t latency_n;
+  double latency_sum;
+  uint64_t latency_max;
+  uint64_t over_target;     /* readings above the target */
+};
+
+static inline uint32_t pulse_tuner_bytes(const pulse_latency_tuner *t, uint64_t usec) {
+  uint64_t frames = usec * t->rate / 1000000;
+  return (uint32_t) ((frames ? frames : 1) * t->frame_bytes);
+}
+
+static inline uint64_t pulse_tuner_usec(const pulse_latency_tuner *t, uint32_t bytes) {
+  return (uint64_t) bytes / t->frame_bytes * 1000000 / t->rate;
+}
+
+static inline uint32_t pulse_tuner_clamp(const pulse_latency_tuner *t, uint64_t bytes) {
+  if (bytes < t->min_fragsize) bytes = t->min_fragsize;
+  if (bytes > t->max_fragsize) bytes = t->max_fragsize;
+  return (uint32_t) (bytes / t->frame_bytes * t->frame_bytes);
+}
+
+static inline void pulse_tuner_init(pulse_latency_tuner *t, uint32_t rate, uint32_t frame_bytes,
+                                    uint64_t target_usec, bool auto_tune) {
+  memset(t, 0, sizeof(*t));
+  t->rate = rate;
+  t->frame_bytes = frame_bytes;
+  t->target_usec = target_usec;
+  t->auto_tune = auto_tune;
+  t->min_fragsize = pulse_tuner_bytes(t, PULSE_TUNER_MIN_USEC);
+  t->max_fragsize = pulse_tuner_bytes(t, PULSE_TUNER_MAX_USEC);
+  t->fragsize = pulse_tuner_clamp(t, pulse_tuner_bytes(t, target_usec));
+  t->probe_ns = PULSE_TUNER_PROBE_NS;
+}
+
+static inline void pulse_tuner_attr(const pulse_latency_tuner *t, pa_buffer_attr *attr) {
+  attr->fragsize = t->fragsize;
+  attr->maxlength = t->fragsize * PULSE_TUNER_MAXLENGTH_FRAGMENTS;
+  attr->tlength = attr->prebuf = attr->minreq = (uint32_t) -1;  /* playback only */
+}
+
+static inline void pulse_tuner_overflow(pulse_latency_tuner *t) {
+  t->overflows++;
+}
+
+/* What the server actually granted (pa_stream_get_buffer_attr()). */
+static inline void pulse_tuner_granted(pulse_latency_tuner *t, uint32_t fragsize) {
+  t->granted = fragsize;
+}
+
+static inline void pulse_tuner_latency(pulse_latency_tuner *t, uint64_t usec) {
+  t->latency_n++;
+  t->latency_sum += (double) usec;
+  if (usec > t->latency_max) t->latency_max = usec;
+  if (t->target_usec && usec > t->target_usec) t->over_target++;
+}
+
+/* Returns true when the attributes changed. */
+static inline bool pulse_tuner_tick(pulse_latency_tuner *t, int64_t now_ns) {
+  if (!t->last_change_ns)
+    t->last_change_ns = now_ns;
+  if (!t->auto_tune)
+    return false;
+
+  if (t->overflows != t->overflows_seen) {
+    /* Too small for this host: back off, and do not come back here soon. */
+    t->overflows_seen = t->overflows;
+    t->floor_fragsize = pulse_tuner_clamp(t, (uint64_t) t->fragsize * 3 / 2);
+    uint32_t next = pulse_tuner_clamp(t, (uint64_t) t->fragsize * 2);
+    t->probe_ns = t->probe_ns * 2 > PULSE_TUNER_MAX_PROBE_NS ? PULSE_TUNER_MAX_PROBE_NS : t->probe_ns * 2;
+    t->last_change_ns = now_ns;
+    if (next == t->fragsize)
+      return false;
+    t->fragsize = next;
+    t->adjustments++;
+    return true;
+  }
+
+  if (now_ns - t->last_change_ns < t->probe_ns)
+    return false;
+  t->last_change_ns = now_ns;
+  /* Stable at the longest interval: the host may have calmed down. */
+  if (t->probe_ns >= PULSE_TUNER_MAX_PROBE_NS)
+    t->floor_fragsize = 0;
+  uint32_t lowest = t->floor_fragsize > t->min_fragsize ? t->floor_fragsize : t->min_fragsize;
+  if (t->fragsize <= lowest)
+    return false;
+  uint32_t next = pulse_tuner_clamp(t, (uint64_t) t->fragsize * 3 / 4);
+  if (next < lowest) next = lowest;
+  if (next == t->fragsize)
+    return false;
+  t->fragsize = next;
+  t->adjustments++;
+  return true;
+}
+
+static inline void pulse_tuner_print_stats(const pulse_latency_tuner *t, FILE *out) {
+  fprintf(out, "latency: target %.1f ms, achieved %.1f ms avg %.1f ms max (%.1f%% over target), "
+          "fragment %.1f ms (granted %.1f ms), %lu overflows, %lu adjustments%s\n",
+          t->target_usec / 1e3, t->latency_n ? t->latency_sum / t->latency_n / 1e3 : 0.0,
+          t->latency_max / 1e3, t->latency_n ? 100.0 * t->over_target / t->latency_n : 0.0,
+          pulse_tuner_usec(t, t->fragsize) / 1e3, t->granted ? pulse_tuner_usec(t, t->granted) / 1e3 : 0.0,
+          (unsigned long) t->overflows, (unsigned long) t->adjustments, t->auto_tune ? ", auto-tuned" : "");
+}
+
+#endif  // PULSE_LATENCY_TUNER_H_
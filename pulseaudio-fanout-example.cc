@@ -0,0 +1,228 @@
+#include <pulse/error.h>
+#include <pulse/gccmacro.h>
+#include <pulse/simple.h>
+#include <signal.h>
+#include <time.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "broadcast-ring.h"
+
+#define SAMPLE_RATE 22050
+#define BIT_DEPTH 16
+#define BUF_SIZE (SAMPLE_RATE) / 10
+#define RING_SLOTS 64
+
+// One capture feeding three consumers through broadcast-ring.h: a WAV
+// recorder, a level meter and a small feature extractor. Each block is
+// read once from pulse and never copied again; every consumer reads it
+// in place at its own pace.
+//
+// g++ pulseaudio-fanout-example.cc -o pulseaudio-fanout-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpulse-simple -lpthread
+
+void finish(pa_simple *s) {
+  if (s) pa_simple_free(s);
+}
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void writeToFile(std::ofstream &file, int value, int size) {
+    file.write(reinterpret_cast<const char*> (&value), size);
+}
+
+void wav_init(std::ofstream &file, const char *name){
+    file.open(name, std::ios::binary);
+
+    //Header chunk
+    file << "RIFF";
+    file << "----";
+    file << "WAVE";
+
+    // Format chunk
+    file << "fmt ";
+    writeToFile(file, 16, 4); // Size
+    writeToFile(file, 1, 2); // Compression code
+    writeToFile(file, 1, 2); // Number of channels
+    writeToFile(file, SAMPLE_RATE, 4); // Sample rate
+    writeToFile(file, SAMPLE_RATE * BIT_DEPTH / 8, 4 ); // Byte rate
+    writeToFile(file, BIT_DEPTH / 8, 2); // Block align
+    writeToFile(file, BIT_DEPTH, 2); // Bit depth
+
+    //Data chunk
+    file << "data";
+    file << "----";
+}
+
+void wav_close(std::ofstream &file, int pre_audio_pos){
+  int post_audio_pos = file.tellp();
+
+  file.seekp(pre_audio_pos - 4);
+  writeToFile(file, post_audio_pos - pre_audio_pos, 4);
+
+  file.seekp(4, std::ios::beg);
+  writeToFile(file, post_audio_pos - 8, 4);
+  file.close();
+}
+
+/* Consumer 1: everything goes to disk, so resume from the oldest block
+   still in the ring when lapped. The block is copied out first and only
+   written once the release says the writer did not overwrite it; a torn
+   block is left out (and counted as torn). */
+static void recorder(broadcast_ring *ring, int id) {
+  std::ofstream audio_file;
+  wav_init(audio_file, "waveform-fanout.wav");
+  int pre_audio_pos = audio_file.tellp();
+
+  std::vector<char> copy(ring->block_bytes);
+  broadcast_block block;
+  while (broadcast_acquire(ring, id, &block, -1)) {
+    memcpy(copy.data(), block.data, block.bytes);
+    if (broadcast_release(ring, id, &block))
+      audio_file.write(copy.data(), block.bytes);
+  }
+  wav_close(audio_file, pre_audio_pos);
+}
+
+/* Consumer 2: only the latest level matters. */
+static void level_meter(broadcast_ring *ring, int id) {
+  broadcast_block block;
+  while (broadcast_acquire(ring, id, &block, -1)) {
+    const int16_t *samples = (const int16_t*) block.data;
+    int peak = 0;
+    double sum = 0;
+    for (uint32_t i = 0; i < block.frames; i++) {
+      int v = samples[i] < 0 ? -samples[i] : samples[i];
+      if (v > peak) peak = v;
+      sum += (double) samples[i] * samples[i];
+    }
+    if (!broadcast_release(ring, id, &block))
+      continue;
+    double rms = sqrt(sum / block.frames);
+    fprintf(stdout, "level #%lu peak %d rms %.1f\n", (unsigned long) block.seq, peak, rms);
+  }
+}
+
+/* Consumer 3: zero crossing rate and log energy per block. */
+static void feature_extractor(broadcast_ring *ring, int id) {
+  broadcast_block block;
+  while (broadcast_acquire(ring, id, &block, -1)) {
+    const int16_t *samples = (const int16_t*) block.data;
+    uint32_t crossings = 0;
+    double energy = 1e-9;
+    for (uint32_t i = 0; i < block.frames; i++) {
+      if (i && ((samples[i - 1] < 0) != (samples[i] < 0))) crossings++;
+      energy += (double) samples[i] * samples[i];
+    }
+    if (!broadcast_release(ring, id, &block))
+      continue;
+    fprintf(stdout, "features #%lu zcr %.3f log-energy %.2f\n", (unsigned long) block.seq,
+            (double) crossings / block.frames, log10(energy / block.frames));
+  }
+}
+
+static void print_consumer_stats(broadcast_ring *ring) {
+  for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+    broadcast_consumer *c = &ring->consumers[i];
+    if (!c->active.load())
+      continue;
+    fprintf(stdout, "%-10s read %lu dropped %lu torn %lu slow %s (%lu times, max lag %lu)\n",
+            c->name,
+            (unsigned long) c->read.load(),
+            (unsigned long) c->dropped.load(),
+            (unsigned long) c->torn.load(),
+            c->slow.load() ? "yes" : "no",
+            (unsigned long) c->slow_events.load(),
+            (unsigned long) c->max_lag.load());
+  }
+}
+
+// To run this example, install pulseaudio on your machine
+// sudo apt-get install -y libpulse-dev
+// Make sure pulseaudio is set on a valid input
+// -> $ pacmd list-sources | grep -e 'index:' -e device.string -e 'name:'
+// To change the default source -> $ pacmd set-default-source "SOURCE_NAME"
+int main(int argc, char *argv[]) {
+  static pa_sample_spec ss;
+  ss.format = PA_SAMPLE_S16LE;  // May vary based on your system
+  ss.rate = SAMPLE_RATE;
+  ss.channels = 1;
+
+  init_signal();
+
+  pa_simple *s = NULL;
+  int error;
+  // Create the recording stream
+  if (!(s = pa_simple_new(NULL, argv[0], PA_STREAM_RECORD, NULL, "record", &ss,
+                          NULL, NULL, &error))) {
+    fprintf(stderr, __FILE__ ": pa_simple_new() failed: %s\n",
+            pa_strerror(error));
+    finish(s);
+    return -1;
+  }
+
+  static broadcast_ring ring;
+  if (!broadcast_init(&ring, RING_SLOTS, BUF_SIZE * sizeof(int16_t))) {
+    fprintf(stderr, "broadcast_init() failed\n");
+    finish(s);
+    return -1;
+  }
+
+  // A consumer is "slow" once it is a quarter of the ring behind.
+  std::thread recorder_thread(recorder, &ring,
+      broadcast_add_consumer(&ring, "recorder", BROADCAST_LAG, RING_SLOTS / 4));
+  std::thread meter_thread(level_meter, &ring,
+      broadcast_add_consumer(&ring, "meter", BROADCAST_DROP, RING_SLOTS / 4));
+  std::thread feature_thread(feature_extractor, &ring,
+      broadcast_add_consumer(&ring, "features", BROADCAST_DROP, RING_SLOTS / 4));
+
+  uint64_t blocks = 0;
+  while (running) {
+    int16_t *buffer = (int16_t*) broadcast_begin_write(&ring);
+    /* Record some data ... */
+    if (pa_simple_read(s, buffer, BUF_SIZE*sizeof(int16_t), &error) < 0) {
+      fprintf(stderr, __FILE__ ": pa_simple_read() failed: %s\n",
+              pa_strerror(error));
+      break;
+    }
+    // pa_simple_read returns when the block is complete: back-date to its first frame.
+    int64_t timestamp = monotonic_ns() - (int64_t) BUF_SIZE * 1000000000LL / SAMPLE_RATE;
+    broadcast_commit(&ring, BUF_SIZE, BUF_SIZE*sizeof(int16_t), timestamp);
+
+    if (++blocks % 50 == 0)
+      print_consumer_stats(&ring);
+  }
+  printf("finishing...\n");
+
+  broadcast_close(&ring);
+  recorder_thread.join();
+  meter_thread.join();
+  feature_thread.join();
+  print_consumer_stats(&ring);
+
+  broadcast_free(&ring);
+  finish(s);
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "level-meter.h"
+#include "pulse-capture-engine.h"
+
+#define SAMPLE_RATE 48000
+#define BLOCK_MS 20
+#define RING_MS 500
+#define METER_MS 1000
+
+// Records many Pulseaudio sources at once on one connection
+// (pulse-capture-engine.h): the mainloop thread only moves fragments into
+// per-stream rings, a pool of workers meters every block (level-meter.h:
+// peak, RMS, clipping and DC per channel). Every second the streams' last
+// published levels and state are printed.
+//
+// --copies records each source several times, to try dozens of streams
+// per process against a single source; --slow=N makes stream N's
+// processing take three times as long as its audio: that stream drops
+// fragments from its own ring, the others must not.
+//
+// g++ pulseaudio-multi-record-example.cc -o pulseaudio-multi-record-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpthread
+// ./pulseaudio-multi-record-example --copies=32 --workers=4 @DEFAULT_SOURCE@
+// ./pulseaudio-multi-record-example --slow=0 alsa_input.usb-mic.analog-stereo alsa_input.pci.analog-stereo
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+struct level {
+  bool slow;
+  level_meter meter;
+};
+
+static void process_block(pulse_engine_stream *s, const void *data, uint32_t frames, int64_t capture_ns,
+                          void *user) {
+  level *l = (level*) user;
+  level_meter_process_s16(&l->meter, (const int16_t*) data, frames, capture_ns);
+  if (l->slow)
+    usleep((useconds_t) (3e6 * frames / s->spec.rate));
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options] [source...]   (default: @DEFAULT_SOURCE@)\n"
+          "  -r, --rate=RATE      sample rate (default %d)\n"
+          "  -c, --channels=N     channels (default 1)\n"
+          "  -b, --block=MS       block handed to processing (default %d)\n"
+          "  -w, --workers=N      processing threads (default: CPUs)\n"
+          "      --copies=N       record every source N times\n"
+          "      --slow=N         stream N processes at a third of real time\n"
+          "      --meter=MS       level window published to the monitor (default %d)\n",
+          argv0, SAMPLE_RATE, BLOCK_MS, METER_MS);
+}
+
+int main(int argc, char *argv[]) {
+  pa_sample_spec spec;
+  spec.format = PA_SAMPLE_S16LE;
+  spec.rate = SAMPLE_RATE;
+  spec.channels = 1;
+  unsigned block_ms = BLOCK_MS, copies = 1, meter_ms = METER_MS;
+  unsigned workers = std::thread::hardware_concurrency();
+  int slow = -1, c;
+
+  static const struct option long_options[] = {
+      {"rate",     1, NULL, 'r'},
+      {"channels", 1, NULL, 'c'},
+      {"block",    1, NULL, 'b'},
+      {"workers",  1, NULL, 'w'},
+      {"copies",   1, NULL, 'n'},
+      {"slow",     1, NULL, 's'},
+      {"meter",    1, NULL, 'm'},
+      {"help",     0, NULL, 'h'},
+      {NULL,       0, NULL, 0}
+  };
+  while ((c = getopt_long(argc, argv, "r:c:b:w:h", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'r': spec.rate = (uint32_t) atoi(optarg); break;
+      case 'c': spec.channels = (uint8_t) atoi(optarg); break;
+      case 'b': block_ms = (unsigned) atoi(optarg); break;
+      case 'w': workers = (unsigned) atoi(optarg); break;
+      case 'n': copies = (unsigned) atoi(optarg); break;
+      case 's': slow = atoi(optarg); break;
+      case 'm': meter_ms = (unsigned) atoi(optarg); break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (!pa_sample_spec_valid(&spec) || !block_ms || !copies || spec.channels > LEVEL_METER_MAX_CHANNELS) {
+    help(argv[0]);
+    return 1;
+  }
+  if (!workers)
+    workers = 1;
+
+  std::vector<const char*> sources(argv + optind, argv + argc);
+  if (sources.empty())
+    sources.push_back(NULL);
+
+  init_signal();
+
+  static pulse_engine engine;
+  if (pulse_engine_start(&engine, "multi-record", workers) < 0)
+    return 1;
+
+  uint32_t block_frames = spec.rate * block_ms / 1000;
+  uint32_t ring_frames = spec.rate * RING_MS / 1000;
+  std::vector<level*> levels;
+  for (unsigned k = 0; k < copies; k++) {
+    for (size_t i = 0; i < sources.size(); i++) {
+      level *l = new level();
+      l->slow = (int) levels.size() == slow;
+      level_meter_init(&l->meter, spec.rate, spec.channels, meter_ms);
+      std::string name = std::string(sources[i] ? sources[i] : "default") + "#" + std::to_string(k);
+      if (!pulse_engine_add_stream(&engine, name.c_str(), sources[i], &spec, block_frames, ring_frames,
+                                   process_block, l)) {
+        delete l;
+        continue;
+      }
+      levels.push_back(l);
+    }
+  }
+  fprintf(stdout, "%lu streams, %u workers, %u ms blocks\n", (unsigned long) levels.size(), workers, block_ms);
+
+  while (running) {
+    sleep(1);
+    for (size_t i = 0; i < engine.streams.size(); i++) {
+      level_snapshot snap;
+      pulse_engine_print_stream_stats(engine.streams[i], stdout);
+      if (!level_meter_read(&levels[i]->meter, &snap))
+        continue;
+      fprintf(stdout, "  window from %ld.%03ld: ", (long) (snap.capture_ns / 1000000000LL),
+              (long) (snap.capture_ns % 1000000000LL / 1000000));
+      level_snapshot_print(&snap, stdout);
+    }
+  }
+
+  for (size_t i = 0; i < engine.streams.size(); i++)
+    pulse_engine_print_stream_stats(engine.streams[i], stdout);
+  pulse_engine_stop(&engine);
+  for (size_t i = 0; i < levels.size(); i++)
+    delete levels[i];
+  return 0;
+}
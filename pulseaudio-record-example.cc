@@ -4,16 +4,40 @@
 #include <signal.h>
 #include <chrono>
 #include <iostream>
+
+#include "biquad-bank.h"
+#include "capture-clock.h"
+#include "capture-log.h"
+#include "mock-capture.h"
+#include "net-audio-sink.h"
+#include "pulse-latency-tuner.h"
+
 #define SAMPLE_RATE 22050
 #define BUF_SIZE (SAMPLE_RATE) / 2
+#define SINK_BATCH_PACKETS 8
+#define SINK_MAX_DELAY_MS 20
 
 // g++ pulseaudio-record-example.cc -o pulseaudio-record-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpulse-simple
+// Optionally ship the blocks to a receiver (see net-audio-receiver.cc):
+// ./pulseaudio-record-example udp://10.0.0.2:5004
+// Record the blocks as read / replay them without a server (capture-log.h):
+// CAPTURE_LOG=field.caplog ./pulseaudio-record-example
+// CAPTURE_REPLAY=field.caplog CAPTURE_REPLAY_SPEED=4 ./pulseaudio-record-example
+// Or from a mock device, no server needed (mock-capture.h):
+// CAPTURE_MOCK=sine=440,noise=0.01,jitter=2 ./pulseaudio-record-example
+// Server-side fragments for a latency target instead of one block
+// (pulse-latency-tuner.h; the simple API cannot retune a running stream):
+// CAPTURE_LATENCY_USEC=20000 ./pulseaudio-record-example
 
 void finish(pa_simple *s) {
   if (s) pa_simple_free(s);
 }
 
 static bool running = true;
+static net_audio_sink sink;
+static capture_log recording;
+static capture_replay replay;
+static mock_capture mock;
 
 /* Signals handling */
 static void handle_sigterm(int signo) { running = false; }
@@ -41,23 +65,69 @@ int main(int argc, char *argv[]) {
   ss.format = PA_SAMPLE_S16LE;  // May vary based on your system
   ss.rate = SAMPLE_RATE;
   ss.channels = 1;
+  uint32_t block_frames = BUF_SIZE;
+
+  // Workload overrides, so every backend can be benchmarked alike
+  // (capture-backend-bench.cc).
+  if (getenv("CAPTURE_RATE")) ss.rate = atoi(getenv("CAPTURE_RATE"));
+  if (getenv("CAPTURE_CHANNELS")) ss.channels = atoi(getenv("CAPTURE_CHANNELS"));
+  if (getenv("CAPTURE_BLOCK_FRAMES")) block_frames = atoi(getenv("CAPTURE_BLOCK_FRAMES"));
 
   init_signal();
 
   pa_simple *s = NULL;
   
+  // Fragments sized for the latency target, a block by default, and room
+  // for a few of them before the server overflows.
+  uint64_t target_usec = (uint64_t) block_frames * 1000000 / ss.rate;
+  if (getenv("CAPTURE_LATENCY_USEC")) target_usec = strtoull(getenv("CAPTURE_LATENCY_USEC"), NULL, 10);
+  static pulse_latency_tuner tuner;
+  pulse_tuner_init(&tuner, ss.rate, ss.channels * sizeof(int16_t), target_usec, false);
   static pa_buffer_attr buf_attr;
-  // buf_attr.maxlength = (uint32_t) 1073741824; // 1G
-  // buf_attr.maxlength = (uint32_t) 8448; // 0.1%
-  buf_attr.maxlength = (uint32_t) 2000; // 0.0...%
-  buf_attr.fragsize = (uint32_t) 0;
-  buf_attr.minreq = 0;
-  buf_attr.prebuf = (uint32_t) -1;
-  buf_attr.tlength = 0;
+  pulse_tuner_attr(&tuner, &buf_attr);
   
   int error;
+  const char *sink_url = argc > 1 ? argv[1] : NULL;
+  if (sink_url && net_audio_sink_open(&sink, sink_url, getpid(), NET_AUDIO_S16LE, ss.rate,
+                                      ss.channels, SINK_BATCH_PACKETS, SINK_MAX_DELAY_MS) < 0)
+    return -1;
+
+  const char *log_path = getenv("CAPTURE_LOG");
+  const char *replay_path = getenv("CAPTURE_REPLAY");
+  const char *mock_spec = replay_path ? NULL : getenv("CAPTURE_MOCK");
+  if (log_path && capture_log_open(&recording, log_path, CAPTURE_LOG_S16LE, ss.rate,
+                                   ss.channels, "pulse-simple") < 0) {
+    fprintf(stderr, __FILE__ ": cannot write capture log %s: %s\n", log_path, strerror(errno));
+    return -1;
+  }
+  if (replay_path) {
+    if (capture_replay_open(&replay, replay_path, capture_replay_parse_speed(getenv("CAPTURE_REPLAY_SPEED"))) < 0 ||
+        replay.header.format != CAPTURE_LOG_S16LE || replay.header.rate != ss.rate ||
+        replay.header.channels != ss.channels) {
+      fprintf(stderr, __FILE__ ": cannot replay %s: not a %u Hz %d channel s16le capture log\n",
+              replay_path, ss.rate, ss.channels);
+      return -1;
+    }
+  }
+  if (mock_spec) {
+    mock_capture_config cfg;
+    mock_capture_default_config(&cfg, ss.rate, ss.channels, MOCK_S16);
+    if (mock_capture_parse(&cfg, mock_spec) < 0) {
+      fprintf(stderr, __FILE__ ": cannot parse CAPTURE_MOCK=%s\n", mock_spec);
+      return -1;
+    }
+    mock_capture_open(&mock, &cfg);
+  }
+  const char *filter_spec = getenv("CAPTURE_FILTER");
+  biquad_bank filter;
+  if (filter_spec && (!biquad_bank_init(&filter, ss.channels, 1, block_frames) ||
+                      !biquad_bank_configure(&filter, ss.rate, filter_spec))) {
+    fprintf(stderr, __FILE__ ": cannot parse CAPTURE_FILTER=%s\n", filter_spec);
+    return -1;
+  }
+
   // Create the recording stream
-  if (!(s = pa_simple_new(NULL, argv[0], PA_STREAM_RECORD, NULL, "record", &ss,
+  if (!replay_path && !mock_spec && !(s = pa_simple_new(NULL, argv[0], PA_STREAM_RECORD, NULL, "record", &ss,
                           NULL, &buf_attr, &error))) {
     fprintf(stderr, __FILE__ ": pa_simple_new() failed: %s\n",
             pa_strerror(error));
@@ -65,11 +135,25 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  int16_t* buffer = (int16_t*) malloc(BUF_SIZE*sizeof(int16_t));
+  capture_clock stream_clock;
+  uint64_t position = 0;
+  capture_clock_init(&stream_clock, ss.rate, CAPTURE_CLOCK_TAU_SEC);
+
+  int16_t* buffer = (int16_t*) malloc(block_frames*ss.channels*sizeof(int16_t));
   while (running) {   
     auto start = std::chrono::high_resolution_clock::now(); 
-    /* Record some data ... */
-    if (pa_simple_read(s, (int16_t*) buffer, BUF_SIZE*sizeof(int16_t), &error) < 0) {
+    int64_t read_start_ns = capture_log_monotonic_ns(), logged_capture_ns = 0;
+    if (replay_path) {
+      long n = capture_replay_read(&replay, buffer, block_frames, &logged_capture_ns);
+      if (n == 0)
+        break;
+      if (n != (long) block_frames)  // an xrun, or a short last block
+        continue;
+    } else if (mock_spec) {
+      if (mock_capture_read(&mock, buffer, block_frames, &logged_capture_ns) != (long) block_frames)
+        continue;  // injected xrun or overrun
+    } else if (pa_simple_read(s, (int16_t*) buffer, block_frames*ss.channels*sizeof(int16_t), &error) < 0) {
+      /* Record some data ... */
       fprintf(stderr, __FILE__ ": pa_simple_read() failed: %s\n",
               pa_strerror(error));
       finish(s);
@@ -77,9 +161,62 @@ int main(int argc, char *argv[]) {
     }
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-    fprintf(stdout, "read %d done %d ms \n", buffer[0], duration);
+
+    int64_t read_end_ns = capture_log_monotonic_ns();
+
+    // The latency is how long ago the first frame after our block was
+    // captured; the block itself starts block_frames frames earlier.
+    int64_t raw_ns = read_end_ns - (int64_t) block_frames * 1000000000LL / ss.rate;
+    pa_usec_t latency = s ? pa_simple_get_latency(s, &error) : (pa_usec_t) -1;
+    if (latency != (pa_usec_t) -1) {
+      raw_ns -= (int64_t) latency * 1000;
+      pulse_tuner_latency(&tuner, latency);
+    }
+    int64_t capture_ns = capture_clock_update(&stream_clock, position, raw_ns) + monotonic_to_realtime_ns();
+    position += block_frames;
+    if (logged_capture_ns)
+      capture_ns = logged_capture_ns;  // replayed or mocked: keep the source's timestamps
+
+    if (recording.file)
+      capture_log_block(&recording, buffer, block_frames, read_start_ns, read_end_ns, capture_ns);
+
+    // After the log, so a replay runs the filter again on the raw input.
+    if (filter_spec)
+      biquad_process_s16(&filter, buffer, block_frames);
+
+    fprintf(stdout, "read %d done %d ms, captured at %ld.%06ld \n", buffer[0], duration,
+            (long) (capture_ns / 1000000000LL), (long) (capture_ns % 1000000000LL / 1000));
+
+    // A fatal socket error (the receiver went away) ends the streaming,
+    // not the capture.
+    if (sink_url && net_audio_sink_push(&sink, buffer, block_frames, capture_ns) < 0) {
+      fprintf(stderr, "sending to %s failed (%s), streaming stopped\n", sink_url, strerror(errno));
+      net_audio_sink_print_stats(&sink, stdout);
+      net_audio_sink_close(&sink);
+      sink_url = NULL;
+    }
+  }
+
+  capture_clock_print_stats(&stream_clock, stdout);
+  if (s)
+    pulse_tuner_print_stats(&tuner, stdout);
+
+  if (sink_url) {
+    net_audio_sink_print_stats(&sink, stdout);
+    net_audio_sink_close(&sink);
+  }
+
+  if (recording.file)
+    capture_log_close(&recording);
+  if (replay_path) {
+    capture_replay_print_stats(&replay, stdout);
+    capture_replay_close(&replay);
   }
+  if (mock_spec)
+    mock_capture_print_stats(&mock, stdout);
 
+  if (filter_spec)
+    biquad_bank_free(&filter);
   free(buffer);
   finish(s);
   return 0;
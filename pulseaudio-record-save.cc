@@ -1,17 +1,44 @@
 #include <pulse/error.h>
 #include <pulse/gccmacro.h>
 #include <pulse/simple.h>
+#include <getopt.h>
 #include <signal.h>
 #include <chrono>
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <vector>
+
+#include "loudness-meter.h"
+#include "onset-detector.h"
+#include "wave-overview.h"
 
 #define SAMPLE_RATE 22050
 #define BIT_DEPTH 16
-#define BUF_SIZE (SAMPLE_RATE) / 2
+#define BUF_SIZE (SAMPLE_RATE / 2)
+#define MAX_EVENTS 64
 
 // g++ pulseaudio-record-example.cc -o pulseaudio-record-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpulse-simple
+//
+// Loudness (loudness-meter.h) is measured as the blocks are written, so QA
+// never has to read the WAV back: waveform-pa.loudness gets a line per
+// block with the seconds recorded and the momentary, short-term and
+// integrated loudness so far (LUFS), and the integrated loudness of the
+// whole recording is printed at the end.
+//
+// With --trigger only what happens is kept: every block goes through an
+// onset detector (onset-detector.h: spectral flux onsets, and the bands
+// given with --band=LO-HI:DB), and a block is written when it has an
+// event or a band is on, with --pre-ms before it and --post-ms after.
+// The events go to waveform-pa.events (capture seconds, type, band,
+// value), with a line where each kept stretch starts in the WAV.
+//
+//   ./pulseaudio-record-save --trigger --band=300-3000:-35 --post-ms=3000
+//
+// What goes into the WAV also goes into waveform-pa.overview
+// (wave-overview.h): min/max/RMS from 23 ms to 95 s per bin and a coarse
+// log spectrogram, so a long recording can be viewed or searched without
+// reading it (wave-overview-tool.cc). --no-overview turns it off.
 
 class SineOscillator {
     float frequency, amplitude, angle = 0.0f, offset = 0.0f;
@@ -86,7 +113,50 @@ void wav_close(std::ofstream &file){
 // It's also very common that pulse audio is not starting correctly.
 // pulseaudio -k #kill the process just in case
 // pulseaudio -D #start it again
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  --trigger          keep only the audio around events\n"
+          "  --band=LO-HI:DB    an event while LO-HI Hz is over DB dBFS (repeatable)\n"
+          "  --onset-ratio=X    onset threshold over the recent flux (1.5)\n"
+          "  --pre-ms=MS        kept before an event (1000)\n"
+          "  --post-ms=MS       kept after the last event (2000)\n"
+          "  --no-overview      no waveform-pa.overview next to the WAV\n",
+          argv0);
+}
+
 int main(int argc, char *argv[]) {
+  bool trigger = false, overview_on = true;
+  double pre_ms = 1000, post_ms = 2000;
+  onset_config onset_cfg;
+  onset_default_config(&onset_cfg, SAMPLE_RATE, 1);
+
+  enum { TRIGGER = 256, BAND, ONSET_RATIO, PRE_MS, POST_MS, NO_OVERVIEW };
+  static const struct option long_options[] = {
+    {"trigger", 0, NULL, TRIGGER}, {"band", 1, NULL, BAND}, {"onset-ratio", 1, NULL, ONSET_RATIO},
+    {"pre-ms", 1, NULL, PRE_MS}, {"post-ms", 1, NULL, POST_MS}, {"no-overview", 0, NULL, NO_OVERVIEW},
+    {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case TRIGGER: trigger = true; break;
+      case BAND:
+        if (!onset_parse_band(&onset_cfg, optarg)) {
+          fprintf(stderr, "bad band %s (LO-HI:DB, at most %d)\n", optarg, ONSET_MAX_BANDS);
+          return 1;
+        }
+        break;
+      case ONSET_RATIO: onset_cfg.flux_ratio = (float) atof(optarg); break;
+      case PRE_MS: pre_ms = atof(optarg); break;
+      case POST_MS: post_ms = atof(optarg); break;
+      case NO_OVERVIEW: overview_on = false; break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
   static pa_sample_spec ss;
   ss.format = PA_SAMPLE_S16LE;  // May vary based on your system
   ss.rate = SAMPLE_RATE;
@@ -123,6 +193,40 @@ int main(int argc, char *argv[]) {
   SineOscillator sineOscillator(440,0.5);
   auto maxAmplitude = pow(2, BIT_DEPTH - 1) - 1;
 
+  loudness_bank loudness;
+  loudness_bank_init(&loudness, SAMPLE_RATE, ss.channels, 1, BUF_SIZE);
+  FILE *loudness_log = fopen("waveform-pa.loudness", "w");
+  if (loudness_log)
+    fprintf(loudness_log, "# seconds momentary short-term integrated (LUFS)\n");
+  uint64_t frames_written = 0, frames_captured = 0;
+
+  wave_overview overview;
+  if (overview_on && wave_overview_open(&overview, "waveform-pa.overview", SAMPLE_RATE, NULL) < 0) {
+    fprintf(stderr, "cannot write waveform-pa.overview\n");
+    overview_on = false;
+  }
+
+  /* --trigger: the blocks before an event wait in a pre-roll ring. */
+  onset_detector onset;
+  FILE *events_log = NULL;
+  size_t pre_blocks = (size_t) ceil(pre_ms * SAMPLE_RATE / 1000 / BUF_SIZE);
+  uint64_t post_blocks = (uint64_t) ceil(post_ms * SAMPLE_RATE / 1000 / BUF_SIZE);
+  std::vector<int16_t> preroll;
+  size_t preroll_count = 0, preroll_next = 0;
+  uint64_t block_index = 0, keep_until = 0;
+  bool keeping = false;
+  onset_event events[MAX_EVENTS];
+  if (trigger) {
+    if (!onset_detector_init(&onset, &onset_cfg)) {
+      fprintf(stderr, "bad onset detector settings\n");
+      return 1;
+    }
+    preroll.resize(pre_blocks * BUF_SIZE);
+    events_log = fopen("waveform-pa.events", "w");
+    if (events_log)
+      fprintf(events_log, "# seconds event [band] value (flux, or band dBFS)\n");
+  }
+
   int16_t* buffer = (int16_t*) malloc(BUF_SIZE*sizeof(int16_t));
   while (running) {   
     auto start = std::chrono::high_resolution_clock::now(); 
@@ -137,9 +241,58 @@ int main(int argc, char *argv[]) {
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     fprintf(stdout, "read %d done %ld ms \n", buffer[0], duration);
 
+    frames_captured += BUF_SIZE;
+
+    bool keep = true;
+    if (trigger) {
+      int64_t capture_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count() - (int64_t) BUF_SIZE * 1000000000 / SAMPLE_RATE;
+      size_t n = onset_detector_process_s16(&onset, buffer, BUF_SIZE, capture_ns, events, MAX_EVENTS);
+      for (size_t i = 0; events_log && i < n; i++)
+        onset_event_print(&events[i], SAMPLE_RATE, events_log);
+      if (n || onset_detector_active(&onset))
+        keep_until = block_index + 1 + post_blocks;
+      keep = block_index < keep_until;
+      if (keep && !keeping) {
+        /* A kept stretch starts with the pre-roll, oldest first. */
+        if (events_log)
+          fprintf(events_log, "# kept from %.1f s, at %.1f s in the WAV\n",
+                  (double) (frames_captured - (preroll_count + 1) * BUF_SIZE) / SAMPLE_RATE,
+                  (double) frames_written / SAMPLE_RATE);
+        size_t first = (preroll_next + pre_blocks - preroll_count) % (pre_blocks ? pre_blocks : 1);
+        for (size_t i = 0; i < preroll_count; i++) {
+          size_t slot = (first + i) % pre_blocks;
+          audio_file.write(reinterpret_cast<const char*>(&preroll[slot * BUF_SIZE]), BUF_SIZE * sizeof(int16_t));
+          if (overview_on)
+            wave_overview_add_s16(&overview, &preroll[slot * BUF_SIZE], BUF_SIZE);
+          frames_written += BUF_SIZE;
+        }
+        preroll_count = 0;
+      }
+      if (!keep && pre_blocks) {
+        memcpy(&preroll[preroll_next * BUF_SIZE], buffer, BUF_SIZE * sizeof(int16_t));
+        preroll_next = (preroll_next + 1) % pre_blocks;
+        if (preroll_count < pre_blocks) preroll_count++;
+      }
+      keeping = keep;
+      block_index++;
+    }
+
     // Write to file
     start = std::chrono::high_resolution_clock::now(); 
-    for(int i=0; i<BUF_SIZE; i++) writeToFile(audio_file, buffer[i], 2);
+    // The whole block at once: one call into the filebuf, not one per sample.
+    if (keep) {
+      audio_file.write(reinterpret_cast<const char*>(buffer), BUF_SIZE * sizeof(int16_t));
+      if (overview_on)
+        wave_overview_add_s16(&overview, buffer, BUF_SIZE);
+      frames_written += BUF_SIZE;
+    }
+
+    loudness_process_s16(&loudness, buffer, BUF_SIZE);
+    if (loudness_log)
+      fprintf(loudness_log, "%.1f %.1f %.1f %.1f\n", (double) frames_captured / SAMPLE_RATE,
+              loudness_momentary(&loudness.stream[0]), loudness_short_term(&loudness.stream[0]),
+              loudness_integrated(&loudness.stream[0]));
     
     // auto sample = sineOscillator.process();
     // int intSample = static_cast<int> (sample * maxAmplitude);
@@ -150,6 +303,22 @@ int main(int argc, char *argv[]) {
     fprintf(stdout, "write done %ld ms \n", duration);
   }
   printf("finishing...\n");
+  fprintf(stdout, "%.1f s recorded, ", (double) frames_written / SAMPLE_RATE);
+  if (trigger)
+    fprintf(stdout, "of %.1f s captured, ", (double) frames_captured / SAMPLE_RATE);
+  loudness_print(&loudness.stream[0], stdout);
+  if (loudness_log)
+    fclose(loudness_log);
+  if (trigger) {
+    onset_detector_print_stats(&onset, stdout);
+    if (events_log)
+      fclose(events_log);
+  }
+  loudness_bank_free(&loudness);
+  if (overview_on) {
+    wave_overview_close(&overview);
+    wave_overview_print_stats(&overview, stdout);
+  }
 
   int post_audio_pos = audio_file.tellp();
 
@@ -0,0 +1,108 @@
+#include <pulse/error.h>
+#include <pulse/gccmacro.h>
+#include <pulse/simple.h>
+#include <signal.h>
+#include <time.h>
+#include <chrono>
+#include <iostream>
+
+#include "shm-audio-bus.h"
+
+#define SAMPLE_RATE 22050
+#define BUF_SIZE (SAMPLE_RATE) / 100
+#define RING_SLOTS 256
+
+// Capture from pulse and publish every block on a shared-memory bus
+// (shm-audio-bus.h). Any number of analysis processes can attach with
+// shm-bus-reader-example; they map the ring read-only, and a reader
+// crashing or stalling never blocks this loop.
+//
+// g++ pulseaudio-shm-publish-example.cc -o pulseaudio-shm-publish-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpulse-simple
+// ./pulseaudio-shm-publish-example mic0
+
+void finish(pa_simple *s) {
+  if (s) pa_simple_free(s);
+}
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// To run this example, install pulseaudio on your machine
+// sudo apt-get install -y libpulse-dev
+// Make sure pulseaudio is set on a valid input
+// -> $ pacmd list-sources | grep -e 'index:' -e device.string -e 'name:'
+int main(int argc, char *argv[]) {
+  const char *bus_name = argc > 1 ? argv[1] : "mic0";
+  static pa_sample_spec ss;
+  ss.format = PA_SAMPLE_S16LE;  // May vary based on your system
+  ss.rate = SAMPLE_RATE;
+  ss.channels = 1;
+
+  init_signal();
+
+  static pa_buffer_attr buf_attr;
+  buf_attr.maxlength = (uint32_t) -1;
+  buf_attr.fragsize = (uint32_t) (BUF_SIZE * sizeof(int16_t));
+  buf_attr.minreq = (uint32_t) -1;
+  buf_attr.prebuf = (uint32_t) -1;
+  buf_attr.tlength = (uint32_t) -1;
+
+  pa_simple *s = NULL;
+  int error;
+  // Create the recording stream
+  if (!(s = pa_simple_new(NULL, argv[0], PA_STREAM_RECORD, NULL, "record", &ss,
+                          NULL, &buf_attr, &error))) {
+    fprintf(stderr, __FILE__ ": pa_simple_new() failed: %s\n",
+            pa_strerror(error));
+    finish(s);
+    return -1;
+  }
+
+  shm_bus bus;
+  if (shm_bus_create(&bus, bus_name, SAMPLE_RATE, ss.channels, sizeof(int16_t), BUF_SIZE, RING_SLOTS) < 0) {
+    finish(s);
+    return -1;
+  }
+  fprintf(stdout, "publishing on bus '%s'\n", bus_name);
+
+  while (running) {
+    // Capture straight into the shared slot: no intermediate buffer.
+    void *slot = shm_bus_begin_write(&bus);
+    if (pa_simple_read(s, slot, BUF_SIZE*sizeof(int16_t), &error) < 0) {
+      fprintf(stderr, __FILE__ ": pa_simple_read() failed: %s\n",
+              pa_strerror(error));
+      break;
+    }
+    // pa_simple_read returns once the block is complete: back-date to its
+    // first frame, minus what is still queued in the server.
+    pa_usec_t latency = pa_simple_get_latency(s, &error);
+    int64_t timestamp = monotonic_ns() - (int64_t) latency * 1000
+        - (int64_t) BUF_SIZE * 1000000000LL / SAMPLE_RATE;
+    shm_bus_commit(&bus, BUF_SIZE, timestamp);
+
+    if (bus.published % 100 == 0)
+      fprintf(stdout, "published %lu blocks to %d readers\n", (unsigned long) bus.published, bus.clients);
+  }
+
+  shm_bus_destroy(&bus);
+  finish(s);
+  return 0;
+}
@@ -20,6 +20,20 @@
   USA.
 
   g++ pulseaudio-stream-example.cc -o pulseaudio-stream-example -lm -std=c++11 -ldl -lstdc++ -lpulse -lpulse-simple
+
+  Raw PCM to stdout (pipes use vmsplice, see pcm-pipe-sink.h):
+  ./pulseaudio-stream-example --stdout --format s16le --rate 48000 --channels 2 | \
+      ffmpeg -f s16le -ar 48000 -ac 2 -i - out.flac
+
+  Capture time of every fragment ("<frame> <CLOCK_REALTIME ns>" per line):
+  ./pulseaudio-stream-example --stdout --timestamps=out.ts > out.raw
+
+  Every fragment as delivered, for capture-log-tool or the backend benchmark:
+  CAPTURE_LOG=field.caplog ./pulseaudio-stream-example --stdout > /dev/null
+
+  Aim for 10 ms and let it find the smallest fragment this host keeps up
+  with (pulse-latency-tuner.h); the achieved latency is printed at exit:
+  ./pulseaudio-stream-example --stdout --latency=10000 > /dev/null
 ***/
 
 // #include <pulse/i18n.h>
@@ -27,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <iostream>
 #include <memory>
 #include <pulse/pulseaudio.h>
@@ -36,6 +51,12 @@
 #include <chrono>
 #include <iostream>
 
+#include "capture-clock.h"
+#include "capture-log.h"
+#include "level-meter.h"
+#include "pcm-pipe-sink.h"
+#include "pulse-latency-tuner.h"
+
 #define TIME_EVENT_USEC 50000
 #define SAMPLE_RATE 22050
 #define BUF_SIZE (SAMPLE_RATE) / 2
@@ -57,6 +78,18 @@ static pa_stream *stream = NULL;
 static void *buffer = NULL;
 static size_t buffer_length = 0, buffer_index = 0;
 
+/* Record: one block, allocated before the stream starts. Fragments are
+   gathered here and processed a block at a time, so nothing is
+   allocated per fragment. */
+static uint8_t *block = NULL;
+static size_t block_length = 0, block_fill = 0;
+static int64_t block_capture_ns = 0;   /* the block's first frame */
+/* Each block is metered; levels are printed per CAPTURE_METER_MS window
+   (per block by default) for s16 and float32 streams. */
+static level_meter meter;
+static bool metered = false;
+static uint64_t levels_shown = 0;
+
 static pa_context *context = NULL;
 static pa_stream_flags_t flags;
 static int64_t ts = 0;
@@ -76,9 +109,25 @@ static pa_sample_spec sample_spec = {
     .rate = SAMPLE_RATE,
     .channels = 1
 };
-static size_t latency = 0, process_time=0;
+/* Target (--latency, 0: server default) and last measured latency, usec. */
+static pa_usec_t target_latency = 0, measured_latency = 0;
+static bool tune_latency = true;
+static pulse_latency_tuner tuner;
 static int verbose = 1;
 
+/* --stdout: raw PCM goes to stdout, everything else to stderr. */
+static bool stream_stdout = false;
+static size_t max_buffer_msec = 500;
+static bool allow_vmsplice = true;
+static pcm_pipe_sink sink;
+static FILE *log_out = stdout;
+
+/* Capture timestamps: frames read so far and their fitted clock. */
+static capture_clock stream_clock;
+static uint64_t frames_read = 0;
+static FILE *timestamps = NULL;
+static capture_log recording;
+
 /* A shortcut for terminating the application */
 static void quit(int ret) {
     assert(mainloop_api);
@@ -210,14 +259,7 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
     assert(e);
     assert(stdio_event == e);
 
-    if (!buffer) {
-        mainloop_api->io_enable(stdio_event, PA_IO_EVENT_NULL);
-        return;
-    }
-
-    assert(buffer_length);
-
-    if ((r = write(fd, (uint8_t*) buffer+buffer_index, buffer_length)) <= 0) {
+    if ((r = pcm_pipe_sink_flush(&sink)) < 0) {
         fprintf(stderr, ("write() failed: %s\n"), strerror(errno));
         quit(1);
 
@@ -226,14 +268,9 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
         return;
     }
 
-    buffer_length -= (uint32_t) r;
-    buffer_index += (uint32_t) r;
-
-    if (!buffer_length) {
-        pa_xfree(buffer);
-        buffer = NULL;
-        buffer_length = buffer_index = 0;
-    }
+    /* Drained: stop polling for POLLOUT until the next fragment. */
+    if (!r)
+        mainloop_api->io_enable(stdio_event, PA_IO_EVENT_NULL);
 }
 
 /* Show the current latency */
@@ -268,13 +305,91 @@ static void get_latency(pa_stream *s)
 		fprintf(stderr, "AUDIO: Pulseaudio pa_stream_get_latency() failed\n");
 		return;
 	}
-	latency = l; /*can only be negative in monitoring streams*/
+	measured_latency = l; /*can only be negative in monitoring streams*/
+	if (target_latency > 0 && !negative)
+		pulse_tuner_latency(&tuner, l);
 }
 
-static void do_stream_process(){
-  static uint8_t _buffer[BUF_SIZE];
-  static uint8_t _buffer_length = NULL;
-  static uint8_t _buffer_index = NULL;
+/* A full block of block_length bytes, in place. */
+static void do_stream_process(const uint8_t *data, size_t length, int64_t capture_ns) {
+    if (!metered)
+        return;
+    uint32_t frames = (uint32_t) (length / pa_frame_size(&sample_spec));
+    if (sample_spec.format == PA_SAMPLE_S16LE)
+        level_meter_process_s16(&meter, (const int16_t*) data, frames, capture_ns);
+    else
+        level_meter_process_f32(&meter, (const float*) data, frames, capture_ns);
+    level_snapshot levels;
+    if (level_meter_read(&meter, &levels) && levels.window + 1 > levels_shown) {
+        levels_shown = levels.window + 1;
+        level_snapshot_print(&levels, log_out);
+    }
+}
+
+/* Date the fragment just peeked, i.e. the frames at the read index.
+   On a record stream pa_stream_get_latency() is how long ago that frame
+   was captured: source latency plus what waits in the server and client
+   buffers. With PA_STREAM_INTERPOLATE_TIMING it costs no round trip. */
+static int64_t stamp_fragment(pa_stream *s, size_t length) {
+    pa_usec_t l;
+    int negative = 0;
+    int64_t raw_ns;
+
+    if (pa_stream_get_latency(s, &l, &negative) == 0)
+        raw_ns = capture_clock_monotonic_ns() - (negative ? -1 : 1) * (int64_t) l * 1000;
+    else if (stream_clock.locked)
+        raw_ns = capture_clock_time(&stream_clock, frames_read);
+    else
+        raw_ns = capture_clock_monotonic_ns();
+
+    int64_t capture_ns = capture_clock_update(&stream_clock, frames_read, raw_ns)
+        + monotonic_to_realtime_ns();
+    if (timestamps)
+        fprintf(timestamps, "%lu %ld\n", (unsigned long) frames_read, (long) capture_ns);
+    frames_read += length / pa_frame_size(&sample_spec);
+    return capture_ns;
+}
+
+/* CAPTURE_LOG: the fragment as peeked, dated. A callback has no read
+   start, so both read times are the delivery time. */
+static void log_fragment(const void *data, size_t length, int64_t capture_ns) {
+    int64_t now = capture_log_monotonic_ns();
+    uint32_t frames = (uint32_t) (length / pa_frame_size(&sample_spec));
+    if (data)
+        capture_log_block(&recording, data, frames, now, now, capture_ns);
+    else
+        capture_log_xrun(&recording, now);
+}
+
+/* --stdout: queue the fragment in the sink and push it out without
+   blocking; whatever the reader does not take yet waits for POLLOUT. */
+static void stream_stdout_fragment(pa_stream *s) {
+    const void *data;
+    size_t length;
+
+    while (pa_stream_readable_size(s) > 0) {
+        if (pa_stream_peek(s, &data, &length) < 0) {
+            fprintf(stderr, ("pa_stream_peek() failed: %s\n"), pa_strerror(pa_context_errno(context)));
+            return;
+        }
+        if (!length)
+            break;
+        int64_t capture_ns = stamp_fragment(s, length);
+        if (recording.file)
+            log_fragment(data, length, capture_ns);
+        /* data == NULL is a hole in the record stream: it goes out as
+           silence, so the reader's timeline keeps its length. */
+        pcm_pipe_sink_push(&sink, data, length);
+        pa_stream_drop(s);
+    }
+
+    ssize_t pending = pcm_pipe_sink_flush(&sink);
+    if (pending < 0) {
+        fprintf(stderr, ("write() failed: %s\n"), strerror(errno));
+        quit(1);
+    } else if (pending && stdio_event) {
+        mainloop_api->io_enable(stdio_event, PA_IO_EVENT_OUTPUT);
+    }
 }
 
 static void stream_read_callback(pa_stream *s, size_t length, void *userdata){
@@ -282,37 +397,80 @@ static void stream_read_callback(pa_stream *s, size_t length, void *userdata){
     assert(s);
     assert(length > 0);
 
-    if (stdio_event)
-      mainloop_api->io_enable(stdio_event, PA_IO_EVENT_OUTPUT);
-
-		if (verbose) {
-      get_latency(s);
-      fprintf(stdout, "length %ld read at %ld us\n", length, latency);
-    } else fprintf(stdout, "length %ld read \n", length);
-    
+    if (stream_stdout) {
+        stream_stdout_fragment(s);
+        return;
+    }
 
     if (pa_stream_peek(s, &data, &length) < 0) {
         fprintf(stderr, ("pa_stream_peek() failed: %s\n"), pa_strerror(pa_context_errno(context)));
         return;
     }
 
+    int64_t capture_ns = stamp_fragment(s, length);
+    if (recording.file)
+        log_fragment(data, length, capture_ns);
+		if (verbose) {
+      get_latency(s);
+      fprintf(log_out, "length %ld read at %ld us, captured at %ld.%06ld\n", length, (long) measured_latency,
+              (long) (capture_ns / 1000000000LL), (long) (capture_ns % 1000000000LL / 1000));
+    } else fprintf(log_out, "length %ld read \n", length);
+
     assert(data);
     assert(length > 0);
 
-    if (buffer) {
-        buffer = pa_xrealloc(buffer, buffer_length + length);
-        memcpy((uint8_t*) buffer + buffer_length, data, length);
-        buffer_length += length;
-    } else {
-        buffer = pa_xmalloc(length);
-        memcpy(buffer, data, length);
-        buffer_length = length;
-        buffer_index = 0;
+    for (size_t done = 0; done < length; ) {
+        size_t n = block_length - block_fill;
+        if (n > length - done)
+            n = length - done;
+        if (!block_fill)
+            block_capture_ns = capture_ns + (int64_t) (done / pa_frame_size(&sample_spec)) * 1000000000LL /
+                                            sample_spec.rate;
+        memcpy(block + block_fill, (const uint8_t*) data + done, n);
+        block_fill += n;
+        done += n;
+        if (block_fill == block_length) {
+            do_stream_process(block, block_length, block_capture_ns);
+            block_fill = 0;
+        }
     }
 
     pa_stream_drop(s);
+}
+
+/* The server fell behind us: the fragment is too small for this host. */
+static void stream_overflow_callback(pa_stream *s, void *userdata) {
+    pulse_tuner_overflow(&tuner);
+}
+
+/* What the server made of our attributes, or changed them to. */
+static void stream_buffer_attr_callback(pa_stream *s, void *userdata) {
+    const pa_buffer_attr *a = pa_stream_get_buffer_attr(s);
+    if (a)
+        pulse_tuner_granted(&tuner, a->fragsize);
+}
+
+static void stream_set_buffer_attr_callback(pa_stream *s, int success, void *userdata) {
+    if (!success)
+        fprintf(stderr, ("pa_stream_set_buffer_attr() failed: %s\n"), pa_strerror(pa_context_errno(context)));
+    stream_buffer_attr_callback(s, userdata);
+}
 
-    do_stream_process();
+/* Feed the tuner a measurement and apply what it decides. */
+static void stream_tune_latency(pa_stream *s) {
+    pa_buffer_attr buffer_attr;
+    pa_operation *o;
+
+    if (!tuner.granted)
+        stream_buffer_attr_callback(s, NULL);
+    get_latency(s);
+    if (!pulse_tuner_tick(&tuner, capture_clock_monotonic_ns()))
+        return;
+    pulse_tuner_attr(&tuner, &buffer_attr);
+    if (!(o = pa_stream_set_buffer_attr(s, &buffer_attr, stream_set_buffer_attr_callback, NULL)))
+        fprintf(stderr, ("pa_stream_set_buffer_attr() failed: %s\n"), pa_strerror(pa_context_errno(context)));
+    else
+        pa_operation_unref(o);
 }
 
 /* This is called whenever the context status changes */
@@ -335,7 +493,7 @@ static void context_state_callback(pa_context *c, void *userdata) {
             if (verbose)
                 fprintf(stderr, ("Connection established.%s \n"), CLEAR_LINE);
 
-            if (!(stream = pa_stream_new(c, (char*) stream_name.get(), &sample_spec, NULL))) {
+            if (!(stream = pa_stream_new(c, stream_name->c_str(), &sample_spec, NULL))) {
                 fprintf(stderr, ("pa_stream_new() failed: %s\n"), pa_strerror(pa_context_errno(c)));
                 goto fail;
             }
@@ -346,22 +504,22 @@ static void context_state_callback(pa_context *c, void *userdata) {
             // pa_stream_set_suspended_callback(stream, stream_suspended_callback, NULL);
             // pa_stream_set_moved_callback(stream, stream_moved_callback, NULL);
             // pa_stream_set_underflow_callback(stream, stream_underflow_callback, NULL);
-            // pa_stream_set_overflow_callback(stream, stream_overflow_callback, NULL);
+            pa_stream_set_overflow_callback(stream, stream_overflow_callback, NULL);
             // pa_stream_set_started_callback(stream, stream_started_callback, NULL);
             // pa_stream_set_event_callback(stream, stream_event_callback, NULL);
-            // pa_stream_set_buffer_attr_callback(stream, stream_buffer_attr_callback, NULL);
-
-            if (latency > 0) {
-                memset(&buffer_attr, 0, sizeof(buffer_attr));
-                buffer_attr.tlength = (uint32_t) latency;
-                buffer_attr.minreq = (uint32_t) process_time;
-                buffer_attr.maxlength = (uint32_t) -1;
-                buffer_attr.prebuf = (uint32_t) -1;
-                buffer_attr.fragsize = (uint32_t) latency;
+            pa_stream_set_buffer_attr_callback(stream, stream_buffer_attr_callback, NULL);
+
+            /* Fragments sized for the target: with ADJUST_LATENCY the
+               server sizes the source to match instead of its default. */
+            if (target_latency > 0) {
+                pulse_tuner_attr(&tuner, &buffer_attr);
                 flags = static_cast<pa_stream_flags_t>(flags | PA_STREAM_ADJUST_LATENCY);
             }
 
-            if ((r = pa_stream_connect_record(stream, (char*) device.get(), latency > 0 ? &buffer_attr : NULL, flags)) < 0) {
+            /* Keep timing info fresh and interpolated for stamp_fragment(). */
+            flags = static_cast<pa_stream_flags_t>(flags | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+
+            if ((r = pa_stream_connect_record(stream, device ? device->c_str() : NULL, target_latency > 0 ? &buffer_attr : NULL, flags)) < 0) {
                 fprintf(stderr, ("pa_stream_connect_record() failed: %s\n"), pa_strerror(pa_context_errno(c)));
                 goto fail;
             }
@@ -391,6 +549,8 @@ static void time_event_callback(pa_mainloop_api *m, pa_time_event *e, const stru
             fprintf(stderr, ("pa_stream_update_timing_info() failed: %s\n"), pa_strerror(pa_context_errno(context)));
         else
             pa_operation_unref(o);
+        if (target_latency > 0)
+            stream_tune_latency(stream);
     }
     m->time_restart(e, pa_timeval_store(&timestamp, pa_rtclock_now() + TIME_EVENT_USEC));
 }
@@ -403,6 +563,23 @@ static void time_event_callback(pa_mainloop_api *m, pa_time_event *e, const stru
 // It's also very common that pulse audio is not starting correctly.
 // pulseaudio -k #kill the process just in case
 // pulseaudio -D #start it again
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  -o, --stdout            write raw PCM to stdout\n"
+          "  -f, --format=FORMAT     sample format: s16le, s32le, float32le, ... (default s16le)\n"
+          "  -r, --rate=RATE         sample rate (default %d)\n"
+          "  -c, --channels=N        channels (default 1)\n"
+          "  -d, --device=SOURCE     source name (default: server default)\n"
+          "      --max-buffer=MSEC   stdout buffer before frames are dropped (default %lu)\n"
+          "      --no-vmsplice       always copy into the pipe\n"
+          "      --timestamps=FILE   write \"<frame> <capture time ns>\" per fragment\n"
+          "      --latency=USEC      latency target: fragments sized for it, then tuned\n"
+          "                          down to the smallest that does not overflow\n"
+          "      --no-latency-tune   keep the fragments sized for the target\n",
+          argv0, SAMPLE_RATE, (unsigned long) max_buffer_msec);
+}
+
 int main(int argc, char *argv[]) {
   int ret = 1, r, c;
 
@@ -410,20 +587,137 @@ int main(int argc, char *argv[]) {
   pa_time_event *time_event = NULL;
   char *bn, *server = NULL;
   int error;
-  
+
+  enum { ARG_MAX_BUFFER = 256, ARG_NO_VMSPLICE, ARG_TIMESTAMPS, ARG_LATENCY, ARG_NO_LATENCY_TUNE };
+  static const struct option long_options[] = {
+      {"stdout",      0, NULL, 'o'},
+      {"format",      1, NULL, 'f'},
+      {"rate",        1, NULL, 'r'},
+      {"channels",    1, NULL, 'c'},
+      {"device",      1, NULL, 'd'},
+      {"max-buffer",  1, NULL, ARG_MAX_BUFFER},
+      {"no-vmsplice", 0, NULL, ARG_NO_VMSPLICE},
+      {"timestamps",  1, NULL, ARG_TIMESTAMPS},
+      {"latency",     1, NULL, ARG_LATENCY},
+      {"no-latency-tune", 0, NULL, ARG_NO_LATENCY_TUNE},
+      {"help",        0, NULL, 'h'},
+      {NULL,          0, NULL, 0}
+  };
+
+  // Workload defaults from the environment, like the other record
+  // examples (capture-backend-bench.cc); options below still win.
+  if (getenv("CAPTURE_RATE")) sample_spec.rate = (uint32_t) atoi(getenv("CAPTURE_RATE"));
+  if (getenv("CAPTURE_CHANNELS")) sample_spec.channels = (uint8_t) atoi(getenv("CAPTURE_CHANNELS"));
+  if (getenv("CAPTURE_LATENCY_USEC")) target_latency = (pa_usec_t) atoll(getenv("CAPTURE_LATENCY_USEC"));
+
+  while ((c = getopt_long(argc, argv, "of:r:c:d:h", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'o':
+        stream_stdout = true;
+        break;
+      case 'f':
+        if ((sample_spec.format = pa_parse_sample_format(optarg)) == PA_SAMPLE_INVALID) {
+          fprintf(stderr, ("Invalid sample format '%s'\n"), optarg);
+          return 1;
+        }
+        break;
+      case 'r':
+        sample_spec.rate = (uint32_t) atoi(optarg);
+        break;
+      case 'c':
+        sample_spec.channels = (uint8_t) atoi(optarg);
+        break;
+      case 'd':
+        device = make_unique<std::string>(optarg);
+        break;
+      case ARG_MAX_BUFFER:
+        max_buffer_msec = (size_t) atoi(optarg);
+        break;
+      case ARG_NO_VMSPLICE:
+        allow_vmsplice = false;
+        break;
+      case ARG_TIMESTAMPS:
+        if (!(timestamps = fopen(optarg, "w"))) {
+          fprintf(stderr, ("Cannot open %s: %s\n"), optarg, strerror(errno));
+          return 1;
+        }
+        break;
+      case ARG_LATENCY:
+        target_latency = (pa_usec_t) atoll(optarg);
+        break;
+      case ARG_NO_LATENCY_TUNE:
+        tune_latency = false;
+        break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
 
   stream_name = make_unique<std::string>("stream");
   client_name = make_unique<std::string>("client");
 
   mode = RECORD;
 
+  if (stream_stdout) {
+    /* stdout carries audio now: logs go to stderr, and only the
+       stats at exit, not a line per fragment. */
+    log_out = stderr;
+    verbose = 0;
+  }
+
   if (!pa_sample_spec_valid(&sample_spec)) {
       fprintf(stderr, ("Invalid sample specification\n"));
       goto quit;
   }
 
+  capture_clock_init(&stream_clock, sample_spec.rate, CAPTURE_CLOCK_TAU_SEC);
+
+  /* Fragments of exactly this many frames, as the benchmark asked:
+     a fixed target, not tuned. */
+  if (getenv("CAPTURE_BLOCK_FRAMES") && !target_latency) {
+      target_latency = (pa_usec_t) atoi(getenv("CAPTURE_BLOCK_FRAMES")) * PA_USEC_PER_SEC / sample_spec.rate;
+      tune_latency = false;
+  }
+  if (target_latency > 0)
+      pulse_tuner_init(&tuner, sample_spec.rate, (uint32_t) pa_frame_size(&sample_spec), target_latency,
+                       tune_latency);
+
+  if (getenv("CAPTURE_LOG")) {
+      uint32_t log_format = sample_spec.format == PA_SAMPLE_S16LE ? CAPTURE_LOG_S16LE :
+                            sample_spec.format == PA_SAMPLE_S32LE ? CAPTURE_LOG_S32LE :
+                            sample_spec.format == PA_SAMPLE_FLOAT32LE ? CAPTURE_LOG_F32LE : 0;
+      if (!log_format || capture_log_open(&recording, getenv("CAPTURE_LOG"), log_format, sample_spec.rate,
+                                          sample_spec.channels, "pulse-async") < 0) {
+          fprintf(stderr, ("Cannot write capture log %s: %s\n"), getenv("CAPTURE_LOG"),
+                  log_format ? strerror(errno) : "format not supported");
+          goto quit;
+      }
+  }
+
+  if (stream_stdout &&
+      pcm_pipe_sink_open(&sink, STDOUT_FILENO,
+                         pa_usec_to_bytes(max_buffer_msec * PA_USEC_PER_MSEC, &sample_spec),
+                         pa_frame_size(&sample_spec), allow_vmsplice) < 0) {
+      fprintf(stderr, ("Cannot set up stdout: %s\n"), strerror(errno));
+      goto quit;
+  }
+
+  /* Half a second per block, touched now so it does not fault later. */
+  if (!stream_stdout) {
+      block_length = (sample_spec.rate / 2) * pa_frame_size(&sample_spec);
+      if (!(block = (uint8_t*) malloc(block_length))) {
+          fprintf(stderr, ("Cannot allocate the block buffer\n"));
+          goto quit;
+      }
+      memset(block, 0, block_length);
+      metered = (sample_spec.format == PA_SAMPLE_S16LE || sample_spec.format == PA_SAMPLE_FLOAT32LE) &&
+                level_meter_init(&meter, sample_spec.rate, sample_spec.channels,
+                                 getenv("CAPTURE_METER_MS") ? atoi(getenv("CAPTURE_METER_MS")) : 0);
+  }
+
   /* Set up a new main loop */
-  printf("mainloop setting...\n");
+  fprintf(log_out, "mainloop setting...\n");
   if (!(m = pa_mainloop_new())) {
       fprintf(stderr, ("pa_mainloop_new() failed.\n"));
       goto quit;
@@ -436,16 +730,17 @@ int main(int argc, char *argv[]) {
   pa_signal_new(SIGINT, exit_signal_callback, NULL);
   pa_signal_new(SIGTERM, exit_signal_callback, NULL);
 
-//   if (!(stdio_event = mainloop_api->io_new(mainloop_api,
-//                                               mode == PLAYBACK ? STDIN_FILENO : STDOUT_FILENO,
-//                                               mode == PLAYBACK ? PA_IO_EVENT_INPUT : PA_IO_EVENT_OUTPUT,
-//                                               mode == PLAYBACK ? stdin_callback : stdout_callback, NULL))) {
-//       fprintf(stderr, ("io_new() failed.\n"));
-//       goto quit;
-//   }
+  if (stream_stdout &&
+      !(stdio_event = mainloop_api->io_new(mainloop_api,
+                                           mode == PLAYBACK ? STDIN_FILENO : STDOUT_FILENO,
+                                           mode == PLAYBACK ? PA_IO_EVENT_INPUT : PA_IO_EVENT_OUTPUT,
+                                           mode == PLAYBACK ? stdin_callback : stdout_callback, NULL))) {
+      fprintf(stderr, ("io_new() failed.\n"));
+      goto quit;
+  }
 
   /* Create a new connection context */
-  if (!(context = pa_context_new(mainloop_api,(char*) client_name.get()))) {
+  if (!(context = pa_context_new(mainloop_api,client_name->c_str()))) {
       fprintf(stderr, ("pa_context_new() failed.\n"));
       goto quit;
   }
@@ -459,14 +754,14 @@ int main(int argc, char *argv[]) {
   }
 
 
-  if (verbose) {
+  if (verbose || target_latency > 0) {
       if (!(time_event = mainloop_api->time_new(mainloop_api, pa_timeval_store(&timestamp, pa_rtclock_now() + TIME_EVENT_USEC), time_event_callback, NULL))) {
           fprintf(stderr, ("time_new() failed.\n"));
           goto quit;
       }
   }
   
-  printf("mainloop...\n");
+  fprintf(log_out, "mainloop...\n");
 
   /* Run the main loop */
   if (pa_mainloop_run(m, &ret) < 0) {
@@ -479,6 +774,20 @@ quit:
       pa_stream_unref(stream);
 
   if (buffer) pa_xfree(buffer);
+  free(block);
+
+  if (stream_stdout && sink.ring) {
+      pcm_pipe_sink_print_stats(&sink, stderr);
+      pcm_pipe_sink_close(&sink);
+  }
+
+  if (stream_clock.updates)
+      capture_clock_print_stats(&stream_clock, log_out);
+  if (target_latency > 0)
+      pulse_tuner_print_stats(&tuner, log_out);
+  if (timestamps)
+      fclose(timestamps);
+  capture_log_close(&recording);
 
   if (stdio_event) {
       assert(mainloop_api);
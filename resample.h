@@ -0,0 +1,165 @@
+/*
+  Fixed-ratio sample rate conversion, for bringing recordings to the rate
+  a model or a feature stage expects (22050 -> 16000, 48000 -> 16000...).
+
+  The ratio is reduced to out/in = L/M and every output sample is one dot
+  product: output n sits at input position n * M / L, whose fractional
+  part is one of L phases, each with its own precomputed row of taps of a
+  Kaiser-windowed sinc. When decimating, the cutoff follows the output
+  rate (and the filter gets longer by the same factor) so nothing above
+  the new Nyquist folds back: 0.9 of the lower Nyquist frequency is the
+  -6 dB point and an alias from 1.1 of it is down more than 85 dB.
+  Channels are kept apart so each dot product runs over contiguous
+  samples.
+
+    resampler r;
+    resampler_init(&r, in_rate, out_rate, channels);
+    n = resampler_process(&r, in, frames, out, max_out_frames);  // interleaved
+    n = resampler_flush(&r, out, max_out_frames);                // at the end
+
+  Output n lines up with input n * M / L exactly: the filter's delay is
+  taken out by starting half a filter early. r.out_frames counts frames
+  written so far. Not thread safe. C++11.
+*/
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#define RESAMPLE_ZERO_CROSSINGS 16   /* taps per side at unity ratio */
+#define RESAMPLE_MAX_PHASES 4096
+#define RESAMPLE_MAX_CHANNELS 16
+
+struct resampler {
+  uint32_t in_rate, out_rate, channels;
+  uint32_t up, down;         /* L, M */
+  uint32_t taps;
+  std::vector<float> table;  /* up rows of taps */
+  /* Pending input per channel; hist[c][0] is input frame `base`. */
+  std::vector<float> hist[RESAMPLE_MAX_CHANNELS];
+  int64_t base;
+  uint64_t out_frames;
+};
+
+static inline uint32_t resample_gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static inline double resample_bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 40; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < 1e-12 * sum) break;
+  }
+  return sum;
+}
+
+/* False when the rates are zero or their ratio needs too many phases. */
+static inline bool resampler_init(resampler *r, uint32_t in_rate, uint32_t out_rate, uint32_t channels) {
+  if (!in_rate || !out_rate || !channels || channels > RESAMPLE_MAX_CHANNELS)
+    return false;
+  uint32_t g = resample_gcd(in_rate, out_rate);
+  r->in_rate = in_rate;
+  r->out_rate = out_rate;
+  r->channels = channels;
+  r->up = out_rate / g;
+  r->down = in_rate / g;
+  if (r->up > RESAMPLE_MAX_PHASES)
+    return false;
+
+  /* Cutoff 0.9 of the lower Nyquist, in input samples. */
+  double scale = out_rate < in_rate ? (double) out_rate / in_rate : 1.0;
+  double cutoff = 0.9 * scale, beta = 8.0;
+  uint32_t half = (uint32_t) ceil(RESAMPLE_ZERO_CROSSINGS / scale);
+  r->taps = 2 * half;
+  r->table.assign((size_t) r->up * r->taps, 0.0f);
+  for (uint32_t p = 0; p < r->up; p++) {
+    double mu = (double) p / r->up, sum = 0;
+    float *row = &r->table[(size_t) p * r->taps];
+    for (uint32_t k = 0; k < r->taps; k++) {
+      double x = ((double) k - (half - 1)) - mu;
+      double s = x == 0 ? cutoff : sin(M_PI * cutoff * x) / (M_PI * x);
+      double w = x / half;
+      double win = fabs(w) >= 1 ? 0 : resample_bessel_i0(beta * sqrt(1 - w * w)) / resample_bessel_i0(beta);
+      row[k] = (float) (s * win);
+      sum += row[k];
+    }
+    for (uint32_t k = 0; k < r->taps; k++)
+      row[k] = (float) (row[k] / sum);
+  }
+  /* Start half a filter early: output 0 is centred on input 0. */
+  for (uint32_t c = 0; c < channels; c++) {
+    r->hist[c].assign(half - 1, 0.0f);
+    r->hist[c].reserve(4096);
+  }
+  r->base = -(int64_t) (half - 1);
+  r->out_frames = 0;
+  return true;
+}
+
+/* Every output whose taps are all in. */
+static inline uint32_t resampler_drain(resampler *r, float *out, uint32_t max_out) {
+  const int64_t have = r->base + (int64_t) r->hist[0].size();
+  const int64_t half = r->taps / 2;
+  uint32_t n = 0;
+  while (n < max_out) {
+    uint64_t pos = r->out_frames * r->down;
+    int64_t i = (int64_t) (pos / r->up);
+    uint32_t phase = (uint32_t) (pos % r->up);
+    if (i + half >= have)
+      break;
+    const float *row = &r->table[(size_t) phase * r->taps];
+    size_t first = (size_t) (i - (half - 1) - r->base);
+    for (uint32_t c = 0; c < r->channels; c++) {
+      const float *x = &r->hist[c][first];
+      float acc = 0;
+      for (uint32_t k = 0; k < r->taps; k++)
+        acc += row[k] * x[k];
+      out[(size_t) n * r->channels + c] = acc;
+    }
+    r->out_frames++;
+    n++;
+  }
+  /* Forget what no later output reaches. */
+  int64_t next = (int64_t) (r->out_frames * r->down / r->up) - (half - 1);
+  if (next > r->base) {
+    size_t drop = (size_t) (next - r->base);
+    if (drop > r->hist[0].size()) drop = r->hist[0].size();
+    for (uint32_t c = 0; c < r->channels; c++)
+      r->hist[c].erase(r->hist[c].begin(), r->hist[c].begin() + drop);
+    r->base += drop;
+  }
+  return n;
+}
+
+/* Interleaved in and out. Returns frames written; max_out must cover
+   frames * out_rate / in_rate + 1. */
+static inline uint32_t resampler_process(resampler *r, const float *in, uint32_t frames, float *out,
+                                         uint32_t max_out) {
+  for (uint32_t c = 0; c < r->channels; c++) {
+    std::vector<float> &h = r->hist[c];
+    size_t at = h.size();
+    h.resize(at + frames);
+    for (uint32_t f = 0; f < frames; f++)
+      h[at + f] = in[(size_t) f * r->channels + c];
+  }
+  return resampler_drain(r, out, max_out);
+}
+
+/* The outputs still waiting for input past the end, against silence. */
+static inline uint32_t resampler_flush(resampler *r, float *out, uint32_t max_out) {
+  for (uint32_t c = 0; c < r->channels; c++)
+    r->hist[c].resize(r->hist[c].size() + r->taps / 2, 0.0f);
+  return resampler_drain(r, out, max_out);
+}
+
+#endif  // RESAMPLE_H_
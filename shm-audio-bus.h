@@ -0,0 +1,413 @@
+/*
+  Shared-memory audio bus (memfd ring + eventfd notifications).
+
+  The capture process publishes blocks into a ring of slots in a sealed
+  memfd. Analysis processes connect over an abstract unix socket and get
+  two file descriptors back with SCM_RIGHTS:
+
+    - the memfd, re-opened read-only, which they map PROT_READ
+    - an eventfd of their own, written by the producer after each block
+
+  Readers see the blocks in place (no copy) and cannot write to the ring,
+  so a crashing or misbehaving reader cannot corrupt capture. The
+  producer never waits for a reader: eventfd writes are non-blocking, a
+  disconnected reader is dropped on the next publish, and a reader that
+  falls a full ring behind skips ahead (counted as dropped). Slots carry
+  a sequence number around the data, so a reader can tell when a block
+  was overwritten while it was reading it.
+
+  Producer:                              Reader:
+    shm_bus_create(&bus, "mic0", ...)      shm_bus_connect(&c, "mic0")
+    loop:                                  while (shm_bus_next(&c, &b, -1)) {
+      p = shm_bus_begin_write(&bus)          ...use b.data...
+      ...fill p...                           shm_bus_release(&c, &b);
+      shm_bus_commit(&bus, frames, ts)     }
+    shm_bus_destroy(&bus)                  shm_bus_disconnect(&c)
+
+  Linux only, C++11.
+*/
+#ifndef SHM_AUDIO_BUS_H_
+#define SHM_AUDIO_BUS_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <new>
+
+#define SHM_BUS_MAGIC 0x53554241u  /* "ABUS" */
+#define SHM_BUS_VERSION 1
+#define SHM_BUS_MAX_CLIENTS 32
+#define SHM_BUS_ALIGN 64
+#define SHM_BUS_HOUSEKEEPING_MS 50
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010  /* Linux 5.1 */
+#endif
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "shm-audio-bus.h needs lock-free 64-bit atomics in shared memory"
+#endif
+
+/* Lives at offset 0 of the memfd. */
+struct shm_bus_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t rate;
+  uint32_t channels;
+  uint32_t sample_bytes;
+  uint32_t block_frames;
+  uint32_t slots;
+  uint32_t slot_stride;       /* slot header + data, multiple of SHM_BUS_ALIGN */
+  uint64_t slots_offset;
+  alignas(SHM_BUS_ALIGN) std::atomic<uint64_t> head;  /* seq of the next block */
+};
+
+/* Starts every slot; the samples follow at SHM_BUS_ALIGN. */
+struct shm_bus_slot {
+  std::atomic<uint64_t> seq;
+  int64_t timestamp_ns;
+  uint32_t frames;
+  uint32_t bytes;
+};
+
+static const uint64_t SHM_BUS_WRITING = ~(uint64_t) 0;
+
+/* First message on a new connection, next to the two fds. */
+struct shm_bus_hello {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t map_size;
+};
+
+struct shm_bus_block {
+  uint64_t seq;
+  int64_t timestamp_ns;
+  uint32_t frames;
+  uint32_t bytes;
+  const void *data;
+};
+
+struct shm_bus {
+  int memfd;
+  int listen_fd;
+  uint8_t *map;
+  size_t map_size;
+  shm_bus_header *header;
+  int client_sock[SHM_BUS_MAX_CLIENTS];
+  int client_event[SHM_BUS_MAX_CLIENTS];
+  int clients;
+  uint64_t published;
+  int64_t housekeeping_ns;
+};
+
+struct shm_bus_client {
+  int sock;
+  int event_fd;
+  const uint8_t *map;
+  size_t map_size;
+  const shm_bus_header *header;
+  uint64_t next;
+  uint64_t read;
+  uint64_t dropped;
+  uint64_t torn;
+};
+
+static inline shm_bus_slot *shm_bus_slot_at(uint8_t *map, const shm_bus_header *h, uint64_t seq) {
+  return (shm_bus_slot*) (map + h->slots_offset + (seq % h->slots) * (uint64_t) h->slot_stride);
+}
+
+static inline socklen_t shm_bus_address(const char *name, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  /* Abstract namespace: nothing to clean up in the filesystem. */
+  int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "audio-bus-%s", name);
+  return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+/* ---------------------------------------------------------------- producer */
+
+static inline int shm_bus_create(shm_bus *bus, const char *name, uint32_t rate, uint32_t channels,
+                                 uint32_t sample_bytes, uint32_t block_frames, uint32_t slots) {
+  memset(bus, 0, sizeof(*bus));
+  bus->memfd = bus->listen_fd = -1;
+
+  uint32_t data_bytes = block_frames * channels * sample_bytes;
+  uint32_t stride = (SHM_BUS_ALIGN + data_bytes + SHM_BUS_ALIGN - 1) & ~(SHM_BUS_ALIGN - 1);
+  uint64_t slots_offset = (sizeof(shm_bus_header) + SHM_BUS_ALIGN - 1) & ~(uint64_t) (SHM_BUS_ALIGN - 1);
+  bus->map_size = slots_offset + (uint64_t) stride * slots;
+
+  if ((bus->memfd = memfd_create("audio-bus", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0 ||
+      ftruncate(bus->memfd, bus->map_size) < 0 ||
+      fcntl(bus->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+    fprintf(stderr, "shm bus memfd setup failed: %s\n", strerror(errno));
+    return -1;
+  }
+  bus->map = (uint8_t*) mmap(NULL, bus->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, bus->memfd, 0);
+  if (bus->map == MAP_FAILED) {
+    fprintf(stderr, "shm bus mmap failed: %s\n", strerror(errno));
+    return -1;
+  }
+  /* Our own mapping stays writable; any later one, or a write() through
+     a reader's descriptor, cannot. Kernels before 5.1 lack the seal and
+     rely on the read-only reopen alone. */
+  if (fcntl(bus->memfd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0 &&
+      (errno != EINVAL || fcntl(bus->memfd, F_ADD_SEALS, F_SEAL_SEAL) < 0)) {
+    fprintf(stderr, "shm bus memfd sealing failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  bus->header = new (bus->map) shm_bus_header;
+  bus->header->rate = rate;
+  bus->header->channels = channels;
+  bus->header->sample_bytes = sample_bytes;
+  bus->header->block_frames = block_frames;
+  bus->header->slots = slots;
+  bus->header->slot_stride = stride;
+  bus->header->slots_offset = slots_offset;
+  bus->header->head.store(0);
+  for (uint32_t i = 0; i < slots; i++)
+    new (shm_bus_slot_at(bus->map, bus->header, i)) shm_bus_slot;
+  for (uint32_t i = 0; i < slots; i++)
+    shm_bus_slot_at(bus->map, bus->header, i)->seq.store(SHM_BUS_WRITING);
+  bus->header->version = SHM_BUS_VERSION;
+  bus->header->magic = SHM_BUS_MAGIC;
+
+  struct sockaddr_un addr;
+  socklen_t len = shm_bus_address(name, &addr);
+  if ((bus->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(bus->listen_fd, (struct sockaddr*) &addr, len) < 0 ||
+      listen(bus->listen_fd, 8) < 0) {
+    fprintf(stderr, "shm bus listen on %s failed: %s\n", name, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static inline void shm_bus_drop_client(shm_bus *bus, int i) {
+  close(bus->client_sock[i]);
+  close(bus->client_event[i]);
+  bus->clients--;
+  bus->client_sock[i] = bus->client_sock[bus->clients];
+  bus->client_event[i] = bus->client_event[bus->clients];
+}
+
+static inline void shm_bus_accept(shm_bus *bus) {
+  int sock;
+  while ((sock = accept4(bus->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", bus->memfd);
+    int ro = open(path, O_RDONLY | O_CLOEXEC);
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ro < 0 || efd < 0 || bus->clients == SHM_BUS_MAX_CLIENTS) {
+      if (ro >= 0) close(ro);
+      if (efd >= 0) close(efd);
+      close(sock);
+      continue;
+    }
+
+    shm_bus_hello hello = { SHM_BUS_MAGIC, SHM_BUS_VERSION, bus->map_size };
+    struct iovec iov = { &hello, sizeof(hello) };
+    union { char buf[CMSG_SPACE(2 * sizeof(int))]; struct cmsghdr align; } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { ro, efd };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    bool sent = sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t) sizeof(hello);
+    close(ro);
+    if (!sent) {
+      close(efd);
+      close(sock);
+      continue;
+    }
+    bus->client_sock[bus->clients] = sock;
+    bus->client_event[bus->clients] = efd;
+    bus->clients++;
+  }
+}
+
+/* Slot memory for the next block; the producer never blocks. */
+static inline void *shm_bus_begin_write(shm_bus *bus) {
+  shm_bus_slot *slot = shm_bus_slot_at(bus->map, bus->header, bus->published);
+  slot->seq.store(SHM_BUS_WRITING, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return (uint8_t*) slot + SHM_BUS_ALIGN;
+}
+
+static inline void shm_bus_commit(shm_bus *bus, uint32_t frames, int64_t timestamp_ns) {
+  shm_bus_slot *slot = shm_bus_slot_at(bus->map, bus->header, bus->published);
+  slot->frames = frames;
+  slot->bytes = frames * bus->header->channels * bus->header->sample_bytes;
+  slot->timestamp_ns = timestamp_ns;
+  slot->seq.store(bus->published, std::memory_order_release);
+  bus->header->head.store(++bus->published, std::memory_order_release);
+
+  uint64_t one = 1;
+  for (int i = 0; i < bus->clients; i++) {
+    /* EAGAIN only if a reader left 2^64-2 wake-ups unread; harmless. */
+    if (write(bus->client_event[i], &one, sizeof(one)) < 0 && errno != EAGAIN)
+      fprintf(stderr, "shm bus eventfd write failed: %s\n", strerror(errno));
+  }
+
+  /* Housekeeping without blocking, a few times per second: new readers,
+     and readers that went away (their socket reads EOF or errors). */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  int64_t now = (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  if (now < bus->housekeeping_ns)
+    return;
+  bus->housekeeping_ns = now + (int64_t) SHM_BUS_HOUSEKEEPING_MS * 1000000;
+  shm_bus_accept(bus);
+  for (int i = 0; i < bus->clients; i++) {
+    char c;
+    ssize_t r = recv(bus->client_sock[i], &c, 1, MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+      shm_bus_drop_client(bus, i--);
+  }
+}
+
+static inline void shm_bus_destroy(shm_bus *bus) {
+  while (bus->clients)
+    shm_bus_drop_client(bus, 0);
+  if (bus->listen_fd >= 0) close(bus->listen_fd);
+  if (bus->map && bus->map != MAP_FAILED) munmap(bus->map, bus->map_size);
+  if (bus->memfd >= 0) close(bus->memfd);
+  memset(bus, 0, sizeof(*bus));
+  bus->memfd = bus->listen_fd = -1;
+}
+
+/* ------------------------------------------------------------------ reader */
+
+static inline int shm_bus_connect(shm_bus_client *c, const char *name) {
+  memset(c, 0, sizeof(*c));
+  c->event_fd = -1;
+
+  struct sockaddr_un addr;
+  socklen_t len = shm_bus_address(name, &addr);
+  if ((c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+      connect(c->sock, (struct sockaddr*) &addr, len) < 0) {
+    fprintf(stderr, "shm bus connect to %s failed: %s\n", name, strerror(errno));
+    if (c->sock >= 0) close(c->sock);
+    return -1;
+  }
+
+  shm_bus_hello hello;
+  struct iovec iov = { &hello, sizeof(hello) };
+  union { char buf[CMSG_SPACE(2 * sizeof(int))]; struct cmsghdr align; } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg;
+  int fds[2] = { -1, -1 };
+  if (recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t) sizeof(hello) ||
+      hello.magic != SHM_BUS_MAGIC ||
+      !(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+    fprintf(stderr, "shm bus handshake with %s failed\n", name);
+    close(c->sock);
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  c->map_size = hello.map_size;
+  c->map = (const uint8_t*) mmap(NULL, c->map_size, PROT_READ, MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+  c->event_fd = fds[1];
+  if (c->map == MAP_FAILED) {
+    fprintf(stderr, "shm bus mmap failed: %s\n", strerror(errno));
+    close(c->event_fd);
+    close(c->sock);
+    return -1;
+  }
+  c->header = (const shm_bus_header*) c->map;
+  if (c->header->magic != SHM_BUS_MAGIC || c->header->version != SHM_BUS_VERSION) {
+    fprintf(stderr, "shm bus %s: incompatible version\n", name);
+    munmap((void*) c->map, c->map_size);
+    close(c->event_fd);
+    close(c->sock);
+    return -1;
+  }
+  /* Start with the next block published. */
+  c->next = c->header->head.load(std::memory_order_acquire);
+  return 0;
+}
+
+/* Next block, read in place. Waits up to timeout_ms (-1 forever).
+   Returns false on timeout or when the producer went away. */
+static inline bool shm_bus_next(shm_bus_client *c, shm_bus_block *out, int timeout_ms) {
+  const shm_bus_header *h = c->header;
+  uint64_t guard = h->slots / 4;
+
+  for (;;) {
+    uint64_t head = h->head.load(std::memory_order_acquire);
+    if (c->next < head) {
+      if (head - c->next > h->slots - guard) {
+        uint64_t resume = head - (h->slots - guard);
+        c->dropped += resume - c->next;
+        c->next = resume;
+      }
+      const shm_bus_slot *slot = shm_bus_slot_at((uint8_t*) c->map, h, c->next);
+      if (slot->seq.load(std::memory_order_acquire) != c->next)
+        continue;
+      out->seq = c->next;
+      out->timestamp_ns = slot->timestamp_ns;
+      out->frames = slot->frames;
+      out->bytes = slot->bytes;
+      out->data = (const uint8_t*) slot + SHM_BUS_ALIGN;
+      return true;
+    }
+
+    struct pollfd pfd[2] = { { c->event_fd, POLLIN, 0 }, { c->sock, POLLIN, 0 } };
+    int n = poll(pfd, 2, timeout_ms);
+    if (n <= 0)
+      return false;
+    if (pfd[1].revents & (POLLHUP | POLLERR | POLLIN))
+      return false;
+    uint64_t count;
+    if (read(c->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      return false;
+  }
+}
+
+/* False if the block was overwritten while it was being used. */
+static inline bool shm_bus_release(shm_bus_client *c, const shm_bus_block *b) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const shm_bus_slot *slot = shm_bus_slot_at((uint8_t*) c->map, c->header, b->seq);
+  bool valid = slot->seq.load(std::memory_order_relaxed) == b->seq;
+  c->next = b->seq + 1;
+  if (valid) c->read++;
+  else c->torn++;
+  return valid;
+}
+
+static inline void shm_bus_disconnect(shm_bus_client *c) {
+  if (c->map && c->map != MAP_FAILED) munmap((void*) c->map, c->map_size);
+  if (c->event_fd >= 0) close(c->event_fd);
+  if (c->sock >= 0) close(c->sock);
+  memset(c, 0, sizeof(*c));
+  c->sock = c->event_fd = -1;
+}
+
+#endif  // SHM_AUDIO_BUS_H_
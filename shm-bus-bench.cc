@@ -0,0 +1,270 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <vector>
+
+#include "shm-audio-bus.h"
+
+// Moves the same blocks from a producer process to a consumer process
+// over three transports and compares them:
+//
+//   shm     shm-audio-bus.h (memfd ring, eventfd wake-ups, no copies)
+//   pipe    the PCM written to a pipe, as with stdout streaming
+//   socket  the PCM written to a unix stream socket
+//
+// Throughput: the producer sends as fast as it can and the consumer
+// touches every sample. On the bus the producer never waits, so a reader
+// that cannot keep up loses blocks instead of slowing capture; that is
+// reported as dropped, and only valid blocks count toward MB/s.
+// CPU time per block is reported for both sides, which is what the
+// capture process pays regardless of drops. Latency: one block per
+// millisecond, timed from commit to the moment the consumer sees it.
+// Run it on a machine with at least two cores; on one core producer and
+// consumer take turns and the bus mostly measures lapping.
+//
+// g++ -O2 shm-bus-bench.cc -o shm-bus-bench -lm -std=c++11
+// ./shm-bus-bench [block frames]
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define RING_SLOTS 256
+#define THROUGHPUT_BLOCKS 200000
+#define LATENCY_BLOCKS 2000
+#define LATENCY_PERIOD_NS 1000000
+
+enum transport { SHM, PIPE, SOCKET };
+static const char *transport_names[] = { "shm", "pipe", "socket" };
+
+struct message_header {
+  uint64_t seq;
+  int64_t sent_ns;
+};
+
+struct consumer_result {
+  uint64_t blocks;
+  uint64_t dropped;
+  uint64_t bytes;
+  int64_t first_ns;
+  int64_t last_ns;
+  int64_t latency_p50_ns;
+  int64_t latency_p99_ns;
+  int64_t latency_max_ns;
+  int64_t cpu_ns;
+  int64_t producer_cpu_ns;
+  uint64_t checksum;
+};
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t cpu_ns() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+static void sleep_until(int64_t ns) {
+  struct timespec ts = { (time_t) (ns / 1000000000LL), (long) (ns % 1000000000LL) };
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static bool read_full(int fd, void *buf, size_t len) {
+  uint8_t *p = (uint8_t*) buf;
+  while (len) {
+    ssize_t r = read(fd, p, len);
+    if (r <= 0)
+      return false;
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t*) buf;
+  while (len) {
+    ssize_t r = write(fd, p, len);
+    if (r <= 0)
+      return false;
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+static uint64_t touch(const void *data, size_t bytes) {
+  const int16_t *s = (const int16_t*) data;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < bytes / sizeof(int16_t); i++)
+    sum += (uint16_t) s[i];
+  return sum;
+}
+
+static void finish_latencies(std::vector<int64_t> &lat, consumer_result *r) {
+  if (lat.empty())
+    return;
+  std::sort(lat.begin(), lat.end());
+  r->latency_p50_ns = lat[lat.size() / 2];
+  r->latency_p99_ns = lat[lat.size() * 99 / 100];
+  r->latency_max_ns = lat.back();
+}
+
+static consumer_result consume_stream(int fd, size_t block_bytes, uint64_t blocks, bool paced) {
+  consumer_result r;
+  memset(&r, 0, sizeof(r));
+  std::vector<uint8_t> buffer(block_bytes);
+  std::vector<int64_t> lat;
+  message_header h;
+
+  while (r.blocks < blocks && read_full(fd, &h, sizeof(h)) && read_full(fd, buffer.data(), block_bytes)) {
+    int64_t now = monotonic_ns();
+    if (!r.blocks) r.first_ns = now;
+    r.last_ns = now;
+    r.checksum += touch(buffer.data(), block_bytes);
+    r.blocks++;
+    r.bytes += block_bytes;
+    if (paced) lat.push_back(now - h.sent_ns);
+  }
+  finish_latencies(lat, &r);
+  return r;
+}
+
+static consumer_result consume_bus(const char *name, uint64_t blocks, bool paced) {
+  consumer_result r;
+  memset(&r, 0, sizeof(r));
+  shm_bus_client c;
+  shm_bus_block b;
+  std::vector<int64_t> lat;
+
+  if (shm_bus_connect(&c, name) < 0)
+    return r;
+  while (c.read + c.dropped + c.torn < blocks && shm_bus_next(&c, &b, 2000)) {
+    int64_t now = monotonic_ns();
+    uint64_t sum = touch(b.data, b.bytes);
+    if (!shm_bus_release(&c, &b))
+      continue;
+    if (!r.blocks) r.first_ns = now;
+    r.last_ns = now;
+    r.checksum += sum;
+    r.blocks++;
+    r.bytes += b.bytes;
+    if (paced) lat.push_back(now - b.timestamp_ns);
+  }
+  r.dropped = c.dropped + c.torn;
+  shm_bus_disconnect(&c);
+  finish_latencies(lat, &r);
+  return r;
+}
+
+static void fill_block(int16_t *samples, size_t n, uint64_t seq) {
+  for (size_t i = 0; i < n; i++)
+    samples[i] = (int16_t) (seq + i);
+}
+
+static consumer_result run(transport t, uint32_t block_frames, uint64_t blocks, bool paced) {
+  size_t block_samples = (size_t) block_frames * CHANNELS;
+  size_t block_bytes = block_samples * sizeof(int16_t);
+  char bus_name[64];
+  int fds[2] = { -1, -1 }, result_pipe[2];
+  shm_bus bus;
+
+  snprintf(bus_name, sizeof(bus_name), "bench-%d", (int) getpid());
+  if (t == SHM && shm_bus_create(&bus, bus_name, SAMPLE_RATE, CHANNELS, sizeof(int16_t),
+                                 block_frames, RING_SLOTS) < 0)
+    exit(1);
+  if (t == PIPE && pipe(fds) < 0) exit(1);
+  if (t == SOCKET && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) exit(1);
+  if (pipe(result_pipe) < 0) exit(1);
+
+  pid_t child = fork();
+  if (child == 0) {
+    close(result_pipe[0]);
+    consumer_result r;
+    if (t == SHM) {
+      r = consume_bus(bus_name, blocks, paced);
+    } else {
+      close(fds[1]);
+      r = consume_stream(fds[0], block_bytes, blocks, paced);
+    }
+    r.cpu_ns = cpu_ns();
+    write_full(result_pipe[1], &r, sizeof(r));
+    _exit(0);
+  }
+  close(result_pipe[1]);
+
+  if (t == SHM) {
+    /* Wait for the reader to attach before publishing. */
+    while (bus.clients == 0) {
+      shm_bus_accept(&bus);
+      usleep(1000);
+    }
+  } else {
+    close(fds[0]);
+  }
+
+  std::vector<uint8_t> scratch(sizeof(message_header) + block_bytes);
+  int64_t cpu_start = cpu_ns();
+  int64_t next = monotonic_ns();
+  for (uint64_t seq = 0; seq < blocks; seq++) {
+    if (paced) {
+      next += LATENCY_PERIOD_NS;
+      sleep_until(next);
+    }
+    if (t == SHM) {
+      fill_block((int16_t*) shm_bus_begin_write(&bus), block_samples, seq);
+      shm_bus_commit(&bus, block_frames, monotonic_ns());
+    } else {
+      message_header *h = (message_header*) scratch.data();
+      fill_block((int16_t*) (h + 1), block_samples, seq);
+      h->seq = seq;
+      h->sent_ns = monotonic_ns();
+      if (!write_full(fds[1], scratch.data(), scratch.size()))
+        break;
+    }
+  }
+
+  int64_t producer_cpu = cpu_ns() - cpu_start;
+  consumer_result r;
+  memset(&r, 0, sizeof(r));
+  read_full(result_pipe[0], &r, sizeof(r));
+  r.producer_cpu_ns = producer_cpu;
+  close(result_pipe[0]);
+  waitpid(child, NULL, 0);
+  if (t == SHM) shm_bus_destroy(&bus);
+  else close(fds[1]);
+  return r;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t block_frames = argc > 1 ? atoi(argv[1]) : 480;
+
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stdout, "block: %u frames x %d ch x s16 = %u bytes\n", block_frames, CHANNELS,
+          (unsigned) (block_frames * CHANNELS * sizeof(int16_t)));
+  fprintf(stdout, "%-8s %10s %10s %14s %14s %10s %10s %10s\n", "", "MB/s", "dropped",
+          "prod ns/blk", "cons ns/blk", "p50 us", "p99 us", "max us");
+
+  for (int t = SHM; t <= SOCKET; t++) {
+    consumer_result tp = run((transport) t, block_frames, THROUGHPUT_BLOCKS, false);
+    consumer_result lat = run((transport) t, block_frames, LATENCY_BLOCKS, true);
+    double seconds = (tp.last_ns - tp.first_ns) / 1e9;
+    fprintf(stdout, "%-8s %10.1f %10lu %14.0f %14.0f %10.1f %10.1f %10.1f\n", transport_names[t],
+            seconds > 0 ? tp.bytes / seconds / 1e6 : 0.0,
+            (unsigned long) (tp.dropped + lat.dropped),
+            (double) tp.producer_cpu_ns / THROUGHPUT_BLOCKS,
+            (double) tp.cpu_ns / THROUGHPUT_BLOCKS,
+            lat.latency_p50_ns / 1e3, lat.latency_p99_ns / 1e3, lat.latency_max_ns / 1e3);
+  }
+  return 0;
+}
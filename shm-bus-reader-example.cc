@@ -0,0 +1,69 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "shm-audio-bus.h"
+
+// Attaches read-only to a shared-memory audio bus published by
+// pulseaudio-shm-publish-example or shm-bus-synthetic-producer and prints
+// per-block peak level and delivery latency (time from the end of the
+// block's capture to the moment this process sees it).
+//
+// g++ shm-bus-reader-example.cc -o shm-bus-reader-example -lm -std=c++11
+// ./shm-bus-reader-example mic0
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : "mic0";
+  shm_bus_client client;
+  shm_bus_block block;
+
+  init_signal();
+
+  if (shm_bus_connect(&client, name) < 0)
+    return 1;
+  fprintf(stdout, "attached to '%s': %u Hz, %u ch, %u byte samples, %u slots\n", name,
+          client.header->rate, client.header->channels, client.header->sample_bytes,
+          client.header->slots);
+
+  while (running && shm_bus_next(&client, &block, 1000)) {
+    const int16_t *samples = (const int16_t*) block.data;
+    int peak = 0;
+    for (uint32_t i = 0; i < block.frames * client.header->channels; i++) {
+      int v = samples[i] < 0 ? -samples[i] : samples[i];
+      if (v > peak) peak = v;
+    }
+    if (!shm_bus_release(&client, &block))
+      continue;
+
+    int64_t block_end = block.timestamp_ns + (int64_t) block.frames * 1000000000LL / client.header->rate;
+    fprintf(stdout, "block #%lu peak %d latency %ld us\n", (unsigned long) block.seq, peak,
+            (long) ((monotonic_ns() - block_end) / 1000));
+  }
+
+  fprintf(stdout, "read %lu dropped %lu torn %lu\n", (unsigned long) client.read,
+          (unsigned long) client.dropped, (unsigned long) client.torn);
+  shm_bus_disconnect(&client);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <cmath>
+
+#include "shm-audio-bus.h"
+
+#define SAMPLE_RATE 22050
+#define BLOCK_FRAMES (SAMPLE_RATE) / 100
+#define RING_SLOTS 256
+
+// Publishes a 440 Hz sine on the shared-memory bus at real-time pace, so
+// readers can be developed and tested without a sound card or pulse.
+//
+// g++ shm-bus-synthetic-producer.cc -o shm-bus-synthetic-producer -lm -std=c++11
+// ./shm-bus-synthetic-producer mic0 &
+// ./shm-bus-reader-example mic0
+
+class SineOscillator {
+    float frequency, amplitude, angle = 0.0f, offset = 0.0f;
+public:
+    SineOscillator(float freq, float amp) : frequency(freq), amplitude(amp) {
+        offset = 2 * M_PI * frequency / SAMPLE_RATE;
+    }
+    float process() {
+        auto sample = amplitude * sin(angle);
+        angle += offset;
+        if (angle > 2 * M_PI) angle -= 2 * M_PI;
+        return sample;
+    }
+};
+
+static bool running = true;
+
+/* Signals handling */
+static void handle_sigterm(int signo) { running = false; }
+
+void init_signal() {
+  struct sigaction sa;
+  sa.sa_flags = 0;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : "mic0";
+  shm_bus bus;
+
+  init_signal();
+
+  if (shm_bus_create(&bus, name, SAMPLE_RATE, 1, sizeof(int16_t), BLOCK_FRAMES, RING_SLOTS) < 0)
+    return 1;
+  fprintf(stdout, "publishing %d frame blocks on bus '%s'\n", BLOCK_FRAMES, name);
+
+  SineOscillator sineOscillator(440, 0.5);
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  int64_t block_ns = (int64_t) BLOCK_FRAMES * 1000000000LL / SAMPLE_RATE;
+
+  while (running) {
+    int64_t timestamp = (int64_t) next.tv_sec * 1000000000LL + next.tv_nsec;
+    int16_t *samples = (int16_t*) shm_bus_begin_write(&bus);
+    for (int i = 0; i < BLOCK_FRAMES; i++)
+      samples[i] = (int16_t) (sineOscillator.process() * 32767);
+
+    // Blocks become available when the last frame has been "captured".
+    next.tv_nsec += block_ns;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    shm_bus_commit(&bus, BLOCK_FRAMES, timestamp);
+
+    if (bus.published % 100 == 0)
+      fprintf(stdout, "published %lu blocks to %d readers\n", (unsigned long) bus.published, bus.clients);
+  }
+
+  shm_bus_destroy(&bus);
+  return 0;
+}
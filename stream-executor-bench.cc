@@ -0,0 +1,467 @@
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "level-meter.h"
+#include "loudness-meter.h"
+#include "mock-capture.h"
+#include "resample.h"
+#include "stream-executor.h"
+
+// CPU and per-block latency of per-stream DSP as the stream count grows
+// (stream-executor.h), against the two obvious alternatives:
+//
+//   steal    every stream a task on a work-stealing pool of --threads
+//            workers: per-stream order, turns on the worker that ran
+//            the stream last, stolen by idle workers
+//   thread   a thread per stream, asleep on its own queue
+//   single   one thread for all streams, round robin
+//
+// Mock sources (mock-capture.h signal, paced in real time by one capture
+// thread) deliver a --block-ms block per stream per period into a shared
+// block pool; each block is level metered, loudness metered and resampled
+// to 16 kHz, as the live examples do. Per mode and stream count:
+//
+//   cpu      process CPU (capture thread included) as a share of all
+//            cores: the mean, and its standard deviation and maximum over
+//            100 ms windows (steady: a small deviation)
+//   latency  from the end of a block's capture period to the end of its
+//            processing: p50, p99 and max
+//   moved    turns that ran on another worker than the stream's last
+//            (steal only; low means the streams stay on their cores)
+//
+// and blocks dropped because a stream's queue or the pool was full. A
+// block processed out of order in any mode fails the run.
+//
+// g++ -O2 stream-executor-bench.cc -o stream-executor-bench -lm -std=c++11 -lpthread
+// ./stream-executor-bench --threads=$(nproc) --json=streams.jsonl
+
+#define LAT_BUCKETS 208   /* us: 1 wide below 16, then 8 per octave */
+#define OUT_RATE 16000
+
+static int lat_bucket(int64_t ns) {
+  uint64_t us = ns > 0 ? (uint64_t) ns / 1000 : 0;
+  if (us < 16) return (int) us;
+  int e = 63 - __builtin_clzll(us);
+  int b = 16 + (e - 4) * 8 + (int) ((us >> (e - 3)) & 7);
+  return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+/* The middle of the bucket, in ms. */
+static double lat_bucket_ms(int b) {
+  if (b < 16) return (b + 0.5) / 1000;
+  int e = (b - 16) / 8 + 4, sub = (b - 16) % 8;
+  return ((double) ((uint64_t) (8 + sub) << (e - 3)) + (double) (1ull << (e - 3)) / 2) / 1000;
+}
+
+struct stream_state {
+  level_meter level;
+  loudness_bank loudness;
+  resampler rs;
+  std::vector<float> out;
+  uint32_t latency[LAT_BUCKETS];
+  int64_t max_ns, last_capture_ns;
+  uint64_t blocks, misordered;
+};
+
+struct options {
+  std::string mode;
+  int threads, queue, batch;
+  double seconds, block_ms;
+  uint32_t rate, channels;
+  bool pin;
+};
+
+static block_pool blocks;
+static uint32_t block_frames;
+
+/* The work per block, in any mode; one thread at a time per stream. */
+static void dsp(stream_state *st, const block_ref *b) {
+  const float *x = (const float*) b->data;
+  level_meter_process_f32(&st->level, x, b->frames, b->capture_ns);
+  loudness_process_f32(&st->loudness, x, b->frames);
+  resampler_process(&st->rs, x, b->frames, st->out.data(), (uint32_t) (st->out.size() / st->rs.channels));
+  block_pool_put(&blocks, b->data);
+  if (b->capture_ns <= st->last_capture_ns) st->misordered++;
+  st->last_capture_ns = b->capture_ns;
+  int64_t lat = mock_monotonic_ns() - b->capture_ns;
+  st->latency[lat_bucket(lat)]++;
+  if (lat > st->max_ns) st->max_ns = lat;
+  st->blocks++;
+}
+
+static void exec_process(exec_stream *s, const block_ref *b, int) {
+  dsp((stream_state*) s->user, b);
+}
+
+static double cpu_seconds() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void sleep_until(int64_t ns) {
+  struct timespec ts = { (time_t) (ns / 1000000000), (long) (ns % 1000000000) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void pin_thread(pthread_t t, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(t, sizeof(set), &set);
+}
+
+/* The single mode's thread: a sweep takes one block per stream. */
+struct single_loop {
+  std::vector<block_queue*> queues;
+  std::vector<stream_state*> states;
+  std::mutex lock;
+  std::condition_variable ring;
+  uint64_t ticks;
+  bool done;
+};
+
+static void single_run(single_loop *l) {
+  uint64_t seen = 0;
+  for (;;) {
+    bool any = false;
+    block_ref r;
+    for (size_t i = 0; i < l->queues.size(); i++)
+      if (block_queue_pop(l->queues[i], &r, 0)) {
+        dsp(l->states[i], &r);
+        any = true;
+      }
+    if (any) continue;
+    std::unique_lock<std::mutex> hold(l->lock);
+    if (l->done && l->ticks == seen) return;
+    while (l->ticks == seen && !l->done)
+      l->ring.wait(hold);
+    seen = l->ticks;
+  }
+}
+
+static void thread_run(block_queue *q, stream_state *st) {
+  block_ref r;
+  while (block_queue_pop(q, &r, -1))
+    dsp(st, &r);
+}
+
+static int failures = 0;
+
+static void run(const options &o, const std::string &mode, uint32_t n, const std::vector<float> &signal, FILE *json) {
+  uint32_t ncpu = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  size_t block_bytes = (size_t) block_frames * o.channels * sizeof(float);
+  uint32_t signal_blocks = (uint32_t) (signal.size() / (block_frames * o.channels));
+  if (block_pool_init(&blocks, n * (uint32_t) o.queue + 64, (uint32_t) block_bytes, false) != 0) {
+    fprintf(stderr, "no memory for %u blocks\n", n * o.queue + 64);
+    exit(1);
+  }
+
+  std::vector<stream_state*> states(n);
+  for (uint32_t i = 0; i < n; i++) {
+    stream_state *st = new stream_state;
+    level_meter_init(&st->level, o.rate, o.channels, 100);
+    loudness_bank_init(&st->loudness, o.rate, o.channels, 1, block_frames);
+    resampler_init(&st->rs, o.rate, OUT_RATE, o.channels);
+    st->out.assign(((size_t) block_frames * OUT_RATE / o.rate + 2) * o.channels, 0.0f);
+    memset(st->latency, 0, sizeof(st->latency));
+    st->max_ns = 0;
+    st->last_capture_ns = 0;
+    st->blocks = st->misordered = 0;
+    states[i] = st;
+  }
+
+  work_pool pool;
+  stream_exec x;
+  std::vector<exec_stream*> streams;
+  std::vector<block_queue*> queues;
+  std::vector<std::thread> threads;
+  single_loop single;
+  single.ticks = 0;
+  single.done = false;
+  if (mode == "steal") {
+    work_pool_start(&pool, o.threads);
+    if (o.pin)
+      for (int i = 0; i < o.threads; i++)
+        pin_thread(pool.workers[i].native_handle(), i % ncpu);
+    stream_exec_init(&x, &pool, (uint32_t) o.batch);
+    for (uint32_t i = 0; i < n; i++)
+      streams.push_back(exec_stream_new(&x, (uint32_t) o.queue, exec_process, states[i]));
+  } else {
+    for (uint32_t i = 0; i < n; i++) {
+      block_queue *q = new block_queue;
+      block_queue_init(q, (uint32_t) o.queue);
+      queues.push_back(q);
+    }
+    if (mode == "thread") {
+      for (uint32_t i = 0; i < n; i++)
+        threads.push_back(std::thread(thread_run, queues[i], states[i]));
+    } else {
+      single.queues = queues;
+      single.states = states;
+      threads.push_back(std::thread(single_run, &single));
+    }
+  }
+
+  /* Capture: one block per stream per period, each from its own place in
+     the signal; the cpu sampled every 100 ms. */
+  int64_t period_ns = (int64_t) block_frames * 1000000000 / o.rate;
+  uint64_t ticks = (uint64_t) (o.seconds * 1e9 / period_ns), sample_every = (uint64_t) (1e8 / period_ns);
+  if (!sample_every) sample_every = 1;
+  uint64_t dropped = 0;
+  std::vector<double> windows;
+  int64_t start = mock_monotonic_ns();
+  double cpu_start = cpu_seconds(), cpu_last = cpu_start;
+  int64_t last = start;
+  for (uint64_t t = 0; t < ticks; t++) {
+    int64_t due = start + (int64_t) (t + 1) * period_ns;
+    sleep_until(due);
+    for (uint32_t i = 0; i < n; i++) {
+      uint8_t *b = block_pool_get(&blocks);
+      if (!b) {
+        dropped++;
+        continue;
+      }
+      uint32_t at = (uint32_t) ((i * 997 + t) % signal_blocks);
+      memcpy(b, &signal[(size_t) at * block_frames * o.channels], block_bytes);
+      bool ok = mode == "steal" ? exec_stream_push(streams[i], b, block_frames, due)
+                                : block_queue_push(queues[i], b, block_frames, due);
+      if (!ok) {
+        block_pool_put(&blocks, b);
+        dropped++;
+      }
+    }
+    if (mode == "single") {
+      std::lock_guard<std::mutex> hold(single.lock);
+      single.ticks++;
+      single.ring.notify_one();
+    }
+    if ((t + 1) % sample_every == 0) {
+      int64_t now = mock_monotonic_ns();
+      double cpu = cpu_seconds();
+      windows.push_back(100.0 * (cpu - cpu_last) / ((now - last) / 1e9) / ncpu);
+      cpu_last = cpu;
+      last = now;
+    }
+  }
+
+  /* Drain. */
+  if (mode == "steal") {
+    work_pool_wait(&pool);
+  } else if (mode == "thread") {
+    for (uint32_t i = 0; i < n; i++)
+      block_queue_close(queues[i]);
+  } else {
+    std::lock_guard<std::mutex> hold(single.lock);
+    single.done = true;
+    single.ring.notify_one();
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  double wall = (mock_monotonic_ns() - start) / 1e9;
+  double cpu = 100.0 * (cpu_seconds() - cpu_start) / wall / ncpu;
+
+  uint32_t latency[LAT_BUCKETS];
+  memset(latency, 0, sizeof(latency));
+  uint64_t processed = 0, misordered = 0;
+  int64_t max_ns = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    for (int b = 0; b < LAT_BUCKETS; b++)
+      latency[b] += states[i]->latency[b];
+    processed += states[i]->blocks;
+    misordered += states[i]->misordered;
+    if (states[i]->max_ns > max_ns) max_ns = states[i]->max_ns;
+  }
+  double p50 = 0, p99 = 0;
+  uint64_t seen = 0;
+  for (int b = 0; b < LAT_BUCKETS && processed; b++) {
+    if (seen < processed / 2 && seen + latency[b] >= processed / 2) p50 = lat_bucket_ms(b);
+    if (seen < processed * 99 / 100 && seen + latency[b] >= processed * 99 / 100) p99 = lat_bucket_ms(b);
+    seen += latency[b];
+  }
+  double mean = 0, var = 0, peak = 0;
+  for (size_t i = 0; i < windows.size(); i++) {
+    mean += windows[i] / windows.size();
+    if (windows[i] > peak) peak = windows[i];
+  }
+  for (size_t i = 0; i < windows.size(); i++)
+    var += (windows[i] - mean) * (windows[i] - mean) / windows.size();
+  double moved = -1;
+  if (mode == "steal") {
+    uint64_t turns = 0, moves = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      turns += streams[i]->turns;
+      moves += streams[i]->moves;
+    }
+    moved = turns ? 100.0 * moves / turns : 0;
+  }
+
+  if (misordered) {
+    fprintf(stderr, "FAIL %s/%u: %lu blocks processed out of order\n", mode.c_str(), n, (unsigned long) misordered);
+    failures++;
+  }
+  printf("%-6s %4u streams %4u threads: %8.0f blocks/s, %6lu dropped; cpu %5.1f%% (sd %4.1f, max %5.1f); "
+         "latency p50 %6.2f p99 %6.2f max %7.2f ms",
+         mode.c_str(), n, mode == "steal" ? (unsigned) o.threads : mode == "thread" ? n : 1, processed / wall,
+         (unsigned long) dropped, cpu, sqrt(var), peak, p50, p99, max_ns / 1e6);
+  if (moved >= 0) printf("; moved %.1f%%", moved);
+  printf("\n");
+  fflush(stdout);
+  if (json) {
+    fprintf(json, "{\"mode\":\"%s\",\"streams\":%u,\"threads\":%d,\"cores\":%u,\"block_ms\":%.3f,\"seconds\":%.3f,"
+            "\"blocks_per_sec\":%.1f,\"dropped\":%lu,\"misordered\":%lu,\"cpu_percent\":%.2f,"
+            "\"cpu_stddev\":%.2f,\"cpu_max\":%.2f,\"latency_p50_ms\":%.3f,\"latency_p99_ms\":%.3f,"
+            "\"latency_max_ms\":%.3f",
+            mode.c_str(), n, mode == "steal" ? o.threads : mode == "thread" ? (int) n : 1, ncpu, o.block_ms, wall,
+            processed / wall, (unsigned long) dropped, (unsigned long) misordered, cpu, sqrt(var), peak, p50, p99,
+            max_ns / 1e6);
+    if (moved >= 0) fprintf(json, ",\"moved_percent\":%.2f", moved);
+    fprintf(json, "}\n");
+    fflush(json);
+  }
+
+  if (mode == "steal") {
+    work_pool_stop(&pool);
+    for (uint32_t i = 0; i < n; i++)
+      exec_stream_free(streams[i]);
+  }
+  for (size_t i = 0; i < queues.size(); i++) {
+    block_queue_free(queues[i]);
+    delete queues[i];
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    loudness_bank_free(&states[i]->loudness);
+    delete states[i];
+  }
+  block_pool_free(&blocks);
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  --streams=N,...   stream counts (1,2,4,8,16,32,64,128,256)\n"
+          "  --mode=M,...      steal, thread and/or single (all three)\n"
+          "  --threads=N       steal workers (the online cores)\n"
+          "  --pin             pin steal worker i to core i\n"
+          "  --batch=N         blocks per turn, at most (4)\n"
+          "  --queue=N         blocks queued per stream, a power of two (16)\n"
+          "  --seconds=S       per run (3)\n"
+          "  --block-ms=MS     capture period (10)\n"
+          "  --rate=HZ         (48000)\n"
+          "  --channels=N      (2)\n"
+          "  --json=FILE       append a JSON line per run\n",
+          argv0);
+}
+
+static std::vector<std::string> split(const char *s) {
+  std::vector<std::string> out;
+  std::string cur;
+  for (; ; s++) {
+    if (!*s || *s == ',') {
+      if (!cur.empty()) out.push_back(cur);
+      cur.clear();
+      if (!*s) break;
+    } else {
+      cur += *s;
+    }
+  }
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  options o;
+  o.mode = "steal,thread,single";
+  o.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  o.queue = 16;
+  o.batch = 4;
+  o.seconds = 3;
+  o.block_ms = 10;
+  o.rate = 48000;
+  o.channels = 2;
+  o.pin = false;
+  std::string counts = "1,2,4,8,16,32,64,128,256";
+  FILE *json = NULL;
+
+  enum { STREAMS = 256, MODE, THREADS, PIN, BATCH, QUEUE, SECONDS, BLOCK_MS, RATE, CHANNELS, JSON };
+  static const struct option long_options[] = {
+    {"streams", 1, NULL, STREAMS}, {"mode", 1, NULL, MODE}, {"threads", 1, NULL, THREADS}, {"pin", 0, NULL, PIN},
+    {"batch", 1, NULL, BATCH}, {"queue", 1, NULL, QUEUE}, {"seconds", 1, NULL, SECONDS},
+    {"block-ms", 1, NULL, BLOCK_MS}, {"rate", 1, NULL, RATE}, {"channels", 1, NULL, CHANNELS},
+    {"json", 1, NULL, JSON}, {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case STREAMS: counts = optarg; break;
+      case MODE: o.mode = optarg; break;
+      case THREADS: o.threads = atoi(optarg); break;
+      case PIN: o.pin = true; break;
+      case BATCH: o.batch = atoi(optarg); break;
+      case QUEUE: o.queue = atoi(optarg); break;
+      case SECONDS: o.seconds = atof(optarg); break;
+      case BLOCK_MS: o.block_ms = atof(optarg); break;
+      case RATE: o.rate = (uint32_t) atoi(optarg); break;
+      case CHANNELS: o.channels = (uint32_t) atoi(optarg); break;
+      case JSON:
+        if (!(json = fopen(optarg, "a"))) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  block_frames = (uint32_t) (o.rate * o.block_ms / 1000);
+  if (o.threads < 1 || o.batch < 1 || o.queue < 2 || (o.queue & (o.queue - 1)) || o.seconds <= 0 || !block_frames ||
+      !o.channels || o.channels > LOUDNESS_LANES) {
+    help(argv[0]);
+    return 1;
+  }
+  std::vector<std::string> modes = split(o.mode.c_str()), ns = split(counts.c_str());
+  for (size_t m = 0; m < modes.size(); m++)
+    if (modes[m] != "steal" && modes[m] != "thread" && modes[m] != "single") {
+      help(argv[0]);
+      return 1;
+    }
+
+  /* One second of the mock signal, which the streams read at different
+     places. */
+  mock_capture_config cfg;
+  mock_capture_default_config(&cfg, o.rate, o.channels, MOCK_F32);
+  cfg.speed = 0;
+  cfg.noise_amp = 0.05f;
+  mock_capture mock;
+  mock_capture_open(&mock, &cfg);
+  uint32_t frames = o.rate / block_frames * block_frames;
+  if (frames < block_frames) frames = block_frames;
+  std::vector<float> signal((size_t) frames * o.channels);
+  int64_t ns_unused;
+  mock_capture_read(&mock, signal.data(), frames, &ns_unused);
+
+  for (size_t i = 0; i < ns.size(); i++)
+    for (size_t m = 0; m < modes.size(); m++) {
+      int n = atoi(ns[i].c_str());
+      if (n > 0) run(o, modes[m], (uint32_t) n, signal, json);
+    }
+  if (json) fclose(json);
+  if (failures) {
+    fprintf(stderr, "%d failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+/*
+  Per-block DSP for many capture streams on a few cores.
+
+  A thread per stream oversubscribes the cores once there are dozens of
+  streams, and one processing thread stops keeping up. Here every stream
+  is a task on a work-stealing pool (work-pool.h) instead:
+
+    capture:  block_pool_get() -> fill -> exec_stream_push(s, ...)
+    pool:     process(s, block, worker) for each block, in order
+
+  Each stream has its own bounded queue (block-pool.h), and at most one
+  turn of it is queued or running at a time, so its blocks are processed
+  in order without a lock: a push schedules a turn only when none is
+  scheduled, and a turn processes up to `batch` blocks, then either
+  reschedules itself (more are waiting) or clears the flag and checks
+  once more for a block that came in meanwhile.
+
+  Turns go to the inbox of the worker that ran the stream last (its
+  filter state, history and output are in that core's cache), which
+  takes them before anything else. A worker with nothing of its own
+  steals them, so a busy worker's streams move to an idle one and stay
+  there. A backlogged stream yields after `batch` blocks, behind the
+  other streams' turns, so per-block latency stays bounded by about one
+  turn per stream per worker.
+
+    work_pool pool;
+    work_pool_start(&pool, threads);
+    stream_exec x;
+    stream_exec_init(&x, &pool, 4);
+    exec_stream *s = exec_stream_new(&x, 16, process, user);
+    if (!exec_stream_push(s, block, frames, capture_ns))
+      block_pool_put(&blocks, block);       // its queue is full: dropped
+    ...
+    work_pool_wait(&pool);                  // once capture stopped: drained
+    exec_stream_free(s);
+
+  process() owns the block (return it to its pool). One producer per
+  stream; any number of streams per producer. Linux only, C++11.
+*/
+#ifndef STREAM_EXECUTOR_H_
+#define STREAM_EXECUTOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+#include "block-pool.h"
+#include "work-pool.h"
+
+struct exec_stream;
+typedef void (*exec_process_fn)(exec_stream *s, const block_ref *b, int worker);
+
+struct stream_exec {
+  work_pool *pool;
+  uint32_t batch;                   /* blocks per turn, at most */
+  std::atomic<uint32_t> streams;    /* for the first homes, round robin */
+};
+
+struct exec_stream {
+  work_item item;                   /* a turn */
+  stream_exec *exec;
+  exec_process_fn process;
+  void *user;
+  uint32_t id;
+  block_queue queue;
+  std::atomic<bool> scheduled;      /* a turn is queued or running */
+  std::atomic<int> home;            /* the worker that ran it last */
+  /* The producer's. */
+  uint64_t pushed, dropped;
+  /* The turn's (one worker at a time). */
+  uint64_t blocks, turns, moves, yields;
+  int64_t busy_ns;
+};
+
+static inline void stream_exec_init(stream_exec *x, work_pool *pool, uint32_t batch) {
+  x->pool = pool;
+  x->batch = batch ? batch : 1;
+  x->streams.store(0);
+}
+
+static inline bool exec_stream_waiting(exec_stream *s) {
+  return s->queue.tail.load(std::memory_order_relaxed) != s->queue.head.load(std::memory_order_acquire);
+}
+
+static inline void exec_stream_run(work_item *w, int worker) {
+  exec_stream *s = (exec_stream*) w;
+  stream_exec *x = s->exec;
+  if (s->home.load(std::memory_order_relaxed) != worker) {
+    s->moves++;
+    s->home.store(worker, std::memory_order_relaxed);
+  }
+  s->turns++;
+  int64_t start = work_pool_now_ns();
+  block_ref r;
+  uint32_t n = 0;
+  while (n < x->batch && block_queue_pop(&s->queue, &r, 0)) {
+    s->process(s, &r, worker);
+    n++;
+  }
+  s->blocks += n;
+  s->busy_ns += work_pool_now_ns() - start;
+  if (n == x->batch && exec_stream_waiting(s)) {
+    /* Behind the turns already queued here; still stealable. */
+    s->yields++;
+    work_pool_submit_to(x->pool, worker, &s->item);
+    return;
+  }
+  s->scheduled.store(false, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (exec_stream_waiting(s) && !s->scheduled.exchange(true, std::memory_order_acq_rel))
+    work_pool_submit_to(x->pool, worker, &s->item);
+}
+
+/* NULL without memory; capacity must be a power of two. */
+static inline exec_stream *exec_stream_new(stream_exec *x, uint32_t capacity, exec_process_fn process, void *user) {
+  exec_stream *s = new exec_stream;
+  if (!block_queue_init(&s->queue, capacity)) {
+    delete s;
+    return NULL;
+  }
+  s->item.run = exec_stream_run;
+  s->item.next = NULL;
+  s->exec = x;
+  s->process = process;
+  s->user = user;
+  s->id = x->streams.fetch_add(1);
+  s->scheduled.store(false);
+  s->home.store((int) (s->id % (uint32_t) x->pool->threads));
+  s->pushed = s->dropped = 0;
+  s->blocks = s->turns = s->moves = s->yields = 0;
+  s->busy_ns = 0;
+  return s;
+}
+
+/* Once no turn can be queued (work_pool_wait() after the last push). */
+static inline void exec_stream_free(exec_stream *s) {
+  block_queue_free(&s->queue);
+  delete s;
+}
+
+/* The stream's producer. False when its queue is full: the caller still
+   owns the block. */
+static inline bool exec_stream_push(exec_stream *s, uint8_t *data, uint32_t frames, int64_t capture_ns) {
+  if (!block_queue_push(&s->queue, data, frames, capture_ns)) {
+    s->dropped++;
+    return false;
+  }
+  s->pushed++;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!s->scheduled.load(std::memory_order_relaxed) && !s->scheduled.exchange(true, std::memory_order_acq_rel))
+    work_pool_submit_to(s->exec->pool, s->home.load(std::memory_order_relaxed), &s->item);
+  return true;
+}
+
+/* Totals over `n` streams: how many turns moved to another worker, and
+   how many blocks a turn took. */
+static inline void stream_exec_print_stats(exec_stream *const *streams, size_t n, FILE *out) {
+  uint64_t pushed = 0, dropped = 0, blocks = 0, turns = 0, moves = 0, yields = 0, max_depth = 0;
+  int64_t busy_ns = 0;
+  for (size_t i = 0; i < n; i++) {
+    const exec_stream *s = streams[i];
+    pushed += s->pushed;
+    dropped += s->dropped;
+    blocks += s->blocks;
+    turns += s->turns;
+    moves += s->moves;
+    yields += s->yields;
+    busy_ns += s->busy_ns;
+    if (s->queue.max_depth > max_depth) max_depth = s->queue.max_depth;
+  }
+  fprintf(out, "%lu streams: %lu blocks pushed, %lu dropped, %lu processed in %lu turns (%.2f per turn, "
+          "%lu yielded), %.1f%% of turns moved worker, %.3f s busy, max queue depth %lu\n",
+          (unsigned long) n, (unsigned long) pushed, (unsigned long) dropped, (unsigned long) blocks,
+          (unsigned long) turns, turns ? (double) blocks / turns : 0.0, (unsigned long) yields,
+          turns ? 100.0 * moves / turns : 0.0, busy_ns / 1e9, (unsigned long) max_depth);
+}
+
+#endif  // STREAM_EXECUTOR_H_
@@ -0,0 +1,630 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "level-meter.h"
+#include "loudness-meter.h"
+#include "resample.h"
+#include "work-pool.h"
+
+// Offline mode: the processing stages of the live examples over recorded
+// WAVs (what pulseaudio-record-save writes, or any PCM WAV), in parallel.
+// Per file, one JSON object per line:
+//
+//   levels      peak, RMS, DC and clipped samples per channel (level-meter.h)
+//   loudness    integrated, and the loudest momentary and short-term
+//               (loudness-meter.h)
+//   features    the signal resampled to --rate (resample.h) and mixed to
+//               mono, cut in 100 ms blocks: zero crossing rate and log
+//               energy, as pulseaudio-fanout-example extracts them live
+//
+// Files are mapped (or, with --read, read in large sequential chunks) and
+// go to a work-stealing pool (work-pool.h), biggest first. A file longer
+// than --segment is cut into segments that idle workers steal, so one
+// long recording does not leave the other cores waiting. Every segment
+// starts with a pre-roll it does not count, which brings the filters,
+// the resampler and the 3 s loudness window to the state they would have
+// had, and segments are cut where 100 ms blocks and resampler phases line
+// up: the merged result is the one a single pass gives.
+//
+// g++ -O2 wav-batch.cc -o wav-batch -lm -std=c++11 -lpthread
+// ./wav-batch --threads=$(nproc) --out=results.jsonl recordings/ more.wav
+
+#define READ_CHUNK_BYTES (4 << 20)
+#define PREROLL_SEC 3
+
+struct options {
+  int threads;
+  uint32_t rate;
+  double segment_sec;
+  bool read;
+  bool verbose;
+};
+
+enum wav_format { WAV_U8, WAV_S16, WAV_S24, WAV_S32, WAV_F32 };
+static const char *wav_format_names[] = { "u8", "s16", "s24", "s32", "f32" };
+
+struct wav_info {
+  wav_format format;
+  uint32_t rate, channels, frame_bytes;
+  uint64_t data_offset, frames;
+};
+
+struct features {
+  uint64_t blocks;
+  double zcr, energy_db, energy_db2, energy_db_min, energy_db_max;
+};
+
+struct segment_result {
+  double peak[LEVEL_METER_MAX_CHANNELS], sum[LEVEL_METER_MAX_CHANNELS], squares[LEVEL_METER_MAX_CHANNELS];
+  uint64_t clips[LEVEL_METER_MAX_CHANNELS];
+  uint64_t frames;
+  loudness_stream loudness;
+  double max_momentary, max_short_term;
+  features feat;
+  uint64_t out_frames;
+  int64_t busy_ns;
+};
+
+struct file_job;
+
+struct segment_job {
+  work_item item;
+  file_job *file;
+  uint64_t first, frames;   /* counted */
+  segment_result result;
+};
+
+struct file_job {
+  work_item item;
+  std::string path;
+  uint64_t size;
+  const options *opt;
+  int fd;
+  const uint8_t *map;
+  wav_info wav;
+  std::vector<segment_job*> segments;
+  std::atomic<uint32_t> remaining;
+  std::string error;
+};
+
+static work_pool pool;
+static FILE *results;
+static std::mutex results_lock;
+static std::atomic<uint64_t> total_bytes, failed;
+
+static uint32_t le16(const uint8_t *p) { return p[0] | p[1] << 8; }
+static uint32_t le32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+
+// RIFF/WAVE: the fmt and data chunks. A recording whose writer never came
+// back to fill in the sizes (pulseaudio-record-save killed hard) has
+// "----" there: then the data runs to the end of the file.
+static bool wav_parse(const uint8_t *p, size_t have, uint64_t file_size, wav_info *w, std::string *err) {
+  if (have < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+    *err = "not a RIFF/WAVE file";
+    return false;
+  }
+  bool fmt = false;
+  uint32_t tag = 0, bits = 0;
+  for (size_t off = 12; off + 8 <= have;) {
+    const uint8_t *id = p + off;
+    uint64_t len = le32(p + off + 4), body = off + 8;
+    if (!memcmp(id, "fmt ", 4) && body + 16 <= have) {
+      tag = le16(p + body);
+      w->channels = le16(p + body + 2);
+      w->rate = le32(p + body + 4);
+      bits = le16(p + body + 14);
+      if (tag == 0xfffe && len >= 26 && body + 26 <= have)
+        tag = le16(p + body + 24);  /* WAVE_FORMAT_EXTENSIBLE: the sub-format */
+      fmt = true;
+    } else if (!memcmp(id, "data", 4)) {
+      if (!fmt) break;
+      if (tag == 1 && bits == 8) w->format = WAV_U8;
+      else if (tag == 1 && bits == 16) w->format = WAV_S16;
+      else if (tag == 1 && bits == 24) w->format = WAV_S24;
+      else if (tag == 1 && bits == 32) w->format = WAV_S32;
+      else if (tag == 3 && bits == 32) w->format = WAV_F32;
+      else {
+        *err = "unsupported sample format";
+        return false;
+      }
+      if (!w->channels || w->channels > LEVEL_METER_MAX_CHANNELS || !w->rate) {
+        *err = "unsupported channel count or rate";
+        return false;
+      }
+      if (!memcmp(p + off + 4, "----", 4) || body + len > file_size)
+        len = file_size - body;
+      w->frame_bytes = w->channels * bits / 8;
+      w->data_offset = body;
+      w->frames = len / w->frame_bytes;
+      return true;
+    }
+    off = body + len + (len & 1);
+  }
+  *err = fmt ? "no data chunk in the header" : "no fmt chunk in the header";
+  return false;
+}
+
+static void wav_to_float(const wav_info *w, const uint8_t *p, uint32_t frames, float *out) {
+  size_t n = (size_t) frames * w->channels;
+  switch (w->format) {
+    case WAV_U8:
+      for (size_t i = 0; i < n; i++) out[i] = ((int) p[i] - 128) * (1.0f / 128);
+      break;
+    case WAV_S16:
+      for (size_t i = 0; i < n; i++) out[i] = (int16_t) le16(p + 2 * i) * (1.0f / 32768);
+      break;
+    case WAV_S24:
+      for (size_t i = 0; i < n; i++) {
+        const uint8_t *s = p + 3 * i;
+        int32_t v = (int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16 | (uint32_t) s[2] << 24) >> 8;
+        out[i] = v * (1.0f / 8388608);
+      }
+      break;
+    case WAV_S32:
+      for (size_t i = 0; i < n; i++) out[i] = (int32_t) le32(p + 4 * i) * (1.0f / 2147483648.0f);
+      break;
+    case WAV_F32:
+      memcpy(out, p, n * sizeof(float));
+      break;
+  }
+}
+
+// Where the frames come from: the mapping, or a window of large reads.
+struct source {
+  const file_job *file;
+  std::vector<uint8_t> buffer;
+  uint64_t buffer_first, buffer_frames;
+};
+
+static const uint8_t *source_frames(source *s, uint64_t first, uint32_t frames) {
+  const file_job *f = s->file;
+  const wav_info *w = &f->wav;
+  if (f->map)
+    return f->map + w->data_offset + first * w->frame_bytes;
+  if (first < s->buffer_first || first + frames > s->buffer_first + s->buffer_frames) {
+    uint64_t want = std::max<uint64_t>(frames, READ_CHUNK_BYTES / w->frame_bytes);
+    want = std::min(want, w->frames - first);
+    s->buffer.resize(want * w->frame_bytes);
+    size_t got = 0;
+    while (got < s->buffer.size()) {
+      ssize_t r = pread(f->fd, &s->buffer[got], s->buffer.size() - got, w->data_offset + first * w->frame_bytes + got);
+      if (r <= 0) break;
+      got += r;
+    }
+    if (got < s->buffer.size())
+      memset(&s->buffer[got], 0, s->buffer.size() - got);  /* truncated under us: silence */
+    s->buffer_first = first;
+    s->buffer_frames = want;
+  }
+  return &s->buffer[(first - s->buffer_first) * w->frame_bytes];
+}
+
+static void features_block(features *ft, const float *x, uint32_t n) {
+  uint32_t crossings = 0;
+  double energy = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    if (i && ((x[i - 1] < 0) != (x[i] < 0))) crossings++;
+    energy += (double) x[i] * x[i];
+  }
+  double db = 10 * log10(energy / n + 1e-12);
+  if (!ft->blocks || db < ft->energy_db_min) ft->energy_db_min = db;
+  if (!ft->blocks || db > ft->energy_db_max) ft->energy_db_max = db;
+  ft->blocks++;
+  ft->zcr += (double) crossings / n;
+  ft->energy_db += db;
+  ft->energy_db2 += db * db;
+}
+
+// Frames per 100 ms block, and how far apart segments may start so that
+// loudness sub-blocks, resampler phases and feature blocks all line up.
+static uint64_t segment_unit(uint32_t rate, uint32_t out_rate) {
+  uint64_t tick = rate / 10, down = rate / resample_gcd(rate, out_rate);
+  uint64_t a = tick, b = down;
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return tick / a * down;
+}
+
+static void write_result(file_job *f);
+
+static void run_segment(work_item *item, int worker) {
+  segment_job *sj = (segment_job*) item;
+  file_job *f = sj->file;
+  const wav_info *w = &f->wav;
+  const uint32_t out_rate = f->opt->rate;
+  segment_result *res = &sj->result;
+  int64_t start_ns = work_pool_now_ns();
+
+  const uint32_t tick = w->rate / 10 ? w->rate / 10 : 1;
+  const uint64_t unit = segment_unit(w->rate, out_rate);
+  uint64_t preroll = sj->first ? (PREROLL_SEC * (uint64_t) w->rate + unit - 1) / unit * unit : 0;
+  if (preroll > sj->first) preroll = sj->first;
+  const uint64_t from = sj->first - preroll, end = sj->first + sj->frames;
+
+  level_meter meter;
+  level_meter_init(&meter, w->rate, w->channels, 0);
+  loudness_bank loudness;
+  loudness_bank_init(&loudness, w->rate, w->channels, 1, tick);
+  resampler rs;
+  resampler_init(&rs, w->rate, out_rate, w->channels);
+
+  source src;
+  src.file = f;
+  src.buffer_first = src.buffer_frames = 0;
+  std::vector<float> x((size_t) tick * w->channels);
+  const uint32_t max_out = (uint32_t) (((uint64_t) tick + rs.taps) * rs.up / rs.down + 2);
+  std::vector<float> y((size_t) max_out * w->channels);
+  const uint32_t block = out_rate / 10 ? out_rate / 10 : 1;
+  std::vector<float> mono(block);
+  uint32_t mono_fill = 0;
+  /* The outputs this segment keeps: those of its counted input frames. */
+  const uint64_t keep_from = ((sj->first - from) * rs.up + rs.down - 1) / rs.down;
+  const uint64_t keep_to = ((end - from) * rs.up + rs.down - 1) / rs.down;
+  /* Read on as far as the resampler's taps reach; past the end of the
+     file they read silence. */
+  const uint64_t stop = std::min<uint64_t>(w->frames, end + rs.taps);
+
+  memset(res, 0, sizeof(*res));
+  res->max_momentary = res->max_short_term = -HUGE_VAL;
+
+  level_snapshot snap;
+  uint64_t out_seen = 0;
+  for (uint64_t at = from; at <= stop; ) {
+    uint32_t n = (uint32_t) std::min<uint64_t>(tick, stop - at), got;
+    if (n) {
+      wav_to_float(w, source_frames(&src, at, n), n, x.data());
+      if (at >= sj->first && at < end) {
+        level_meter_process_f32(&meter, x.data(), n, 0);
+        if (level_meter_read(&meter, &snap))
+          for (uint32_t c = 0; c < w->channels; c++) {
+            res->peak[c] = std::max<double>(res->peak[c], snap.channel[c].peak);
+            res->sum[c] += (double) snap.channel[c].dc * snap.frames;
+            res->squares[c] += (double) snap.channel[c].rms * snap.channel[c].rms * snap.frames;
+            res->clips[c] += snap.channel[c].clips;
+          }
+        res->frames += n;
+      }
+      if (at < end) {
+        if (at == sj->first && sj->first)
+          loudness_reset_integrated(&loudness.stream[0]);
+        loudness_process_f32(&loudness, x.data(), n);
+        if (at >= sj->first && n == tick) {
+          res->max_momentary = std::max(res->max_momentary, loudness_momentary(&loudness.stream[0]));
+          res->max_short_term = std::max(res->max_short_term, loudness_short_term(&loudness.stream[0]));
+        }
+      }
+      got = resampler_process(&rs, x.data(), n, y.data(), max_out);
+      at += n;
+    } else if (stop == w->frames) {
+      got = resampler_flush(&rs, y.data(), max_out);
+      at++;
+    } else {
+      break;
+    }
+    for (uint32_t i = 0; i < got; i++, out_seen++) {
+      if (out_seen < keep_from || out_seen >= keep_to)
+        continue;
+      float v = 0;
+      for (uint32_t c = 0; c < w->channels; c++)
+        v += y[(size_t) i * w->channels + c];
+      mono[mono_fill++] = v / w->channels;
+      res->out_frames++;
+      if (mono_fill == block) {
+        features_block(&res->feat, mono.data(), block);
+        mono_fill = 0;
+      }
+    }
+  }
+  if (mono_fill)
+    features_block(&res->feat, mono.data(), mono_fill);
+  memcpy(&res->loudness, &loudness.stream[0], sizeof(res->loudness));
+  loudness_bank_free(&loudness);
+  res->busy_ns = work_pool_now_ns() - start_ns;
+  (void) worker;
+
+  if (f->remaining.fetch_sub(1) == 1)
+    write_result(f);
+}
+
+static void json_number(FILE *out, const char *key, double v) {
+  if (isfinite(v)) fprintf(out, ",\"%s\":%.6g", key, v);
+  else fprintf(out, ",\"%s\":null", key);
+}
+
+static std::string json_escape(const std::string &s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') out += '\\';
+    if ((unsigned char) s[i] >= 0x20) out += s[i];
+  }
+  return out;
+}
+
+// The last segment of a file merges them all and writes the line.
+static void write_result(file_job *f) {
+  char *text = NULL;
+  size_t length = 0;
+  FILE *out = open_memstream(&text, &length);
+  fprintf(out, "{\"file\":\"%s\"", json_escape(f->path).c_str());
+  if (!f->error.empty()) {
+    fprintf(out, ",\"error\":\"%s\"}\n", json_escape(f->error).c_str());
+    failed++;
+  } else {
+    const wav_info *w = &f->wav;
+    segment_result all;
+    memset(&all, 0, sizeof(all));
+    all.max_momentary = all.max_short_term = -HUGE_VAL;
+    for (size_t i = 0; i < f->segments.size(); i++) {
+      const segment_result *r = &f->segments[i]->result;
+      for (uint32_t c = 0; c < w->channels; c++) {
+        all.peak[c] = std::max(all.peak[c], r->peak[c]);
+        all.sum[c] += r->sum[c];
+        all.squares[c] += r->squares[c];
+        all.clips[c] += r->clips[c];
+      }
+      all.frames += r->frames;
+      loudness_merge_integrated(&all.loudness, &r->loudness);
+      all.max_momentary = std::max(all.max_momentary, r->max_momentary);
+      all.max_short_term = std::max(all.max_short_term, r->max_short_term);
+      if (r->feat.blocks) {
+        if (!all.feat.blocks || r->feat.energy_db_min < all.feat.energy_db_min)
+          all.feat.energy_db_min = r->feat.energy_db_min;
+        if (!all.feat.blocks || r->feat.energy_db_max > all.feat.energy_db_max)
+          all.feat.energy_db_max = r->feat.energy_db_max;
+      }
+      all.feat.blocks += r->feat.blocks;
+      all.feat.zcr += r->feat.zcr;
+      all.feat.energy_db += r->feat.energy_db;
+      all.feat.energy_db2 += r->feat.energy_db2;
+      all.out_frames += r->out_frames;
+      all.busy_ns += r->busy_ns;
+    }
+    fprintf(out, ",\"format\":\"%s\",\"rate\":%u,\"channels\":%u,\"frames\":%lu,\"segments\":%lu",
+            wav_format_names[w->format], w->rate, w->channels, (unsigned long) w->frames,
+            (unsigned long) f->segments.size());
+    json_number(out, "seconds", (double) w->frames / w->rate);
+    double frames = all.frames ? (double) all.frames : 1;
+    const char *keys[] = { "peak_dbfs", "rms_dbfs", "dc", "clips" };
+    for (int k = 0; k < 4; k++) {
+      fprintf(out, ",\"%s\":[", keys[k]);
+      for (uint32_t c = 0; c < w->channels; c++) {
+        double v = k == 0 ? level_db((float) all.peak[c]) : k == 1 ? level_db((float) sqrt(all.squares[c] / frames))
+                 : k == 2 ? all.sum[c] / frames : (double) all.clips[c];
+        fprintf(out, "%s%.6g", c ? "," : "", v);
+      }
+      fprintf(out, "]");
+    }
+    json_number(out, "integrated_lufs", loudness_integrated(&all.loudness));
+    json_number(out, "max_momentary_lufs", all.max_momentary);
+    json_number(out, "max_short_term_lufs", all.max_short_term);
+    fprintf(out, ",\"out_rate\":%u,\"out_frames\":%lu,\"feature_blocks\":%lu", f->opt->rate,
+            (unsigned long) all.out_frames, (unsigned long) all.feat.blocks);
+    double blocks = all.feat.blocks ? (double) all.feat.blocks : 1, mean = all.feat.energy_db / blocks;
+    json_number(out, "zcr_mean", all.feat.zcr / blocks);
+    json_number(out, "log_energy_db_mean", mean);
+    json_number(out, "log_energy_db_std", sqrt(fmax(0, all.feat.energy_db2 / blocks - mean * mean)));
+    json_number(out, "log_energy_db_min", all.feat.energy_db_min);
+    json_number(out, "log_energy_db_max", all.feat.energy_db_max);
+    json_number(out, "cpu_ms", all.busy_ns / 1e6);
+    fprintf(out, "}\n");
+    total_bytes += w->frames * w->frame_bytes;
+  }
+  fclose(out);
+  {
+    std::lock_guard<std::mutex> hold(results_lock);
+    fwrite(text, 1, length, results);
+  }
+  free(text);
+
+  if (f->map)
+    munmap((void*) f->map, f->size);
+  if (f->fd >= 0)
+    close(f->fd);
+  for (size_t i = 0; i < f->segments.size(); i++)
+    delete f->segments[i];
+  f->segments.clear();
+}
+
+// Open, parse, cut into segments; run the first here and leave the rest
+// to whoever is idle.
+static void run_file(work_item *item, int worker) {
+  file_job *f = (file_job*) item;
+  f->map = NULL;
+  f->fd = open(f->path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (f->fd < 0) {
+    f->error = strerror(errno);
+    write_result(f);
+    return;
+  }
+  uint8_t head[65536];
+  const uint8_t *p = head;
+  size_t have;
+  if (f->opt->read) {
+    posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ssize_t r = pread(f->fd, head, sizeof(head), 0);
+    have = r > 0 ? (size_t) r : 0;
+  } else {
+    void *m = f->size ? mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0) : MAP_FAILED;
+    if (m == MAP_FAILED) {
+      f->error = f->size ? strerror(errno) : "empty file";
+      write_result(f);
+      return;
+    }
+    madvise(m, f->size, MADV_SEQUENTIAL);
+    f->map = (const uint8_t*) m;
+    p = f->map;
+    have = std::min<uint64_t>(f->size, sizeof(head));
+  }
+  if (!wav_parse(p, have, f->size, &f->wav, &f->error)) {
+    write_result(f);
+    return;
+  }
+  resampler probe;
+  if (!resampler_init(&probe, f->wav.rate, f->opt->rate, f->wav.channels)) {
+    f->error = "cannot resample this rate to --rate";
+    write_result(f);
+    return;
+  }
+
+  uint64_t unit = segment_unit(f->wav.rate, f->opt->rate);
+  uint64_t length = (uint64_t) (f->opt->segment_sec * f->wav.rate) / unit * unit;
+  if (length < unit) length = unit;
+  uint64_t count = f->wav.frames ? (f->wav.frames + length - 1) / length : 1;
+  for (uint64_t i = 0; i < count; i++) {
+    segment_job *sj = new segment_job;
+    sj->item.run = run_segment;
+    sj->file = f;
+    sj->first = i * length;
+    sj->frames = std::min(length, f->wav.frames - sj->first);
+    f->segments.push_back(sj);
+  }
+  f->remaining.store((uint32_t) count);
+  /* Pushed last to first: thieves take from the top, the end of the file. */
+  for (uint64_t i = count; i-- > 1;)
+    work_pool_spawn(&pool, worker, &f->segments[i]->item);
+  run_segment(&f->segments[0]->item, worker);
+}
+
+static bool is_wav(const std::string &name) {
+  return name.size() > 4 && !strcasecmp(name.c_str() + name.size() - 4, ".wav");
+}
+
+// Files named, and every *.wav under directories named, with their sizes.
+static void collect(const std::string &path, bool named, std::vector<std::pair<uint64_t, std::string> > *files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  if (S_ISREG(st.st_mode)) {
+    if (named || is_wav(path))
+      files->push_back(std::make_pair((uint64_t) st.st_size, path));
+    return;
+  }
+  if (!S_ISDIR(st.st_mode))
+    return;
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *e = readdir(dir))
+    if (e->d_name[0] != '.')
+      names.push_back(e->d_name);
+  closedir(dir);
+  for (size_t i = 0; i < names.size(); i++)
+    collect(path + (path[path.size() - 1] == '/' ? "" : "/") + names[i], false, files);
+}
+
+static void help(const char *argv0) {
+  fprintf(stderr,
+          "%s [options] DIR|FILE... > results.jsonl\n"
+          "  --threads=N      workers (all cores)\n"
+          "  --rate=HZ        resample to this rate for the features (16000)\n"
+          "  --segment=S      cut files longer than this many seconds (600)\n"
+          "  --read           large sequential reads instead of mmap\n"
+          "  --out=FILE       results here instead of stdout\n"
+          "  --verbose        per-worker statistics at the end\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  options o;
+  o.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  o.rate = 16000;
+  o.segment_sec = 600;
+  o.read = false;
+  o.verbose = false;
+  const char *out_path = NULL;
+
+  enum { THREADS = 256, RATE, SEGMENT, READ, OUT, VERBOSE };
+  static const struct option long_options[] = {
+    {"threads", 1, NULL, THREADS}, {"rate", 1, NULL, RATE}, {"segment", 1, NULL, SEGMENT},
+    {"read", 0, NULL, READ}, {"out", 1, NULL, OUT}, {"verbose", 0, NULL, VERBOSE},
+    {"help", 0, NULL, 'h'}, {NULL, 0, NULL, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (c) {
+      case THREADS: o.threads = atoi(optarg); break;
+      case RATE: o.rate = atoi(optarg); break;
+      case SEGMENT: o.segment_sec = atof(optarg); break;
+      case READ: o.read = true; break;
+      case OUT: out_path = optarg; break;
+      case VERBOSE: o.verbose = true; break;
+      default:
+        help(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc || o.threads < 1 || !o.rate || o.segment_sec <= 0) {
+    help(argv[0]);
+    return 1;
+  }
+  results = out_path ? fopen(out_path, "w") : stdout;
+  if (!results) {
+    perror(out_path);
+    return 1;
+  }
+
+  std::vector<std::pair<uint64_t, std::string> > files;
+  for (int i = optind; i < argc; i++)
+    collect(argv[i], true, &files);
+  /* Biggest first: the long tail of the run is small files. */
+  std::sort(files.begin(), files.end(), std::greater<std::pair<uint64_t, std::string> >());
+
+  std::vector<file_job*> jobs;
+  for (size_t i = 0; i < files.size(); i++) {
+    file_job *f = new file_job;
+    f->item.run = run_file;
+    f->size = files[i].first;
+    f->path = files[i].second;
+    f->opt = &o;
+    f->fd = -1;
+    f->map = NULL;
+    jobs.push_back(f);
+  }
+
+  int64_t start = work_pool_now_ns();
+  work_pool_start(&pool, o.threads);
+  for (size_t i = 0; i < jobs.size(); i++)
+    work_pool_submit(&pool, &jobs[i]->item);
+  work_pool_wait(&pool);
+  double wall = (work_pool_now_ns() - start) / 1e9;
+
+  /* Audio seconds at each file's own rate. */
+  double audio = 0;
+  for (size_t i = 0; i < jobs.size(); i++)
+    if (jobs[i]->error.empty())
+      audio += (double) jobs[i]->wav.frames / jobs[i]->wav.rate;
+  fprintf(stderr, "%lu files (%lu failed), %.1f h of audio, %.1f MB in %.2f s with %d threads: %.0fx real time, %.1f MB/s\n",
+          (unsigned long) jobs.size(), (unsigned long) failed.load(), audio / 3600, total_bytes.load() / 1e6, wall,
+          o.threads, wall > 0 ? audio / wall : 0, wall > 0 ? total_bytes.load() / 1e6 / wall : 0);
+  if (o.verbose)
+    work_pool_print_stats(&pool, stderr);
+  work_pool_stop(&pool);
+
+  for (size_t i = 0; i < jobs.size(); i++)
+    delete jobs[i];
+  if (results != stdout)
+    fclose(results);
+  return failed.load() ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "wave-overview.h"
+
+// Read overview sidecars (wave-overview.h), as a viewer or a search would.
+//
+//   show FILE [level] [from_s] [to_s]
+//                  one line per bin: time, min, max, RMS (dBFS), and the
+//                  spectrum as a row of characters, low bands first
+//   find FILE DB [level]
+//                  the stretches where the RMS is at or over DB dBFS
+//   check FILE [minutes]
+//                  write an overview of synthetic audio (noise, with 1 kHz
+//                  bursts) to FILE and check it against the samples: min and
+//                  max exact and RMS within one step at every level, the
+//                  loudest band of a burst holding 1 kHz, a chunk cut short
+//                  ignored; prints the cost per sample and the bytes a day
+//                  takes on disk and to read
+//
+// Both show and find print how many bytes they read.
+//
+// g++ -O2 wave-overview-tool.cc -o wave-overview-tool -lm -std=c++11
+// ./pulseaudio-record-save && ./wave-overview-tool find waveform-pa.overview -30 3
+
+static int failures = 0;
+
+static void expect(bool ok, const char *name, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL %s: %s\n", name, what);
+    failures++;
+  }
+}
+
+static double rms_dbfs(uint16_t rms) {
+  return 20 * log10((rms + 1e-9) / 32768.0);
+}
+
+static int open_or_fail(wave_overview_reader *r, const char *path) {
+  if (wave_overview_open_read(r, path) < 0) {
+    fprintf(stderr, "%s: not an overview\n", path);
+    return -1;
+  }
+  const wave_overview_header &h = r->h;
+  fprintf(stdout, "%s: %.1f s at %u Hz; %u levels of %u to %lu frames per bin, %u bands from level %u\n", path,
+          (double) r->frames / h.rate, h.rate, h.levels, h.base,
+          (unsigned long) wave_overview_bin_frames(&h, h.levels - 1), h.bands, h.spec_level);
+  return 0;
+}
+
+static int show(const char *path, uint32_t level, double from, double to) {
+  wave_overview_reader r;
+  if (open_or_fail(&r, path) < 0)
+    return 1;
+  const wave_overview_header &h = r.h;
+  if (level >= h.levels) level = h.levels - 1;
+  double seconds = (double) wave_overview_bin_frames(&h, level) / h.rate;
+  uint64_t first = (uint64_t) (from / seconds), last = to > 0 ? (uint64_t) ceil(to / seconds) : UINT64_MAX;
+  uint32_t spec = wave_overview_spectrum_bytes(&h, level);
+  static const char ramp[] = " .:-=+*#%@";
+  const size_t batch = 1024;
+  std::vector<wave_overview_bin> bins(batch);
+  std::vector<uint8_t> spectra(batch * spec);
+  for (uint64_t b = first; b < last;) {
+    size_t want = last - b < batch ? (size_t) (last - b) : batch;
+    size_t n = wave_overview_read(&r, level, b, want, bins.data(), spectra.data());
+    if (!n)
+      break;
+    for (size_t i = 0; i < n; i++) {
+      fprintf(stdout, "%10.2f %6d %6d %6.1f ", (b + i) * seconds, bins[i].min, bins[i].max, rms_dbfs(bins[i].rms));
+      /* -90 to -10 dB over the ramp. */
+      for (uint32_t k = 0; k < spec; k++) {
+        int c = (int) ((wave_overview_spectrum_db(spectra[i * spec + k]) + 90) / 8);
+        fputc(ramp[c < 0 ? 0 : c > 9 ? 9 : c], stdout);
+      }
+      fputc('\n', stdout);
+    }
+    b += n;
+  }
+  fprintf(stdout, "read %lu bytes\n", (unsigned long) r.bytes_read);
+  wave_overview_close_read(&r);
+  return 0;
+}
+
+static int find(const char *path, double db, uint32_t level) {
+  wave_overview_reader r;
+  if (open_or_fail(&r, path) < 0)
+    return 1;
+  const wave_overview_header &h = r.h;
+  if (level >= h.levels) level = h.levels - 1;
+  double seconds = (double) wave_overview_bin_frames(&h, level) / h.rate;
+  const size_t batch = 4096;
+  std::vector<wave_overview_bin> bins(batch);
+  bool in = false;
+  double start = 0, loudest = -200;
+  uint64_t b = 0, stretches = 0;
+  for (;;) {
+    size_t n = wave_overview_read(&r, level, b, batch, bins.data(), NULL);
+    for (size_t i = 0; i < n; i++) {
+      double level_db = rms_dbfs(bins[i].rms);
+      if (level_db >= db) {
+        if (!in) start = (b + i) * seconds, loudest = -200;
+        in = true;
+        if (level_db > loudest) loudest = level_db;
+      } else if (in) {
+        fprintf(stdout, "%.1f s to %.1f s, %.1f dBFS RMS at most\n", start, (b + i) * seconds, loudest);
+        stretches++;
+        in = false;
+      }
+    }
+    b += n;
+    if (n < batch)
+      break;
+  }
+  if (in) {
+    fprintf(stdout, "%.1f s to %.1f s, %.1f dBFS RMS at most\n", start, (double) r.frames / h.rate, loudest);
+    stretches++;
+  }
+  fprintf(stdout, "%lu stretches at or over %.1f dBFS; read %lu bytes\n", (unsigned long) stretches, db,
+          (unsigned long) r.bytes_read);
+  wave_overview_close_read(&r);
+  return 0;
+}
+
+#define CHECK_RATE 22050
+
+static int check(const char *path, double minutes) {
+  /* Noise at -50 dBFS; every 2 minutes, 20 s of 1 kHz at -12 dBFS. */
+  uint64_t frames = (uint64_t) (minutes * 60 * CHECK_RATE) + 12345;
+  std::vector<int16_t> x(frames);
+  uint64_t seed = 11;
+  double noise = 32768 * pow(10.0, -50 / 20.0) * sqrt(3.0), tone = 32767 * pow(10.0, -12 / 20.0);
+  for (uint64_t f = 0; f < frames; f++) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    double v = noise * (2.0 * (double) (seed >> 11) / 9007199254740992.0 - 1);
+    double t = (double) f / CHECK_RATE;
+    if (fmod(t, 120) >= 30 && fmod(t, 120) < 50)
+      v += tone * sin(2 * M_PI * 1000 * t);
+    x[f] = (int16_t) lrint(v);
+  }
+
+  wave_overview ov;
+  if (wave_overview_open(&ov, path, CHECK_RATE, NULL) < 0) {
+    perror(path);
+    return 1;
+  }
+  /* As a capture loop would: 0.5 s blocks. */
+  for (uint64_t f = 0; f < frames; f += CHECK_RATE / 2) {
+    uint32_t n = frames - f < CHECK_RATE / 2 ? (uint32_t) (frames - f) : CHECK_RATE / 2;
+    wave_overview_add_s16(&ov, &x[f], n);
+  }
+  wave_overview_close(&ov);
+  wave_overview_print_stats(&ov, stdout);
+
+  wave_overview_reader r;
+  if (open_or_fail(&r, path) < 0)
+    return 1;
+  const wave_overview_header &h = r.h;
+  expect(r.frames == frames, "frames", "the overview does not cover every frame");
+  uint64_t bad_minmax = 0, bad_rms = 0, bursts = 0, bad_band = 0, checked = 0;
+  for (uint32_t level = 0; level < h.levels; level++) {
+    uint64_t per = wave_overview_bin_frames(&h, level), count = wave_overview_level_bins(&r, level);
+    uint32_t spec = wave_overview_spectrum_bytes(&h, level);
+    std::vector<wave_overview_bin> bins(count);
+    std::vector<uint8_t> spectra(count * spec);
+    expect(wave_overview_read(&r, level, 0, count, bins.data(), spectra.data()) == count, "read", "bins missing");
+    for (uint64_t b = 0; b < count; b++) {
+      uint64_t a = b * per, e = a + per < frames ? a + per : frames;
+      int lo = INT16_MAX, hi = INT16_MIN;
+      double sum = 0;
+      for (uint64_t f = a; f < e; f++) {
+        if (x[f] < lo) lo = x[f];
+        if (x[f] > hi) hi = x[f];
+        sum += (double) x[f] * x[f];
+      }
+      double rms = sqrt(sum / (e - a));
+      if (bins[b].min != lo || bins[b].max != hi) bad_minmax++;
+      if (fabs(bins[b].rms - rms) > 0.5 + 1e-9) bad_rms++;
+      checked++;
+      /* A bin well inside a burst: its loudest band has 1 kHz. */
+      double t0 = (double) a / CHECK_RATE, t1 = (double) e / CHECK_RATE;
+      if (spec && fmod(t0, 120) >= 30.1 && fmod(t0, 120) < 50 && fmod(t1, 120) > 30 && fmod(t1, 120) <= 49.9 &&
+          t1 - t0 < 20) {
+        uint32_t best = 0;
+        for (uint32_t k = 1; k < spec; k++)
+          if (spectra[b * spec + k] > spectra[b * spec + best]) best = k;
+        bursts++;
+        if (!(h.band_hz[best] <= 1000 && h.band_hz[best + 1] >= 1000)) bad_band++;
+      }
+    }
+  }
+  printf("check:  %lu bins at %u levels; min/max wrong in %lu, RMS off in %lu; 1 kHz the loudest band in %lu of "
+         "%lu burst bins\n", (unsigned long) checked, h.levels, (unsigned long) bad_minmax, (unsigned long) bad_rms,
+         (unsigned long) (bursts - bad_band), (unsigned long) bursts);
+  expect(bad_minmax == 0, "minmax", "a bin's min or max is wrong");
+  expect(bad_rms == 0, "rms", "a bin's RMS is off");
+  expect(bursts > 0 && bad_band == 0, "spectrum", "a burst's loudest band is not 1 kHz");
+  uint64_t chunks = r.chunks;
+  wave_overview_close_read(&r);
+
+  /* A recording that dies mid-chunk: the cut chunk does not count. */
+  off_t size = (off_t) (sizeof(wave_overview_header) + chunks * h.chunk_bytes - 100);
+  expect(truncate(path, size) == 0, "cut", "cannot truncate");
+  wave_overview_reader cut;
+  wave_overview_open_read(&cut, path);
+  printf("cut:    %lu chunks, %lu frames left of %lu chunks\n", (unsigned long) cut.chunks,
+         (unsigned long) cut.frames, (unsigned long) chunks);
+  expect(cut.chunks == chunks - 1 && cut.frames == (chunks - 1) * h.chunk_frames, "cut",
+         "a cut chunk is read");
+  wave_overview_close_read(&cut);
+
+  /* A day: the disk, and what a 2000-column view of it reads. */
+  double day = 86400.0 * CHECK_RATE, per_day = day / h.chunk_frames * h.chunk_bytes;
+  uint32_t level = 0;
+  while (level + 1 < h.levels && day / wave_overview_bin_frames(&h, level) > 2000) level++;
+  double view = day / h.chunk_frames * wave_overview_chunk_bins(&h, level) *
+                (sizeof(wave_overview_bin) + wave_overview_spectrum_bytes(&h, level));
+  printf("size:   %.1f MB per day at %u Hz (the WAV: %.0f MB); a day's view at level %u reads %.0f kB\n",
+         per_day / 1e6, CHECK_RATE, day * 2 / 1e6, level, view / 1e3);
+  printf("cost:   %.2f ns per sample, %.3f%% of a core at %u Hz\n", (double) ov.busy_ns / frames,
+         100.0 * ov.busy_ns / frames * CHECK_RATE / 1e9, CHECK_RATE);
+  if (failures) {
+    fprintf(stderr, "%d failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 3 && !strcmp(argv[1], "show"))
+    return show(argv[2], argc > 3 ? (uint32_t) atoi(argv[3]) : WAVE_OVERVIEW_MAX_LEVELS,
+                argc > 4 ? atof(argv[4]) : 0, argc > 5 ? atof(argv[5]) : 0);
+  if (argc >= 4 && !strcmp(argv[1], "find"))
+    return find(argv[2], atof(argv[3]), argc > 4 ? (uint32_t) atoi(argv[4]) : 2);
+  if (argc >= 3 && !strcmp(argv[1], "check"))
+    return check(argv[2], argc > 3 ? atof(argv[3]) : 20);
+  fprintf(stderr, "%s show FILE [level] [from_s] [to_s] | find FILE DB [level] | check FILE [minutes]\n", argv[0]);
+  return 1;
+}
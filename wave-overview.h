@@ -0,0 +1,487 @@
+/*
+  Overview sidecar for long recordings: a min/max/RMS pyramid and a coarse
+  log spectrogram, built while the audio is written, so a viewer or a
+  search can cover days of audio by reading kilobytes instead of the WAV.
+
+  Level 0 bins are `base` frames; every level above merges `factor` bins
+  of the one below (by default 512 frames, x8, five levels: 23 ms to
+  95 s at 22050 Hz). A bin is the minimum, maximum and RMS of its
+  samples. From `spec_level` up, a bin also has a spectrum: the mean
+  power of the Hann-windowed FFT frames taken at the end of every
+  `fft_every`th level 0 bin (onset-detector.h's FFT), in `bands`
+  log-spaced bands, one byte each, 0.5 dB steps up from -120 dB relative
+  to a full-scale sine.
+
+  The file is a header, then chunks of the same size, each covering one
+  top-level bin (base * factor^(levels - 1) frames), coarsest level
+  first:
+
+    wave_overview_header          once
+    chunk: uint64 frames          frames in this chunk (less in the last)
+           per level, top first:  wave_overview_bin[bins], then
+                                  uint8 spectrum[bins][bands] from spec_level
+    chunk ...
+
+  so bin i of level L is at a known offset, and a day at 12 s per bin is
+  a few hundred small reads. A chunk is written (and flushed) when it is
+  full, and the last, partial one at close, so a recording that dies
+  loses at most one chunk of overview. The writer's cost is a min, max
+  and sum of squares per sample, plus one small FFT every few level 0
+  bins.
+
+    wave_overview ov;                                  // writing
+    wave_overview_open(&ov, "rec.overview", rate, NULL);   // defaults
+    wave_overview_add_s16(&ov, samples, frames);       // mono, as written
+    wave_overview_close(&ov);
+
+    wave_overview_reader r;                            // reading
+    wave_overview_open_read(&r, "rec.overview");
+    size_t n = wave_overview_read(&r, level, first_bin, count, bins, spectra);
+
+  Everything is little-endian. Linux only, C++11.
+*/
+#ifndef WAVE_OVERVIEW_H_
+#define WAVE_OVERVIEW_H_
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "onset-detector.h"
+
+#define WAVE_OVERVIEW_MAGIC "WAVOVR\0\1"
+#define WAVE_OVERVIEW_VERSION 1
+#define WAVE_OVERVIEW_MAX_LEVELS 8
+#define WAVE_OVERVIEW_MAX_BANDS 64
+#define WAVE_OVERVIEW_FLOOR_DB -120.0f   /* spectrum byte 0; 0.5 dB per step */
+
+struct wave_overview_config {
+  uint32_t base;          /* frames per level 0 bin */
+  uint32_t factor;        /* bins merged per level */
+  uint32_t levels;
+  uint32_t spec_level;    /* the first level with spectra; >= levels for none */
+  uint32_t bands;         /* 0 for no spectrogram */
+  uint32_t fft_size;      /* power of two, at most base */
+  uint32_t fft_every;     /* level 0 bins per FFT frame */
+  float low_hz;           /* the first band's lower edge; the last ends at rate / 2 */
+};
+
+struct wave_overview_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t rate;
+  uint32_t base, factor, levels, spec_level, bands, fft_size;
+  uint32_t chunk_bytes;
+  uint32_t fft_every;
+  uint64_t chunk_frames;
+  int64_t start_realtime_ns;
+  float band_hz[WAVE_OVERVIEW_MAX_BANDS + 1];   /* band edges */
+  uint32_t reserved2;
+};
+
+struct wave_overview_bin {
+  int16_t min, max;
+  uint16_t rms;
+};
+
+static inline void wave_overview_default_config(wave_overview_config *c) {
+  c->base = 512;
+  c->factor = 8;
+  c->levels = 5;
+  c->spec_level = 2;
+  c->bands = 32;
+  c->fft_size = 512;
+  c->fft_every = 4;
+  c->low_hz = 50;
+}
+
+/* Layout. */
+
+static inline uint64_t wave_overview_bin_frames(const wave_overview_header *h, uint32_t level) {
+  uint64_t f = h->base;
+  for (uint32_t i = 0; i < level; i++) f *= h->factor;
+  return f;
+}
+
+static inline uint32_t wave_overview_chunk_bins(const wave_overview_header *h, uint32_t level) {
+  return (uint32_t) (h->chunk_frames / wave_overview_bin_frames(h, level));
+}
+
+static inline uint32_t wave_overview_spectrum_bytes(const wave_overview_header *h, uint32_t level) {
+  return level >= h->spec_level ? h->bands : 0;
+}
+
+/* Bytes of a chunk with this layout; 0 when the levels do not fit a
+   chunk of at most 1 GB (or chunk_frames is not the top level's bin). */
+static inline uint32_t wave_overview_layout_bytes(const wave_overview_header *h) {
+  uint64_t f = h->base;
+  for (uint32_t l = 1; l < h->levels; l++) {
+    if (f > (1ull << 40) / h->factor)
+      return 0;
+    f *= h->factor;
+  }
+  if (h->chunk_frames != f)
+    return 0;
+  uint64_t bytes = 8;
+  for (uint32_t l = 0; l < h->levels; l++)
+    bytes += (uint64_t) wave_overview_chunk_bins(h, l) *
+             (sizeof(wave_overview_bin) + wave_overview_spectrum_bytes(h, l));
+  return bytes > (1u << 30) ? 0 : (uint32_t) bytes;
+}
+
+/* Where a level's bins start in a chunk; its spectra follow them. */
+static inline uint32_t wave_overview_level_offset(const wave_overview_header *h, uint32_t level) {
+  uint32_t at = 8;
+  for (uint32_t l = h->levels - 1; l > level; l--)
+    at += wave_overview_chunk_bins(h, l) * ((uint32_t) sizeof(wave_overview_bin) + wave_overview_spectrum_bytes(h, l));
+  return at;
+}
+
+/* Writing. */
+
+struct wave_overview_acc {
+  int16_t min, max;
+  uint64_t sumsq;
+  uint64_t frames;
+  uint32_t columns;                       /* FFT frames in power */
+  float power[WAVE_OVERVIEW_MAX_BANDS];
+  uint32_t bins;                          /* written in this chunk */
+};
+
+struct wave_overview {
+  FILE *file;
+  wave_overview_header h;
+  std::vector<uint8_t> chunk;
+  wave_overview_acc acc[WAVE_OVERVIEW_MAX_LEVELS];
+  uint64_t chunk_pos;                     /* frames into the chunk */
+  onset_detector fft;                     /* only its FFT */
+  std::vector<int16_t> ring;              /* the last fft_size samples */
+  uint32_t ring_pos;
+  uint64_t level0_bins;
+  uint32_t band_bin[WAVE_OVERVIEW_MAX_BANDS + 1];   /* FFT bin edges */
+  uint64_t frames, chunks;
+  int64_t busy_ns;
+};
+
+static inline int64_t wave_overview_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void wave_overview_reset_acc(wave_overview_acc *a) {
+  uint32_t bins = a->bins;
+  memset(a, 0, sizeof(*a));
+  a->min = INT16_MAX;
+  a->max = INT16_MIN;
+  a->bins = bins;
+}
+
+/* cfg NULL for the defaults. -1 when the file cannot be written or the
+   configuration makes no sense. */
+static inline int wave_overview_open(wave_overview *ov, const char *path, uint32_t rate,
+                                     const wave_overview_config *cfg) {
+  wave_overview_config c;
+  if (cfg) c = *cfg;
+  else wave_overview_default_config(&c);
+  ov->file = NULL;
+  if (!rate || !c.base || c.factor < 2 || !c.levels || c.levels > WAVE_OVERVIEW_MAX_LEVELS ||
+      c.bands > WAVE_OVERVIEW_MAX_BANDS || (c.bands && (c.fft_size > c.base || !c.fft_every ||
+                                                        c.low_hz <= 0 || c.low_hz >= rate / 2.0f)))
+    return -1;
+  wave_overview_header *h = &ov->h;
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, WAVE_OVERVIEW_MAGIC, sizeof(h->magic));
+  h->version = WAVE_OVERVIEW_VERSION;
+  h->rate = rate;
+  h->base = c.base;
+  h->factor = c.factor;
+  h->levels = c.levels;
+  h->bands = c.bands;
+  h->spec_level = c.bands && c.spec_level < c.levels ? c.spec_level : c.levels;
+  h->fft_size = c.bands ? c.fft_size : 0;
+  h->fft_every = c.bands ? c.fft_every : 0;
+  h->chunk_frames = wave_overview_bin_frames(h, h->levels - 1);
+  if (!(h->chunk_bytes = wave_overview_layout_bytes(h)))
+    return -1;
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  h->start_realtime_ns = (int64_t) real.tv_sec * 1000000000LL + real.tv_nsec;
+
+  if (h->bands) {
+    onset_config oc;
+    onset_default_config(&oc, rate, 1);
+    oc.fft_size = c.fft_size;
+    oc.hop = c.fft_size;
+    if (!onset_detector_init(&ov->fft, &oc))
+      return -1;
+    /* Log-spaced edges, each band at least one FFT bin wide. */
+    uint32_t half = c.fft_size / 2;
+    for (uint32_t b = 0; b <= h->bands; b++) {
+      h->band_hz[b] = (float) (c.low_hz * pow(rate / 2.0 / c.low_hz, (double) b / h->bands));
+      uint32_t k = (uint32_t) lround(h->band_hz[b] * c.fft_size / rate);
+      if (b && k <= ov->band_bin[b - 1]) k = ov->band_bin[b - 1] + 1;
+      ov->band_bin[b] = k < half + 1 ? k : half + 1;
+    }
+    ov->ring.assign(c.fft_size, 0);
+  }
+  ov->ring_pos = 0;
+  ov->level0_bins = 0;
+  ov->chunk.assign(h->chunk_bytes, 0);
+  for (uint32_t l = 0; l < h->levels; l++) {
+    ov->acc[l].bins = 0;
+    wave_overview_reset_acc(&ov->acc[l]);
+  }
+  ov->chunk_pos = ov->frames = ov->chunks = 0;
+  ov->busy_ns = 0;
+
+  if (!(ov->file = fopen(path, "wb")))
+    return -1;
+  if (fwrite(h, sizeof(*h), 1, ov->file) != 1 || fflush(ov->file) != 0) {
+    fclose(ov->file);
+    ov->file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/* Band powers of the last fft_size samples into level 0. */
+static inline void wave_overview_spectrum(wave_overview *ov) {
+  onset_detector *d = &ov->fft;
+  uint32_t n = d->n;
+  /* Oldest first: from ring_pos to the end, then from the start. */
+  const int16_t *ring = ov->ring.data();
+  uint32_t tail = n - ov->ring_pos;
+  for (uint32_t i = 0; i < tail; i++)
+    d->frame[i] = d->window[i] * (ring[ov->ring_pos + i] * (1.0f / 32768));
+  for (uint32_t i = tail; i < n; i++)
+    d->frame[i] = d->window[i] * (ring[i - tail] * (1.0f / 32768));
+  onset_fft(d);
+  wave_overview_acc *a = &ov->acc[0];
+  for (uint32_t b = 0; b < ov->h.bands; b++) {
+    float p = 0;
+    for (uint32_t k = ov->band_bin[b]; k < ov->band_bin[b + 1]; k++)
+      p += d->power[k];
+    /* Relative to a full-scale sine's mean square, 0.5. */
+    a->power[b] += p * d->power_scale / 0.5f;
+  }
+  a->columns++;
+}
+
+static inline void wave_overview_write_chunk(wave_overview *ov) {
+  memcpy(&ov->chunk[0], &ov->chunk_pos, 8);
+  if (ov->file) {
+    fwrite(&ov->chunk[0], ov->h.chunk_bytes, 1, ov->file);
+    fflush(ov->file);
+  }
+  ov->chunks++;
+  ov->chunk_pos = 0;
+  memset(&ov->chunk[0], 0, ov->chunk.size());
+  for (uint32_t l = 0; l < ov->h.levels; l++)
+    ov->acc[l].bins = 0;
+}
+
+/* Level `level`'s bin is complete (or the recording ends): store it, fold
+   it into the level above. */
+static inline void wave_overview_emit(wave_overview *ov, uint32_t level) {
+  const wave_overview_header *h = &ov->h;
+  wave_overview_acc *a = &ov->acc[level];
+  wave_overview_bin bin;
+  bin.min = a->frames ? a->min : 0;
+  bin.max = a->frames ? a->max : 0;
+  double rms = a->frames ? sqrt((double) a->sumsq / a->frames) : 0;
+  bin.rms = (uint16_t) (rms > 65535 ? 65535 : rms + 0.5);
+  uint32_t i = a->bins++;
+  uint8_t *base = &ov->chunk[wave_overview_level_offset(h, level)];
+  memcpy(base + (size_t) i * sizeof(bin), &bin, sizeof(bin));
+  if (level >= h->spec_level) {
+    uint8_t *s = base + (size_t) wave_overview_chunk_bins(h, level) * sizeof(bin) + (size_t) i * h->bands;
+    for (uint32_t b = 0; b < h->bands; b++) {
+      float db = a->columns ? 10 * log10f(a->power[b] / a->columns + 1e-30f) : WAVE_OVERVIEW_FLOOR_DB;
+      float v = (db - WAVE_OVERVIEW_FLOOR_DB) * 2;
+      s[b] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v + 0.5f);
+    }
+  }
+  if (level + 1 < h->levels) {
+    wave_overview_acc *up = &ov->acc[level + 1];
+    if (a->frames) {
+      if (a->min < up->min) up->min = a->min;
+      if (a->max > up->max) up->max = a->max;
+    }
+    up->sumsq += a->sumsq;
+    up->frames += a->frames;
+    up->columns += a->columns;
+    for (uint32_t b = 0; b < h->bands; b++)
+      up->power[b] += a->power[b];
+  }
+  wave_overview_reset_acc(a);
+  if (level + 1 == h->levels)
+    wave_overview_write_chunk(ov);
+  else if (a->bins % h->factor == 0)
+    wave_overview_emit(ov, level + 1);
+}
+
+/* Mono samples, in the order they are written. */
+static inline void wave_overview_add_s16(wave_overview *ov, const int16_t *x, uint32_t frames) {
+  int64_t t = wave_overview_monotonic_ns();
+  const wave_overview_header *h = &ov->h;
+  wave_overview_acc *a = &ov->acc[0];
+  while (frames) {
+    uint32_t n = (uint32_t) (h->base - a->frames);
+    if (n > frames) n = frames;
+    int32_t lo = a->min, hi = a->max;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      int32_t v = x[i];
+      lo = v < lo ? v : lo;
+      hi = v > hi ? v : hi;
+      sum += (uint64_t) (v * v);
+    }
+    a->min = (int16_t) lo;
+    a->max = (int16_t) hi;
+    a->sumsq += sum;
+    a->frames += n;
+    /* Only what the next FFT frame needs. */
+    uint32_t fft_at = h->bands && (ov->level0_bins + 1) % h->fft_every == 0 ? h->fft_size : 0;
+    if (fft_at) {
+      for (uint32_t i = n > fft_at ? n - fft_at : 0; i < n; i++) {
+        ov->ring[ov->ring_pos] = x[i];
+        ov->ring_pos = ov->ring_pos + 1 == h->fft_size ? 0 : ov->ring_pos + 1;
+      }
+    }
+    x += n;
+    frames -= n;
+    ov->frames += n;
+    ov->chunk_pos += n;
+    if (a->frames == h->base) {
+      if (fft_at)
+        wave_overview_spectrum(ov);
+      ov->level0_bins++;
+      wave_overview_emit(ov, 0);
+    }
+  }
+  ov->busy_ns += wave_overview_monotonic_ns() - t;
+}
+
+/* Writes what is left as a last, partial chunk. */
+static inline void wave_overview_close(wave_overview *ov) {
+  if (ov->chunk_pos) {
+    /* Each partial bin, bottom up, into the one above; a partial level 0
+       bin has no FFT frame. */
+    for (uint32_t l = 0; l < ov->h.levels && ov->chunk_pos; l++)
+      if (ov->acc[l].frames || l + 1 == ov->h.levels)
+        wave_overview_emit(ov, l);
+  }
+  if (ov->file)
+    fclose(ov->file);
+  ov->file = NULL;
+}
+
+static inline void wave_overview_print_stats(const wave_overview *ov, FILE *out) {
+  uint64_t bytes = sizeof(wave_overview_header) + ov->chunks * ov->h.chunk_bytes;
+  fprintf(out, "overview: %u levels (%u to %lu frames per bin), %u bands from level %u; %lu chunks, %lu bytes, "
+          "%.1f ns per sample\n", ov->h.levels, ov->h.base,
+          (unsigned long) wave_overview_bin_frames(&ov->h, ov->h.levels - 1), ov->h.bands, ov->h.spec_level,
+          (unsigned long) ov->chunks, (unsigned long) bytes,
+          ov->frames ? (double) ov->busy_ns / ov->frames : 0.0);
+}
+
+/* Reading. */
+
+struct wave_overview_reader {
+  int fd;
+  wave_overview_header h;
+  uint64_t chunks;        /* including a partial last one */
+  uint64_t frames;
+  uint64_t bytes_read;
+};
+
+/* -1 when it cannot be read, is not an overview, or its header does not
+   describe a layout the writer could have made. */
+static inline int wave_overview_open_read(wave_overview_reader *r, const char *path) {
+  memset(r, 0, sizeof(*r));
+  if ((r->fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  struct stat st;
+  if (pread(r->fd, &r->h, sizeof(r->h), 0) != (ssize_t) sizeof(r->h) ||
+      memcmp(r->h.magic, WAVE_OVERVIEW_MAGIC, sizeof(r->h.magic)) || r->h.version != WAVE_OVERVIEW_VERSION ||
+      !r->h.rate || !r->h.base || r->h.factor < 2 || !r->h.levels || r->h.levels > WAVE_OVERVIEW_MAX_LEVELS ||
+      r->h.bands > WAVE_OVERVIEW_MAX_BANDS || r->h.spec_level > r->h.levels ||
+      (!r->h.bands && r->h.spec_level != r->h.levels) || !r->h.chunk_bytes ||
+      wave_overview_layout_bytes(&r->h) != r->h.chunk_bytes || fstat(r->fd, &st) < 0) {
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+  }
+  r->bytes_read = sizeof(r->h);
+  /* A chunk cut short by a crash does not count. */
+  r->chunks = ((uint64_t) st.st_size - sizeof(r->h)) / r->h.chunk_bytes;
+  if (r->chunks) {
+    uint64_t last = 0;
+    if (pread(r->fd, &last, 8, sizeof(r->h) + (r->chunks - 1) * r->h.chunk_bytes) != 8)
+      last = 0;
+    r->bytes_read += 8;
+    r->frames = (r->chunks - 1) * r->h.chunk_frames + last;
+  }
+  return 0;
+}
+
+static inline uint64_t wave_overview_level_bins(const wave_overview_reader *r, uint32_t level) {
+  uint64_t f = wave_overview_bin_frames(&r->h, level);
+  return (r->frames + f - 1) / f;
+}
+
+/* Up to `count` bins of `level` from bin `first`, and their spectra
+   (bands bytes each) when `spectra` is not NULL and the level has them.
+   Returns the bins read. */
+static inline size_t wave_overview_read(wave_overview_reader *r, uint32_t level, uint64_t first, size_t count,
+                                        wave_overview_bin *bins, uint8_t *spectra) {
+  const wave_overview_header *h = &r->h;
+  if (level >= h->levels)
+    return 0;
+  uint64_t total = wave_overview_level_bins(r, level);
+  if (first >= total)
+    return 0;
+  if (count > total - first) count = (size_t) (total - first);
+  uint32_t per = wave_overview_chunk_bins(h, level), spec = wave_overview_spectrum_bytes(h, level);
+  uint32_t offset = wave_overview_level_offset(h, level);
+  size_t done = 0;
+  while (done < count) {
+    uint64_t b = first + done, chunk = b / per;
+    uint32_t i = (uint32_t) (b % per), n = per - i;
+    if (n > count - done) n = (uint32_t) (count - done);
+    off_t at = (off_t) (sizeof(*h) + chunk * h->chunk_bytes + offset);
+    ssize_t want = (ssize_t) (n * sizeof(wave_overview_bin));
+    if (pread(r->fd, bins + done, want, at + i * sizeof(wave_overview_bin)) != want)
+      break;
+    r->bytes_read += want;
+    if (spectra && spec) {
+      want = (ssize_t) n * spec;
+      if (pread(r->fd, spectra + done * spec, want, at + (off_t) per * sizeof(wave_overview_bin) + (off_t) i * spec) !=
+          want)
+        break;
+      r->bytes_read += want;
+    }
+    done += n;
+  }
+  return done;
+}
+
+static inline float wave_overview_spectrum_db(uint8_t v) {
+  return WAVE_OVERVIEW_FLOOR_DB + v * 0.5f;
+}
+
+static inline void wave_overview_close_read(wave_overview_reader *r) {
+  if (r->fd >= 0)
+    close(r->fd);
+  r->fd = -1;
+}
+
+#endif  // WAVE_OVERVIEW_H_
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "work-pool.h"
+
+// Wake-ups and overhead of work-pool.h.
+//
+//   burst    a pool left idle long enough for every worker to sleep gets
+//            2 x threads jobs of SPIN_MS each from outside: every worker
+//            must run at least one (a push wakes a different sleeper
+//            each time), over ROUNDS rounds
+//   spawn    a binary tree of tiny items spawned from inside run():
+//            ns per item, and how many were stolen
+//
+// g++ -O2 work-pool-bench.cc -o work-pool-bench -lm -std=c++11 -lpthread
+// ./work-pool-bench [threads]      (4 by default)
+
+#define ROUNDS 20
+#define IDLE_MS 100
+#define SPIN_MS 20
+#define SPAWN_DEPTH 20
+
+static int failures = 0;
+
+static void expect(bool ok, const char *name, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL %s: %s\n", name, what);
+    failures++;
+  }
+}
+
+struct spin_job {
+  work_item item;
+  std::atomic<int> *ran_by;   /* jobs per worker */
+};
+
+static void run_spin(work_item *w, int worker) {
+  spin_job *j = (spin_job*) w;
+  int64_t until = work_pool_now_ns() + (int64_t) SPIN_MS * 1000000;
+  while (work_pool_now_ns() < until) {}
+  j->ran_by[worker].fetch_add(1);
+}
+
+static void check_burst(int threads) {
+  work_pool pool;
+  work_pool_start(&pool, threads);
+  std::vector<std::atomic<int>> ran_by(threads);
+  std::vector<spin_job> jobs(2 * threads);
+  int all_ran = 0, fewest = threads;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < threads; i++) ran_by[i].store(0);
+    usleep(IDLE_MS * 1000);
+    for (size_t i = 0; i < jobs.size(); i++) {
+      jobs[i].item.run = run_spin;
+      jobs[i].ran_by = ran_by.data();
+      work_pool_submit(&pool, &jobs[i].item);
+    }
+    work_pool_wait(&pool);
+    int workers = 0;
+    for (int i = 0; i < threads; i++)
+      if (ran_by[i].load()) workers++;
+    if (workers == threads) all_ran++;
+    if (workers < fewest) fewest = workers;
+  }
+  work_pool_stop(&pool);
+  printf("burst:  %d jobs into an idle pool of %d: every worker ran one in %d of %d rounds (%d at least)\n",
+         2 * threads, threads, all_ran, ROUNDS, fewest);
+  expect(all_ran == ROUNDS, "burst", "a sleeping worker was not woken for a burst");
+}
+
+struct tree_job {
+  work_item item;
+  work_pool *pool;
+  int depth;
+};
+
+static std::vector<tree_job> tree;
+
+static void run_tree(work_item *w, int worker) {
+  tree_job *j = (tree_job*) w;
+  if (!j->depth)
+    return;
+  /* Children of node i are 2i + 1 and 2i + 2. */
+  size_t i = j - tree.data();
+  for (size_t c = 2 * i + 1; c <= 2 * i + 2; c++) {
+    tree[c].item.run = run_tree;
+    tree[c].pool = j->pool;
+    tree[c].depth = j->depth - 1;
+    work_pool_spawn(j->pool, worker, &tree[c].item);
+  }
+}
+
+static void check_spawn(int threads) {
+  work_pool pool;
+  work_pool_start(&pool, threads);
+  size_t items = ((size_t) 1 << (SPAWN_DEPTH + 1)) - 1;
+  tree.assign(items, tree_job());
+  tree[0].item.run = run_tree;
+  tree[0].pool = &pool;
+  tree[0].depth = SPAWN_DEPTH;
+  int64_t t = work_pool_now_ns();
+  work_pool_submit(&pool, &tree[0].item);
+  work_pool_wait(&pool);
+  double ns = (double) (work_pool_now_ns() - t);
+  uint64_t ran = 0, stolen = 0;
+  for (int i = 0; i < threads; i++) {
+    ran += pool.deques[i]->ran + pool.deques[i]->inline_runs;
+    stolen += pool.deques[i]->stolen;
+  }
+  work_pool_stop(&pool);
+  printf("spawn:  %lu items, %.1f ns each, %lu stolen\n", (unsigned long) ran, ns / items, (unsigned long) stolen);
+  expect(ran == items, "spawn", "items lost or run twice");
+}
+
+int main(int argc, char *argv[]) {
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  if (threads < 1) threads = 1;
+  check_burst(threads);
+  check_spawn(threads);
+  if (failures) {
+    fprintf(stderr, "%d failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
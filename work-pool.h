@@ -0,0 +1,347 @@
+/*
+  A work-stealing thread pool for batch DSP: every worker has its own
+  deque of work items, runs the newest of its own first (what it just
+  split off is still in cache) and, when it has none, steals the oldest
+  from another worker (the biggest pieces are split first, so what is
+  stolen is worth moving).
+
+  The deques are Chase-Lev deques (Le, Pop, Cohen, Zappa Nardelli, "Correct
+  and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013): the
+  owner pushes and pops at the bottom without a lock, thieves take from
+  the top with one compare-and-swap, and only the last item is contended.
+  They have a fixed capacity; a push that does not fit runs the item at
+  once instead. Work from outside the pool goes to a shared injection
+  list, which workers take from before they steal, or to one worker's
+  inbox (work_pool_submit_to), for work that should run where its data
+  is warm: the owner takes from its inbox before anything else, and
+  others only take from it when they would otherwise steal.
+
+  Items are intrusive: embed a work_item in whatever describes the work
+  and recover it in run().
+
+    struct job { work_item item; ... };
+    static void run_job(work_item *w, int worker) { job *j = (job*) w; ... }
+
+    work_pool pool;
+    work_pool_start(&pool, threads);
+    j->item.run = run_job;
+    work_pool_submit(&pool, &j->item);       // any thread outside the pool
+    work_pool_submit_to(&pool, k, &j->item); // the same, preferring worker k
+    work_pool_spawn(&pool, worker, &item);   // a worker, from inside run()
+    work_pool_wait(&pool);                   // until everything submitted has run
+    work_pool_stop(&pool);
+
+  Idle workers sleep, each on its own condition variable; a push wakes
+  one only when someone sleeps, and a push to an inbox wakes its owner.
+  Linux only, C++11.
+*/
+#ifndef WORK_POOL_H_
+#define WORK_POOL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define WORK_DEQUE_SLOTS 4096   /* per worker, a power of two */
+
+struct work_item {
+  void (*run)(work_item *self, int worker);
+  work_item *next;   /* injection list */
+};
+
+struct work_deque {
+  std::atomic<int64_t> top;
+  char pad0[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom;
+  char pad1[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<work_item*> slot[WORK_DEQUE_SLOTS];
+  /* Inbox: work submitted for this worker from outside the pool. */
+  std::mutex inbox_lock;
+  work_item *inbox_head, *inbox_tail;
+  std::atomic<uint32_t> inbox_count;
+  /* Under the pool's sleep_lock. */
+  std::condition_variable wake;
+  bool asleep;
+  /* Owner only. */
+  uint64_t ran, stolen, steal_misses, inline_runs, from_inbox;
+  int64_t idle_ns;
+  uint32_t victim_seed;
+};
+
+struct work_pool {
+  int threads;
+  std::vector<work_deque*> deques;
+  std::vector<std::thread> workers;
+  /* Injection list: work from outside the pool. */
+  std::mutex inject_lock;
+  work_item *inject_head, *inject_tail;
+  /* Sleeping: a push bumps the epoch, and wakes a worker when anyone
+     sleeps. */
+  std::mutex sleep_lock;
+  std::atomic<uint64_t> epoch;
+  std::atomic<int> sleepers;
+  /* Done waiting. */
+  std::atomic<int64_t> pending;
+  std::condition_variable idle;
+  std::atomic<bool> stop;
+};
+
+static inline int64_t work_pool_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Owner: false when full. */
+static inline bool work_deque_push(work_deque *d, work_item *w) {
+  int64_t b = d->bottom.load(std::memory_order_relaxed);
+  int64_t t = d->top.load(std::memory_order_acquire);
+  if (b - t >= WORK_DEQUE_SLOTS)
+    return false;
+  d->slot[b & (WORK_DEQUE_SLOTS - 1)].store(w, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  d->bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+/* Owner: the newest item, or NULL. */
+static inline work_item *work_deque_pop(work_deque *d) {
+  int64_t b = d->bottom.load(std::memory_order_relaxed) - 1;
+  d->bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = d->top.load(std::memory_order_relaxed);
+  if (t > b) {
+    d->bottom.store(b + 1, std::memory_order_relaxed);
+    return NULL;
+  }
+  work_item *w = d->slot[b & (WORK_DEQUE_SLOTS - 1)].load(std::memory_order_relaxed);
+  if (t == b) {
+    /* The last one: race the thieves for it. */
+    if (!d->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      w = NULL;
+    d->bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return w;
+}
+
+/* Any thread: the oldest item, or NULL (empty, or lost a race). */
+static inline work_item *work_deque_steal(work_deque *d) {
+  int64_t t = d->top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = d->bottom.load(std::memory_order_acquire);
+  if (t >= b)
+    return NULL;
+  work_item *w = d->slot[t & (WORK_DEQUE_SLOTS - 1)].load(std::memory_order_relaxed);
+  if (!d->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return NULL;
+  return w;
+}
+
+/* Wakes `worker` if it sleeps, or (worker < 0, or no such sleeper) any
+   sleeping worker. The woken one is marked awake here, not when it gets
+   the lock back, so a burst of pushes wakes a different sleeper each. */
+static inline void work_pool_notify_worker(work_pool *p, int worker) {
+  p->epoch.fetch_add(1, std::memory_order_seq_cst);
+  if (p->sleepers.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard<std::mutex> hold(p->sleep_lock);
+    work_deque *d = NULL;
+    if (worker >= 0 && p->deques[worker]->asleep)
+      d = p->deques[worker];
+    for (int i = 0; !d && i < p->threads; i++)
+      if (p->deques[i]->asleep)
+        d = p->deques[i];
+    if (d) {
+      d->asleep = false;
+      d->wake.notify_one();
+    }
+  }
+}
+
+static inline void work_pool_notify(work_pool *p) {
+  work_pool_notify_worker(p, -1);
+}
+
+static inline void work_pool_done(work_pool *p) {
+  if (p->pending.fetch_sub(1) == 1) {
+    std::lock_guard<std::mutex> hold(p->sleep_lock);
+    p->idle.notify_all();
+  }
+}
+
+/* A worker, inside run(): more work, for this worker or a thief. */
+static inline void work_pool_spawn(work_pool *p, int worker, work_item *w) {
+  p->pending.fetch_add(1);
+  work_deque *d = p->deques[worker];
+  if (!work_deque_push(d, w)) {
+    d->inline_runs++;
+    w->run(w, worker);
+    work_pool_done(p);
+    return;
+  }
+  work_pool_notify(p);
+}
+
+/* Outside the pool. */
+static inline void work_pool_submit(work_pool *p, work_item *w) {
+  p->pending.fetch_add(1);
+  w->next = NULL;
+  {
+    std::lock_guard<std::mutex> hold(p->inject_lock);
+    if (p->inject_tail) p->inject_tail->next = w;
+    else p->inject_head = w;
+    p->inject_tail = w;
+  }
+  work_pool_notify(p);
+}
+
+/* Outside the pool: for `worker`, or whoever is idle when it is busy. */
+static inline void work_pool_submit_to(work_pool *p, int worker, work_item *w) {
+  work_deque *d = p->deques[(unsigned) worker % p->threads];
+  p->pending.fetch_add(1);
+  w->next = NULL;
+  uint32_t queued;
+  {
+    std::lock_guard<std::mutex> hold(d->inbox_lock);
+    if (d->inbox_tail) d->inbox_tail->next = w;
+    else d->inbox_head = w;
+    d->inbox_tail = w;
+    queued = d->inbox_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+  /* The owner first; with a backlog, someone to share it too. */
+  work_pool_notify_worker(p, (int) ((unsigned) worker % p->threads));
+  if (queued > 1)
+    work_pool_notify(p);
+}
+
+static inline work_item *work_pool_take_inbox(work_deque *d) {
+  if (!d->inbox_count.load(std::memory_order_relaxed))
+    return NULL;
+  std::lock_guard<std::mutex> hold(d->inbox_lock);
+  work_item *w = d->inbox_head;
+  if (w) {
+    d->inbox_head = w->next;
+    if (!d->inbox_head) d->inbox_tail = NULL;
+    d->inbox_count.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return w;
+}
+
+static inline work_item *work_pool_take_injected(work_pool *p) {
+  std::lock_guard<std::mutex> hold(p->inject_lock);
+  work_item *w = p->inject_head;
+  if (w) {
+    p->inject_head = w->next;
+    if (!p->inject_head) p->inject_tail = NULL;
+  }
+  return w;
+}
+
+/* Own inbox and deque, then the injection list, then every other worker
+   once (deque, then inbox), starting from a random one. */
+static inline work_item *work_pool_find(work_pool *p, int worker) {
+  work_deque *d = p->deques[worker];
+  work_item *w = work_pool_take_inbox(d);
+  if (w) {
+    d->from_inbox++;
+    return w;
+  }
+  if ((w = work_deque_pop(d))) return w;
+  if ((w = work_pool_take_injected(p))) return w;
+  d->victim_seed = d->victim_seed * 1664525u + 1013904223u;
+  int first = (int) ((d->victim_seed >> 8) % p->threads);
+  for (int i = 0; i < p->threads; i++) {
+    int v = (first + i) % p->threads;
+    if (v == worker) continue;
+    if ((w = work_deque_steal(p->deques[v])) || (w = work_pool_take_inbox(p->deques[v]))) {
+      d->stolen++;
+      return w;
+    }
+  }
+  d->steal_misses++;
+  return NULL;
+}
+
+static inline void work_pool_worker(work_pool *p, int worker) {
+  work_deque *d = p->deques[worker];
+  while (!p->stop.load(std::memory_order_relaxed)) {
+    uint64_t epoch = p->epoch.load(std::memory_order_seq_cst);
+    work_item *w = work_pool_find(p, worker);
+    if (w) {
+      d->ran++;
+      w->run(w, worker);
+      work_pool_done(p);
+      continue;
+    }
+    int64_t t = work_pool_now_ns();
+    std::unique_lock<std::mutex> hold(p->sleep_lock);
+    d->asleep = true;
+    p->sleepers.fetch_add(1, std::memory_order_seq_cst);
+    while (p->epoch.load(std::memory_order_seq_cst) == epoch && !p->stop.load())
+      d->wake.wait(hold);
+    p->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+    d->asleep = false;
+    d->idle_ns += work_pool_now_ns() - t;
+  }
+}
+
+static inline void work_pool_start(work_pool *p, int threads) {
+  p->threads = threads < 1 ? 1 : threads;
+  p->inject_head = p->inject_tail = NULL;
+  p->epoch.store(0);
+  p->sleepers.store(0);
+  p->pending.store(0);
+  p->stop.store(false);
+  for (int i = 0; i < p->threads; i++) {
+    work_deque *d = new work_deque;
+    d->top.store(0);
+    d->bottom.store(0);
+    d->inbox_head = d->inbox_tail = NULL;
+    d->inbox_count.store(0);
+    d->asleep = false;
+    d->ran = d->stolen = d->steal_misses = d->inline_runs = d->from_inbox = 0;
+    d->idle_ns = 0;
+    d->victim_seed = 0x9e3779b9u * (i + 1);
+    p->deques.push_back(d);
+  }
+  for (int i = 0; i < p->threads; i++)
+    p->workers.push_back(std::thread(work_pool_worker, p, i));
+}
+
+/* Until every item submitted or spawned so far has run. */
+static inline void work_pool_wait(work_pool *p) {
+  std::unique_lock<std::mutex> hold(p->sleep_lock);
+  while (p->pending.load() > 0)
+    p->idle.wait(hold);
+}
+
+static inline void work_pool_stop(work_pool *p) {
+  {
+    std::lock_guard<std::mutex> hold(p->sleep_lock);
+    p->stop.store(true);
+    for (size_t i = 0; i < p->deques.size(); i++)
+      p->deques[i]->wake.notify_all();
+  }
+  for (size_t i = 0; i < p->workers.size(); i++)
+    p->workers[i].join();
+  for (size_t i = 0; i < p->deques.size(); i++)
+    delete p->deques[i];
+  p->workers.clear();
+  p->deques.clear();
+}
+
+/* After work_pool_wait(). */
+static inline void work_pool_print_stats(const work_pool *p, FILE *out) {
+  for (int i = 0; i < p->threads; i++) {
+    const work_deque *d = p->deques[i];
+    fprintf(out, "worker %d: ran %lu (stolen %lu, from its inbox %lu), %lu empty steal rounds, %lu run inline, "
+            "idle %.3f s\n", i, (unsigned long) d->ran, (unsigned long) d->stolen, (unsigned long) d->from_inbox,
+            (unsigned long) d->steal_misses, (unsigned long) d->inline_runs, d->idle_ns / 1e9);
+  }
+}
+
+#endif  // WORK_POOL_H_